@@ -0,0 +1,300 @@
+/**
+    @file arena.c
+    @author Sachi Vyas (smvyas)
+    A program that: Hands out small blocks from large slabs so a map can allocate nodes and
+    values without a malloc each time, and free all of them with one pass over the slabs.
+ */
+#define _DEFAULT_SOURCE
+#include "arena.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/** Size and alignment of every slab.  A block's slab is found by rounding its address down. */
+#define SLAB_SIZE ( 64 * 1024 )
+/** Blocks are rounded up to a multiple of this, which is also their alignment. */
+#define GRANULE 16
+/** Number of small size classes, one per GRANULE. */
+#define SMALL_CLASSES 16
+/** Largest block in a small size class. */
+#define MAX_SMALL ( GRANULE * SMALL_CLASSES )
+/** MAX_SMALL is 2 to this power */
+#define SMALL_POWER 8
+/** Bits above the highest set bit that pick a medium size class, splitting each power of
+    two into 4 classes so a block is never rounded up by more than a quarter */
+#define MEDIUM_STEP_BITS 2
+/** Powers of two past MAX_SMALL that are split into medium size classes */
+#define MEDIUM_POWERS 5
+/** Number of size classes; larger requests get a slab of their own. */
+#define NUM_CLASSES ( SMALL_CLASSES + ( MEDIUM_POWERS << MEDIUM_STEP_BITS ) )
+/** Largest block served from a shared slab, an eighth of one so little of it is lost. */
+#define MAX_MEDIUM ( MAX_SMALL << MEDIUM_POWERS )
+/** Bytes reserved at the front of each slab for its header, keeping blocks aligned. */
+#define HEADER_SIZE 64
+
+/** Header at the start of every slab. */
+typedef struct SlabStruct {
+  /** Arena that owns this slab. */
+  Arena *arena;
+
+  /** Size class of the blocks in this slab, or -1 if it holds one large block. */
+  int sizeClass;
+
+  /** Bytes mapped for a slab holding one large block, including its header. */
+  size_t mapped;
+
+  /** Next slab in the arena's list. */
+  struct SlabStruct *next;
+
+  /** Previous slab in the arena's list, so large slabs can be unlinked when released. */
+  struct SlabStruct *prev;
+} Slab;
+
+/** A released block, linked into the free list for its size class. */
+typedef struct FreeStruct {
+  /** Next free block of the same size class. */
+  struct FreeStruct *next;
+} FreeBlock;
+
+/** Representation of an arena. */
+struct ArenaStruct {
+  /** Every slab owned by the arena. */
+  Slab *slabs;
+
+  /** Released blocks for each size class. */
+  FreeBlock *freeLists[ NUM_CLASSES ];
+
+  /** Next unused byte in the newest slab for each size class. */
+  char *bump[ NUM_CLASSES ];
+
+  /** End of the newest slab for each size class. */
+  char *bumpEnd[ NUM_CLASSES ];
+};
+
+/**
+    Maps pages for a slab holding one large block, aligned to SLAB_SIZE.  Extra room is
+    mapped so an aligned start can be found in it, and the unused ends are unmapped
+    again, so only the block's own pages are kept.
+    @param size total size of the slab including its header
+    @param *mapped filled in with the number of bytes kept mapped
+    @return the start of the slab
+ */
+static void *mapLargeSlab( size_t size, size_t *mapped )
+{
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size = ( size + page - 1 ) / page * page;
+    char *mem = mmap(NULL, size + SLAB_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        abort();
+    }
+    uintptr_t aligned = ( (uintptr_t) mem + SLAB_SIZE - 1 ) & ~(uintptr_t) ( SLAB_SIZE - 1 );
+    char *start = (char *) aligned;
+    if (start > mem) {
+        munmap(mem, start - mem);
+    }
+    if (mem + size + SLAB_SIZE > start + size) {
+        munmap(start + size, mem + size + SLAB_SIZE - ( start + size ));
+    }
+    *mapped = size;
+    return start;
+}
+
+/**
+    Gives a slab back to the system.
+    @param *s the slab
+ */
+static void freeSlab( Slab *s )
+{
+    if (s->sizeClass < 0) {
+        munmap(s, s->mapped);
+    } else {
+        free(s);
+    }
+}
+
+/**
+    Allocates a slab aligned to SLAB_SIZE and links it into the arena.  Shared slabs come
+    from posix_memalign(); a large block's slab is mapped on its own, so the alignment
+    costs address space rather than memory.
+    @param *a the arena that will own the slab
+    @param size total size of the slab including its header
+    @param sizeClass size class of the blocks it will hold, or -1 for a large block
+    @return pointer to the slab header
+ */
+static Slab *newSlab( Arena *a, size_t size, int sizeClass )
+{
+    void *mem;
+    size_t mapped = 0;
+    if (sizeClass < 0) {
+        mem = mapLargeSlab(size, &mapped);
+    } else if (posix_memalign(&mem, SLAB_SIZE, size) != 0) {
+        abort();
+    }
+    Slab *s = (Slab *) mem;
+    s->arena = a;
+    s->sizeClass = sizeClass;
+    s->mapped = mapped;
+    s->prev = NULL;
+    s->next = a->slabs;
+    if (a->slabs) {
+        a->slabs->prev = s;
+    }
+    a->slabs = s;
+    return s;
+}
+
+/**
+    Finds the size class of a block small enough to share a slab.  Up to MAX_SMALL,
+    each class is GRANULE bytes bigger than the last; above it, each power of two is
+    split into four classes.
+    @param size number of bytes needed, at most MAX_MEDIUM
+    @return the size class
+ */
+static int sizeClassOf( size_t size )
+{
+    if (size <= MAX_SMALL) {
+        return size == 0 ? 0 : (int) ((size - 1) / GRANULE);
+    }
+    int power = 63 - __builtin_clzll(size - 1);
+    int step = (int) ((size - 1) >> (power - MEDIUM_STEP_BITS)) - (1 << MEDIUM_STEP_BITS);
+    return SMALL_CLASSES + ((power - SMALL_POWER) << MEDIUM_STEP_BITS) + step;
+}
+
+/**
+    Returns the size of the blocks in a size class.
+    @param sizeClass the size class
+    @return bytes in each block, a multiple of GRANULE
+ */
+static size_t blockSizeOf( int sizeClass )
+{
+    if (sizeClass < SMALL_CLASSES) {
+        return (size_t) (sizeClass + 1) * GRANULE;
+    }
+    int power = SMALL_POWER + ((sizeClass - SMALL_CLASSES) >> MEDIUM_STEP_BITS);
+    int step = (sizeClass - SMALL_CLASSES) & ((1 << MEDIUM_STEP_BITS) - 1);
+    return (size_t) ((1 << MEDIUM_STEP_BITS) + step + 1) << (power - MEDIUM_STEP_BITS);
+}
+
+/**
+    Makes an empty arena.  No slabs are allocated until the first block is requested.
+    @return a pointer to the new arena
+ */
+Arena *makeArena( void )
+{
+    Arena *a = (Arena *) calloc(1, sizeof(Arena));
+    return a;
+}
+
+/**
+    Allocates a block from the arena.  Blocks up to an eighth of a slab come from a
+    free list of released blocks of the same size class, or else are carved from a
+    slab for that class.  Only larger ones get a slab of their own.
+    @param *a the arena to allocate from
+    @param size number of bytes needed
+    @return pointer to a block of at least size bytes, aligned for any type
+ */
+void *arenaAlloc( Arena *a, size_t size )
+{
+    if (size > MAX_MEDIUM) {
+        Slab *s = newSlab(a, HEADER_SIZE + size, -1);
+        return (char *) s + HEADER_SIZE;
+    }
+
+    int c = sizeClassOf(size);
+    if (a->freeLists[c] != NULL) {
+        FreeBlock *b = a->freeLists[c];
+        a->freeLists[c] = b->next;
+        return b;
+    }
+
+    size_t blockSize = blockSizeOf(c);
+    if (a->bump[c] == NULL || a->bump[c] + blockSize > a->bumpEnd[c]) {
+        Slab *s = newSlab(a, SLAB_SIZE, c);
+        a->bump[c] = (char *) s + HEADER_SIZE;
+        a->bumpEnd[c] = (char *) s + SLAB_SIZE;
+    }
+    void *p = a->bump[c];
+    a->bump[c] += blockSize;
+    return p;
+}
+
+/**
+    Gives a block back to the arena it came from so it can be reused.  The arena is
+    found from the block's address, so callers don't need to keep track of it.
+    @param *p a block returned by arenaAlloc(), or NULL
+ */
+void arenaRelease( void *p )
+{
+    if (p == NULL) {
+        return;
+    }
+    Slab *s = (Slab *) ((uintptr_t) p & ~(uintptr_t) (SLAB_SIZE - 1));
+    Arena *a = s->arena;
+    if (s->sizeClass < 0) {
+        // A large block has its slab to itself, so the slab goes back to the system.
+        if (s->prev) {
+            s->prev->next = s->next;
+        } else {
+            a->slabs = s->next;
+        }
+        if (s->next) {
+            s->next->prev = s->prev;
+        }
+        freeSlab(s);
+        return;
+    }
+    FreeBlock *b = (FreeBlock *) p;
+    b->next = a->freeLists[s->sizeClass];
+    a->freeLists[s->sizeClass] = b;
+}
+
+/**
+    Moves every slab of one arena, and its released blocks, into another, so blocks
+    allocated from either are freed along with the second.  The first arena is left
+    empty, but can still be used or freed.
+    @param *dst the arena that takes the slabs
+    @param *src the arena they come from
+ */
+void arenaAdopt( Arena *dst, Arena *src )
+{
+    // Each slab names its arena, which is how released blocks find their free list.
+    Slab *last = NULL;
+    for (Slab *s = src->slabs; s != NULL; s = s->next) {
+        s->arena = dst;
+        last = s;
+    }
+    if (last != NULL) {
+        last->next = dst->slabs;
+        if (dst->slabs) {
+            dst->slabs->prev = last;
+        }
+        dst->slabs = src->slabs;
+    }
+    for (int c = 0; c < NUM_CLASSES; c++) {
+        FreeBlock **tail = &src->freeLists[c];
+        while (*tail != NULL) {
+            tail = &(*tail)->next;
+        }
+        *tail = dst->freeLists[c];
+        dst->freeLists[c] = src->freeLists[c];
+    }
+    // The unused ends of src's newest slabs go to waste until dst is freed.
+    *src = (Arena) { 0 };
+}
+
+/**
+    Frees every slab in the arena at once, along with all the blocks in them.
+    @param *a the arena to free
+ */
+void freeArena( Arena *a )
+{
+    Slab *s = a->slabs;
+    while (s != NULL) {
+        Slab *next = s->next;
+        freeSlab(s);
+        s = next;
+    }
+    free(a);
+}
@@ -0,0 +1,52 @@
+/**
+    @file arena.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for arena.c, a slab allocator that a map and its values can share
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/** Incomplete type for an arena of slabs. */
+typedef struct ArenaStruct Arena;
+
+/**
+    Makes an empty arena.  No slabs are allocated until the first block is requested.
+    @return a pointer to the new arena
+ */
+Arena *makeArena( void );
+
+/**
+    Allocates a block from the arena.  Blocks up to an eighth of a slab come from a
+    free list of released blocks of the same size class, or else are carved from a
+    slab for that class.  Only larger ones get a slab of their own.
+    @param *a the arena to allocate from
+    @param size number of bytes needed
+    @return pointer to a block of at least size bytes, aligned for any type
+ */
+void *arenaAlloc( Arena *a, size_t size );
+
+/**
+    Gives a block back to the arena it came from so it can be reused.  The arena is
+    found from the block's address, so callers don't need to keep track of it.
+    @param *p a block returned by arenaAlloc(), or NULL
+ */
+void arenaRelease( void *p );
+
+/**
+    Moves every slab of one arena, and its released blocks, into another, so blocks
+    allocated from either are freed along with the second.  The first arena is left
+    empty, but can still be used or freed.
+    @param *dst the arena that takes the slabs
+    @param *src the arena they come from
+ */
+void arenaAdopt( Arena *dst, Arena *src );
+
+/**
+    Frees every slab in the arena at once, along with all the blocks in them.
+    @param *a the arena to free
+ */
+void freeArena( Arena *a );
+
+#endif
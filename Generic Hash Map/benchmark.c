@@ -0,0 +1,1883 @@
+/**
+    @file benchmark.c
+    @author Sachi Vyas (smvyas)
+    A program that: Times the map and its supporting components on synthetic workloads.
+    Run it as "benchmark [name] [count]"; with no name every benchmark runs.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "map.h"
+#include "value.h"
+#include "concurrent.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "bulk.h"
+#include "latency.h"
+/** Number of keys used when no count is given on the command line. */
+#define DEFAULT_COUNT 1000000
+/** Nanoseconds in a second */
+#define NANOS 1.0e9
+/** Number of buckets the driver starts its map with */
+#define START_BUCKETS 1000
+/** Number of times each key is hashed when timing a hash function */
+#define HASH_ROUNDS 20
+/** Letters used for random keys */
+#define ALPHABET "abcdefghijklmnopqrstuvwxyz0123456789_-"
+/** Shortest random key */
+#define MIN_RANDOM_KEY 3
+/** Longest generated key; the map itself takes keys of any length */
+#define KEY_LONGEST 24
+/** Room for one generated key and its terminator */
+#define KEY_BUFFER ( KEY_LONGEST + 1 )
+/** File the throughput benchmark writes its commands to */
+#define COMMAND_FILE "benchmark-commands.txt"
+/** Room for one shell command that runs the driver */
+#define SHELL_BUFFER 256
+/** File the snapshot benchmark saves the map to */
+#define SNAPSHOT_FILE "benchmark.snap"
+/** Log file the wal benchmark appends to */
+#define WAL_FILE "benchmark.wal"
+/** Most sets to time when every record gets its own fsync */
+#define SYNCED_SETS 2000
+/** Commit window of the log whose longest wait the wal benchmark checks, in ms */
+#define WAIT_MILLIS 100
+/** Records per group in that log */
+#define WAIT_RECORDS 4
+/** Milliseconds into the window that log's first group fills up */
+#define WAIT_FULL_AFTER 10
+/** Milliseconds between checks for that log's commits */
+#define WAIT_POLL 1
+/** Nanoseconds in a millisecond */
+#define NANOS_PER_MILLI 1000000L
+/** Number of stripes in the striped concurrent map */
+#define STRIPES 64
+/** Keys per mapGetMany() / mapSetMany() call, and per mget line, in the multi benchmark */
+#define MULTI_KEYS 64
+/** Step through the keys for lookups in an order unrelated to how they were inserted */
+#define LOOKUP_STRIDE 7919
+/** Number of distinct keys the concurrent benchmark's threads work on */
+#define SHARED_KEYS 65536
+/** Longest key in the keys benchmark's mixed key set */
+#define LONG_KEY 200
+/** Number of distinct counters the counter benchmark updates */
+#define COUNTERS 10000
+/** Number of distinct numbers the parse benchmark cycles through */
+#define PARSE_TEXTS 4096
+/** Number of distinct keys the cache benchmark requests */
+#define CACHE_KEYS 100000
+/** Percent of the whole key set's bytes each run of the cache benchmark may use */
+static int const cachePercents[] = { 5, 10, 25, 50 };
+/** File the latency benchmark has the driver write its histograms to */
+#define LATENCY_FILE "benchmark-latency.txt"
+/** Runs of the driver each way in the latency benchmark; the fastest counts */
+#define LATENCY_RUNS 3
+/** Socket the server benchmark runs the driver on */
+#define SERVER_SOCKET "benchmark.sock"
+/** Distinct labels the repeated string values are drawn from */
+#define INTERN_LABELS 500
+/** Room for the text of one string value */
+#define INTERN_TEXT 64
+/** Percent of string values that are unique in each interning run */
+static int const internUniquePercents[] = { 10, 50, 100 };
+/** Fewest thread counts the bulk load is timed with, even on a machine with fewer cores */
+#define BULK_MIN_THREADS 4
+/** Keys set while a view is open in each run of the view benchmark, as a percent of
+    the keys in the map */
+static int const viewWritePercents[] = { 0, 1, 10, 100 };
+
+/** Results of timed hashing end up here so the compiler can't skip the work. */
+volatile uint32_t hashSink;
+
+/**
+    Reads the monotonic clock.
+    @return the current time in seconds
+ */
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / NANOS;
+}
+
+/**
+    Prints one line of results in a fixed layout so runs are easy to compare.
+    @param *what name of the configuration being measured
+    @param *op name of the operation
+    @param seconds total elapsed time
+    @param count number of operations performed
+ */
+static void report( char const *what, char const *op, double seconds, int count )
+{
+    printf("%-16s %-10s %10.1f ns/op\n", what, op, seconds * NANOS / count);
+}
+
+/**
+    Builds an array of distinct keys in a shuffled order.
+    @param count number of keys to make
+    @param *prefix text that starts every key
+    @return dynamically allocated array of count keys, KEY_BUFFER bytes each
+ */
+static char (*makeKeys( int count, char const *prefix ))[ KEY_BUFFER ]
+{
+    char (*keys)[ KEY_BUFFER ] = malloc(count * sizeof(*keys));
+    for (int i = 0; i < count; i++) {
+        snprintf(keys[i], KEY_BUFFER, "%s%d", prefix, i);
+    }
+    srand(1);
+    for (int i = count - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        char tmp[ KEY_BUFFER ];
+        memcpy(tmp, keys[i], KEY_BUFFER);
+        memcpy(keys[i], keys[j], KEY_BUFFER);
+        memcpy(keys[j], tmp, KEY_BUFFER);
+    }
+    return keys;
+}
+
+/**
+    Runs insert, hit, miss and remove passes against one map.
+    @param *what name of the configuration being measured
+    @param *m the empty map to use
+    @param count number of keys
+ */
+static void timeMap( char const *what, Map *m, int count )
+{
+    char (*keys)[ KEY_BUFFER ] = makeKeys(count, "key-");
+    char (*missing)[ KEY_BUFFER ] = makeKeys(count, "absent-");
+    Value **vals = malloc(count * sizeof(Value *));
+    for (int i = 0; i < count; i++) {
+        vals[i] = parseInteger("1");
+    }
+
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        mapSet(m, keys[i], vals[i]);
+    }
+    report(what, "set", now() - start, count);
+
+    long found = 0;
+    start = now();
+    for (int i = 0; i < count; i++) {
+        found += mapGet(m, keys[i]) != NULL;
+    }
+    report(what, "get-hit", now() - start, count);
+
+    start = now();
+    for (int i = 0; i < count; i++) {
+        found += mapGet(m, missing[i]) != NULL;
+    }
+    report(what, "get-miss", now() - start, count);
+
+    start = now();
+    for (int i = 0; i < count; i++) {
+        mapRemove(m, keys[i]);
+    }
+    report(what, "remove", now() - start, count);
+
+    if (found != count || mapSize(m) != 0) {
+        fprintf(stderr, "%s: map gave wrong answers\n", what);
+    }
+    freeMap(m);
+    free(vals);
+    free(missing);
+    free(keys);
+}
+
+/**
+    Compares the chained table against the Robin Hood table.
+    @param count number of keys
+ */
+static void benchMap( int count )
+{
+    timeMap("chained", makeMap(count), count);
+    timeMap("robin-hood", makeMapEngine(count, MAP_ROBIN_HOOD), count);
+}
+
+/**
+    Fills a table to a fixed load without letting it grow, then times lookups of keys
+    that are there and keys that aren't, which walk the longest probes.
+    @param *what name of the engine being measured
+    @param engine the storage engine
+    @param load entries per bucket, or fraction of slots in use, to fill the table to
+    @param buckets number of buckets or slots in the table
+ */
+static void timeLoad( char const *what, MapEngine engine, double load, int buckets )
+{
+    int count = buckets * load;
+    MapOptions opts = { .engine = engine, .maxLoad = load };
+    Map *m = makeMapWith(buckets, &opts);
+    char (*keys)[ KEY_BUFFER ] = makeKeys(count, "key-");
+    char (*missing)[ KEY_BUFFER ] = makeKeys(count, "absent-");
+    for (int i = 0; i < count; i++) {
+        mapSet(m, keys[i], makeIntegerIn(i, NULL));
+    }
+    MapStats stats;
+    mapStats(m, &stats);
+    char name[ 32 ];
+    snprintf(name, sizeof(name), "%s@%.2f", what, stats.loadFactor);
+
+    long found = 0;
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        found += mapGet(m, keys[i]) != NULL;
+    }
+    report(name, "get-hit", now() - start, count);
+
+    start = now();
+    for (int i = 0; i < count; i++) {
+        found += mapGet(m, missing[i]) != NULL;
+    }
+    report(name, "get-miss", now() - start, count);
+
+    if (found != count || stats.resizes != 0) {
+        fprintf(stderr, "%s: map gave wrong answers or grew\n", name);
+    }
+    freeMap(m);
+    free(missing);
+    free(keys);
+}
+
+/**
+    Times lookups in tables filled well past their usual load, where probes and chains
+    get long and rejecting the wrong entries quickly matters most.
+    @param count about how many keys to store
+ */
+static void benchLoad( int count )
+{
+    double chained[] = { 0.75, 2, 4, 8 };
+    for (int i = 0; i < sizeof(chained) / sizeof(chained[0]); i++) {
+        timeLoad("chained", MAP_CHAINED, chained[i], count / chained[i]);
+    }
+    // Robin Hood tables are a power of two long.
+    int slots = 1;
+    while (slots < count) {
+        slots *= 2;
+    }
+    double robin[] = { 0.5, 0.875, 0.95, 0.98 };
+    for (int i = 0; i < sizeof(robin) / sizeof(robin[0]); i++) {
+        timeLoad("robin-hood", MAP_ROBIN_HOOD, robin[i], slots);
+    }
+}
+
+/**
+    Orders two doubles for qsort.
+    @param *a pointer to the first double
+    @param *b pointer to the second double
+    @return negative, zero or positive as a is less than, equal to or greater than b
+ */
+static int compareDoubles( void const *a, void const *b )
+{
+    double x = *(double const *) a, y = *(double const *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+    Grows a map from a small table and reports the slowest sets, which would include
+    a full rehash if the table grew all at once.
+    @param *what name of the configuration being measured
+    @param *m the empty map to use
+    @param count number of keys
+ */
+static void timeGrowth( char const *what, Map *m, int count )
+{
+    char (*keys)[ KEY_BUFFER ] = makeKeys(count, "key-");
+    double *times = malloc(count * sizeof(double));
+    double total = 0;
+    for (int i = 0; i < count; i++) {
+        Value *v = parseInteger("1");
+        double start = now();
+        mapSet(m, keys[i], v);
+        times[i] = now() - start;
+        total += times[i];
+    }
+    MapStats stats;
+    mapStats(m, &stats);
+    qsort(times, count, sizeof(double), compareDoubles);
+    report(what, "set", total, count);
+    printf("%-16s %-10s %10.1f us\n", what, "p99.99-set", times[count - 1 - count / 10000] * NANOS / 1000);
+    printf("%-16s %-10s %10.1f us\n", what, "worst-set", times[count - 1] * NANOS / 1000);
+    printf("%-16s %-10s %10d buckets, load %.2f, %d resizes\n", what, "final",
+           stats.buckets, stats.loadFactor, stats.resizes);
+    freeMap(m);
+    free(times);
+    free(keys);
+}
+
+/**
+    Grows both engines from the driver's starting size of 1000 buckets.
+    @param count number of keys
+ */
+static void benchResize( int count )
+{
+    timeGrowth("chained", makeMap(START_BUCKETS), count);
+    timeGrowth("robin-hood", makeMapEngine(START_BUCKETS, MAP_ROBIN_HOOD), count);
+}
+
+/**
+    Fills in keys that look like numbered records, e.g. user:00001234:name.
+    @param (*keys) array to fill
+    @param count number of keys
+ */
+static void recordKeys( char (*keys)[ KEY_BUFFER ], int count )
+{
+    for (int i = 0; i < count; i++) {
+        snprintf(keys[i], KEY_BUFFER, "user:%08d:name", i);
+    }
+}
+
+/**
+    Fills in random lower-case keys between 3 and KEY_LONGEST characters long.
+    @param (*keys) array to fill
+    @param count number of keys
+ */
+static void randomKeys( char (*keys)[ KEY_BUFFER ], int count )
+{
+    srand(2);
+    for (int i = 0; i < count; i++) {
+        int len = MIN_RANDOM_KEY + rand() % (KEY_LONGEST - MIN_RANDOM_KEY + 1);
+        for (int j = 0; j < len; j++) {
+            keys[i][j] = ALPHABET[rand() % (sizeof(ALPHABET) - 1)];
+        }
+        keys[i][len] = '\0';
+    }
+}
+
+/**
+    Fills in short sequential keys like the ones in the driver tests, e.g. k123.
+    @param (*keys) array to fill
+    @param count number of keys
+ */
+static void shortKeys( char (*keys)[ KEY_BUFFER ], int count )
+{
+    for (int i = 0; i < count; i++) {
+        snprintf(keys[i], KEY_BUFFER, "k%d", i);
+    }
+}
+
+/**
+    Times one hash function and measures how evenly it spreads keys over a
+    power-of-two table with one bucket per key.  The spread is reported as
+    sum(b * (b + 1) / 2) over the buckets, divided by what a uniformly random
+    hash would give, so 1.00 is ideal and larger is worse.
+    @param *what name of the hash and key set
+    @param hash the hash function
+    @param (*keys) keys to hash
+    @param count number of keys
+ */
+static void timeHash( char const *what, HashFunction hash, char (*keys)[ KEY_BUFFER ], int count )
+{
+    size_t *lens = malloc(count * sizeof(size_t));
+    for (int i = 0; i < count; i++) {
+        lens[i] = strlen(keys[i]);
+    }
+
+    uint32_t sink = 0;
+    double start = now();
+    for (int r = 0; r < HASH_ROUNDS; r++) {
+        for (int i = 0; i < count; i++) {
+            sink ^= hash((const uint8_t *) keys[i], lens[i]);
+        }
+    }
+    double elapsed = now() - start;
+
+    uint32_t buckets = 1;
+    while (buckets < count) {
+        buckets *= 2;
+    }
+    int *load = calloc(buckets, sizeof(int));
+    int longest = 0;
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        int b = ++load[hash((const uint8_t *) keys[i], lens[i]) & (buckets - 1)];
+        longest = b > longest ? b : longest;
+        sum += b;
+    }
+    double expected = (count / (2.0 * buckets)) * (count + 2.0 * buckets - 1);
+    hashSink = sink;
+    printf("%-22s %6.2f ns/hash  spread %5.2f  longest %3d\n", what,
+           elapsed * NANOS / ((double) count * HASH_ROUNDS), sum / expected, longest);
+    free(load);
+    free(lens);
+}
+
+/**
+    Compares the hash functions on several realistic key sets.
+    @param count number of keys in each set
+ */
+static void benchHash( int count )
+{
+    struct {
+        char const *name;
+        void (*fill)( char (*keys)[ KEY_BUFFER ], int count );
+    } sets[] = { { "record", recordKeys }, { "random", randomKeys }, { "short", shortKeys } };
+    char const *hashes[] = { "jenkins", "fnv1a", "word" };
+
+    char (*keys)[ KEY_BUFFER ] = malloc(count * sizeof(*keys));
+    for (int s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+        sets[s].fill(keys, count);
+        for (int h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++) {
+            char what[ 2 * KEY_BUFFER ];
+            snprintf(what, sizeof(what), "%s/%s", hashes[h], sets[s].name);
+            timeHash(what, hashByName(hashes[h]), keys, count);
+        }
+    }
+    free(keys);
+}
+
+/**
+    Bulk-loads a map with values parsed the way the driver does, churns half the keys,
+    and tears the map down, timing each phase.
+    @param *what name of the configuration being measured
+    @param *opts settings for the map
+    @param count number of keys
+ */
+static void timeAllocation( char const *what, MapOptions const *opts, int count )
+{
+    char (*keys)[ KEY_BUFFER ] = makeKeys(count, "key-");
+    Map *m = makeMapWith(count, opts);
+    Arena *arena = mapArena(m);
+
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        mapSet(m, keys[i], i % 2 ? parseIntegerIn("12345", arena)
+                                 : parseStringIn("\"a short string\"", arena));
+    }
+    report(what, "load", now() - start, count);
+
+    start = now();
+    for (int i = 0; i < count; i += 2) {
+        mapRemove(m, keys[i]);
+        mapSet(m, keys[i], parseDoubleIn("3.25", arena));
+    }
+    report(what, "churn", now() - start, count / 2);
+
+    start = now();
+    freeMap(m);
+    report(what, "teardown", now() - start, count);
+    free(keys);
+}
+
+/**
+    Compares heap allocation against a per-map arena for both engines.
+    @param count number of keys
+ */
+static void benchArena( int count )
+{
+    MapOptions opts = { .engine = MAP_CHAINED };
+    timeAllocation("chained/malloc", &opts, count);
+    opts.arena = true;
+    timeAllocation("chained/arena", &opts, count);
+    opts.engine = MAP_ROBIN_HOOD;
+    opts.arena = false;
+    timeAllocation("robin/malloc", &opts, count);
+    opts.arena = true;
+    timeAllocation("robin/arena", &opts, count);
+}
+
+/**
+    Reports how many bytes of heap are in use, where the C library can tell us.
+    @return bytes allocated with malloc and not yet freed, or 0 if unknown
+ */
+static long heapInUse()
+{
+#if defined( __GLIBC__ ) && ( __GLIBC__ > 2 || __GLIBC_MINOR__ >= 33 )
+    // Large blocks, like a big table, are mapped separately and counted apart.
+    struct mallinfo2 info = mallinfo2();
+    return (long) ( info.uordblks + info.hblkhd );
+#else
+    return 0;
+#endif
+}
+
+/**
+    Parses and then destroys many copies of one value, reporting the time and the heap
+    bytes each value holds while it is alive.
+    @param *what name of the value being measured
+    @param *text the value as it would appear in a set command
+    @param count number of values
+ */
+static void timeValues( char const *what, char const *text, int count )
+{
+    Value **vals = malloc(count * sizeof(Value *));
+    long before = heapInUse();
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        vals[i] = text[0] == '"' ? parseString(text)
+                  : strchr(text, '.') ? parseDouble(text) : parseInteger(text);
+    }
+    double parsed = now() - start;
+    long bytes = heapInUse() - before;
+
+    start = now();
+    for (int i = 0; i < count; i++) {
+        valueDestroy(vals[i]);
+    }
+    double destroyed = now() - start;
+
+    printf("%-16s %8.1f ns/parse %8.1f ns/destroy %6.1f heap bytes/value\n", what,
+           parsed * NANOS / count, destroyed * NANOS / count, (double) bytes / count);
+    free(vals);
+}
+
+/**
+    Measures values whose payload fits inline and ones that don't.
+    @param count number of values of each kind
+ */
+static void benchValue( int count )
+{
+    printf("sizeof(Value) = %zu\n", sizeof(Value));
+    timeValues("int", "12345", count);
+    timeValues("double", "3.25", count);
+    timeValues("short-string", "\"ok\"", count);
+    timeValues("long-string", "\"a string too long to fit inline\"", count);
+}
+
+/**
+    Writes the quoted text of the string values for an interning run.  Repeated ones
+    are labels like a status and region, with the popular labels picked far more often
+    than the rest; unique ones carry their own number.
+    @param count number of values
+    @param uniquePercent percent of the values that are unique
+    @return dynamically allocated array of count texts
+ */
+static char (*labelTexts( int count, int uniquePercent ))[ INTERN_TEXT ]
+{
+    static char const *const states[] = { "shipped", "pending", "delivered", "returned" };
+    char (*texts)[ INTERN_TEXT ] = malloc(count * sizeof(*texts));
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        if (rand() % 100 < uniquePercent) {
+            snprintf(texts[i], INTERN_TEXT, "\"order note %d for the warehouse\"", i);
+        } else {
+            // Squaring a uniform number skews the picks toward the first labels.
+            double u = (double) rand() / RAND_MAX;
+            int label = (int) ( u * u * ( INTERN_LABELS - 1 ) );
+            snprintf(texts[i], INTERN_TEXT, "\"status=%s region=eu-west-%d\"",
+                     states[label % 4], label / 4);
+        }
+    }
+    return texts;
+}
+
+/**
+    Sets a string value under every key, parsed the way the driver parses a set, and
+    reports the time per set and the heap bytes per entry.
+    @param *what name of the configuration being measured
+    @param intern true to intern the strings
+    @param uniquePercent percent of the values that are unique
+    @param count number of keys
+ */
+static void timeIntern( char const *what, bool intern, int uniquePercent, int count )
+{
+    char (*keys)[ KEY_BUFFER ] = makeKeys(count, "interned-");
+    char (*texts)[ INTERN_TEXT ] = labelTexts(count, uniquePercent);
+    valueIntern(intern);
+    long before = heapInUse();
+    Map *m = makeMap(START_BUCKETS);
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        mapSet(m, keys[i], parseString(texts[i]));
+    }
+    double elapsed = now() - start;
+    long bytes = heapInUse() - before;
+    ValueStats values;
+    valueStats(&values);
+    char name[ KEY_BUFFER ];
+    snprintf(name, sizeof(name), "%s %d%%", what, uniquePercent);
+    printf("%-16s %8.1f ns/set %8.1f heap bytes/entry %8ld strings %8.1f MB saved\n",
+           name, elapsed * NANOS / count, (double) bytes / count, values.internedStrings,
+           values.internSavedBytes / 1.0e6);
+    freeMap(m);
+    valueIntern(false);
+    free(texts);
+    free(keys);
+}
+
+/**
+    Compares copying long string values with interning them, on values that mostly
+    repeat a few hundred labels, on values that are half unique, and on values that
+    never repeat.
+    @param count number of keys
+ */
+static void benchIntern( int count )
+{
+    for (int u = 0; u < sizeof(internUniquePercents) / sizeof(internUniquePercents[0]); u++) {
+        timeIntern("copied", false, internUniquePercents[u], count);
+        timeIntern("interned", true, internUniquePercents[u], count);
+    }
+}
+
+/**
+    Parses a number the way value.c did before its fast path: classify by looking for
+    a '.', then sscanf() and a separate scan for trailing blanks.
+    @param *str the text
+    @param *out filled in with the number
+    @return false if it isn't a number
+ */
+static bool scanfNumber( char const *str, Value *out )
+{
+    int n;
+    if (strchr(str, '.') != NULL) {
+        out->type = VALUE_DOUBLE;
+        if (sscanf(str, "%lf%n", &out->as.d, &n) != 1) {
+            return false;
+        }
+    } else {
+        out->type = VALUE_INT;
+        if (sscanf(str, "%d%n", &out->as.i, &n) != 1) {
+            return false;
+        }
+    }
+    return blankString(str + n);
+}
+
+/**
+    Times sscanf() and parseNumber() on one kind of number.
+    @param *what name of the kind of number
+    @param *format printf() format that makes one from a random int and a random
+                   fraction
+    @param fractions fractions are picked from 0 up to this
+    @param count number of numbers each way
+ */
+static void timeParse( char const *what, char const *format, int fractions, int count )
+{
+    char (*texts)[ KEY_BUFFER ] = malloc(PARSE_TEXTS * sizeof(*texts));
+    srand(1);
+    for (int i = 0; i < PARSE_TEXTS; i++) {
+        snprintf(texts[i], KEY_BUFFER, format, rand() % 100000 - 50000,
+                 rand() % fractions);
+    }
+    for (int round = 0; round < 2; round++) {
+        Value num;
+        double sum = 0;
+        double start = now();
+        for (int i = 0; i < count; i++) {
+            char const *text = texts[i % PARSE_TEXTS];
+            if (round == 0 ? scanfNumber(text, &num) : parseNumber(text, &num)) {
+                sum += num.type == VALUE_INT ? num.as.i : num.as.d;
+            }
+        }
+        double elapsed = now() - start;
+        hashSink += (uint32_t) sum;
+        report(what, round == 0 ? "sscanf" : "fast", elapsed, count);
+    }
+    free(texts);
+}
+
+/**
+    Compares parsing numbers with sscanf() and with the single-pass parser the driver
+    uses for set, on ints, short decimals, long decimals and exponents.
+    @param count number of numbers of each kind
+ */
+static void benchParse( int count )
+{
+    timeParse("int", "%d", 1, count);
+    timeParse("short-double", "%d.%.2d", 100, count);
+    timeParse("long-double", "%d.%.9d", 1000000000, count);
+    timeParse("exponent", "%d.%.3de-7", 1000, count);
+}
+
+/**
+    Times counter updates done the old way, by reading the value, formatting and parsing
+    the new one and setting it, and with mapIncrement(), and reports how many values
+    each way allocates per update.
+    @param *what name of the engine
+    @param engine the storage engine
+    @param count number of updates of each kind
+ */
+static void timeCounters( char const *what, MapEngine engine, int count )
+{
+    char (*keys)[ KEY_BUFFER ] = makeKeys(COUNTERS, "counter");
+    Map *map = makeMapEngine(START_BUCKETS, engine);
+    for (int i = 0; i < COUNTERS; i++) {
+        mapSet(map, keys[i], makeIntegerIn(0, NULL));
+    }
+    Value one = { .type = VALUE_INT, .as.i = 1 };
+    for (int round = 0; round < 2; round++) {
+        ValueStats before, after;
+        valueStats(&before);
+        double start = now();
+        for (int i = 0; i < count; i++) {
+            char const *key = keys[(long) i * LOOKUP_STRIDE % COUNTERS];
+            if (round == 0) {
+                char text[ KEY_BUFFER ];
+                snprintf(text, sizeof(text), "%d", mapGet(map, key)->as.i + 1);
+                mapSet(map, key, parseInteger(text));
+            } else {
+                mapIncrement(map, key, &one);
+            }
+        }
+        double elapsed = now() - start;
+        valueStats(&after);
+        report(what, round == 0 ? "get+set" : "incr", elapsed, count);
+        printf("%-16s %-10s %10.2f allocs/op\n", what, round == 0 ? "get+set" : "incr",
+               (double) ( after.allocations - before.allocations ) / count);
+    }
+    freeMap(map);
+    free(keys);
+}
+
+/**
+    Compares updating counters by replacing their values with updating them in place.
+    @param count number of updates of each kind
+ */
+static void benchCounter( int count )
+{
+    timeCounters("chained", MAP_CHAINED, count);
+    timeCounters("robin", MAP_ROBIN_HOOD, count);
+}
+
+/**
+    Picks keys with Zipf's law, so the key of rank k is asked for in proportion to 1 / k,
+    as the popular keys of a real cache are.  The keys are drawn up front so the timed
+    loop only does the lookups.
+    @param count number of keys to draw
+    @return dynamically allocated array of count key numbers below CACHE_KEYS
+ */
+static int *zipfKeys( int count )
+{
+    double *cdf = malloc(CACHE_KEYS * sizeof(double));
+    double total = 0;
+    for (int k = 0; k < CACHE_KEYS; k++) {
+        total += 1.0 / ( k + 1 );
+        cdf[k] = total;
+    }
+    int *picks = malloc(count * sizeof(int));
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        double u = (double) rand() / RAND_MAX * total;
+        int lo = 0, hi = CACHE_KEYS - 1;
+        while (lo < hi) {
+            int mid = ( lo + hi ) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        picks[i] = lo;
+    }
+    free(cdf);
+    return picks;
+}
+
+/**
+    Runs a cache workload on a map capped at some fraction of the bytes every key
+    would take: each request gets its key and, on a miss, sets it, which evicts others.
+    @param *what name of the engine
+    @param engine the storage engine
+    @param count number of requests for each cap
+ */
+static void timeCache( char const *what, MapEngine engine, int count )
+{
+    char (*keys)[ KEY_BUFFER ] = makeKeys(CACHE_KEYS, "cached-page-");
+    char const *text = "a cached value long enough to need its own block";
+    int *picks = zipfKeys(count);
+
+    // Load every key once, uncapped, to see how many bytes the whole set takes.
+    MapOptions opts = { .engine = engine };
+    Map *full = makeMapWith(START_BUCKETS, &opts);
+    for (int i = 0; i < CACHE_KEYS; i++) {
+        mapSet(full, keys[i], makeStringIn(text, strlen(text), NULL));
+    }
+    MapStats stats;
+    mapStats(full, &stats);
+    size_t fullBytes = stats.tableBytes + stats.nodeBytes + stats.keyBytes + stats.valueBytes;
+    freeMap(full);
+
+    for (int c = 0; c < sizeof(cachePercents) / sizeof(cachePercents[0]); c++) {
+        opts.maxBytes = fullBytes / 100 * cachePercents[c];
+        Map *map = makeMapWith(START_BUCKETS, &opts);
+        int hits = 0;
+        double start = now();
+        for (int i = 0; i < count; i++) {
+            char const *key = keys[picks[i]];
+            if (mapGet(map, key) != NULL) {
+                hits++;
+            } else {
+                mapSet(map, key, makeStringIn(text, strlen(text), NULL));
+            }
+        }
+        double elapsed = now() - start;
+        mapStats(map, &stats);
+        char name[ KEY_BUFFER ];
+        snprintf(name, sizeof(name), "%s %d%%", what, cachePercents[c]);
+        report(name, "request", elapsed, count);
+        printf("%-16s %-10s %9.1f%% hits, %d keys, %ld evicted\n", name, "request",
+               100.0 * hits / count, stats.entries, stats.evicted);
+        freeMap(map);
+    }
+    free(picks);
+    free(keys);
+}
+
+/**
+    Measures the hit rate and speed of the map as a cache under a memory cap, with
+    sampled least-recently-used eviction making room for missed keys.
+    @param count number of requests for each cap
+ */
+static void benchCache( int count )
+{
+    timeCache("chained", MAP_CHAINED, count);
+    timeCache("robin", MAP_ROBIN_HOOD, count);
+}
+
+/**
+    Writes a script of driver commands: a set for every key, a get and an overwrite of
+    each one, then a remove of each one.
+    @param *fp file to write the commands to
+    @param count number of distinct keys
+    @return number of commands written
+ */
+static int writeCommands( FILE *fp, int count )
+{
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "set key%d %d\n", i, i);
+    }
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "get key%d\n", i);
+        fprintf(fp, "set key%d \"value %d\"\n", i, i);
+    }
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "remove key%d\n", i);
+    }
+    fprintf(fp, "quit\n");
+    return count * 4 + 1;
+}
+
+/**
+    Runs the driver on the command script.
+    @param *flags extra command-line arguments for the driver
+    @param piped true to pipe the script in, false to redirect it from the file
+    @param commands number of commands in the script
+    @return commands handled each second, or a negative number if the driver failed
+ */
+static double driverRate( char const *flags, bool piped, int commands )
+{
+    char cmd[ SHELL_BUFFER ];
+    if (piped) {
+        snprintf(cmd, sizeof(cmd), "cat %s | ./driver %s > /dev/null", COMMAND_FILE, flags);
+    } else {
+        snprintf(cmd, sizeof(cmd), "./driver %s < %s > /dev/null", flags, COMMAND_FILE);
+    }
+    double start = now();
+    if (system(cmd) != 0) {
+        return -1;
+    }
+    return commands / ( now() - start );
+}
+
+/**
+    Runs the driver on the command script and reports how many commands it handled
+    each second.
+    @param *what name of the configuration being measured
+    @param *flags extra command-line arguments for the driver
+    @param piped true to pipe the script in, false to redirect it from the file
+    @param commands number of commands in the script
+ */
+static void timeDriver( char const *what, char const *flags, bool piped, int commands )
+{
+    double rate = driverRate(flags, piped, commands);
+    if (rate < 0) {
+        printf("%-16s driver failed\n", what);
+        return;
+    }
+    printf("%-16s %10.0f commands/s\n", what, rate);
+}
+
+/**
+    Measures the whole driver, from reading commands to printing results, in line
+    mode and in batch mode, with the script piped in or mapped from the file.
+    @param count number of distinct keys in the script
+ */
+static void benchThroughput( int count )
+{
+    FILE *fp = fopen(COMMAND_FILE, "w");
+    if (!fp) {
+        perror(COMMAND_FILE);
+        return;
+    }
+    int commands = writeCommands(fp, count);
+    fclose(fp);
+
+    timeDriver("line/pipe", "", true, commands);
+    timeDriver("line/mmap", "", false, commands);
+    timeDriver("batch/pipe", "-batch", true, commands);
+    timeDriver("batch/mmap", "-batch", false, commands);
+    timeDriver("batch/robin", "-batch -robin -arena", false, commands);
+    remove(COMMAND_FILE);
+}
+
+/**
+    Runs the driver on the command script with and without -latency, keeping the best
+    of a few runs each way, and reports how much the timing slowed it down.
+    @param *what name of the configuration being measured
+    @param *flags extra command-line arguments for the driver
+    @param commands number of commands in the script
+ */
+static void timeLatencyOverhead( char const *what, char const *flags, int commands )
+{
+    char timed[ SHELL_BUFFER ];
+    snprintf(timed, sizeof(timed), "%s -latency %s", flags, LATENCY_FILE);
+    double plain = 0, measured = 0;
+    for (int r = 0; r < LATENCY_RUNS; r++) {
+        double rate = driverRate(flags, false, commands);
+        plain = rate > plain ? rate : plain;
+        rate = driverRate(timed, false, commands);
+        measured = rate > measured ? rate : measured;
+    }
+    if (plain <= 0 || measured <= 0) {
+        printf("%-16s driver failed\n", what);
+        return;
+    }
+    printf("%-16s %10.0f commands/s plain %10.0f with -latency %6.1f%% slower\n", what,
+           plain, measured, ( plain / measured - 1 ) * 100);
+}
+
+/**
+    Measures what -latency costs: the clock read and histogram update each phase
+    takes, in-process, and the driver's throughput with and without it.
+    @param count number of distinct keys in the script
+ */
+static void benchLatency( int count )
+{
+    long sink = 0;
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        sink += latencyClock();
+    }
+    report("cycle counter", "read", now() - start, count);
+
+    int row = latencyCommand("benchmark");
+    uint64_t last = latencyClock();
+    start = now();
+    for (int i = 0; i < count; i++) {
+        uint64_t t = latencyClock();
+        latencyRecord(row, i % LATENCY_PHASES, t - last);
+        last = t;
+    }
+    report("histogram", "phase", now() - start, count);
+    hashSink = sink;
+
+    FILE *fp = fopen(COMMAND_FILE, "w");
+    if (!fp) {
+        perror(COMMAND_FILE);
+        return;
+    }
+    int commands = writeCommands(fp, count);
+    fclose(fp);
+    timeLatencyOverhead("line/mmap", "", commands);
+    timeLatencyOverhead("batch/mmap", "-batch", commands);
+    remove(COMMAND_FILE);
+    remove(LATENCY_FILE);
+}
+
+/**
+    Writes a file for a bulk load: a set of an int, then of a string, for every key,
+    a double for every other key, and a remove of every fourth.
+    @param *fp file to write the commands to
+    @param count number of distinct keys
+    @return number of commands written
+ */
+static int writeBulkCommands( FILE *fp, int count )
+{
+    int commands = 0;
+    for (int i = 0; i < count; i++, commands++) {
+        fprintf(fp, "set key%d %d\n", i, i);
+    }
+    for (int i = 0; i < count; i++, commands++) {
+        fprintf(fp, "set key%d \"value number %d\"\n", i, i);
+    }
+    for (int i = 0; i < count; i += 2, commands++) {
+        fprintf(fp, "set key%d %d.5\n", i, i);
+    }
+    for (int i = 0; i < count; i += 4, commands++) {
+        fprintf(fp, "remove key%d\n", i);
+    }
+    return commands;
+}
+
+/**
+    Loads the command file into a new map with bulkLoad() and reports the rate and
+    where the time went.
+    @param *what name of the configuration being measured
+    @param *opts options for the map
+    @param threads number of threads to load with
+ */
+static void timeBulk( char const *what, MapOptions const *opts, int threads )
+{
+    Map *m = makeMapWith(START_BUCKETS, opts);
+    BulkStats stats;
+    double start = now();
+    bool ok = bulkLoad(m, COMMAND_FILE, threads, NULL, &stats);
+    double elapsed = now() - start;
+    char name[ KEY_BUFFER ];
+    snprintf(name, sizeof(name), "%s %d", what, threads);
+    if (!ok) {
+        printf("%-16s bulk load failed\n", name);
+    } else {
+        printf("%-16s %10.0f commands/s (split %.3f s, apply %.3f s, merge %.3f s)\n", name,
+               stats.commands / elapsed, stats.parseSeconds, stats.applySeconds,
+               stats.mergeSeconds);
+    }
+    freeMap(m);
+}
+
+/**
+    Compares running a file of sets and removes through the driver one at a time with
+    a bulk load of it on 1, 2, 4 and so on threads, up to the number of cores.
+    @param count number of distinct keys in the file
+ */
+static void benchBulk( int count )
+{
+    FILE *fp = fopen(COMMAND_FILE, "w");
+    if (!fp) {
+        perror(COMMAND_FILE);
+        return;
+    }
+    int commands = writeBulkCommands(fp, count);
+    fclose(fp);
+
+    int cores = bulkThreads();
+    int most = cores > BULK_MIN_THREADS ? cores : BULK_MIN_THREADS;
+    printf("%d cores\n", cores);
+    timeDriver("driver/batch", "-batch", false, commands);
+    timeDriver("driver/robin", "-batch -robin -arena", false, commands);
+    for (int threads = 1; threads < most * 2; threads *= 2) {
+        // A core count that isn't a power of two is timed in place of the next one.
+        int n = threads > most ? most : threads;
+        timeBulk("chained", &(MapOptions) { .engine = MAP_CHAINED }, n);
+        timeBulk("robin", &(MapOptions) { .engine = MAP_ROBIN_HOOD, .arena = true }, n);
+    }
+    remove(COMMAND_FILE);
+}
+
+/**
+    Runs the driver as a server and puts load on it with loadgen, with one client and
+    many, and with and without pipelining.  loadgen prints the rate and latencies.
+    @param count number of requests sent for each configuration
+ */
+static void benchServer( int count )
+{
+    static int const configs[][ 2 ] = { { 1, 1 }, { 1, 16 }, { 4, 1 }, { 4, 16 }, { 16, 64 } };
+    for (int i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+        for (int robin = 0; robin <= 1; robin++) {
+            char cmd[ SHELL_BUFFER ];
+            snprintf(cmd, sizeof(cmd),
+                     "./driver %s -serve %s & ./loadgen %s %d %d %d; s=$?; kill $!; wait; exit $s",
+                     robin ? "-robin -arena" : "", SERVER_SOCKET, SERVER_SOCKET,
+                     configs[i][0], configs[i][1], count);
+            printf("%-8s ", robin ? "robin" : "chained");
+            fflush(stdout);
+            if (system(cmd) != 0) {
+                printf("server run failed\n");
+            }
+        }
+    }
+}
+
+/** One thread's share of a concurrent benchmark. */
+typedef struct {
+  /** Map shared by every thread. */
+  ConcurrentMap *map;
+
+  /** Keys to pick from. */
+  char (*keys)[ KEY_BUFFER ];
+
+  /** Number of operations this thread performs. */
+  int ops;
+
+  /** Percentage of operations that are gets; the rest are split between sets and removes. */
+  int readPercent;
+
+  /** Seed for this thread's random choices. */
+  uint32_t seed;
+
+  /** Sum of the values the thread found, so the lookups can't be skipped. */
+  long sum;
+} Worker;
+
+/**
+    Adds an integer value to a running sum.
+    @param *val the value found by concurrentMapGet()
+    @param *arg pointer to the sum
+ */
+static void addValue( Value const *val, void *arg )
+{
+    *(long *) arg += val->as.i;
+}
+
+/**
+    Runs one thread's mix of random gets, sets and removes.
+    @param *arg the thread's Worker
+    @return NULL
+ */
+static void *runWorker( void *arg )
+{
+    Worker *w = arg;
+    uint32_t x = w->seed;
+    for (int i = 0; i < w->ops; i++) {
+        // xorshift32 is cheap enough not to show up in the timing.
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        char const *key = w->keys[x % SHARED_KEYS];
+        int pick = ( x >> 16 ) % 100;
+        if (pick < w->readPercent) {
+            concurrentMapGet(w->map, key, addValue, &w->sum);
+        } else if (pick % 2 == 0) {
+            concurrentMapSet(w->map, key, parseInteger("1"));
+        } else {
+            concurrentMapRemove(w->map, key);
+        }
+    }
+    return NULL;
+}
+
+/**
+    Runs the same total number of operations on one shared map split over several
+    threads and reports the combined rate.
+    @param *what name of the configuration being measured
+    @param stripes number of stripes (locks) in the map, or 0 for a lock-free map with
+                   STRIPES stripes
+    @param readPercent percentage of operations that are gets
+    @param threads number of threads
+    @param count total number of operations
+ */
+static void timeThreads( char const *what, int stripes, int readPercent, int threads,
+                         int count )
+{
+    MapOptions opts = { .engine = MAP_CHAINED };
+    ConcurrentMap *m = stripes == 0 ? makeLockFreeMap(SHARED_KEYS, STRIPES, NULL)
+                       : makeConcurrentMap(SHARED_KEYS, stripes, &opts);
+    char (*keys)[ KEY_BUFFER ] = makeKeys(SHARED_KEYS, "key-");
+    for (int i = 0; i < SHARED_KEYS; i += 2) {
+        concurrentMapSet(m, keys[i], parseInteger("1"));
+    }
+
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    Worker *workers = malloc(threads * sizeof(Worker));
+    double start = now();
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (Worker) { m, keys, count / threads, readPercent, 2463534242u + i, 0 };
+        pthread_create(&ids[i], NULL, runWorker, &workers[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    double elapsed = now() - start;
+    printf("%-16s %3d%% get %3d threads %8.2f Mops/s\n", what, readPercent, threads,
+           count / elapsed / 1.0e6);
+
+    freeConcurrentMap(m);
+    free(workers);
+    free(ids);
+    free(keys);
+}
+
+/**
+    Shows how a shared map scales from one thread to one per core, for read-heavy and
+    write-heavy mixes, with a single lock, with striped locks, and with lock-free reads.
+    @param count total number of operations for each run
+ */
+static void benchConcurrent( int count )
+{
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int most = cores > 2 ? cores : 2;
+    int mixes[] = { 95, 50 };
+    for (int k = 0; k < sizeof(mixes) / sizeof(mixes[0]); k++) {
+        for (int t = 1; ; t = t * 2 < most ? t * 2 : most) {
+            timeThreads("one-lock", 1, mixes[k], t, count);
+            timeThreads("striped", STRIPES, mixes[k], t, count);
+            timeThreads("lock-free", 0, mixes[k], t, count);
+            if (t == most) {
+                break;
+            }
+        }
+    }
+}
+
+/**
+    Runs the driver on a script and times it.
+    @param *script file to redirect the driver's input from
+    @return elapsed seconds, or a negative number if the driver failed
+ */
+static double runDriver( char const *script )
+{
+    char cmd[ SHELL_BUFFER ];
+    snprintf(cmd, sizeof(cmd), "./driver -batch < %s > /dev/null", script);
+    double start = now();
+    if (system(cmd) != 0) {
+        return -1;
+    }
+    return now() - start;
+}
+
+/**
+    Compares warming up a map by replaying set commands with loading the same pairs from
+    a snapshot, in the driver and in-process, and compares lookups in a loaded map with
+    lookups straight out of the mapped snapshot file.
+    @param count number of key / value pairs
+ */
+static void benchSnapshot( int count )
+{
+    char (*keys)[ KEY_BUFFER ] = makeKeys(count, "key-");
+    char const *texts[] = { "12345", "3.25", "\"ok\"", "\"a string too long to fit inline\"" };
+    Map *m = makeMap(START_BUCKETS);
+    FILE *fp = fopen(COMMAND_FILE, "w");
+    if (!fp) {
+        perror(COMMAND_FILE);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        char const *text = texts[i % 4];
+        fprintf(fp, "set %s %s\n", keys[i], text);
+        mapSet(m, keys[i], text[0] == '"' ? parseString(text)
+               : strchr(text, '.') ? parseDouble(text) : parseInteger(text));
+    }
+    fclose(fp);
+
+    double start = now();
+    mapSave(m, SNAPSHOT_FILE);
+    report("map", "save", now() - start, count);
+    freeMap(m);
+
+    double replay = runDriver(COMMAND_FILE);
+    fp = fopen(COMMAND_FILE, "w");
+    fprintf(fp, "load %s\n", SNAPSHOT_FILE);
+    fclose(fp);
+    double load = runDriver(COMMAND_FILE);
+    printf("%-16s replay %.3f s, load %.3f s\n", "driver", replay, load);
+
+    m = makeMap(START_BUCKETS);
+    start = now();
+    mapLoad(m, SNAPSHOT_FILE);
+    report("map", "load", now() - start, count);
+
+    long found = 0;
+    start = now();
+    for (int i = 0; i < count; i++) {
+        found += mapGet(m, keys[i]) != NULL;
+    }
+    report("map", "get", now() - start, count);
+    freeMap(m);
+
+    start = now();
+    Snapshot *snap = openSnapshot(SNAPSHOT_FILE);
+    report("mapped file", "open", now() - start, 1);
+    Value val;
+    start = now();
+    for (int i = 0; i < count; i++) {
+        found += snapshotGet(snap, keys[i], &val);
+    }
+    report("mapped file", "get", now() - start, count);
+    closeSnapshot(snap);
+
+    if (found != 2L * count) {
+        fprintf(stderr, "snapshot: lookups gave wrong answers\n");
+    }
+    remove(COMMAND_FILE);
+    remove(SNAPSHOT_FILE);
+    free(keys);
+}
+
+/**
+    Times sets that go through a write-ahead log before reaching the map.
+    @param *what name of the configuration
+    @param groupRecords records per commit, or 0 for none
+    @param groupMillis commit window in milliseconds, or 0 for none
+    @param *keys keys to set
+    @param count number of sets
+ */
+static void timeWal( char const *what, int groupRecords, int groupMillis,
+                     char (*keys)[ KEY_BUFFER ], int count )
+{
+    remove(WAL_FILE);
+    Map *m = makeMap(START_BUCKETS);
+    Wal *w = openWal(WAL_FILE, groupRecords, groupMillis);
+    if (w == NULL) {
+        perror(WAL_FILE);
+        freeMap(m);
+        return;
+    }
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        Value *val = makeIntegerIn(i, NULL);
+        walSet(w, keys[i], val);
+        mapSet(m, keys[i], val);
+    }
+    walSync(w);
+    double seconds = now() - start;
+    long commits = walCommits(w);
+    closeWal(w);
+    printf("%-16s %-10s %10.1f ns/op %10.0f ops/s %8ld syncs\n", what, "set",
+           seconds * NANOS / count, count / seconds, commits);
+    freeMap(m);
+    remove(WAL_FILE);
+}
+
+/**
+    Waits until a log has made a given number of commits.
+    @param *w the log
+    @param commits number of commits to wait for
+ */
+static void awaitCommits( Wal *w, long commits )
+{
+    struct timespec poll = { 0, WAIT_POLL * NANOS_PER_MILLI };
+    while (walCommits(w) < commits) {
+        nanosleep(&poll, NULL);
+    }
+}
+
+/**
+    Checks that a record added just after a full group is committed still waits no
+    longer than the log's commit window, rather than for what is left of the window
+    the full group started plus a whole new one.
+ */
+static void checkWalWait()
+{
+    remove(WAL_FILE);
+    Wal *w = openWal(WAL_FILE, WAIT_RECORDS, WAIT_MILLIS);
+    if (w == NULL) {
+        perror(WAL_FILE);
+        return;
+    }
+    Value val = { .type = VALUE_INT, .as.i = 1 };
+    struct timespec pause = { 0, WAIT_FULL_AFTER * NANOS_PER_MILLI };
+    walSet(w, "first", &val);
+    nanosleep(&pause, NULL);
+    for (int i = 1; i < WAIT_RECORDS; i++) {
+        walSet(w, "full", &val);
+    }
+    awaitCommits(w, 1);
+    double start = now();
+    walSet(w, "late", &val);
+    awaitCommits(w, 2);
+    double waited = ( now() - start ) * 1000;
+    closeWal(w);
+    remove(WAL_FILE);
+    printf("%-16s %-10s %10.1f ms\n", "100 ms window", "wait", waited);
+    if (waited > WAIT_MILLIS * 1.5) {
+        fprintf(stderr, "wal: a record waited %.0f ms to commit with a %d ms window\n",
+                waited, WAIT_MILLIS);
+    }
+}
+
+/**
+    Compares mutation throughput with no log and with logs that commit every record,
+    every few records, and on a timer.
+    @param count number of sets
+ */
+static void benchWal( int count )
+{
+    char (*keys)[ KEY_BUFFER ] = makeKeys(count, "key-");
+    Map *m = makeMap(START_BUCKETS);
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        mapSet(m, keys[i], makeIntegerIn(i, NULL));
+    }
+    report("no log", "set", now() - start, count);
+    freeMap(m);
+
+    // One fsync per record is far slower than the rest, so it gets fewer sets.
+    timeWal("every record", 1, 0, keys, count < SYNCED_SETS ? count : SYNCED_SETS);
+    timeWal("16 records", 16, 0, keys, count);
+    timeWal("256 records", 256, 0, keys, count);
+    timeWal("4096 records", 4096, 0, keys, count);
+    timeWal("1 ms", 0, 1, keys, count);
+    timeWal("10 ms", 0, 10, keys, count);
+    timeWal("128 or 10 ms", 128, 10, keys, count);
+    checkWalWait();
+    free(keys);
+}
+
+/**
+    Counts a pair visited by a scan.
+    @param *key the key
+    @param *val the value
+    @param *arg the count to add to
+ */
+static void countPair( char const *key, Value *val, void *arg )
+{
+    ( *(long *) arg )++;
+}
+
+/**
+    Copies a pair's key into an array, for sorting the keys by hand.
+    @param *key the key
+    @param *val the value
+    @param *arg pointer to the next free slot in the array
+ */
+static void copyKey( char const *key, Value *val, void *arg )
+{
+    char (**next)[ KEY_BUFFER ] = arg;
+    snprintf(**next, KEY_BUFFER, "%s", key);
+    ( *next )++;
+}
+
+/**
+    Orders two keys for qsort.
+    @param *a pointer to the first key
+    @param *b pointer to the second key
+    @return negative, zero or positive as for strcmp
+ */
+static int compareKeys( void const *a, void const *b )
+{
+    return strcmp(a, b);
+}
+
+/**
+    Times sets, ordered walks, prefix lookups and removes on one map.
+    @param *what name of the configuration
+    @param early if true the sorted index exists before the first set; otherwise it
+                 is built by the first scan, after the sets
+    @param *keys keys to use
+    @param count number of keys
+ */
+static void timeOrdered( char const *what, bool early, char (*keys)[ KEY_BUFFER ], int count )
+{
+    Map *m = makeMap(START_BUCKETS);
+    long visited = 0;
+    if (early) {
+        // An empty scan builds the (empty) index, so every set below maintains it.
+        mapScan(m, NULL, "", countPair, &visited);
+    }
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        mapSet(m, keys[i], makeIntegerIn(i, NULL));
+    }
+    report(what, "set", now() - start, count);
+    if (!early) {
+        start = now();
+        mapScan(m, NULL, NULL, countPair, &visited);
+        report(what, "first-scan", now() - start, count);
+    }
+    start = now();
+    mapScan(m, NULL, NULL, countPair, &visited);
+    report(what, "scan-all", now() - start, count);
+
+    int prefixes = count < 1000 ? count : 1000;
+    start = now();
+    for (int i = 0; i < prefixes; i++) {
+        mapPrefix(m, keys[i], countPair, &visited);
+    }
+    report(what, "prefix", now() - start, prefixes);
+
+    start = now();
+    for (int i = 0; i < count; i++) {
+        mapRemove(m, keys[i]);
+    }
+    report(what, "remove", now() - start, count);
+    freeMap(m);
+}
+
+/**
+    Measures what the sorted index costs sets and removes, and compares walking it with
+    copying the keys out of a plain map and sorting them.
+    @param count number of keys
+ */
+static void benchOrdered( int count )
+{
+    char (*keys)[ KEY_BUFFER ] = makeKeys(count, "key-");
+    Map *m = makeMap(START_BUCKETS);
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        mapSet(m, keys[i], makeIntegerIn(i, NULL));
+    }
+    report("hash only", "set", now() - start, count);
+    start = now();
+    char (*sorted)[ KEY_BUFFER ] = malloc(count * sizeof(*sorted));
+    char (*next)[ KEY_BUFFER ] = sorted;
+    mapForEach(m, copyKey, &next);
+    qsort(sorted, count, sizeof(*sorted), compareKeys);
+    report("hash only", "sort-all", now() - start, count);
+    free(sorted);
+    start = now();
+    for (int i = 0; i < count; i++) {
+        mapRemove(m, keys[i]);
+    }
+    report("hash only", "remove", now() - start, count);
+    freeMap(m);
+
+    timeOrdered("index on scan", false, keys, count);
+    timeOrdered("index on set", true, keys, count);
+    free(keys);
+}
+
+/** Copies a whole map has taken, for the view benchmark's stop-the-world baseline. */
+typedef struct {
+  /** Copies of the keys. */
+  char **keys;
+
+  /** Copies of the values. */
+  Value **vals;
+
+  /** Number of pairs copied so far. */
+  int count;
+
+  /** Bytes the copies take. */
+  size_t bytes;
+} FullCopy;
+
+/**
+    Copies one pair into a FullCopy.
+    @param *key the key
+    @param *val the value
+    @param *arg the FullCopy
+ */
+static void copyWhole( char const *key, Value *val, void *arg )
+{
+    FullCopy *copy = arg;
+    size_t len = strlen(key) + 1;
+    copy->keys[copy->count] = malloc(len);
+    memcpy(copy->keys[copy->count], key, len);
+    copy->vals[copy->count] = valueCopy(val);
+    copy->bytes += len + valueSize(copy->vals[copy->count]);
+    copy->count++;
+}
+
+/**
+    Times copying every pair of a map at once, as a snapshot would have to without
+    copy-on-write, with the map stopped for all of it.
+    @param *what name of the configuration
+    @param *m the map
+ */
+static void timeFullCopy( char const *what, Map *m )
+{
+    FullCopy copy = { malloc(mapSize(m) * sizeof(char *)),
+                      malloc(mapSize(m) * sizeof(Value *)), 0, 0 };
+    double start = now();
+    mapForEach(m, copyWhole, &copy);
+    double elapsed = now() - start;
+    printf("%-16s %-10s %9.1f ms stopped %8.1f MB copied\n", what, "full copy",
+           elapsed * 1000, copy.bytes / 1.0e6);
+    for (int i = 0; i < copy.count; i++) {
+        free(copy.keys[i]);
+        valueDestroy(copy.vals[i]);
+    }
+    free(copy.keys);
+    free(copy.vals);
+}
+
+/**
+    Reads a whole view of a map while sets overwrite random keys, spread evenly over
+    the read, and reports how long the map was stopped to open the view and what the
+    view had to copy.
+    @param *what name of the configuration
+    @param *m the map
+    @param *keys the map's keys
+    @param count number of keys
+    @param writePercent sets made while the view is open, as a percent of count
+ */
+static void timeView( char const *what, Map *m, char (*keys)[ KEY_BUFFER ], int count,
+                      int writePercent )
+{
+    int writes = (long) count * writePercent / 100;
+    double start = now();
+    MapView *v = mapSnapshot(m);
+    double open = now() - start;
+    MapViewStats stats;
+    mapViewStats(v, &stats);
+    long seen = 0;
+    int read = 0;
+    srand(2);
+    start = now();
+    for (int i = 0; i < writes; i++) {
+        mapSet(m, keys[rand() % count], makeIntegerIn(i, NULL));
+        int target = (long) stats.pages * ( i + 1 ) / writes;
+        mapViewNext(v, target - read, countPair, &seen);
+        read = target;
+    }
+    mapViewNext(v, stats.pages, countPair, &seen);
+    double elapsed = now() - start;
+    mapViewStats(v, &stats);
+    mapViewClose(v);
+    char name[ KEY_BUFFER ];
+    snprintf(name, sizeof(name), "%d%% set", writePercent);
+    printf("%-16s %-10s %9.1f us stopped %8.1f MB copied %6d of %d pages %8.1f ms in all\n",
+           what, name, open * 1.0e6, stats.bytesCopied / 1.0e6, stats.pagesCopied,
+           stats.pages, elapsed * 1000);
+    if (seen != count) {
+        fprintf(stderr, "view: read %ld pairs instead of %d\n", seen, count);
+    }
+}
+
+/**
+    Compares copying a whole map at once with a copy-on-write view of it, read while
+    more and more of the map is overwritten.
+    @param count number of keys
+ */
+static void benchView( int count )
+{
+    char (*keys)[ KEY_BUFFER ] = makeKeys(count, "key-");
+    char const *texts[] = { "12345", "3.25", "\"ok\"", "\"a string too long to fit inline\"" };
+    for (int e = 0; e < 2; e++) {
+        MapOptions opts = { .engine = e == 0 ? MAP_CHAINED : MAP_ROBIN_HOOD };
+        char const *what = e == 0 ? "chained" : "robin hood";
+        Map *m = makeMapWith(START_BUCKETS, &opts);
+        for (int i = 0; i < count; i++) {
+            char const *text = texts[i % 4];
+            mapSet(m, keys[i], text[0] == '"' ? parseString(text)
+                   : strchr(text, '.') ? parseDouble(text) : parseInteger(text));
+        }
+        timeFullCopy(what, m);
+        for (int w = 0; w < sizeof(viewWritePercents) / sizeof(viewWritePercents[0]); w++) {
+            timeView(what, m, keys, count, viewWritePercents[w]);
+        }
+        freeMap(m);
+    }
+    free(keys);
+}
+
+/**
+    Times single gets and sets against batched ones on one full map.
+    @param *what name of the configuration
+    @param *m the empty map to use
+    @param *keys keys to use
+    @param count number of keys
+ */
+static void timeMulti( char const *what, Map *m, char (*keys)[ KEY_BUFFER ], int count )
+{
+    for (int i = 0; i < count; i++) {
+        mapSet(m, keys[i], makeIntegerIn(i, NULL));
+    }
+    // Visit the keys in a scattered order, so nearly every lookup misses the cache.
+    char const **order = malloc(count * sizeof(char const *));
+    for (int i = 0; i < count; i++) {
+        order[i] = keys[(long) i * LOOKUP_STRIDE % count];
+    }
+    Value **vals = malloc(count * sizeof(Value *));
+
+    long found = 0;
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        found += mapGet(m, order[i]) != NULL;
+    }
+    report(what, "get", now() - start, count);
+
+    start = now();
+    for (int i = 0; i < count; i += MULTI_KEYS) {
+        mapGetMany(m, count - i < MULTI_KEYS ? count - i : MULTI_KEYS, order + i, vals + i);
+    }
+    report(what, "get-many", now() - start, count);
+    for (int i = 0; i < count; i++) {
+        found += vals[i] != NULL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        vals[i] = makeIntegerIn(i, NULL);
+    }
+    start = now();
+    for (int i = 0; i < count; i++) {
+        mapSet(m, order[i], vals[i]);
+    }
+    report(what, "set", now() - start, count);
+
+    for (int i = 0; i < count; i++) {
+        vals[i] = makeIntegerIn(i, NULL);
+    }
+    start = now();
+    for (int i = 0; i < count; i += MULTI_KEYS) {
+        mapSetMany(m, count - i < MULTI_KEYS ? count - i : MULTI_KEYS, order + i, vals + i);
+    }
+    report(what, "set-many", now() - start, count);
+
+    if (found != 2L * count) {
+        fprintf(stderr, "%s: batched lookups gave wrong answers\n", what);
+    }
+    free(vals);
+    free(order);
+    freeMap(m);
+}
+
+/**
+    Compares one lookup at a time with batches whose cache misses overlap, in-process
+    and through the driver's get and mget commands.
+    @param count number of keys
+ */
+static void benchMulti( int count )
+{
+    char (*keys)[ KEY_BUFFER ] = makeKeys(count, "key-");
+    timeMulti("chained", makeMap(START_BUCKETS), keys, count);
+    timeMulti("robin-hood", makeMapEngine(START_BUCKETS, MAP_ROBIN_HOOD), keys, count);
+
+    for (int multi = 0; multi < 2; multi++) {
+        FILE *fp = fopen(COMMAND_FILE, "w");
+        if (!fp) {
+            perror(COMMAND_FILE);
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            fprintf(fp, "set %s %d\n", keys[i], i);
+        }
+        for (int i = 0; i < count; i++) {
+            char const *key = keys[(long) i * LOOKUP_STRIDE % count];
+            if (!multi) {
+                fprintf(fp, "get %s\n", key);
+            } else {
+                fprintf(fp, "%s%s%s", i % MULTI_KEYS == 0 ? "mget " : " ", key,
+                        i % MULTI_KEYS == MULTI_KEYS - 1 || i == count - 1 ? "\n" : "");
+            }
+        }
+        fclose(fp);
+        timeDriver(multi ? "driver mget" : "driver get", "-batch", false, 2 * count);
+    }
+    remove(COMMAND_FILE);
+    free(keys);
+}
+
+/**
+    Makes a key set like a cache or session store would see: short counters, record
+    keys and session keys, and, if longKeys is set, URL keys from 40 to LONG_KEY
+    characters.  Without long keys every key fits in 24 characters.
+    @param count number of keys
+    @param longKeys true to make every fourth key a long one
+    @return dynamically allocated array of count dynamically allocated keys
+ */
+static char **realisticKeys( int count, bool longKeys )
+{
+    char **keys = malloc(count * sizeof(char *));
+    char buf[ LONG_KEY + 1 ];
+    srand(3);
+    for (int i = 0; i < count; i++) {
+        int kind = longKeys ? i % 4 : i % 3;
+        if (kind == 0) {
+            snprintf(buf, sizeof(buf), "k%d", i);
+        } else if (kind == 1) {
+            snprintf(buf, sizeof(buf), "user:%08d:name", i);
+        } else if (kind == 2) {
+            snprintf(buf, sizeof(buf), "sess:%06x:cart", i);
+        } else {
+            int len = snprintf(buf, sizeof(buf), "https://example.com/api/v2/items/%d?q=", i);
+            int want = 40 + rand() % (LONG_KEY - 40 + 1);
+            while (len < want) {
+                buf[len++] = ALPHABET[rand() % (sizeof(ALPHABET) - 1)];
+            }
+            buf[len] = '\0';
+        }
+        keys[i] = malloc(strlen(buf) + 1);
+        strcpy(keys[i], buf);
+    }
+    return keys;
+}
+
+/**
+    Loads a map with one small integer per key and reports the heap bytes each entry
+    costs, counting the map's nodes, slots, keys and values but not the caller's keys.
+    @param *what name of the configuration being measured
+    @param *opts settings for the map
+    @param **keys the keys
+    @param count number of keys
+ */
+static void measureKeys( char const *what, MapOptions const *opts, char **keys, int count )
+{
+    long keyBytes = 0;
+    for (int i = 0; i < count; i++) {
+        keyBytes += strlen(keys[i]);
+    }
+    long before = heapInUse();
+    Map *m = makeMapWith(START_BUCKETS, opts);
+    for (int i = 0; i < count; i++) {
+        mapSet(m, keys[i], makeIntegerIn(i, mapArena(m)));
+    }
+    long bytes = heapInUse() - before;
+    printf("%-20s %6.1f key chars/entry %8.1f heap bytes/entry\n", what,
+           (double) keyBytes / count, (double) bytes / mapSize(m));
+    freeMap(m);
+}
+
+/**
+    Measures the memory each entry takes with keys of realistic lengths, for both
+    engines with and without an arena.
+    @param count number of keys
+ */
+static void benchKeys( int count )
+{
+    for (int longKeys = 0; longKeys < 2; longKeys++) {
+        char **keys = realisticKeys(count, longKeys);
+        char const *names[] = { "chained", "chained/arena", "robin", "robin/arena" };
+        for (int i = 0; i < 4; i++) {
+            MapOptions opts = { .engine = i < 2 ? MAP_CHAINED : MAP_ROBIN_HOOD,
+                                .arena = i % 2 };
+            char what[ 32 ];
+            snprintf(what, sizeof(what), "%s %s", longKeys ? "mixed" : "short", names[i]);
+            measureKeys(what, &opts, keys, count);
+        }
+        for (int i = 0; i < count; i++) {
+            free(keys[i]);
+        }
+        free(keys);
+    }
+}
+
+/** A benchmark that can be picked by name on the command line. */
+typedef struct {
+  /** Name used to select the benchmark. */
+  char const *name;
+
+  /** Function that runs it for the given number of items. */
+  void (*run)( int count );
+} Benchmark;
+
+/** Every benchmark this program knows about. */
+static Benchmark benchmarks[] = {
+  { "map", benchMap },
+  { "resize", benchResize },
+  { "load", benchLoad },
+  { "hash", benchHash },
+  { "arena", benchArena },
+  { "value", benchValue },
+  { "parse", benchParse },
+  { "intern", benchIntern },
+  { "counter", benchCounter },
+  { "cache", benchCache },
+  { "throughput", benchThroughput },
+  { "latency", benchLatency },
+  { "bulk", benchBulk },
+  { "concurrent", benchConcurrent },
+  { "snapshot", benchSnapshot },
+  { "view", benchView },
+  { "wal", benchWal },
+  { "ordered", benchOrdered },
+  { "multi", benchMulti },
+  { "keys", benchKeys },
+  { "server", benchServer },
+};
+
+/**
+   Starting point for the program.
+   @param argc number of command-line arguments.
+   @param argv array of strings given as command-line arguments.
+   @return exit status for the program.
+ */
+int main( int argc, char *argv[] )
+{
+    int count = DEFAULT_COUNT;
+    if (argc > 2) {
+        count = atoi(argv[2]);
+    }
+    if (argc > 3 || count <= 0) {
+        fprintf(stderr, "Usage: benchmark [name] [count]\n");
+        return EXIT_FAILURE;
+    }
+
+    bool ran = false;
+    for (int i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        if (argc < 2 || strcmp(argv[1], benchmarks[i].name) == 0) {
+            printf("== %s\n", benchmarks[i].name);
+            benchmarks[i].run(count);
+            ran = true;
+        }
+    }
+    if (!ran) {
+        fprintf(stderr, "Unknown benchmark: %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
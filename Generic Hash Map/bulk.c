@@ -0,0 +1,503 @@
+/**
+    @file bulk.c
+    @author Sachi Vyas (smvyas)
+    A program that: Loads a file of set and remove commands into a map on several
+    threads.  The file is read in rounds; each round is cut into one chunk per thread at
+    line boundaries, and the threads split their chunks into commands, routing each to
+    a queue for the partition its key hashes to.  Then each thread takes one partition
+    and applies its queues from every chunk in file order, so the commands for any one
+    key run in the order they were written.  Once the whole file is in, the partitions
+    are moved into the map.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "bulk.h"
+#include "command.h"
+#include "hash.h"
+#include "value.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Bytes of the file each thread splits per round, so the queued commands stay bounded */
+#define ROUND_BYTES ( 32 * 1024 * 1024 )
+/** Buckets (or slots) each partition starts with */
+#define PART_BUCKETS 1024
+/** Commands a queue first makes room for */
+#define QUEUE_START 64
+/** 2^32 divided by the golden ratio, which spreads a hash's bits before the top ones
+    pick a partition */
+#define SPREAD 2654435769u
+/** Nanoseconds in a second */
+#define NANOS 1.0e9
+
+/** One set or remove waiting to be applied to its partition. */
+typedef struct {
+  /** The key, ended by a '\0' in the file's buffer. */
+  char const *key;
+
+  /** Text of a set's value, ended by a '\0', or NULL for a remove. */
+  char const *value;
+
+  /** Length of the value. */
+  size_t valueLen;
+
+  /** Seconds a set's key should live, or 0 if it doesn't expire. */
+  double ttl;
+} BulkOp;
+
+/** Commands from one chunk for one partition, in file order. */
+typedef struct {
+  /** The commands. */
+  BulkOp *ops;
+
+  /** Number of commands. */
+  int count;
+
+  /** Room in ops. */
+  int cap;
+} Queue;
+
+/** One thread's share of a round of the file. */
+typedef struct {
+  /** First character of the chunk. */
+  char *start;
+
+  /** End of the chunk, just past a newline or at the end of the file. */
+  char *end;
+
+  /** Number of partitions. */
+  int parts;
+
+  /** One queue per partition. */
+  Queue *queues;
+
+  /** Lines read from the chunk. */
+  long lines;
+
+  /** Line of the chunk, counting from 1, that isn't a valid command, or 0. */
+  long badLine;
+} Chunk;
+
+/** One thread's partition of the keys. */
+typedef struct {
+  /** Map holding the partition's keys. */
+  Map *map;
+
+  /** Keys whose last command was a remove, which must also be removed from the map
+      being loaded, or NULL if that map started out empty. */
+  Map *removed;
+
+  /** The chunks of the current round. */
+  Chunk *chunks;
+
+  /** Number of chunks. */
+  int count;
+
+  /** Which queue of each chunk belongs to this partition. */
+  int index;
+} Partition;
+
+/**
+    Reads the monotonic clock.
+    @return the current time in seconds
+ */
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / NANOS;
+}
+
+/**
+    Returns the number of threads to load with when none is given: one per core.
+    @return the number of threads
+ */
+int bulkThreads( void )
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+/**
+    Gets the file into writable memory with room for a '\0' after its last line.  It is
+    mapped privately, so writing to it never changes the file, unless a last line with
+    no newline ends exactly on a page boundary; then it is read into a buffer.
+    @param *path name of the file
+    @param *len set to the length of the file
+    @param *mapped set to true if the memory is a mapping rather than a buffer
+    @return the file's contents, or NULL if it can't be read
+ */
+static char *readFile( char const *path, size_t *len, bool *mapped )
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    *len = st.st_size;
+    *mapped = false;
+    if (*len > 0) {
+        char *buf = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (buf != MAP_FAILED &&
+            ( buf[*len - 1] == '\n' || *len % sysconf(_SC_PAGESIZE) != 0 )) {
+            close(fd);
+            *mapped = true;
+            return buf;
+        }
+        if (buf != MAP_FAILED) {
+            munmap(buf, *len);
+        }
+    }
+    char *buf = malloc(*len + 1);
+    size_t got = 0;
+    ssize_t n;
+    while (got < *len && ( n = read(fd, buf + got, *len - got) ) > 0) {
+        got += n;
+    }
+    close(fd);
+    if (got < *len) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+/**
+    Picks the partition for a key.  The routing hash is spread with a multiply so the
+    partition says little about the bits the partition's own table uses.
+    @param *key the key
+    @param len length of the key
+    @param parts number of partitions
+    @return the partition, from 0 to parts - 1
+ */
+static int partitionOf( char const *key, size_t len, int parts )
+{
+    uint32_t h = word_at_a_time_hash((uint8_t const *) key, len) * SPREAD;
+    return (int) ( ( (uint64_t) h * parts ) >> 32 );
+}
+
+/**
+    Adds a command to the end of a queue.
+    @param *q the queue
+    @param *op the command
+ */
+static void push( Queue *q, BulkOp const *op )
+{
+    if (q->count == q->cap) {
+        q->cap = q->cap ? q->cap * 2 : QUEUE_START;
+        q->ops = realloc(q->ops, q->cap * sizeof(BulkOp));
+    }
+    q->ops[q->count++] = *op;
+}
+
+/**
+    Splits one line into a set or remove and queues it for its key's partition.  A line
+    is checked the way the driver checks it, but the value isn't parsed yet.
+    @param *c the chunk the line is in
+    @param *line the line, followed by a '\0' at line + len
+    @param len length of the line
+    @return false if the line isn't a valid set or remove
+ */
+static bool queueLine( Chunk *c, char *line, size_t len )
+{
+    Command cmd;
+    if (!parseCommand(line, len, &cmd) || cmd.keyLen == 0) {
+        return false;
+    }
+    BulkOp op = { .value = NULL, .ttl = 0 };
+    if (strcmp(cmd.name, "set") == 0) {
+        if (cmd.value == cmd.end) {
+            return false;
+        }
+        op.key = commandKey(&cmd);
+        char *stop = splitExpiry(cmd.value, (char *) cmd.end, &op.ttl);
+        if (stop == NULL) {
+            return false;
+        }
+        op.value = cmd.value;
+        op.valueLen = stop - cmd.value;
+    } else if (strcmp(cmd.name, "remove") == 0) {
+        op.key = commandKey(&cmd);
+    } else {
+        return false;
+    }
+    push(&c->queues[partitionOf(op.key, cmd.keyLen, c->parts)], &op);
+    return true;
+}
+
+/**
+    Splits a chunk into lines and queues each command, stopping at the first line that
+    isn't a valid one.
+    @param *arg the Chunk
+    @return NULL
+ */
+static void *splitChunk( void *arg )
+{
+    Chunk *c = arg;
+    for (char *line = c->start; line < c->end; ) {
+        char *nl = memchr(line, '\n', c->end - line);
+        char *stop = nl ? nl : c->end;
+        *stop = '\0';
+        c->lines++;
+        if (!queueLine(c, line, stop - line)) {
+            c->badLine = c->lines;
+            return NULL;
+        }
+        line = stop + 1;
+    }
+    return NULL;
+}
+
+/**
+    Applies a partition's queued commands from every chunk of the round, in file order,
+    and empties the queues.  Values are parsed here, from the partition's own arena if
+    it has one, so no two threads ever allocate from the same arena.
+    @param *arg the Partition
+    @return NULL
+ */
+static void *applyPartition( void *arg )
+{
+    Partition *p = arg;
+    Arena *arena = mapArena(p->map);
+    for (int c = 0; c < p->count; c++) {
+        Queue *q = &p->chunks[c].queues[p->index];
+        for (int i = 0; i < q->count; i++) {
+            BulkOp const *op = &q->ops[i];
+            if (op->value == NULL) {
+                mapRemove(p->map, op->key);
+                if (p->removed != NULL) {
+                    mapSet(p->removed, op->key, makeIntegerIn(0, NULL));
+                }
+                continue;
+            }
+            // As in the driver, a set whose value doesn't parse changes nothing.
+            Value *val = parseValueIn(op->value, op->valueLen, arena);
+            if (val == NULL) {
+                continue;
+            }
+            mapSet(p->map, op->key, val);
+            if (p->removed != NULL) {
+                mapRemove(p->removed, op->key);
+            }
+            if (op->ttl > 0) {
+                mapExpireAt(p->map, op->key, mapNow() + op->ttl);
+            }
+        }
+        q->count = 0;
+    }
+    return NULL;
+}
+
+/**
+    Runs a function on each of several items, one thread per item, and waits for all
+    of them.
+    @param count number of items
+    @param run the function
+    @param *items the first item
+    @param size size of each item
+ */
+static void runThreads( int count, void *(*run)( void * ), void *items, size_t size )
+{
+    pthread_t *ids = malloc(count * sizeof(pthread_t));
+    for (int i = 0; i < count; i++) {
+        pthread_create(&ids[i], NULL, run, (char *) items + i * size);
+    }
+    for (int i = 0; i < count; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    free(ids);
+}
+
+/**
+    Finds where a chunk that should end near some position really ends: just past the
+    next newline.
+    @param *buf the file
+    @param len length of the file
+    @param pos where the chunk would end
+    @return the position just past the line that pos is in
+ */
+static size_t lineEnd( char const *buf, size_t len, size_t pos )
+{
+    if (pos >= len) {
+        return len;
+    }
+    char const *nl = memchr(buf + pos - 1, '\n', len - pos + 1);
+    return nl ? nl - buf + 1 : len;
+}
+
+/**
+    Moves a key whose last command was a remove out of the map being loaded.
+    @param *key the key
+    @param *val unused
+    @param *arg the map
+ */
+static void removeKey( char const *key, Value *val, void *arg )
+{
+    mapRemove(arg, key);
+}
+
+/** Where logPair() and logRemove() add a partition's keys to the log. */
+typedef struct {
+  /** The partition's map. */
+  Map *map;
+
+  /** The log. */
+  Wal *wal;
+
+  /** False once a record couldn't be added. */
+  bool ok;
+} PartitionLog;
+
+/**
+    Adds a set of one pair of a partition to the log, with its expiry time if it has one.
+    @param *key the key
+    @param *val the value
+    @param *arg the PartitionLog
+ */
+static void logPair( char const *key, Value *val, void *arg )
+{
+    PartitionLog *log = arg;
+    double deadline = mapDeadline(log->map, key);
+    log->ok = log->ok && walSet(log->wal, key, val) &&
+              ( deadline == 0 || walExpire(log->wal, key, deadline) );
+}
+
+/**
+    Adds a remove of a key whose last command was a remove to the log.
+    @param *key the key
+    @param *val unused
+    @param *arg the PartitionLog
+ */
+static void logRemove( char const *key, Value *val, void *arg )
+{
+    PartitionLog *log = arg;
+    log->ok = log->ok && walRemove(log->wal, key);
+}
+
+/**
+    Runs a file of "set" and "remove" commands against a map, with the same result as
+    running them through the driver one at a time.  The file is split at line
+    boundaries and read on several threads; each key is routed by its hash to one of
+    as many partitions, each filled by its own thread in file order, so the last
+    command for a key wins.  The partitions are then moved into the map.
+    @param *m the map to load into
+    @param *path name of the file
+    @param threads number of threads, and partitions, to use
+    @param *wal log to add what each key ended up as to before the map changes, with
+                absolute expiry times, or NULL
+    @param *stats filled in with what the load did
+    @return false if the file can't be read, has a line that isn't a valid set or
+            remove, or the log can't be written, in which case the map is left
+            unchanged
+ */
+bool bulkLoad( Map *m, char const *path, int threads, Wal *wal, BulkStats *stats )
+{
+    *stats = (BulkStats) { 0 };
+    size_t len;
+    bool mapped;
+    char *buf = readFile(path, &len, &mapped);
+    if (buf == NULL) {
+        return false;
+    }
+    if (mapped) {
+        posix_madvise(buf, len, POSIX_MADV_SEQUENTIAL);
+    }
+
+    Chunk *chunks = calloc(threads, sizeof(Chunk));
+    Partition *parts = calloc(threads, sizeof(Partition));
+    for (int i = 0; i < threads; i++) {
+        chunks[i].parts = threads;
+        chunks[i].queues = calloc(threads, sizeof(Queue));
+        parts[i].map = makeMapLike(m, PART_BUCKETS);
+        parts[i].removed = mapSize(m) > 0 ? makeMap(PART_BUCKETS) : NULL;
+        parts[i].chunks = chunks;
+        parts[i].count = threads;
+        parts[i].index = i;
+    }
+
+    bool ok = true;
+    for (size_t pos = 0; pos < len && ok; ) {
+        size_t round = len - pos;
+        if (round > (size_t) threads * ROUND_BYTES) {
+            round = (size_t) threads * ROUND_BYTES;
+        }
+        size_t base = pos;
+        for (int i = 0; i < threads; i++) {
+            size_t end = lineEnd(buf, len, base + round * ( i + 1 ) / threads);
+            chunks[i].start = buf + pos;
+            chunks[i].end = buf + ( end > pos ? end : pos );
+            chunks[i].lines = chunks[i].badLine = 0;
+            pos = chunks[i].end - buf;
+        }
+
+        double start = now();
+        runThreads(threads, splitChunk, chunks, sizeof(Chunk));
+        stats->parseSeconds += now() - start;
+        for (int i = 0; i < threads && ok; i++) {
+            if (chunks[i].badLine != 0) {
+                stats->badLine = stats->commands + chunks[i].badLine;
+                ok = false;
+            }
+            stats->commands += chunks[i].lines;
+        }
+        if (ok) {
+            start = now();
+            runThreads(threads, applyPartition, parts, sizeof(Partition));
+            stats->applySeconds += now() - start;
+        }
+    }
+
+    // Logging the outcome rather than the file keeps a replay from depending on the
+    // file, or on when it runs: expiry times are already absolute.
+    if (ok && wal != NULL) {
+        PartitionLog log = { NULL, wal, true };
+        for (int i = 0; i < threads && log.ok; i++) {
+            log.map = parts[i].map;
+            if (parts[i].removed != NULL) {
+                mapForEach(parts[i].removed, logRemove, &log);
+            }
+            mapForEach(parts[i].map, logPair, &log);
+        }
+        stats->logFailed = !log.ok;
+        ok = log.ok;
+    }
+
+    // The keys of different partitions never overlap, so the order they merge in
+    // doesn't matter.
+    double start = now();
+    for (int i = 0; i < threads; i++) {
+        if (ok) {
+            if (parts[i].removed != NULL) {
+                mapForEach(parts[i].removed, removeKey, m);
+            }
+            mapAbsorb(m, parts[i].map);
+        } else {
+            freeMap(parts[i].map);
+        }
+        if (parts[i].removed != NULL) {
+            freeMap(parts[i].removed);
+        }
+        for (int j = 0; j < threads; j++) {
+            free(chunks[i].queues[j].ops);
+        }
+        free(chunks[i].queues);
+    }
+    stats->mergeSeconds = now() - start;
+    free(parts);
+    free(chunks);
+    if (mapped) {
+        munmap(buf, len);
+    } else {
+        free(buf);
+    }
+    return ok;
+}
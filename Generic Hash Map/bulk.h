@@ -0,0 +1,59 @@
+/**
+    @file bulk.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for bulk.c, which loads a file of set and remove commands
+    into a map on several threads
+ */
+#ifndef BULK_H
+#define BULK_H
+
+#include "map.h"
+#include "wal.h"
+#include <stdbool.h>
+
+/** What a bulk load did, filled in by bulkLoad(). */
+typedef struct {
+  /** Number of set and remove commands read. */
+  long commands;
+
+  /** Line number of the first line that isn't a valid set or remove, or 0. */
+  long badLine;
+
+  /** Seconds spent splitting lines and routing commands to partitions. */
+  double parseSeconds;
+
+  /** Seconds spent parsing values and applying the commands to the partitions. */
+  double applySeconds;
+
+  /** Seconds spent moving the partitions into the map. */
+  double mergeSeconds;
+
+  /** True if the load's changes couldn't be added to the log. */
+  bool logFailed;
+} BulkStats;
+
+/**
+    Returns the number of threads to load with when none is given: one per core.
+    @return the number of threads
+ */
+int bulkThreads( void );
+
+/**
+    Runs a file of "set" and "remove" commands against a map, with the same result as
+    running them through the driver one at a time.  The file is split at line
+    boundaries and read on several threads; each key is routed by its hash to one of
+    as many partitions, each filled by its own thread in file order, so the last
+    command for a key wins.  The partitions are then moved into the map.
+    @param *m the map to load into
+    @param *path name of the file
+    @param threads number of threads, and partitions, to use
+    @param *wal log to add what each key ended up as to before the map changes, with
+                absolute expiry times, or NULL
+    @param *stats filled in with what the load did
+    @return false if the file can't be read, has a line that isn't a valid set or
+            remove, or the log can't be written, in which case the map is left
+            unchanged
+ */
+bool bulkLoad( Map *m, char const *path, int threads, Wal *wal, BulkStats *stats );
+
+#endif
@@ -0,0 +1,157 @@
+/**
+    @file command.c
+    @author Sachi Vyas (smvyas)
+    A program that: Splits a driver command line into its command word, key and value with a
+    single pass over the characters, in place of several sscanf calls on a copy of the line.
+ */
+#include "command.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+    Copies the next whitespace-separated word, skipping whitespace before it.
+    @param *p where to start looking
+    @param *end end of the line
+    @param *word buffer to copy the word into
+    @param limit most characters to copy; a longer word is cut off here
+    @return pointer just past the copied characters
+ */
+static char const *scanWord( char const *p, char const *end, char *word, int limit )
+{
+    while (p < end && isspace((unsigned char) *p)) {
+        p++;
+    }
+    int n = 0;
+    while (p < end && n < limit && !isspace((unsigned char) *p)) {
+        word[n++] = *p++;
+    }
+    word[n] = '\0';
+    return p;
+}
+
+/**
+    Skips spaces and tabs.
+    @param *p where to start
+    @param *end end of the line
+    @return pointer to the first other character
+ */
+static char *skipBlanks( char *p, char const *end )
+{
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+/**
+    Splits a command line into a command word, a key and the text after them.  Words are
+    split on whitespace, and the command word is cut off at NAME_LIMIT characters the way
+    sscanf's "%15s" would, but the line isn't copied or scanned twice.  Keys point into
+    the line, so they can be any length.
+    @param *line start of the line, which must be followed by a '\0' at line + len
+    @param len number of characters in the line
+    @param *cmd structure to fill in
+    @return false if the line has no command word
+ */
+bool parseCommand( char *line, size_t len, Command *cmd )
+{
+    char *end = line + len;
+    cmd->end = end;
+    char *p = line + ( scanWord(line, end, cmd->name, NAME_LIMIT) - line );
+    while (p < end && isspace((unsigned char) *p)) {
+        p++;
+    }
+    cmd->args = p;
+    cmd->key = p;
+    while (p < end && !isspace((unsigned char) *p)) {
+        p++;
+    }
+    cmd->keyLen = p - cmd->key;
+    cmd->rest = skipBlanks(p, end);
+    cmd->value = cmd->rest;
+    while (cmd->value < end && isspace((unsigned char) *cmd->value)) {
+        cmd->value++;
+    }
+    return cmd->name[0] != '\0';
+}
+
+/**
+    Ends a command's key with a '\0' by writing over the whitespace after it.
+    @param *cmd a parsed command
+    @return the key
+ */
+char const *commandKey( Command const *cmd )
+{
+    cmd->key[cmd->keyLen] = '\0';
+    return cmd->key;
+}
+
+/**
+    Splits the next whitespace-separated word off in place, ending it with a '\0'.
+    @param *p where to start looking
+    @param *end end of the line
+    @param **word set to the word, or to NULL if there are no more
+    @return pointer to where the next word can be looked for
+ */
+char *splitWord( char *p, char const *end, char **word )
+{
+    while (p < end && isspace((unsigned char) *p)) {
+        p++;
+    }
+    if (p == end) {
+        *word = NULL;
+        return p;
+    }
+    *word = p;
+    while (p < end && !isspace((unsigned char) *p)) {
+        p++;
+    }
+    if (p < end) {
+        *p++ = '\0';
+    }
+    return p;
+}
+
+/**
+    Splits an "ex seconds" option off the end of a set's value.  The option is only
+    looked for as the last two words, after the value, and not inside a quoted string.
+    @param *value start of the value
+    @param *end end of the line
+    @param *ttl set to the number of seconds the key should live, or 0 if there is no
+                option
+    @return the end of the value, which is followed by a '\0', or NULL if the option is
+            there but the time isn't a positive number
+ */
+char *splitExpiry( char *value, char *end, double *ttl )
+{
+    *ttl = 0;
+    char *p = end;
+    while (p > value && isspace((unsigned char) p[-1])) {
+        p--;
+    }
+    char *number = p;
+    while (number > value && !isspace((unsigned char) number[-1])) {
+        number--;
+    }
+    char *option = number;
+    while (option > value && isspace((unsigned char) option[-1])) {
+        option--;
+    }
+    option -= 2;
+    if (option <= value || option == number - 2 || strncmp(option, "ex", 2) != 0 ||
+        !isspace((unsigned char) option[-1]) || memchr(number, '"', p - number) != NULL) {
+        return end;
+    }
+    *p = '\0';
+    char *rest;
+    *ttl = strtod(number, &rest);
+    if (rest != p || !(*ttl > 0)) {
+        return NULL;
+    }
+    while (isspace((unsigned char) option[-1])) {
+        option--;
+    }
+    *option = '\0';
+    return option;
+}
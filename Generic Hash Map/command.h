@@ -0,0 +1,85 @@
+/**
+    @file command.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for command.c, which splits a driver command line into its parts
+ */
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "map.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Longest command word that is kept; the rest of a longer word is left in args. */
+#define NAME_LIMIT 15
+
+/** A command line split into its parts.  The pointers point into the line. */
+typedef struct {
+  /** The command word, e.g. "set", or empty if the line is blank. */
+  char name[ NAME_LIMIT + 1 ];
+
+  /** Text after the command word with leading whitespace skipped, not cut off anywhere. */
+  char *args;
+
+  /** The first argument, however long.  It isn't followed by a '\0' until commandKey()
+      is called. */
+  char *key;
+
+  /** Length of the first argument, or 0 if there isn't one. */
+  size_t keyLen;
+
+  /** Text after the key with leading spaces and tabs skipped. */
+  char *rest;
+
+  /** Text after the key with all leading whitespace skipped (the value of a set). */
+  char *value;
+
+  /** End of the line. */
+  char const *end;
+} Command;
+
+/**
+    Splits a command line into a command word, a key and the text after them.  Words are
+    split on whitespace, and the command word is cut off at NAME_LIMIT characters the way
+    sscanf's "%15s" would, but the line isn't copied or scanned twice.  Keys point into
+    the line, so they can be any length.
+    @param *line start of the line, which must be followed by a '\0' at line + len
+    @param len number of characters in the line
+    @param *cmd structure to fill in
+    @return false if the line has no command word
+ */
+bool parseCommand( char *line, size_t len, Command *cmd );
+
+/**
+    Ends a command's key with a '\0' by writing over the whitespace after it, so it can
+    be used as a string.  Text after the key is left alone, but args no longer reads
+    as one string.
+    @param *cmd a parsed command
+    @return the key
+ */
+char const *commandKey( Command const *cmd );
+
+/**
+    Splits the next whitespace-separated word off in place, skipping whitespace before
+    it and ending it with a '\0'.  Commands with more than one key use this to pick the
+    later ones out of the line.
+    @param *p where to start looking
+    @param *end end of the line
+    @param **word set to the word, or to NULL if there are no more
+    @return pointer to where the next word can be looked for
+ */
+char *splitWord( char *p, char const *end, char **word );
+
+/**
+    Splits an "ex seconds" option off the end of a set's value.  The option is only
+    looked for as the last two words, after the value, and not inside a quoted string.
+    @param *value start of the value
+    @param *end end of the line
+    @param *ttl set to the number of seconds the key should live, or 0 if there is no
+                option
+    @return the end of the value, which is followed by a '\0', or NULL if the option is
+            there but the time isn't a positive number
+ */
+char *splitExpiry( char *value, char *end, double *ttl );
+
+#endif
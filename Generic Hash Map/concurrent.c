@@ -0,0 +1,233 @@
+/**
+    @file concurrent.c
+    @author Sachi Vyas (smvyas)
+    A program that: Shares one map between threads by splitting it into stripes, each an
+    ordinary Map guarded by its own reader / writer lock, or an RcuTable whose readers
+    take no lock at all.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "concurrent.h"
+#include "rcu.h"
+#include "epoch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/** Size of a cache line; each stripe gets its own so locks don't share one. */
+#define CACHE_LINE 64
+
+/** One stripe: a table holding a range of hashes and the lock that guards it. */
+typedef struct {
+  /** Lock taken for writing by sets and removes, and for reading by lookups in a Map. */
+  pthread_rwlock_t lock;
+
+  /** Map holding this stripe's keys, or NULL if lookups are lock-free. */
+  Map *map;
+
+  /** Table holding this stripe's keys when lookups are lock-free, or NULL. */
+  RcuTable *rcu;
+} __attribute__(( aligned( CACHE_LINE ) )) Stripe;
+
+/** Representation of a striped concurrent map. */
+struct ConcurrentMapStruct {
+  /** Array of stripes. */
+  Stripe *stripes;
+
+  /** Number of stripes. */
+  int count;
+
+  /** Function used to pick a stripe for a key; the stripe's map uses it too. */
+  HashFunction hash;
+};
+
+/**
+    Picks the stripe for a key from the top bits of its hash.  The table inside the stripe
+    picks a bucket from the low bits, so the two choices don't line up.
+    @param *m the map
+    @param *key the key
+    @param *hash filled in with the hash of the key
+    @return the stripe that holds the key
+ */
+static Stripe *stripeFor( ConcurrentMap *m, char const *key, uint32_t *hash )
+{
+    *hash = m->hash((const uint8_t *) key, strlen(key));
+    return &m->stripes[ ( (uint64_t) *hash * m->count ) >> 32 ];
+}
+
+/**
+    Allocates the stripes of a map, aligned to cache lines.
+    @param *m the map
+    @param stripes number of stripes
+    @param hash function used to hash keys
+ */
+static void makeStripes( ConcurrentMap *m, int stripes, HashFunction hash )
+{
+    void *mem;
+    posix_memalign(&mem, CACHE_LINE, stripes * sizeof(Stripe));
+    m->stripes = (Stripe *) mem;
+    m->count = stripes;
+    m->hash = hash;
+    for (int i = 0; i < stripes; i++) {
+        pthread_rwlock_init(&m->stripes[i].lock, NULL);
+        m->stripes[i].map = NULL;
+        m->stripes[i].rcu = NULL;
+    }
+}
+
+/**
+    Makes an empty map split into stripes.  Each stripe owns the keys whose hashes fall in
+    one range and has its own lock, so threads working on different stripes don't wait
+    for each other.
+    @param len total number of buckets to start with, shared among the stripes
+    @param stripes number of stripes; 1 gives a single lock around the whole map
+    @param *opts settings for the map in each stripe; arena and maxBytes are not
+                 supported and are ignored
+    @return a pointer to the allocated map
+ */
+ConcurrentMap *makeConcurrentMap( int len, int stripes, MapOptions const *opts )
+{
+    // A caller can't allocate a value from a stripe's arena without holding its lock.
+    MapOptions stripeOpts = *opts;
+    stripeOpts.arena = false;
+    // Under a memory cap every lookup marks its key as used, a write that readers
+    // sharing a stripe's lock would race on.
+    stripeOpts.maxBytes = 0;
+    if (stripeOpts.hash == NULL) {
+        stripeOpts.hash = jenkins_one_at_a_time_hash;
+    }
+    int stripeLen = len / stripes > 0 ? len / stripes : 1;
+
+    ConcurrentMap *m = (ConcurrentMap *) malloc(sizeof(ConcurrentMap));
+    makeStripes(m, stripes, stripeOpts.hash);
+    for (int i = 0; i < stripes; i++) {
+        m->stripes[i].map = makeMapWith(stripeLen, &stripeOpts);
+    }
+    return m;
+}
+
+/**
+    Makes an empty map whose lookups never take a lock.  Sets and removes still lock one
+    stripe, and values they replace or remove are freed only once no lookup can still
+    be reading them.
+    @param len total number of buckets to start with, shared among the stripes
+    @param stripes number of stripes, each with its own lock for writers
+    @param hash function used to hash keys, or NULL for jenkins_one_at_a_time_hash
+    @return a pointer to the allocated map
+ */
+ConcurrentMap *makeLockFreeMap( int len, int stripes, HashFunction hash )
+{
+    ConcurrentMap *m = (ConcurrentMap *) malloc(sizeof(ConcurrentMap));
+    makeStripes(m, stripes, hash ? hash : jenkins_one_at_a_time_hash);
+    for (int i = 0; i < stripes; i++) {
+        m->stripes[i].rcu = makeRcuTable(len / stripes);
+    }
+    return m;
+}
+
+/**
+    Returns the number of key / value pairs in the map.  Each stripe is counted under its
+    own lock, so the total may be stale if other threads are changing the map.
+    @param *m pointer to the map
+    @return the size of the map
+ */
+int concurrentMapSize( ConcurrentMap *m )
+{
+    int size = 0;
+    for (int i = 0; i < m->count; i++) {
+        if (m->stripes[i].rcu != NULL) {
+            size += rcuSize(m->stripes[i].rcu);
+            continue;
+        }
+        pthread_rwlock_rdlock(&m->stripes[i].lock);
+        size += mapSize(m->stripes[i].map);
+        pthread_rwlock_unlock(&m->stripes[i].lock);
+    }
+    return size;
+}
+
+/**
+    Stores a key / value pair, replacing and freeing any value already stored for the key.
+    The map takes ownership of the value.
+    @param *m pointer to the map
+    @param *key pointer to the key to store
+    @param *val pointer to the value to store
+ */
+void concurrentMapSet( ConcurrentMap *m, char const *key, Value *val )
+{
+    uint32_t hash;
+    Stripe *s = stripeFor(m, key, &hash);
+    pthread_rwlock_wrlock(&s->lock);
+    if (s->rcu != NULL) {
+        rcuSet(s->rcu, hash, key, val);
+    } else {
+        mapSet(s->map, key, val);
+    }
+    pthread_rwlock_unlock(&s->lock);
+}
+
+/**
+    Looks up a key and, if it is there, calls visit with its value while other threads
+    are kept from freeing it.  Several threads can look up keys in the same stripe at once,
+    and in a lock-free map lookups don't wait for sets or removes either.
+    @param *m pointer to the map
+    @param *key pointer to the key to find
+    @param visit function to call with the value
+    @param *arg passed on to visit
+    @return true if the key was found
+ */
+bool concurrentMapGet( ConcurrentMap *m, char const *key, ValueVisitor visit, void *arg )
+{
+    uint32_t hash;
+    Stripe *s = stripeFor(m, key, &hash);
+    if (s->rcu != NULL) {
+        return rcuGet(s->rcu, hash, key, visit, arg);
+    }
+    // mapGet() never moves entries, even while the table is growing, so readers can
+    // share the lock.
+    pthread_rwlock_rdlock(&s->lock);
+    Value *val = mapGet(s->map, key);
+    if (val != NULL) {
+        visit(val, arg);
+    }
+    pthread_rwlock_unlock(&s->lock);
+    return val != NULL;
+}
+
+/**
+    Removes a key and frees its value.
+    @param *m pointer to the map
+    @param *key pointer to the key to remove
+    @return true if the key was in the map
+ */
+bool concurrentMapRemove( ConcurrentMap *m, char const *key )
+{
+    uint32_t hash;
+    Stripe *s = stripeFor(m, key, &hash);
+    pthread_rwlock_wrlock(&s->lock);
+    bool removed = s->rcu != NULL ? rcuRemove(s->rcu, hash, key) : mapRemove(s->map, key);
+    pthread_rwlock_unlock(&s->lock);
+    return removed;
+}
+
+/**
+    Frees the map and every value still stored in it.  No other thread may be using it.
+    This also waits for values the calling thread replaced or removed in a lock-free map
+    to be freed.
+    @param *m pointer to the map to free
+ */
+void freeConcurrentMap( ConcurrentMap *m )
+{
+    for (int i = 0; i < m->count; i++) {
+        if (m->stripes[i].rcu != NULL) {
+            freeRcuTable(m->stripes[i].rcu);
+        } else {
+            freeMap(m->stripes[i].map);
+        }
+        pthread_rwlock_destroy(&m->stripes[i].lock);
+    }
+    free(m->stripes);
+    free(m);
+    // Values this thread replaced or removed may still be waiting to be freed.
+    epochBarrier();
+}
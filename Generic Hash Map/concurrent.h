@@ -0,0 +1,91 @@
+/**
+    @file concurrent.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for concurrent.c, a map that can be shared between threads
+ */
+#ifndef CONCURRENT_H
+#define CONCURRENT_H
+
+#include "map.h"
+#include "value.h"
+#include <stdbool.h>
+
+/** Incomplete type for a map that several threads can use at once. */
+typedef struct ConcurrentMapStruct ConcurrentMap;
+
+/**
+    Function called with a value while the part of the map holding it is locked.
+    @param *val the value that was found
+    @param *arg the argument given to concurrentMapGet()
+ */
+typedef void (*ValueVisitor)( Value const *val, void *arg );
+
+/**
+    Makes an empty map split into stripes.  Each stripe owns the keys whose hashes fall in
+    one range and has its own lock, so threads working on different stripes don't wait
+    for each other.
+    @param len total number of buckets to start with, shared among the stripes
+    @param stripes number of stripes; 1 gives a single lock around the whole map
+    @param *opts settings for the map in each stripe; arena and maxBytes are not
+                 supported and are ignored
+    @return a pointer to the allocated map
+ */
+ConcurrentMap *makeConcurrentMap( int len, int stripes, MapOptions const *opts );
+
+/**
+    Makes an empty map whose lookups never take a lock.  Sets and removes still lock one
+    stripe, and values they replace or remove are freed only once no lookup can still
+    be reading them.
+    @param len total number of buckets to start with, shared among the stripes
+    @param stripes number of stripes, each with its own lock for writers
+    @param hash function used to hash keys, or NULL for jenkins_one_at_a_time_hash
+    @return a pointer to the allocated map
+ */
+ConcurrentMap *makeLockFreeMap( int len, int stripes, HashFunction hash );
+
+/**
+    Returns the number of key / value pairs in the map.  Each stripe is counted under its
+    own lock, so the total may be stale if other threads are changing the map.
+    @param *m pointer to the map
+    @return the size of the map
+ */
+int concurrentMapSize( ConcurrentMap *m );
+
+/**
+    Stores a key / value pair, replacing and freeing any value already stored for the key.
+    The map takes ownership of the value.
+    @param *m pointer to the map
+    @param *key pointer to the key to store
+    @param *val pointer to the value to store
+ */
+void concurrentMapSet( ConcurrentMap *m, char const *key, Value *val );
+
+/**
+    Looks up a key and, if it is there, calls visit with its value while other threads
+    are kept from freeing it.  Several threads can look up keys in the same stripe at once,
+    and in a lock-free map lookups don't wait for sets or removes either.
+    @param *m pointer to the map
+    @param *key pointer to the key to find
+    @param visit function to call with the value
+    @param *arg passed on to visit
+    @return true if the key was found
+ */
+bool concurrentMapGet( ConcurrentMap *m, char const *key, ValueVisitor visit, void *arg );
+
+/**
+    Removes a key and frees its value.
+    @param *m pointer to the map
+    @param *key pointer to the key to remove
+    @return true if the key was in the map
+ */
+bool concurrentMapRemove( ConcurrentMap *m, char const *key );
+
+/**
+    Frees the map and every value still stored in it.  No other thread may be using it.
+    This also waits for values the calling thread replaced or removed in a lock-free map
+    to be freed.
+    @param *m pointer to the map to free
+ */
+void freeConcurrentMap( ConcurrentMap *m );
+
+#endif
@@ -8,135 +8,653 @@
 #include <string.h>
 #include <stdbool.h>
 #include <setjmp.h>
+#include <ctype.h>
 #include <unistd.h> // Unix-specific isatty() function.
 #include "map.h"
 #include "value.h"
 #include "input.h"
-/** Maximum length of the command string */
-#define CMD_LENGTH 10
-/** Maximum length of the value in case it is a long sentence */
-#define MAX_VALUE_LENGTH 1024
-/** Maximum number of observations in the map */
+#include "command.h"
+#include "wal.h"
+#include "server.h"
+#include "bulk.h"
+#include "latency.h"
+/** Number of buckets the map starts with; it grows as keys are added */
 #define MAP_MAX 1000
-/** Number of parameters to read in when using the set command */
-#define NUM_PARAMETERS 2
+/** Number of lines tokenized together before they are executed in batch mode */
+#define BATCH_SIZE 256
+/** Size of the stdout buffer in batch mode */
+#define OUTPUT_BUFFER ( 1024 * 1024 )
+/** Number of keys an mget or mset hands to the map at once */
+#define MULTI_CHUNK 64
+/** Number of log records committed together unless -commit says otherwise */
+#define GROUP_RECORDS 128
+/** Longest a log record waits to be committed unless -commit says otherwise */
+#define GROUP_MILLIS 10
+/** Number of pages of the table a background save writes after each command */
+#define SAVE_STEP 32
 /** Interactive boolean variable to check the -term */
 bool interactive = false;
+/** Write-ahead log of the changes made to the map, or NULL if -wal wasn't given */
+static Wal *wal = NULL;
+/** Save started by a bgsave command that hasn't finished, or NULL */
+static MapSave *background = NULL;
+/** Name of the file the background save is writing */
+static char backgroundPath[ FILENAME_MAX ];
+/** File the latency histograms are written to at exit, or NULL if -latency wasn't given */
+static char const *latencyPath = NULL;
+/** Clock reading where reading the next command's line started */
+static uint64_t readStart;
+/** Clock reading where the current phase of the running command started */
+static uint64_t phaseStart;
+/** Latency row of the running command */
+static int phaseRow;
+/** True once the running command has finished with the map and started printing */
+static bool printing;
 /** Print out a usage message and exit unsuccessfully. */
 static void usage()
 {
-  fprintf( stderr, "Usage: driver [-term]\n" );
+  fprintf( stderr, "Usage: driver [-term] [-robin] [-hash jenkins|fnv1a|word] [-arena] [-batch] [-wal file] [-commit records ms] [-serve socket] [-maxmemory bytes] [-load file] [-threads n] [-intern] [-latency file]\n" );
   exit( EXIT_FAILURE );
 }
+
+/** Commits whatever is left in the write-ahead log when the program exits. */
+static void closeLog()
+{
+  if ( wal != NULL && !closeWal( wal ) ) {
+    fprintf( stderr, "Error: Cannot write log\n" );
+  }
+  wal = NULL;
+}
+
 /**
-    Handles the different commands present and updates the given map or prints it to the terminal
-    @param *map a pointer to the map to make changes to
-    @param *line the line to parse through
-    @param *env allows the method to signal errors to its caller without terminating the program
-    @return bool to show if the command was executed successfully or not
+    Stops the program if a record couldn't be added to the write-ahead log.
+    @param ok result of adding the record
+ */
+static void checkLog( bool ok )
+{
+  if ( !ok ) {
+    fprintf( stderr, "Error: Cannot write log\n" );
+    exit( EXIT_FAILURE );
+  }
+}
+/** Writes the latency histograms to the -latency file when the program exits. */
+static void writeLatency()
+{
+  FILE *fp = fopen( latencyPath, "w" );
+  if ( fp == NULL ) {
+    fprintf( stderr, "Error: Cannot write %s\n", latencyPath );
+    return;
+  }
+  latencyReport( fp );
+  fclose( fp );
+}
+
+/**
+    Ends the running command's current phase, adding its time to the command's
+    histogram, and starts the next.  Each phase starts at the reading of the clock that
+    ended the one before, so a command reads it once per phase.
+    @param phase the phase that ended
+ */
+static void endPhase( LatencyPhase phase )
+{
+  uint64_t now = latencyClock();
+  latencyRecord( phaseRow, phase, now - phaseStart );
+  phaseStart = now;
+}
+
+/** Marks where the running command is done with the map and starts printing. */
+static void startPrinting()
+{
+  if ( latencyPath != NULL && !printing ) {
+    endPhase( LATENCY_EXECUTE );
+    printing = true;
+  }
+}
+
+/**
+    Finishes the background save, if one is running, writing whatever it has left.
+ */
+static void endBackgroundSave()
+{
+  if ( background == NULL ) {
+    return;
+  }
+  bool ok = mapSaveEnd( background );
+  background = NULL;
+  if ( !ok ) {
+    if ( !interactive ) {
+      fprintf( stderr, "Error: Cannot bgsave %s\n", backgroundPath );
+      exit( EXIT_FAILURE );
+    }
+    printf( "Cannot bgsave %s\n", backgroundPath );
+  }
+}
+
+/**
+    Finishes a background save still running when the program stops on an error, so
+    the file is written even though the commands after it failed.  It reports a save
+    that can't be written, but leaves the exit status alone.
+ */
+static void finishBackgroundSave()
+{
+  if ( background != NULL && !mapSaveEnd( background ) ) {
+    fprintf( stderr, "Error: Cannot bgsave %s\n", backgroundPath );
+  }
+  background = NULL;
+}
+
+/** Writes a few more pages of the background save, if one is running. */
+static void stepBackgroundSave()
+{
+  if ( background != NULL && !mapSaveStep( background, SAVE_STEP ) ) {
+    endBackgroundSave();
+  }
+}
+
+/**
+    Prints one key / value pair found by a scan or prefix command.
+    @param *key the key
+    @param *val its value
+    @param *arg unused
+ */
+static void printPair( char const *key, Value *val, void *arg )
+{
+    startPrinting();
+    fputs(key, stdout);
+    putchar(' ');
+    valuePrint(val);
+    putchar('\n');
+}
+
+/**
+    Prints the value of a get, or reports the missing key the way get does.
+    @param *name the command, for the error message
+    @param *key the key looked up
+    @param *val its value, or NULL if it isn't in the map
+ */
+static void printFound(char const *name, char const *key, Value const *val)
+{
+    startPrinting();
+    if (val != NULL) {
+        valuePrint(val);
+        putchar('\n');
+    }
+    else if (!interactive) {
+        fprintf(stderr, "Invalid command: %s%s%s\n", name, key[0] ? " " : "", key);
+        exit(EXIT_FAILURE);
+    }
+    else {
+        printf("%s\n", "Invalid command");
+    }
+}
+
+/**
+    Runs an mget: looks its keys up MULTI_CHUNK at a time with mapGetMany(), and prints
+    each value on its own line, in order.
+    @param *map the map
+    @param *cmd the command
+    @param *env allows the method to signal errors to its caller
+ */
+static void runMget(Map *map, Command const *cmd, jmp_buf *env)
+{
+    char const *keys[MULTI_CHUNK];
+    Value *vals[MULTI_CHUNK];
+    char *p = cmd->args;
+    int total = 0;
+    for (;;) {
+        int n = 0;
+        char *word;
+        while (n < MULTI_CHUNK) {
+            p = splitWord(p, cmd->end, &word);
+            if (word == NULL) {
+                break;
+            }
+            keys[n++] = word;
+        }
+        if (n == 0 && total == 0) {
+            fprintf(stderr, "Invalid command: %s\n", cmd->name);
+            longjmp(*env, 1);
+        }
+        mapGetMany(map, n, keys, vals);
+        for (int i = 0; i < n; i++) {
+            printFound(cmd->name, keys[i], vals[i]);
+        }
+        total += n;
+        if (n < MULTI_CHUNK) {
+            return;
+        }
+    }
+}
+
+/**
+    Finds the end of one value of an mset: a quoted string runs to its closing quote,
+    anything else to the next whitespace.
+    @param *p start of the value
+    @param *end end of the line
+    @return pointer just past the value
  */
-bool handleCommand(Map *map, char const *line, jmp_buf *env) 
+static char const *valueEnd(char const *p, char const *end)
 {
+    if (*p == '"') {
+        for (p++; p < end && *p != '"'; p++) {
+            if (*p == '\\' && p + 1 < end) {
+                p++;
+            }
+        }
+        return p < end ? p + 1 : p;
+    }
+    while (p < end && !isspace((unsigned char) *p)) {
+        p++;
+    }
+    return p;
+}
+
+/**
+    Runs an mset: parses its key / value pairs MULTI_CHUNK at a time and stores them with
+    mapSetMany().  Values are written like the value of a set, but a string must be
+    quoted if it contains whitespace.
+    @param *map the map
+    @param *cmd the command
+    @param *env allows the method to signal errors to its caller
+ */
+static void runMset(Map *map, Command const *cmd, jmp_buf *env)
+{
+    char const *keys[MULTI_CHUNK];
+    Value *vals[MULTI_CHUNK];
+    Arena *arena = mapArena(map);
+    char *p = cmd->args;
+    int total = 0;
+    for (;;) {
+        int n = 0;
+        bool bad = false;
+        char *word;
+        while (n < MULTI_CHUNK) {
+            p = splitWord(p, cmd->end, &word);
+            if (word == NULL) {
+                break;
+            }
+            while (p < cmd->end && isspace((unsigned char) *p)) {
+                p++;
+            }
+            char *start = p;
+            p = (char *) valueEnd(p, cmd->end);
+            // The value has to end the line or be followed by whitespace, which is
+            // overwritten so the parsers see it followed by a '\0'.
+            if (p == start || (p < cmd->end && !isspace((unsigned char) *p))) {
+                bad = true;
+                break;
+            }
+            int len = p - start;
+            if (p < cmd->end) {
+                *p++ = '\0';
+            }
+            keys[n] = word;
+            vals[n] = parseValueIn(start, len, arena);
+            n++;
+        }
+        if (bad || (n == 0 && total == 0)) {
+            for (int i = 0; i < n; i++) {
+                if (vals[i] != NULL) {
+                    valueDestroy(vals[i]);
+                }
+            }
+            fprintf(stderr, "Error: Invalid set command format\n");
+            longjmp(*env, 1);
+        }
+        for (int i = 0; i < n && wal != NULL; i++) {
+            if (vals[i] != NULL) {
+                checkLog(walSet(wal, keys[i], vals[i]));
+            }
+        }
+        mapSetMany(map, n, keys, vals);
+        total += n;
+        if (n < MULTI_CHUNK) {
+            return;
+        }
+    }
+}
 
-    int lenLine = strlen(line);
-    char *input = (char *)malloc(lenLine + 1);
+/**
+    Prints the map's statistics and the value allocation counts, one "name number" pair
+    per line.
+    @param *map the map
+ */
+static void printStats(Map *map)
+{
+    MapStats stats;
+    mapStats(map, &stats);
+    ValueStats values;
+    valueStats(&values);
+    startPrinting();
+    printf("entries %d\nbuckets %d\nload-factor %.3f\nresizes %d\n", stats.entries,
+           stats.buckets, stats.loadFactor, stats.resizes);
+    printf("max-chain %d\nmean-chain %.2f\n", stats.maxChain, stats.meanChain);
+    printf("table-bytes %zu\nnode-bytes %zu\nkey-bytes %zu\nvalue-bytes %zu\n"
+           "index-bytes %zu\n", stats.tableBytes, stats.nodeBytes, stats.keyBytes,
+           stats.valueBytes, stats.indexBytes);
+    printf("value-allocations %ld\nvalue-frees %ld\n", values.allocations, values.frees);
+    printf("interned-strings %ld\nintern-saved-bytes %ld\n", values.internedStrings,
+           values.internSavedBytes);
+    printf("expiring %d\nexpired %ld\nevicted %ld\n", stats.expiring, stats.expired,
+           stats.evicted);
+}
 
-    strcpy(input, line);
-    char *origInput = input;
-    char cmd[CMD_LENGTH];
-    int n = 0;
-    if (sscanf(input, "%15s%n", cmd, &n) != 1) {
+/**
+    Carries out one command that has already been split into its parts, updating the
+    map or printing to the terminal
+    @param *map a pointer to the map to make changes to
+    @param *cmd the command to run
+    @param *env allows the method to signal errors to its caller without terminating the program
+    @return true if the command was quit
+ */
+static bool executeCommand(Map *map, Command const *cmd, jmp_buf *env)
+{
+    if (cmd->name[0] == '\0') {
         fprintf(stderr, "Error: Invalid command format\n");
         longjmp(*env, 1);
     }
-    input += n;
-    while (*input == ' ' || *input == '\t') {
-        input++;
-    }
-    if (strcmp(cmd, "quit") == 0) {
+    if (strcmp(cmd->name, "quit") == 0) {
         return true;
     } 
-    else if (strcmp(cmd, "size") == 0) {
-        printf("%d\n", mapSize(map));
+    else if (strcmp(cmd->name, "size") == 0) {
+        int size = mapSize(map);
+        startPrinting();
+        printf("%d\n", size);
         return false;
     } 
-    else if (strcmp(cmd, "get") == 0) {
-        char k[KEY_LIMIT + 1];
-        int n = 0;
-        if (sscanf(input, "%24s%n", k, &n) != 1) {
-            fprintf(stderr, "Invalid command: %s\n", cmd);
+    else if (strcmp(cmd->name, "latency") == 0) {
+        startPrinting();
+        latencyReport(stdout);
+        return false;
+    }
+    else if (strcmp(cmd->name, "stats") == 0) {
+        printStats(map);
+        return false;
+    }
+    else if (strcmp(cmd->name, "get") == 0) {
+        if (cmd->keyLen == 0) {
+            fprintf(stderr, "Invalid command: %s\n", cmd->name);
             longjmp(*env, 1);
         }
-        input += n;
-        while (*input == ' ' || *input == '\t') {
-            input++;
-        }
-        if (*input != '\0') {
-            fprintf(stderr, "Invalid command: %s %s %s\n", cmd, k, input);
+        if (cmd->rest < cmd->end) {
+            fprintf(stderr, "Invalid command: %s %s %.*s\n", cmd->name, commandKey(cmd),
+                    (int) (cmd->end - cmd->rest), cmd->rest);
             exit(EXIT_FAILURE);
         }
-        Value *val = mapGet(map, k);
-        
-        if (val != NULL) {
-            val->print(val);
-            printf("\n");
-        } 
-        else {
-            if (!interactive) {
-                fprintf(stderr, "Invalid command: %s %s\n", cmd, k);
-                exit(EXIT_FAILURE);
-            }
-            else {
-                printf("%s\n", "Invalid command");
-            }
-        }
-        
+        char const *key = commandKey(cmd);
+        printFound(cmd->name, key, mapGet(map, key));
         return false;
     } 
+
+    else if (strcmp(cmd->name, "mget") == 0) {
+        runMget(map, cmd, env);
+        return false;
+    }
+
+    else if (strcmp(cmd->name, "mset") == 0) {
+        runMset(map, cmd, env);
+        return false;
+    }
     
-    else if (strcmp(cmd, "remove") == 0) {
-        char k[KEY_LIMIT + 1];
-        if (sscanf(input, "%24s", k) != 1) {
+    else if (strcmp(cmd->name, "remove") == 0) {
+        if (cmd->keyLen == 0) {
             fprintf(stderr, "Error: Missing or invalid key\n");
             longjmp(*env, 1);
         }
-        mapRemove(map, k);
+        char const *key = commandKey(cmd);
+        if (wal != NULL) {
+            checkLog(walRemove(wal, key));
+        }
+        mapRemove(map, key);
        
         return false;
     } 
     
-    else if (strcmp(cmd, "set") == 0) {
-        char key[KEY_LIMIT + 1];
-        char valueStr[MAX_VALUE_LENGTH];
-       
-        if (sscanf(input, "%24s %[^\n]", key, valueStr) != NUM_PARAMETERS) {
-            
+    else if (strcmp(cmd->name, "scan") == 0 || strcmp(cmd->name, "prefix") == 0) {
+        // Matching pairs are printed in key order as the index is walked.
+        char *last = NULL;
+        if (cmd->name[0] == 's') {
+            splitWord(cmd->rest, cmd->end, &last);
+        }
+        if (cmd->keyLen == 0 || (cmd->name[0] == 's' && last == NULL)) {
+            fprintf(stderr, "Error: Missing or invalid key\n");
+            longjmp(*env, 1);
+        }
+        char const *key = commandKey(cmd);
+        if (cmd->name[0] == 's') {
+            mapScan(map, key, last, printPair, NULL);
+        } else {
+            mapPrefix(map, key, printPair, NULL);
+        }
+        return false;
+    }
+
+    else if (strcmp(cmd->name, "save") == 0 || strcmp(cmd->name, "load") == 0 ||
+             strcmp(cmd->name, "bgsave") == 0) {
+        // The file name is the rest of the line, so it may be longer than a key.
+        char const *last = cmd->end;
+        while (last > cmd->args && isspace((unsigned char) last[-1])) {
+            last--;
+        }
+        char path[FILENAME_MAX];
+        if (last == cmd->args || (size_t) (last - cmd->args) >= sizeof(path)) {
+            fprintf(stderr, "Error: Missing or invalid file name\n");
+            longjmp(*env, 1);
+        }
+        memcpy(path, cmd->args, last - cmd->args);
+        path[last - cmd->args] = '\0';
+
+        // A bgsave only makes a view of the map; its pages are written between
+        // commands, and the map can change meanwhile without changing the file.
+        bool ok;
+        if (cmd->name[0] == 'b') {
+            ok = background == NULL && (background = mapSaveBegin(map, path)) != NULL;
+            if (ok) {
+                static bool finishAtExit = false;
+                if (!finishAtExit) {
+                    atexit(finishBackgroundSave);
+                    finishAtExit = true;
+                }
+                strcpy(backgroundPath, path);
+            }
+        } else {
+            ok = cmd->name[0] == 's' ? mapSave(map, path) : mapLoad(map, path);
+        }
+        if (ok && cmd->name[0] == 'l' && wal != NULL) {
+            checkLog(walLoad(wal, path));
+        }
+        if (!ok) {
+            if (!interactive) {
+                fprintf(stderr, "Error: Cannot %s %s\n", cmd->name, path);
+                exit(EXIT_FAILURE);
+            }
+            printf("Cannot %s %s\n", cmd->name, path);
+        }
+        return false;
+    }
+
+    else if (strcmp(cmd->name, "set") == 0) {
+        if (cmd->keyLen == 0 || cmd->value == cmd->end) {
             fprintf(stderr, "Error: Invalid set command format\n");
             longjmp(*env, 1);
         }
-        Value *val = NULL;
-        int len = strlen(valueStr);
-        if (valueStr[0] == '"' && valueStr[len - 1] == '"') {
-            val = parseString(valueStr);
-        } 
-        //&& strpbrk(valueStr, "0123456789") && strpbrk(valueStr, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz") == NULL
-        else if (strchr(valueStr, '.') != NULL) {
-            val = parseDouble(valueStr);
-        } 
-        else {
-            val = parseInteger(valueStr);
+        char const *key = commandKey(cmd);
+        double ttl;
+        char *stop = splitExpiry(cmd->value, (char *) cmd->end, &ttl);
+        if (stop == NULL) {
+            fprintf(stderr, "Error: Invalid set command format\n");
+            longjmp(*env, 1);
+        }
+        Value *val = parseValueIn(cmd->value, stop - cmd->value, mapArena(map));
+        if (val != NULL && wal != NULL) {
+            checkLog(walSet(wal, key, val));
         }
         mapSet(map, key, val);
+        // The expiry time is absolute, so a replayed log expires the key on time.
+        if (val != NULL && ttl > 0) {
+            double deadline = mapNow() + ttl;
+            if (wal != NULL) {
+                checkLog(walExpire(wal, key, deadline));
+            }
+            mapExpireAt(map, key, deadline);
+        }
+        return false;
+    }
+    else if (strcmp(cmd->name, "ttl") == 0) {
+        if (cmd->keyLen == 0) {
+            fprintf(stderr, "Error: Missing or invalid key\n");
+            longjmp(*env, 1);
+        }
+        // Whole seconds left, rounded up; -1 means no expiry and -2 no such key.
+        double left = mapTtl(map, commandKey(cmd));
+        startPrinting();
+        printf("%ld\n", left < 0 ? (long) left : (long) left + (left > (long) left));
+        return false;
+    }
+    else if (strcmp(cmd->name, "incr") == 0) {
+        // The stored number is changed in place; the log gets its new value as a set,
+        // followed by the key's deadline, since replaying a set clears it.
+        Value delta;
+        if (cmd->keyLen == 0 || cmd->value == cmd->end || !parseNumber(cmd->value, &delta)) {
+            fprintf(stderr, "Error: Invalid incr command format\n");
+            longjmp(*env, 1);
+        }
+        char const *key = commandKey(cmd);
+        Value *val = mapIncrement(map, key, &delta);
+        if (val != NULL && wal != NULL) {
+            double deadline = mapDeadline(map, key);
+            checkLog(walSet(wal, key, val));
+            if (deadline > 0) {
+                checkLog(walExpire(wal, key, deadline));
+            }
+        }
+        printFound(cmd->name, key, val);
+        return false;
+    }
+    else if (strcmp(cmd->name, "sum") == 0 || strcmp(cmd->name, "min") == 0 ||
+             strcmp(cmd->name, "max") == 0) {
+        // Without a prefix every number in the map counts.
+        char const *prefix = cmd->keyLen ? commandKey(cmd) : NULL;
+        MapAggregate agg;
+        mapAggregate(map, prefix, &agg);
+        if (cmd->name[1] == 'u') {
+            startPrinting();
+        }
+        if (cmd->name[1] == 'u' && agg.doubles == 0) {
+            printf("%lld\n", agg.intSum);
+        }
+        else if (cmd->name[1] == 'u') {
+            printf("%lf\n", agg.intSum + agg.doubleSum);
+        }
+        else {
+            printFound(cmd->name, prefix ? prefix : "", cmd->name[1] == 'i' ? agg.min : agg.max);
+        }
         return false;
     }
     else {
-        fprintf(stderr, "Invalid command %s", cmd);
+        fprintf(stderr, "Invalid command %s", cmd->name);
         exit(EXIT_FAILURE);
     }
-    free(input);
-    free(origInput);
-    
 }
+
+/**
+    Runs a command that has already been split into its parts, adding the time each
+    phase took to its latency histograms if -latency was given, and then writes a few
+    pages of any background save.
+    @param *map a pointer to the map to make changes to
+    @param *cmd the command to run
+    @param *env allows the method to signal errors to its caller without terminating the program
+    @param readTicks clock ticks spent reading the command's line
+    @param parseTicks clock ticks spent parsing it, which ended at phaseStart
+    @return true if the command was quit
+ */
+static bool runCommand(Map *map, Command const *cmd, jmp_buf *env, uint64_t readTicks,
+                       uint64_t parseTicks)
+{
+    if (latencyPath != NULL) {
+        phaseRow = latencyCommand(cmd->name);
+        latencyRecord(phaseRow, LATENCY_READ, readTicks);
+        latencyRecord(phaseRow, LATENCY_PARSE, parseTicks);
+        printing = false;
+    }
+    bool quit = executeCommand(map, cmd, env);
+    // Commands that print nothing, or print as they go, may never have called
+    // startPrinting().
+    if (latencyPath != NULL) {
+        endPhase(printing ? LATENCY_PRINT : LATENCY_EXECUTE);
+        readStart = phaseStart;
+    }
+    stepBackgroundSave();
+    return quit;
+}
+
+/**
+    Handles the different commands present and updates the given map or prints it to the terminal
+    @param *map a pointer to the map to make changes to
+    @param *line the line to parse through, followed by a '\0'
+    @param len number of characters in the line
+    @param *env allows the method to signal errors to its caller without terminating the program
+    @return bool to show if the command was executed successfully or not
+ */
+bool handleCommand(Map *map, char *line, size_t len, jmp_buf *env) 
+{
+    Command cmd;
+    uint64_t parsed = 0, read = 0;
+    if (latencyPath != NULL) {
+        parsed = latencyClock();
+        read = parsed - readStart;
+    }
+    parseCommand(line, len, &cmd);
+    if (latencyPath != NULL) {
+        phaseStart = latencyClock();
+        parsed = phaseStart - parsed;
+    }
+    return runCommand(map, &cmd, env, read, parsed);
+}
+
+/**
+    Runs commands from standard input in batches: the input file is mapped, or large chunks
+    of a pipe are read, and split into lines in place, a batch of lines is tokenized, and
+    then the batch is executed.
+    Output goes through one large stdout buffer.
+    @param *map a pointer to the map to make changes to
+    @param *env allows the method to signal errors to its caller without terminating the program
+    @return true if the input ended with a quit command
+ */
+static bool runBatch(Map *map, jmp_buf *env)
+{
+    LineReader *reader = makeLineReader(stdin);
+    Line lines[BATCH_SIZE];
+    Command cmds[BATCH_SIZE];
+    uint64_t parsed[BATCH_SIZE] = { 0 };
+    uint64_t read = 0;
+    int n;
+    // Lines are read a batch at a time, so each command is charged an equal share.
+    readStart = latencyPath != NULL ? latencyClock() : 0;
+    while ((n = readLines(reader, lines, BATCH_SIZE)) > 0) {
+        if (latencyPath != NULL) {
+            phaseStart = latencyClock();
+            read = ( phaseStart - readStart ) / n;
+        }
+        for (int i = 0; i < n; i++) {
+            uint64_t start = phaseStart;
+            parseCommand(lines[i].text, lines[i].len, &cmds[i]);
+            if (latencyPath != NULL) {
+                phaseStart = latencyClock();
+                parsed[i] = phaseStart - start;
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            if (runCommand(map, &cmds[i], env, read, parsed[i])) {
+                freeLineReader(reader);
+                return true;
+            }
+        }
+    }
+    freeLineReader(reader);
+    return false;
+}
+
 /**
    Starting point for the program.
    @param argc number of command-line arguments.
@@ -148,6 +666,14 @@ int main( int argc, char *argv[] )
   // See if our input is from a terminal.
     interactive = isatty( STDIN_FILENO );
   // Parse command-line arguments.
+    MapOptions opts = { .engine = MAP_CHAINED };
+    bool batch = false;
+    char const *walPath = NULL;
+    char const *servePath = NULL;
+    char const *loadPath = NULL;
+    int threads = bulkThreads();
+    int groupRecords = GROUP_RECORDS;
+    int groupMillis = GROUP_MILLIS;
     int apos = 1;
     while ( apos < argc ) {
     // The -term option makes the program behave as if it's in interactive mode,
@@ -156,11 +682,128 @@ int main( int argc, char *argv[] )
             interactive = true;
             apos += 1;
         } 
+        // The -robin option stores the map in the open-addressing table.
+        else if ( strcmp( argv[ apos ], "-robin" ) == 0 ) {
+            opts.engine = MAP_ROBIN_HOOD;
+            apos += 1;
+        }
+        // The -arena option allocates nodes and values from slabs owned by the map.
+        else if ( strcmp( argv[ apos ], "-arena" ) == 0 ) {
+            opts.arena = true;
+            apos += 1;
+        }
+        // The -batch option reads and runs scripted input in large chunks.
+        else if ( strcmp( argv[ apos ], "-batch" ) == 0 ) {
+            batch = true;
+            apos += 1;
+        }
+        // The -wal option logs every change to a file and replays the file at startup.
+        else if ( strcmp( argv[ apos ], "-wal" ) == 0 && apos + 1 < argc ) {
+            walPath = argv[ apos + 1 ];
+            apos += 2;
+        }
+        // The -serve option answers binary requests on a Unix domain socket instead of
+        // reading commands.
+        else if ( strcmp( argv[ apos ], "-serve" ) == 0 && apos + 1 < argc ) {
+            servePath = argv[ apos + 1 ];
+            apos += 2;
+        }
+        // The -commit option sets how many log records, or how many milliseconds,
+        // go into one fsync.
+        else if ( strcmp( argv[ apos ], "-commit" ) == 0 && apos + 2 < argc ) {
+            groupRecords = atoi( argv[ apos + 1 ] );
+            groupMillis = atoi( argv[ apos + 2 ] );
+            if ( groupRecords < 0 || groupMillis < 0 || groupRecords + groupMillis == 0 ) {
+                usage();
+            }
+            apos += 3;
+        }
+        // The -maxmemory option caps the bytes the map's entries take; sets past it
+        // evict the keys least recently used.
+        else if ( strcmp( argv[ apos ], "-maxmemory" ) == 0 && apos + 1 < argc ) {
+            char *rest;
+            long long bytes = strtoll( argv[ apos + 1 ], &rest, 10 );
+            if ( bytes <= 0 || *rest != '\0' ) {
+                usage();
+            }
+            opts.maxBytes = bytes;
+            apos += 2;
+        }
+        // The -load option runs a file of set and remove commands on several threads
+        // before reading any others.
+        else if ( strcmp( argv[ apos ], "-load" ) == 0 && apos + 1 < argc ) {
+            loadPath = argv[ apos + 1 ];
+            apos += 2;
+        }
+        // The -threads option sets how many threads -load uses.
+        else if ( strcmp( argv[ apos ], "-threads" ) == 0 && apos + 1 < argc ) {
+            threads = atoi( argv[ apos + 1 ] );
+            if ( threads <= 0 ) {
+                usage();
+            }
+            apos += 2;
+        }
+        // The -intern option lets long string values with the same characters share
+        // one copy of them.
+        else if ( strcmp( argv[ apos ], "-intern" ) == 0 ) {
+            valueIntern( true );
+            apos += 1;
+        }
+        // The -latency option times the phases of every command and writes their
+        // histograms to a file at exit.
+        else if ( strcmp( argv[ apos ], "-latency" ) == 0 && apos + 1 < argc ) {
+            latencyPath = argv[ apos + 1 ];
+            apos += 2;
+        }
+        // The -hash option picks the function used to hash keys.
+        else if ( strcmp( argv[ apos ], "-hash" ) == 0 && apos + 1 < argc ) {
+            opts.hash = hashByName( argv[ apos + 1 ] );
+            if ( opts.hash == NULL ) {
+                usage();
+            }
+            apos += 2;
+        }
         else {
             usage();
         }
     }
-    Map *map = makeMap(MAP_MAX);
+    if (latencyPath != NULL) {
+        latencyClock();
+        atexit(writeLatency);
+    }
+    Map *map = makeMapWith(MAP_MAX, &opts);
+    if (walPath != NULL) {
+        // Rebuild the map from the log before taking any new commands.
+        if (walRecover(walPath, map) < 0 ||
+            (wal = openWal(walPath, groupRecords, groupMillis)) == NULL) {
+            fprintf(stderr, "Error: Cannot open log %s\n", walPath);
+            return EXIT_FAILURE;
+        }
+        atexit(closeLog);
+    }
+    if (loadPath != NULL) {
+        BulkStats stats;
+        if (!bulkLoad(map, loadPath, threads, wal, &stats)) {
+            if (stats.logFailed) {
+                fprintf(stderr, "Error: Cannot write log\n");
+            } else if (stats.badLine > 0) {
+                fprintf(stderr, "Error: Invalid command on line %ld of %s\n", stats.badLine,
+                        loadPath);
+            } else {
+                fprintf(stderr, "Error: Cannot load %s\n", loadPath);
+            }
+            freeMap(map);
+            return EXIT_FAILURE;
+        }
+    }
+    if (servePath != NULL) {
+        if (!runServer(map, wal, servePath)) {
+            fprintf(stderr, "Error: Cannot listen on %s\n", servePath);
+            return EXIT_FAILURE;
+        }
+        freeMap(map);
+        return EXIT_SUCCESS;
+    }
     // if (map == NULL) {
     //     fprintf(stderr, "Map memory not allocated");
     //     return EXIT_FAILURE;
@@ -168,22 +811,54 @@ int main( int argc, char *argv[] )
     jmp_buf env;
     if (setjmp(env) != 0) {
         fprintf(stderr, "Error: command ");
+        endBackgroundSave();
         return EXIT_FAILURE;
     }
+    if (batch && !interactive) {
+        setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER);
+        if (!runBatch(map, &env)) {
+            endBackgroundSave();
+            exit(EXIT_SUCCESS);
+        }
+        endBackgroundSave();
+        freeMap(map);
+        return EXIT_SUCCESS;
+    }
+    // When input is redirected from a file, run each line straight out of the mapped file.
+    LineReader *mapped = mapLineReader(stdin);
+    if (mapped != NULL) {
+        Line view;
+        readStart = latencyPath != NULL ? latencyClock() : 0;
+        while (readLines(mapped, &view, 1) > 0) {
+            if (interactive) {
+                printf("cmd> ");
+                fflush(stdout);
+            }
+            if (handleCommand(map, view.text, view.len, &env)) {
+                break;
+            }
+        }
+        freeLineReader(mapped);
+        endBackgroundSave();
+        freeMap(map);
+        return EXIT_SUCCESS;
+    }
     char *line = NULL;
+    readStart = latencyPath != NULL ? latencyClock() : 0;
     for (line = readLine(stdin); line != NULL; line = readLine(stdin)) {
         if (interactive) {
             printf("cmd> ");
             fflush(stdout);
         }
         // Process the command and check for the "quit" command.
-        if (handleCommand(map, line, &env)) {
+        if (handleCommand(map, line, strlen(line), &env)) {
             free(line);
             break;
         }
         // Free the dynamically allocated line after processing.
         free(line);
     }
+    endBackgroundSave();
     if (feof(stdin)) {
         
         exit(EXIT_SUCCESS);
@@ -0,0 +1,265 @@
+/**
+    @file epoch.c
+    @author Sachi Vyas (smvyas)
+    A program that: Frees memory unlinked from lock-free structures only after every reader
+    that could have seen it is done, using epoch-based reclamation.  A global epoch counter
+    only advances once every thread inside a critical section has seen the current value,
+    so anything retired two epochs ago can no longer be reached by anyone.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "epoch.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+
+/** Number of limbo lists each thread keeps, one for each epoch that may still be in use. */
+#define LIMBO_LISTS 3
+/** Objects retired between attempts to advance the epoch and free old ones. */
+#define COLLECT_EVERY 64
+/** Starting capacity of a limbo list. */
+#define LIMBO_START 64
+
+/** An object waiting to be freed. */
+typedef struct {
+  /** The object. */
+  void *p;
+
+  /** Function that frees it. */
+  Releaser release;
+} Retired;
+
+/** Objects one thread retired during one epoch. */
+typedef struct {
+  /** Array of retired objects. */
+  Retired *items;
+
+  /** Number of objects in the list. */
+  int count;
+
+  /** Capacity of the array. */
+  int cap;
+
+  /** Epoch the objects were retired in. */
+  unsigned long epoch;
+} Limbo;
+
+/** Per-thread state, kept in a list that threads only ever add to. */
+typedef struct RecordStruct {
+  /** The epoch shifted left one bit, plus one, while in a critical section; 0 otherwise. */
+  unsigned long state;
+
+  /** True while a thread owns this record. */
+  bool inUse;
+
+  /** Retired objects, indexed by epoch modulo LIMBO_LISTS. */
+  Limbo limbo[ LIMBO_LISTS ];
+
+  /** Objects retired since the last collection. */
+  int sinceCollect;
+
+  /** Next record in the list. */
+  struct RecordStruct *next;
+} Record;
+
+/** The global epoch. */
+static unsigned long globalEpoch;
+
+/** Every record ever made. */
+static Record *records;
+
+/** Key whose destructor gives a record back when its thread exits. */
+static pthread_key_t recordKey;
+
+/** Makes sure recordKey is created once. */
+static pthread_once_t keyOnce = PTHREAD_ONCE_INIT;
+
+/** The calling thread's record, or NULL if it hasn't used epochs yet. */
+static __thread Record *mine;
+
+/**
+    Frees every object in a limbo list.
+    @param *l the list to empty
+ */
+static void freeLimbo( Limbo *l )
+{
+    for (int i = 0; i < l->count; i++) {
+        l->items[i].release(l->items[i].p);
+    }
+    l->count = 0;
+}
+
+/**
+    Advances the global epoch if every thread in a critical section has seen its current
+    value.
+ */
+static void tryAdvance( void )
+{
+    unsigned long e = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+    for (Record *r = __atomic_load_n(&records, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+        unsigned long s = __atomic_load_n(&r->state, __ATOMIC_SEQ_CST);
+        if ((s & 1) && (s >> 1) != e) {
+            return;
+        }
+    }
+    __atomic_compare_exchange_n(&globalEpoch, &e, e + 1, false, __ATOMIC_SEQ_CST,
+                                __ATOMIC_RELAXED);
+}
+
+/**
+    Frees a record's objects that were retired at least two epochs ago.
+    @param *r the record
+    @return true if the record has no objects left to free
+ */
+static bool collect( Record *r )
+{
+    unsigned long e = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+    bool empty = true;
+    for (int i = 0; i < LIMBO_LISTS; i++) {
+        Limbo *l = &r->limbo[i];
+        if (l->count > 0 && l->epoch + 2 <= e) {
+            freeLimbo(l);
+        }
+        empty = empty && l->count == 0;
+    }
+    return empty;
+}
+
+/**
+    Waits until a record has no objects left to free.
+    @param *r the record
+ */
+static void drain( Record *r )
+{
+    for (;;) {
+        tryAdvance();
+        if (collect(r)) {
+            return;
+        }
+        sched_yield();
+    }
+}
+
+/**
+    Key destructor that frees what an exiting thread retired and gives its record back.
+    @param *p the thread's record
+ */
+static void releaseRecord( void *p )
+{
+    Record *r = p;
+    drain(r);
+    for (int i = 0; i < LIMBO_LISTS; i++) {
+        free(r->limbo[i].items);
+        r->limbo[i].items = NULL;
+        r->limbo[i].cap = 0;
+    }
+    mine = NULL;
+    __atomic_store_n(&r->inUse, false, __ATOMIC_RELEASE);
+}
+
+/**
+    Creates the key used to notice when threads exit.
+ */
+static void makeKey( void )
+{
+    pthread_key_create(&recordKey, releaseRecord);
+}
+
+/**
+    Finds the calling thread's record, taking over one left by an exited thread or adding
+    a new one the first time.
+    @return the record
+ */
+static Record *myRecord( void )
+{
+    if (mine != NULL) {
+        return mine;
+    }
+    pthread_once(&keyOnce, makeKey);
+    for (Record *r = __atomic_load_n(&records, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+        bool expected = false;
+        if (__atomic_compare_exchange_n(&r->inUse, &expected, true, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            mine = r;
+            break;
+        }
+    }
+    if (mine == NULL) {
+        Record *r = calloc(1, sizeof(Record));
+        r->inUse = true;
+        r->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&records, &r->next, r, true, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+        mine = r;
+    }
+    pthread_setspecific(recordKey, mine);
+    return mine;
+}
+
+/**
+    Starts a read-side critical section.  Anything the calling thread reaches through
+    shared pointers until epochExit() won't be freed out from under it.  Critical sections
+    don't nest.
+ */
+void epochEnter( void )
+{
+    Record *r = myRecord();
+    unsigned long e;
+    // If the epoch moved on while we were announcing ourselves, announce again, so we
+    // never read shared pointers while claiming an epoch older than the global one.
+    do {
+        e = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&r->state, (e << 1) | 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST) != e);
+}
+
+/**
+    Ends the read-side critical section started by epochEnter().
+ */
+void epochExit( void )
+{
+    __atomic_store_n(&mine->state, 0, __ATOMIC_RELEASE);
+}
+
+/**
+    Hands over an object that has been unlinked from every shared structure.  It is freed
+    once every thread that might still hold a pointer to it has left its critical section.
+    @param *p the object to free later
+    @param release function that frees it
+ */
+void epochRetire( void *p, Releaser release )
+{
+    Record *r = myRecord();
+    // The unlink has to be visible before we read the epoch the object is retired in.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned long e = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+    Limbo *l = &r->limbo[e % LIMBO_LISTS];
+    if (l->epoch != e) {
+        // Anything still here is from at least LIMBO_LISTS epochs ago, so it's safe.
+        freeLimbo(l);
+        l->epoch = e;
+    }
+    if (l->count == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : LIMBO_START;
+        l->items = realloc(l->items, l->cap * sizeof(Retired));
+    }
+    l->items[l->count++] = (Retired) { p, release };
+
+    if (++r->sinceCollect >= COLLECT_EVERY) {
+        r->sinceCollect = 0;
+        tryAdvance();
+        collect(r);
+    }
+}
+
+/**
+    Waits until everything the calling thread has retired is freed.  Threads call this
+    on their own when they exit; call it directly before the end of the program.  The
+    calling thread must not be in a critical section.
+ */
+void epochBarrier( void )
+{
+    drain(myRecord());
+}
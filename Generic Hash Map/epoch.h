@@ -0,0 +1,43 @@
+/**
+    @file epoch.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for epoch.c, which decides when memory that lock-free readers
+    might still be looking at can be freed
+ */
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/**
+    Function that frees one retired object.
+    @param *p the object to free
+ */
+typedef void (*Releaser)( void *p );
+
+/**
+    Starts a read-side critical section.  Anything the calling thread reaches through
+    shared pointers until epochExit() won't be freed out from under it.  Critical sections
+    don't nest.
+ */
+void epochEnter( void );
+
+/**
+    Ends the read-side critical section started by epochEnter().
+ */
+void epochExit( void );
+
+/**
+    Hands over an object that has been unlinked from every shared structure.  It is freed
+    once every thread that might still hold a pointer to it has left its critical section.
+    @param *p the object to free later
+    @param release function that frees it
+ */
+void epochRetire( void *p, Releaser release );
+
+/**
+    Waits until everything the calling thread has retired is freed.  Threads call this
+    on their own when they exit; call it directly before the end of the program.  The
+    calling thread must not be in a critical section.
+ */
+void epochBarrier( void );
+
+#endif
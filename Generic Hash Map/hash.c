@@ -0,0 +1,171 @@
+/**
+    @file hash.c
+    @author Sachi Vyas (smvyas)
+    A program that: Provides the hash functions a map can use to place its keys
+ */
+#include "hash.h"
+#include <string.h>
+/** Magic number used in the uint32_t function */
+#define NUM_6 6
+/** Magic number used in the uint32_t function */
+#define NUM_10 10
+/** Magic number used in the uint32_t function */
+#define NUM_3 3
+/** Magic number used in the uint32_t function */
+#define NUM_11 11
+/** Magic number used in the uint32_t function */
+#define NUM_15 15
+/** Starting value for FNV-1a */
+#define FNV_OFFSET 2166136261u
+/** Multiplier for FNV-1a */
+#define FNV_PRIME 16777619u
+/** First multiplier for the word hash (from xxHash64) */
+#define PRIME_1 0x9E3779B185EBCA87ull
+/** Second multiplier for the word hash */
+#define PRIME_2 0xC2B2AE3D27D4EB4Full
+/** Third multiplier for the word hash */
+#define PRIME_3 0x165667B19E3779F9ull
+/** Constant added after each word is mixed in */
+#define PRIME_4 0x85EBCA77C2B2AE63ull
+/** Bytes consumed by each round of the word hash */
+#define WORD_SIZE 8
+/** Bytes in each of the two reads used for keys of four to seven bytes */
+#define HALF_WORD 4
+
+/**
+    The key hashing function to use to help us compute the Jenkins 32-bit hash function
+    @param *key pointer to a key that we need to hash
+    @param length the length of the key
+    @return hash of the key as a 32 bit hash
+*/
+uint32_t jenkins_one_at_a_time_hash(const uint8_t *key, size_t length) 
+{
+    uint32_t hash = 0;
+    size_t i = 0;
+    while (i != length) {
+        hash += key[i++];
+        hash += (hash << NUM_10);
+        hash ^= (hash >> NUM_6);
+    }
+    hash += (hash << NUM_3);
+    hash ^= (hash >> NUM_11);
+    hash += (hash << NUM_15);
+    return hash;
+}
+
+/**
+    The 32-bit FNV-1a hash, one byte at a time.
+    @param *key pointer to a key that we need to hash
+    @param length the length of the key
+    @return hash of the key as a 32 bit hash
+ */
+uint32_t fnv1a_hash( const uint8_t *key, size_t length )
+{
+    uint32_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= key[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+    Rotates a 64-bit word left.
+    @param x the word to rotate
+    @param r number of bits to rotate by, between 1 and 63
+    @return the rotated word
+ */
+static uint64_t rotl64( uint64_t x, int r )
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/**
+    Mixes one word of key into the running hash.
+    @param hash the hash so far
+    @param word the next eight (or fewer, zero padded) bytes of the key
+    @return the updated hash
+ */
+static uint64_t mixWord( uint64_t hash, uint64_t word )
+{
+    word *= PRIME_2;
+    word = rotl64(word, 31);
+    word *= PRIME_1;
+    hash ^= word;
+    return rotl64(hash, 27) * PRIME_1 + PRIME_4;
+}
+
+/**
+    A hash that reads the key eight bytes at a time and mixes each word with multiplies
+    and rotates, in the style of xxHash, so a 24 byte key takes three rounds.
+    @param *key pointer to a key that we need to hash
+    @param length the length of the key
+    @return hash of the key as a 32 bit hash
+ */
+uint32_t word_at_a_time_hash( const uint8_t *key, size_t length )
+{
+    uint64_t hash = PRIME_3 + length;
+    uint64_t word;
+    if (length >= WORD_SIZE) {
+        while (length > WORD_SIZE) {
+            memcpy(&word, key, WORD_SIZE);
+            hash = mixWord(hash, word);
+            key += WORD_SIZE;
+            length -= WORD_SIZE;
+        }
+        // The last word ends at the end of the key, overlapping the one before it,
+        // so the tail never needs a byte loop.
+        memcpy(&word, key + length - WORD_SIZE, WORD_SIZE);
+        hash = mixWord(hash, word);
+    } else if (length >= HALF_WORD) {
+        uint32_t lo, hi;
+        memcpy(&lo, key, HALF_WORD);
+        memcpy(&hi, key + length - HALF_WORD, HALF_WORD);
+        hash = mixWord(hash, ((uint64_t) hi << 32) | lo);
+    } else if (length > 0) {
+        word = ((uint64_t) key[0] << 16) | ((uint64_t) key[length / 2] << 8) | key[length - 1];
+        hash = mixWord(hash, word);
+    }
+
+    // Final avalanche so every input bit reaches the low bits the table uses.
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_3;
+    hash ^= hash >> 32;
+    return (uint32_t) hash;
+}
+
+/**
+    Looks up a hash function by the name used on the driver's command line.
+    @param *name one of "jenkins", "fnv1a" or "word"
+    @return the matching function, or NULL if the name isn't known
+ */
+HashFunction hashByName( char const *name )
+{
+    if (strcmp(name, "jenkins") == 0) {
+        return jenkins_one_at_a_time_hash;
+    } else if (strcmp(name, "fnv1a") == 0) {
+        return fnv1a_hash;
+    } else if (strcmp(name, "word") == 0) {
+        return word_at_a_time_hash;
+    }
+    return NULL;
+}
+
+/**
+    Gives the name hashByName() knows a hash function by.
+    @param hash the function
+    @return "jenkins", "fnv1a" or "word", or NULL for any other function
+ */
+char const *hashName( HashFunction hash )
+{
+    if (hash == jenkins_one_at_a_time_hash) {
+        return "jenkins";
+    } else if (hash == fnv1a_hash) {
+        return "fnv1a";
+    } else if (hash == word_at_a_time_hash) {
+        return "word";
+    }
+    return NULL;
+}
@@ -0,0 +1,54 @@
+/**
+    @file hash.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for hash.c, the key hash functions a map can be made with
+ */
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** A function that hashes the given number of bytes of a key to 32 bits. */
+typedef uint32_t (*HashFunction)( const uint8_t *key, size_t length );
+
+/**
+    The key hashing function to use to help us compute the Jenkins 32-bit hash function
+    @param *key pointer to a key that we need to hash
+    @param length the length of the key
+    @return hash of the key as a 32 bit hash
+*/
+uint32_t jenkins_one_at_a_time_hash(const uint8_t *key, size_t length);
+
+/**
+    The 32-bit FNV-1a hash, one byte at a time.
+    @param *key pointer to a key that we need to hash
+    @param length the length of the key
+    @return hash of the key as a 32 bit hash
+ */
+uint32_t fnv1a_hash( const uint8_t *key, size_t length );
+
+/**
+    A hash that reads the key eight bytes at a time and mixes each word with multiplies
+    and rotates, in the style of xxHash, so a 24 byte key takes three rounds.
+    @param *key pointer to a key that we need to hash
+    @param length the length of the key
+    @return hash of the key as a 32 bit hash
+ */
+uint32_t word_at_a_time_hash( const uint8_t *key, size_t length );
+
+/**
+    Looks up a hash function by the name used on the driver's command line.
+    @param *name one of "jenkins", "fnv1a" or "word"
+    @return the matching function, or NULL if the name isn't known
+ */
+HashFunction hashByName( char const *name );
+
+/**
+    Gives the name hashByName() knows a hash function by.
+    @param hash the function
+    @return "jenkins", "fnv1a" or "word", or NULL for any other function
+ */
+char const *hashName( HashFunction hash );
+
+#endif
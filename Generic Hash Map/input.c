@@ -4,16 +4,22 @@
     A program that: Helps us reads a single line of input from the given input stream (stdin or a file) and returns it as a 
     string inside a block of dynamically allocated memory.
  */
+#define _POSIX_C_SOURCE 200112L
 #include "input.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 /** Temporary buffer size */
 #define BUFFER_SIZE 100
 /** Multiply by 2 to increase array size during resizing */
 #define DOUBLE_SIZE 2
+/** Number of bytes readLines() asks for from the stream at a time */
+#define CHUNK_SIZE ( 1024 * 1024 )
 
 /**
     Reads a line from the given file
@@ -51,3 +57,169 @@ char *readLine( FILE *fp )
     buffer[position] = '\0';
     return buffer;
 }
+
+/** Representation of a chunked line reader. */
+struct LineReaderStruct {
+  /** Stream the lines come from. */
+  FILE *fp;
+
+  /** Buffer holding the current chunk, with one extra byte for a final '\0'. */
+  char *buf;
+
+  /** Capacity of the buffer, not counting the extra byte. */
+  size_t cap;
+
+  /** Offset of the first character not handed out yet. */
+  size_t start;
+
+  /** Offset just past the last character read. */
+  size_t end;
+
+  /** True once the stream has no more input. */
+  bool eof;
+
+  /** True if buf is the whole input file mapped into memory rather than a chunk. */
+  bool mapped;
+
+  /** Length of the mapping, for munmap(). */
+  size_t mapLen;
+};
+
+/**
+    Maps the rest of a regular file into memory so readLines() can hand out lines that
+    point straight into it.  The mapping is private and writable, so ending each line with
+    a '\0' changes only this process's copy of the page, never the file.
+    @param fp the stream to map
+    @return pointer to the new reader, or NULL if the stream isn't a file that can be mapped
+ */
+LineReader *mapLineReader( FILE *fp )
+{
+    int fd = fileno(fp);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0 || st.st_size <= pos) {
+        return NULL;
+    }
+    size_t len = st.st_size;
+    char *buf = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED) {
+        return NULL;
+    }
+
+    // A last line with no newline needs a '\0' after it.  Past the end of the file the
+    // last page reads as zeros, unless the file ends exactly on a page boundary.
+    if (buf[len - 1] != '\n' && len % sysconf(_SC_PAGESIZE) == 0) {
+        munmap(buf, len);
+        return NULL;
+    }
+    posix_madvise(buf, len, POSIX_MADV_SEQUENTIAL);
+
+    LineReader *r = malloc(sizeof(LineReader));
+    r->fp = fp;
+    r->buf = buf;
+    r->cap = len;
+    r->start = pos;
+    r->end = len;
+    r->eof = true;
+    r->mapped = true;
+    r->mapLen = len;
+    return r;
+}
+
+/**
+    Makes a reader for the given stream, mapping it into memory if it is a regular file
+    and otherwise reading it in large chunks.
+    @param fp the stream to read
+    @return pointer to the new reader
+ */
+LineReader *makeLineReader( FILE *fp )
+{
+    LineReader *r = mapLineReader(fp);
+    if (r != NULL) {
+        return r;
+    }
+    r = malloc(sizeof(LineReader));
+    r->fp = fp;
+    r->cap = CHUNK_SIZE;
+    r->buf = malloc(r->cap + 1);
+    r->start = r->end = 0;
+    r->eof = false;
+    r->mapped = false;
+    r->mapLen = 0;
+    return r;
+}
+
+/**
+    Hands out the next complete lines from the reader's buffer, reading another chunk
+    only when none are left.  The lines point into the buffer, so nothing is copied, and
+    they stay valid until the next call.
+    @param *r the reader
+    @param *lines array to fill in
+    @param max most lines to return
+    @return number of lines filled in, or 0 at the end of the stream
+ */
+int readLines( LineReader *r, Line *lines, int max )
+{
+    int n = 0;
+    while (n == 0) {
+        while (n < max) {
+            char *line = r->buf + r->start;
+            char *nl = memchr(line, '\n', r->end - r->start);
+            if (nl == NULL) {
+                break;
+            }
+            *nl = '\0';
+            lines[n].text = line;
+            lines[n].len = nl - line;
+            n++;
+            r->start = nl - r->buf + 1;
+        }
+        if (n > 0) {
+            return n;
+        }
+
+        if (r->eof) {
+            // A last line with no newline after it.
+            if (r->start == r->end) {
+                return 0;
+            }
+            r->buf[r->end] = '\0';
+            lines[0].text = r->buf + r->start;
+            lines[0].len = r->end - r->start;
+            r->start = r->end;
+            return 1;
+        }
+
+        // Keep the partial line, and make room for it to get longer if it fills the buffer.
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+        if (r->end == r->cap) {
+            r->cap *= DOUBLE_SIZE;
+            r->buf = realloc(r->buf, r->cap + 1);
+        }
+        size_t got = fread(r->buf + r->end, 1, r->cap - r->end, r->fp);
+        if (got == 0) {
+            r->eof = true;
+        }
+        r->end += got;
+    }
+    return n;
+}
+
+/**
+    Frees a reader and its buffer or mapping.
+    @param *r the reader to free
+ */
+void freeLineReader( LineReader *r )
+{
+    if (r->mapped) {
+        munmap(r->buf, r->mapLen);
+    } else {
+        free(r->buf);
+    }
+    free(r);
+}
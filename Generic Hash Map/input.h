@@ -13,4 +13,49 @@
     @param fp the pointer for the file
     @return a pointer to a dynamically allocated memory containing the line
  */
-char *readLine( FILE *fp );
\ No newline at end of file
+char *readLine( FILE *fp );
+
+/** One line handed out by readLines(). */
+typedef struct {
+  /** The characters of the line, with the newline replaced by a '\0'. */
+  char *text;
+
+  /** Number of characters in the line. */
+  size_t len;
+} Line;
+
+/** Incomplete type for a reader that pulls lines out of large chunks of a stream. */
+typedef struct LineReaderStruct LineReader;
+
+/**
+    Maps the rest of a regular file into memory so readLines() can hand out lines that
+    point straight into it.
+    @param fp the stream to map
+    @return pointer to the new reader, or NULL if the stream isn't a file that can be mapped
+ */
+LineReader *mapLineReader( FILE *fp );
+
+/**
+    Makes a reader for the given stream, mapping it into memory if it is a regular file
+    and otherwise reading it in large chunks.
+    @param fp the stream to read
+    @return pointer to the new reader
+ */
+LineReader *makeLineReader( FILE *fp );
+
+/**
+    Hands out the next complete lines from the reader's buffer, reading another chunk
+    only when none are left.  The lines point into the buffer, so nothing is copied, and
+    they stay valid until the next call.
+    @param *r the reader
+    @param *lines array to fill in
+    @param max most lines to return
+    @return number of lines filled in, or 0 at the end of the stream
+ */
+int readLines( LineReader *r, Line *lines, int max );
+
+/**
+    Frees a reader and its buffer or mapping.
+    @param *r the reader to free
+ */
+void freeLineReader( LineReader *r );
\ No newline at end of file
@@ -0,0 +1,152 @@
+/**
+    @file intern.c
+    @author Sachi Vyas (smvyas)
+    A program that: Keeps one copy of each distinct string that values share.  Each
+    copy carries a count of the values referring to it and is freed when the last one
+    lets go.  The copies live in a chained hash table behind a single mutex, since
+    values are made and destroyed from several threads at once.
+ */
+#include "intern.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/** Buckets the table starts with; always a power of two */
+#define INTERN_BUCKETS 256
+/** The table doubles once it holds more strings than this many per bucket */
+#define INTERN_LOAD 0.75
+
+/** One shared string. */
+typedef struct InternedStruct {
+  /** Next string in the same bucket. */
+  struct InternedStruct *next;
+
+  /** Hash of the characters. */
+  uint32_t hash;
+
+  /** Number of characters. */
+  uint32_t len;
+
+  /** Number of values referring to the string. */
+  uint32_t refs;
+
+  /** The characters, ended by a '\0'. */
+  char text[];
+} Interned;
+
+/** The table every interned string is kept in. */
+static struct {
+  /** Held while the table or any reference count is read or changed. */
+  pthread_mutex_t lock;
+
+  /** Chains of strings by hash. */
+  Interned **buckets;
+
+  /** Number of buckets minus one. */
+  uint32_t mask;
+
+  /** What the table holds. */
+  InternStats stats;
+} table = { PTHREAD_MUTEX_INITIALIZER };
+
+/**
+    Doubles the number of buckets, or makes the first ones, and moves every string.
+    Called with the lock held.
+ */
+static void growTable()
+{
+    uint32_t len = table.buckets == NULL ? INTERN_BUCKETS : ( table.mask + 1 ) * 2;
+    Interned **buckets = calloc(len, sizeof(Interned *));
+    for (uint32_t i = 0; table.buckets != NULL && i <= table.mask; i++) {
+        for (Interned *e = table.buckets[i], *next; e != NULL; e = next) {
+            next = e->next;
+            e->next = buckets[e->hash & ( len - 1 )];
+            buckets[e->hash & ( len - 1 )] = e;
+        }
+    }
+    free(table.buckets);
+    table.buckets = buckets;
+    table.mask = len - 1;
+}
+
+/**
+    Finds the shared copy of a string, adding one if there isn't one yet, and takes a
+    reference to it.  Safe to call from several threads at once.
+    @param *text the characters, which need not end with a '\0'
+    @param len number of characters
+    @return the shared copy, ended by a '\0', which must be given back to
+            internRelease() and never changed or freed
+ */
+char *internString( char const *text, size_t len )
+{
+    uint32_t hash = word_at_a_time_hash((uint8_t const *) text, len);
+    pthread_mutex_lock(&table.lock);
+    if (table.buckets == NULL ||
+        table.stats.strings + 1 > ( table.mask + 1 ) * INTERN_LOAD) {
+        growTable();
+    }
+    Interned **link = &table.buckets[hash & table.mask];
+    Interned *e = *link;
+    while (e != NULL &&
+           ( e->hash != hash || e->len != len || memcmp(e->text, text, len) != 0 )) {
+        e = e->next;
+    }
+    if (e != NULL) {
+        table.stats.savedBytes += len + 1;
+    } else {
+        e = malloc(sizeof(Interned) + len + 1);
+        e->hash = hash;
+        e->len = len;
+        e->refs = 0;
+        memcpy(e->text, text, len);
+        e->text[len] = '\0';
+        e->next = *link;
+        *link = e;
+        table.stats.strings++;
+        table.stats.bytes += len + 1;
+    }
+    e->refs++;
+    table.stats.refs++;
+    pthread_mutex_unlock(&table.lock);
+    return e->text;
+}
+
+/**
+    Drops a reference taken by internString(), freeing the shared copy when it was
+    the last one.
+    @param *str the shared copy
+ */
+void internRelease( char *str )
+{
+    Interned *e = (Interned *) ( str - offsetof(Interned, text) );
+    pthread_mutex_lock(&table.lock);
+    table.stats.refs--;
+    if (--e->refs > 0) {
+        table.stats.savedBytes -= e->len + 1;
+        pthread_mutex_unlock(&table.lock);
+        return;
+    }
+    Interned **link = &table.buckets[e->hash & table.mask];
+    while (*link != e) {
+        link = &( *link )->next;
+    }
+    *link = e->next;
+    table.stats.strings--;
+    table.stats.bytes -= e->len + 1;
+    pthread_mutex_unlock(&table.lock);
+    free(e);
+}
+
+/**
+    Reports what the intern table holds right now.
+    @param *stats structure to fill in
+ */
+void internStats( InternStats *stats )
+{
+    pthread_mutex_lock(&table.lock);
+    *stats = table.stats;
+    pthread_mutex_unlock(&table.lock);
+}
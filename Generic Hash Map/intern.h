@@ -0,0 +1,50 @@
+/**
+    @file intern.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for intern.c, a table that lets string values with the
+    same characters share one reference-counted copy of them
+ */
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+
+/** What the intern table holds, filled in by internStats(). */
+typedef struct {
+  /** Number of distinct strings in the table. */
+  long strings;
+
+  /** Number of references to them, one per value sharing a string. */
+  long refs;
+
+  /** Bytes the strings' characters take, counted once each. */
+  size_t bytes;
+
+  /** Bytes that separate copies for every reference would have taken beyond that. */
+  size_t savedBytes;
+} InternStats;
+
+/**
+    Finds the shared copy of a string, adding one if there isn't one yet, and takes a
+    reference to it.  Safe to call from several threads at once.
+    @param *text the characters, which need not end with a '\0'
+    @param len number of characters
+    @return the shared copy, ended by a '\0', which must be given back to
+            internRelease() and never changed or freed
+ */
+char *internString( char const *text, size_t len );
+
+/**
+    Drops a reference taken by internString(), freeing the shared copy when it was
+    the last one.
+    @param *str the shared copy
+ */
+void internRelease( char *str );
+
+/**
+    Reports what the intern table holds right now.
+    @param *stats structure to fill in
+ */
+void internStats( InternStats *stats );
+
+#endif
@@ -0,0 +1,254 @@
+/**
+    @file latency.c
+    @author Sachi Vyas (smvyas)
+    A program that: Keeps a histogram of how long each phase of each kind of command
+    takes, measured with the processor's cycle counter.  Like an HDR histogram, each
+    power of two is split into a fixed number of buckets, so every time is kept to
+    within a few percent however large it is, in a few kilobytes, and adding one is a
+    couple of shifts and an increment.  Not safe to use from several threads at once.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "latency.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#endif
+
+/** Bits of each time kept below its highest set bit, so the times sharing a bucket
+    differ by less than one part in 16 */
+#define SUB_BITS 5
+/** Buckets for each power of two past the first 2 ^ SUB_BITS, which get one each */
+#define HALF_BUCKETS ( 1 << ( SUB_BITS - 1 ) )
+/** Buckets in a histogram, enough for any 64-bit time */
+#define BUCKETS ( ( 64 - SUB_BITS + 2 ) * HALF_BUCKETS )
+/** Most commands that get their own row; later ones share the last */
+#define MAX_ROWS 32
+/** Room for a command's name in its row */
+#define NAME_LENGTH 16
+/** Shortest stretch of time ticks are compared with nanoseconds over */
+#define CALIBRATION_NANOS 1.0e7
+/** Nanoseconds in a second */
+#define NANOS 1.0e9
+
+/** Times measured for one phase of one command. */
+typedef struct {
+  /** Number of times. */
+  uint64_t count;
+
+  /** Sum of the times. */
+  uint64_t sum;
+
+  /** Smallest time. */
+  uint64_t min;
+
+  /** Largest time. */
+  uint64_t max;
+
+  /** Number of times in each bucket. */
+  uint64_t buckets[ BUCKETS ];
+} Histogram;
+
+/** Histograms kept for one command. */
+typedef struct {
+  /** The command's name. */
+  char name[ NAME_LENGTH ];
+
+  /** A histogram for each phase, or NULL until the phase is first measured. */
+  Histogram *phases[ LATENCY_PHASES ];
+} Row;
+
+/** Names of the phases, as the report writes them. */
+static char const *const phaseNames[] = { "read", "parse", "execute", "print" };
+
+/** Every command's histograms. */
+static Row rows[ MAX_ROWS ];
+
+/** Number of rows in use. */
+static int rowCount = 0;
+
+/** True once latencyClock() has been called. */
+static bool started = false;
+
+/** Tick count at the first call to latencyClock(). */
+static uint64_t startTicks;
+
+/** Monotonic clock, in nanoseconds, at the first call to latencyClock(). */
+static double startNanos;
+
+/**
+    Reads the monotonic clock.
+    @return the current time in nanoseconds
+ */
+static double monotonicNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NANOS + ts.tv_nsec;
+}
+
+/**
+    Reads the clock latencies are measured with: the processor's cycle counter where
+    there is one, or else the monotonic clock in nanoseconds.  The first call starts
+    the measurement that later converts ticks to nanoseconds.
+    @return the current tick count
+ */
+uint64_t latencyClock( void )
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+    uint64_t ticks = __rdtsc();
+#else
+    uint64_t ticks = monotonicNanos();
+#endif
+    if (!started) {
+        started = true;
+        startTicks = ticks;
+        startNanos = monotonicNanos();
+    }
+    return ticks;
+}
+
+/**
+    Works out how many ticks of latencyClock() there are to a nanosecond, from how far
+    it and the monotonic clock have moved since the first reading.  A short run waits
+    until the two have moved far enough apart to compare.
+    @return ticks per nanosecond
+ */
+static double ticksPerNano()
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+    latencyClock();
+    double nanos;
+    while (( nanos = monotonicNanos() - startNanos ) < CALIBRATION_NANOS) {
+    }
+    return ( __rdtsc() - startTicks ) / nanos;
+#else
+    return 1;
+#endif
+}
+
+/**
+    Finds the bucket a time goes in.  Times below 2 ^ SUB_BITS have a bucket each;
+    above that, the highest set bit picks a power of two and the next SUB_BITS - 1
+    bits pick one of its buckets.
+    @param ticks the time
+    @return the bucket
+ */
+static int bucketOf( uint64_t ticks )
+{
+    if (ticks < ( 1 << SUB_BITS )) {
+        return ticks;
+    }
+    int shift = 63 - __builtin_clzll(ticks) - SUB_BITS + 1;
+    return shift * HALF_BUCKETS + ( ticks >> shift );
+}
+
+/**
+    Returns the largest time that goes in a bucket.
+    @param bucket the bucket
+    @return the time
+ */
+static uint64_t bucketTop( int bucket )
+{
+    if (bucket < ( 1 << SUB_BITS )) {
+        return bucket;
+    }
+    int shift = bucket / HALF_BUCKETS - 1;
+    uint64_t sub = bucket - shift * HALF_BUCKETS;
+    return ( ( sub + 1 ) << shift ) - 1;
+}
+
+/**
+    Finds the row of histograms kept for a command, adding one the first time a name is
+    seen.  Past a few dozen names, every new one shares a row called "other".
+    @param *name the command's name
+    @return the row
+ */
+int latencyCommand( char const *name )
+{
+    for (int i = 0; i < rowCount; i++) {
+        if (strcmp(rows[i].name, name) == 0) {
+            return i;
+        }
+    }
+    if (rowCount >= MAX_ROWS - 1 || strlen(name) >= NAME_LENGTH) {
+        name = "other";
+        for (int i = 0; i < rowCount; i++) {
+            if (strcmp(rows[i].name, name) == 0) {
+                return i;
+            }
+        }
+    }
+    strcpy(rows[rowCount].name, name);
+    return rowCount++;
+}
+
+/**
+    Adds one measurement to a command's histogram for a phase.
+    @param row the command's row, from latencyCommand()
+    @param phase the phase measured
+    @param ticks how long it took, in latencyClock() ticks
+ */
+void latencyRecord( int row, LatencyPhase phase, uint64_t ticks )
+{
+    Histogram *h = rows[row].phases[phase];
+    if (h == NULL) {
+        h = rows[row].phases[phase] = calloc(1, sizeof(Histogram));
+        h->min = ticks;
+    }
+    h->count++;
+    h->sum += ticks;
+    h->min = ticks < h->min ? ticks : h->min;
+    h->max = ticks > h->max ? ticks : h->max;
+    h->buckets[bucketOf(ticks)]++;
+}
+
+/**
+    Finds the time a fraction of a histogram's times are at or below, to the top of
+    its bucket.
+    @param *h the histogram
+    @param fraction the fraction, from 0 to 1
+    @return the time
+ */
+static uint64_t percentile( Histogram const *h, double fraction )
+{
+    uint64_t rank = fraction * h->count;
+    rank += rank < fraction * h->count || rank == 0;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t top = bucketTop(i);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+/**
+    Writes a line for every command and phase that has measurements: the command, the
+    phase, the count, and then the smallest, mean, 50th, 90th, 99th and 99.9th
+    percentile and largest time, in nanoseconds.  A first line, starting with '#',
+    names the columns.
+    @param *fp the stream to write to
+ */
+void latencyReport( FILE *fp )
+{
+    fprintf(fp, "# command phase count min-ns mean-ns p50-ns p90-ns p99-ns p99.9-ns max-ns\n");
+    double perNano = rowCount > 0 ? ticksPerNano() : 1;
+    for (int i = 0; i < rowCount; i++) {
+        for (int p = 0; p < LATENCY_PHASES; p++) {
+            Histogram const *h = rows[i].phases[p];
+            if (h == NULL) {
+                continue;
+            }
+            fprintf(fp, "%s %s %llu %.0f %.0f %.0f %.0f %.0f %.0f %.0f\n", rows[i].name,
+                    phaseNames[p], (unsigned long long) h->count, h->min / perNano,
+                    (double) h->sum / h->count / perNano, percentile(h, 0.5) / perNano,
+                    percentile(h, 0.9) / perNano, percentile(h, 0.99) / perNano,
+                    percentile(h, 0.999) / perNano, h->max / perNano);
+        }
+    }
+}
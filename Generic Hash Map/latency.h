@@ -0,0 +1,64 @@
+/**
+    @file latency.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for latency.c, which keeps histograms of how long each
+    phase of each kind of command takes
+ */
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/** Phases a command is timed in. */
+typedef enum {
+  /** Reading the command's line. */
+  LATENCY_READ,
+
+  /** Splitting the line into the command's name, key and arguments. */
+  LATENCY_PARSE,
+
+  /** Running the command against the map. */
+  LATENCY_EXECUTE,
+
+  /** Printing the command's result. */
+  LATENCY_PRINT,
+
+  /** Number of phases. */
+  LATENCY_PHASES
+} LatencyPhase;
+
+/**
+    Reads the clock latencies are measured with: the processor's cycle counter where
+    there is one, or else the monotonic clock in nanoseconds.  The first call starts
+    the measurement that later converts ticks to nanoseconds.
+    @return the current tick count
+ */
+uint64_t latencyClock( void );
+
+/**
+    Finds the row of histograms kept for a command, adding one the first time a name is
+    seen.  Past a few dozen names, every new one shares a row called "other".
+    @param *name the command's name
+    @return the row
+ */
+int latencyCommand( char const *name );
+
+/**
+    Adds one measurement to a command's histogram for a phase.
+    @param row the command's row, from latencyCommand()
+    @param phase the phase measured
+    @param ticks how long it took, in latencyClock() ticks
+ */
+void latencyRecord( int row, LatencyPhase phase, uint64_t ticks );
+
+/**
+    Writes a line for every command and phase that has measurements: the command, the
+    phase, the count, and then the smallest, mean, 50th, 90th, 99th and 99.9th
+    percentile and largest time, in nanoseconds.  A first line, starting with '#',
+    names the columns.
+    @param *fp the stream to write to
+ */
+void latencyReport( FILE *fp );
+
+#endif
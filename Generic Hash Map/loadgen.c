@@ -0,0 +1,374 @@
+/**
+    @file loadgen.c
+    @author Sachi Vyas (smvyas)
+    A program that: Puts load on a driver running with -serve.  Several client threads each
+    send a mix of gets, sets and removes on their own keys, a pipeline of requests at a
+    time, check every reply against what the key should hold, and time each request from
+    when its pipeline was sent to when its reply arrived.  At the end it reports requests
+    per second and the median and 99th percentile latency.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "wire.h"
+
+/** Client threads unless the command line says otherwise */
+#define DEFAULT_CLIENTS 4
+/** Requests each client sends before reading any replies, unless told otherwise */
+#define DEFAULT_DEPTH 16
+/** Requests sent in all, unless told otherwise */
+#define DEFAULT_REQUESTS 200000
+/** Distinct keys each client works on */
+#define CLIENT_KEYS 1000
+/** Percent of requests that are gets */
+#define GET_PERCENT 70
+/** Percent of requests that are gets or sets; the rest are removes */
+#define SET_PERCENT 90
+/** Room for one key */
+#define KEY_BUFFER 48
+/** Times to try connecting while the server starts up */
+#define CONNECT_TRIES 200
+/** Nanoseconds between tries */
+#define CONNECT_WAIT 10000000
+/** Microseconds in a second */
+#define MICROS 1.0e6
+/** Nanoseconds in a second */
+#define NANOS 1.0e9
+
+/** One request that has been sent and whose reply is awaited. */
+typedef struct {
+  /** What the request asked for. */
+  WireOp op;
+
+  /** Version the key held when it was sent, or -1 if it wasn't set. */
+  int expect;
+} Sent;
+
+/** State of one client thread. */
+typedef struct {
+  /** Name of the server's socket. */
+  char const *path;
+
+  /** Number of this client, which its keys start with. */
+  int id;
+
+  /** Requests sent before reading replies. */
+  int depth;
+
+  /** Requests to send. */
+  int count;
+
+  /** Latency of each request, in seconds. */
+  double *latency;
+
+  /** Number of replies that weren't what they should have been. */
+  int errors;
+
+  /** Number of this client's keys set when it finished. */
+  int live;
+} Worker;
+
+/**
+    Reads the monotonic clock.
+    @return the current time in seconds
+ */
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / NANOS;
+}
+
+/**
+    Connects to the server, waiting a while for it to start listening.
+    @param *path name of the socket
+    @return the connection, or -1 if the server never answered
+ */
+static int connectTo( char const *path )
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct timespec wait = { 0, CONNECT_WAIT };
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    for (int i = 0; i < CONNECT_TRIES; i++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        nanosleep(&wait, NULL);
+    }
+    return -1;
+}
+
+/**
+    Writes a whole buffer to a connection.
+    @param fd the connection
+    @param *buf the bytes
+    @param len number of bytes
+    @return false if the connection failed
+ */
+static bool sendAll( int fd, char const *buf, size_t len )
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+    Makes the value a key holds at a given version: an int for even versions and a
+    short string for odd ones, so both kinds make the round trip.
+    @param *v the value to fill in
+    @param version the version
+ */
+static void versionValue( Value *v, int version )
+{
+    if (version % 2 == 0) {
+        v->type = VALUE_INT;
+        v->as.i = version;
+    } else {
+        v->type = VALUE_SHORT_STRING;
+        snprintf(v->as.str, sizeof(v->as.str), "s%d", version);
+    }
+}
+
+/**
+    Checks one reply against what its request should have got back.
+    @param *sent the request
+    @param *body the reply's body
+    @param len length of the body
+    @return true if the reply is right
+ */
+static bool checkReply( Sent const *sent, char const *body, size_t len )
+{
+    if (len < 1) {
+        return false;
+    }
+    if (sent->op == WIRE_SET) {
+        return body[0] == WIRE_OK && len == 1;
+    }
+    if (sent->expect < 0 || sent->op == WIRE_REMOVE) {
+        return body[0] == ( sent->expect < 0 ? WIRE_MISSING : WIRE_OK ) && len == 1;
+    }
+    Value *got;
+    if (body[0] != WIRE_OK || wireGetValue(body + 1, body + len, NULL, &got) != body + len) {
+        return false;
+    }
+    Value want;
+    versionValue(&want, sent->expect);
+    bool same = valueCompare(got, &want) == 0 && got->type == want.type;
+    valueDestroy(got);
+    return same;
+}
+
+/**
+    Runs one client: sends its requests a pipeline at a time and checks the replies.
+    @param *arg the Worker
+    @return NULL
+ */
+static void *runWorker( void *arg )
+{
+    Worker *w = arg;
+    int fd = connectTo(w->path);
+    if (fd < 0) {
+        w->errors = w->count;
+        return NULL;
+    }
+    int version[ CLIENT_KEYS ];
+    for (int i = 0; i < CLIENT_KEYS; i++) {
+        version[i] = -1;
+    }
+    unsigned int seed = w->id + 1;
+    Sent *sent = malloc(w->depth * sizeof(Sent));
+    size_t cap = w->depth * ( WIRE_HEADER + WIRE_REQUEST_HEADER + 2 * KEY_BUFFER );
+    char *out = malloc(cap);
+    char *in = malloc(cap);
+    int next = 1;
+    for (int done = 0; done < w->count; ) {
+        int n = w->count - done < w->depth ? w->count - done : w->depth;
+        char *p = out;
+        for (int i = 0; i < n; i++) {
+            int k = rand_r(&seed) % CLIENT_KEYS;
+            int r = rand_r(&seed) % 100;
+            char key[ KEY_BUFFER ];
+            int keyLen = snprintf(key, sizeof(key), "%d:%d:key-%d", (int) getpid(), w->id, k);
+            sent[i].expect = version[k];
+            if (r < GET_PERCENT) {
+                sent[i].op = WIRE_GET;
+                p = wirePutRequest(p, WIRE_GET, key, keyLen, NULL);
+            } else if (r < SET_PERCENT) {
+                Value v;
+                versionValue(&v, next);
+                version[k] = next++;
+                sent[i].op = WIRE_SET;
+                p = wirePutRequest(p, WIRE_SET, key, keyLen, &v);
+            } else {
+                version[k] = -1;
+                sent[i].op = WIRE_REMOVE;
+                p = wirePutRequest(p, WIRE_REMOVE, key, keyLen, NULL);
+            }
+        }
+        double start = now();
+        if (!sendAll(fd, out, p - out)) {
+            break;
+        }
+
+        // Read until every reply in the pipeline has come back.
+        size_t have = 0;
+        int replies = 0;
+        while (replies < n) {
+            ssize_t got = read(fd, in + have, cap - have);
+            if (got <= 0) {
+                break;
+            }
+            have += got;
+            double arrived = now();
+            size_t pos = 0;
+            while (have - pos >= WIRE_HEADER &&
+                   have - pos - WIRE_HEADER >= wireGetU32(in + pos)) {
+                uint32_t len = wireGetU32(in + pos);
+                if (!checkReply(&sent[replies], in + pos + WIRE_HEADER, len)) {
+                    w->errors++;
+                }
+                w->latency[done + replies++] = arrived - start;
+                pos += WIRE_HEADER + len;
+            }
+            memmove(in, in + pos, have - pos);
+            have -= pos;
+        }
+        if (replies < n) {
+            break;
+        }
+        done += n;
+    }
+    for (int i = 0; i < CLIENT_KEYS; i++) {
+        w->live += version[i] >= 0;
+    }
+    free(in);
+    free(out);
+    free(sent);
+    close(fd);
+    return NULL;
+}
+
+/**
+    Asks the server how many keys it holds.
+    @param *path name of the socket
+    @return the count, or -1 if it couldn't be had
+ */
+static int serverSize( char const *path )
+{
+    int fd = connectTo(path);
+    if (fd < 0) {
+        return -1;
+    }
+    char buf[ WIRE_HEADER + WIRE_REQUEST_HEADER + sizeof(int32_t) + 1 ];
+    char *p = wirePutRequest(buf, WIRE_SIZE, "", 0, NULL);
+    size_t have = 0;
+    if (sendAll(fd, buf, p - buf)) {
+        ssize_t got;
+        while (( have < WIRE_HEADER || have - WIRE_HEADER < wireGetU32(buf) ) &&
+               ( got = read(fd, buf + have, sizeof(buf) - have) ) > 0) {
+            have += got;
+        }
+    }
+    close(fd);
+    Value *size;
+    if (have < WIRE_HEADER + 1 || buf[WIRE_HEADER] != WIRE_OK ||
+        wireGetValue(buf + WIRE_HEADER + 1, buf + have, NULL, &size) == NULL) {
+        return -1;
+    }
+    int count = size->as.i;
+    valueDestroy(size);
+    return count;
+}
+
+/**
+    Orders two doubles for qsort.
+    @param *a pointer to the first double
+    @param *b pointer to the second double
+    @return negative, zero or positive as a is less than, equal to or greater than b
+ */
+static int compareDoubles( void const *a, void const *b )
+{
+    double x = *(double const *) a, y = *(double const *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+   Starting point for the program.
+   @param argc number of command-line arguments.
+   @param argv array of strings given as command-line arguments.
+   @return exit status for the program.
+ */
+int main( int argc, char *argv[] )
+{
+    int clients = argc > 2 ? atoi(argv[2]) : DEFAULT_CLIENTS;
+    int depth = argc > 3 ? atoi(argv[3]) : DEFAULT_DEPTH;
+    int requests = argc > 4 ? atoi(argv[4]) : DEFAULT_REQUESTS;
+    if (argc < 2 || argc > 5 || clients <= 0 || depth <= 0 || requests < clients) {
+        fprintf(stderr, "Usage: loadgen socket [clients] [depth] [requests]\n");
+        return EXIT_FAILURE;
+    }
+    char const *path = argv[1];
+    int before = serverSize(path);
+    if (before < 0) {
+        fprintf(stderr, "Error: Cannot reach server at %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    Worker *workers = calloc(clients, sizeof(Worker));
+    pthread_t *threads = malloc(clients * sizeof(pthread_t));
+    double *latency = malloc(requests * sizeof(double));
+    double start = now();
+    for (int i = 0, first = 0; i < clients; i++) {
+        workers[i].path = path;
+        workers[i].id = i;
+        workers[i].depth = depth;
+        workers[i].count = requests / clients + ( i < requests % clients );
+        workers[i].latency = latency + first;
+        first += workers[i].count;
+        pthread_create(&threads[i], NULL, runWorker, &workers[i]);
+    }
+    int errors = 0, live = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+        errors += workers[i].errors;
+        live += workers[i].live;
+    }
+    double elapsed = now() - start;
+    if (serverSize(path) != before + live) {
+        errors++;
+    }
+
+    qsort(latency, requests, sizeof(double), compareDoubles);
+    printf("clients %d depth %d: %.0f ops/s, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           clients, depth, requests / elapsed, latency[requests / 2] * MICROS,
+           latency[(long) requests * 99 / 100] * MICROS, latency[requests - 1] * MICROS);
+    free(latency);
+    free(threads);
+    free(workers);
+    if (errors > 0) {
+        fprintf(stderr, "Error: %d wrong replies\n", errors);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
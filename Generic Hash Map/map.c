@@ -3,36 +3,76 @@
     @author Sachi Vyas (smvyas)
     A program that: Helps us make changes in the map by allowing us to set, add, and remove elements
  */
+#define _POSIX_C_SOURCE 200112L
 #include "map.h"
+#include "robin.h"
+#include "snapshot.h"
+#include "skiplist.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
-/** Magic number used in the uint32_t function */
-#define NUM_6 6
-/** Magic number used in the uint32_t function */
-#define NUM_10 10
-/** Magic number used in the uint32_t function */
-#define NUM_3 3
-/** Magic number used in the uint32_t function */
-#define NUM_11 11
-/** Magic number used in the uint32_t function */
-#define NUM_15 15
-
-/** Node containing a key / value pair. */
+#include <time.h>
+/** Unless the options say otherwise, the table starts growing once it holds more than
+    LOAD_NUM / LOAD_DEN entries per bucket. */
+#define LOAD_NUM 3
+/** Denominator for the maximum load factor. */
+#define LOAD_DEN 4
+/** Number of old buckets moved into the new table by each set or remove while growing. */
+#define MIGRATE_STEP 4
+/** Number of keys mapGetMany() and mapSetMany() hash and prefetch before using any. */
+#define PREFETCH_WINDOW 16
+/** Number of keys with expiry times each set checks, so expired keys nobody looks up
+    again still leave. */
+#define EXPIRE_STEP 2
+/** Entries sampled for each eviction; the least recently used of them is evicted. */
+#define EVICT_SAMPLES 5
+/** Most buckets looked through for a non-empty one when sampling a chained table. */
+#define SAMPLE_SCAN 64
+/** Starting number of buckets in a map's table of expiry times. */
+#define EXPIRE_BUCKETS 64
+/** Keys up to this long are copied to the stack when the map removes a key it picked. */
+#define SHORT_KEY 64
+/** Nanoseconds in a second */
+#define NANOS 1.0e9
+/** Buckets (or Robin Hood slots) in each page of the table a view copies before it
+    changes. */
+#define VIEW_PAGE 16
+/** While a view is open, a chained table grows only once it holds this many times as
+    many entries per bucket as it otherwise would. */
+#define VIEW_LOAD 4
+
+/** Node containing a key / value pair.  The key is stored at the end, taking only
+    as many bytes as it needs. */
 typedef struct NodeStruct {
-  /** String key for this map entry. */
-  char key[ KEY_LIMIT + 1 ];
-  
-  /** Pointer to the value part of the key / value pair. */
-  Value *val;
-  
   /** Pointer to the next node at the same element of this table. */
   struct NodeStruct *next;
+
+  /** Pointer to the value part of the key / value pair. */
+  Value *val;
+
+  /** Full hash of the key, so most mismatches never compare the characters and
+      growing the table never rehashes. */
+  uint32_t hash;
+
+  /** Length of the key. */
+  uint32_t len;
+
+  /** String key for this map entry, followed by a '\0'. */
+  char key[];
 } Node;
 
 /** Representation of a hash table implementation of a map. */
 struct MapStruct {
+  /** Which storage engine holds the key / value pairs. */
+  MapEngine engine;
+
+  /** Function used to hash keys. */
+  HashFunction hash;
+
+  /** Open-addressing table, used instead of the chains for MAP_ROBIN_HOOD. */
+  RobinTable *robin;
+
   /** Table of key / value pairs. */
   Node **table;
 
@@ -41,6 +81,95 @@ struct MapStruct {
   
   /** Current size of the map (number of different keys). */
   int size;
+
+  /** Table we are growing out of, or NULL when no resize is in progress. */
+  Node **oldTable;
+
+  /** Length of the old table. */
+  int oldLen;
+
+  /** Buckets of the old table below this index have already been moved. */
+  int migrated;
+
+  /** Number of times the table has started growing. */
+  int resizes;
+
+  /** Entries per bucket the table may reach before it grows. */
+  double maxLoad;
+
+  /** Bytes of key characters stored, kept up to date by every set and remove. */
+  size_t keyBytes;
+
+  /** Bytes of values stored, as valueSize() counts them. */
+  size_t valueBytes;
+
+  /** Arena the nodes (and the driver's values) come from, or NULL to use malloc. */
+  Arena *arena;
+
+  /** Keys in sorted order, or NULL until the first range is asked for. */
+  SkipList *order;
+
+  /** Most bytes the entries may take before sets evict some, or 0 for no limit. */
+  size_t maxBytes;
+
+  /** Access clock: ticks on every set, and on every get while maxBytes is set.  Values
+      record it in their touched field. */
+  uint32_t clock;
+
+  /** State of the random number generator used to sample entries. */
+  uint32_t seed;
+
+  /** Expiry time of every key that has one, as a VALUE_DOUBLE on the mapNow() clock,
+      or NULL until the first one is set.  Their values have the expires flag set. */
+  Map *expires;
+
+  /** Number of keys removed because they expired. */
+  long expired;
+
+  /** Number of keys evicted to stay under maxBytes. */
+  long evicted;
+
+  /** View made by mapSnapshot() that hasn't been closed, or NULL. */
+  MapView *view;
+};
+
+/** One key / value pair copied out of a page of the table. */
+typedef struct {
+  /** The key, kept in the same block as the copy. */
+  char *key;
+
+  /** A heap copy of the value. */
+  Value *val;
+
+  /** Time the key expired at when the page was copied, or 0 if it never does. */
+  double deadline;
+} CopiedPair;
+
+/** Copy of one page of the table, made just before the page first changed. */
+typedef struct {
+  /** Number of pairs. */
+  int count;
+
+  /** The pairs, followed by the characters of their keys. */
+  CopiedPair pairs[];
+} PageCopy;
+
+/** Representation of a point-in-time view of a map. */
+struct MapViewStruct {
+  /** The map being viewed. */
+  Map *m;
+
+  /** Number of pages the table was split into when the view was made. */
+  int pages;
+
+  /** Pages below this one have been read. */
+  int next;
+
+  /** Copy of each page that changed before it was read, or NULL. */
+  PageCopy **copies;
+
+  /** What the view has cost so far. */
+  MapViewStats stats;
 };
 
 /**
@@ -50,20 +179,74 @@ struct MapStruct {
  */
 Map *makeMap( int len ) 
 {
+    return makeMapEngine(len, MAP_CHAINED);
+}
+
+/**
+    Makes an empty map that stores its pairs using the given engine.
+    @param len gives the number of buckets (or initial slots) in the hash table.
+    @param engine the storage engine to use
+    @return a pointer to a allocated map
+ */
+Map *makeMapEngine( int len, MapEngine engine )
+{
+    MapOptions opts = { .engine = engine };
+    return makeMapWith(len, &opts);
+}
+
+/**
+    Makes an empty map with the given storage engine and hash function.
+    @param len gives the number of buckets (or initial slots) in the hash table.
+    @param *opts settings for the new map
+    @return a pointer to a allocated map
+ */
+Map *makeMapWith( int len, MapOptions const *opts )
+{
+    MapEngine engine = opts->engine;
     Map *m = (Map*)malloc(sizeof(Map));
-    // if (m == NULL) {
-    //     return NULL;
-    // }
+    m->engine = engine;
+    m->hash = opts->hash ? opts->hash : jenkins_one_at_a_time_hash;
     m->tlen = len;
     m->size = 0;
-    m->table = (Node **) calloc(len, sizeof(Node *));
-    // if (!m->table) {
-    //     free(m);
-    //     exit(EXIT_FAILURE);
-    // }
+    m->oldTable = NULL;
+    m->oldLen = 0;
+    m->migrated = 0;
+    m->resizes = 0;
+    m->keyBytes = 0;
+    m->valueBytes = 0;
+    m->maxLoad = opts->maxLoad > 0 ? opts->maxLoad : (double) LOAD_NUM / LOAD_DEN;
+    m->arena = opts->arena ? makeArena() : NULL;
+    m->order = NULL;
+    m->maxBytes = opts->maxBytes;
+    m->clock = 0;
+    m->seed = 2463534242u;
+    m->expires = NULL;
+    m->expired = 0;
+    m->evicted = 0;
+    m->view = NULL;
+    if (engine == MAP_ROBIN_HOOD) {
+        m->robin = makeRobin(len, opts->maxLoad, m->arena);
+        m->table = NULL;
+    } else {
+        m->robin = NULL;
+        m->table = (Node **) calloc(len, sizeof(Node *));
+    }
     return m;
 }
 
+/**
+    Makes an empty map with the same engine, hash function and arena setting as
+    another, but no memory limit, so it can be filled and then handed to mapAbsorb().
+    @param *m the map to copy the settings of
+    @param len gives the number of buckets (or initial slots) in the hash table.
+    @return a pointer to a allocated map
+ */
+Map *makeMapLike( Map *m, int len )
+{
+    MapOptions opts = { .engine = m->engine, .hash = m->hash, .arena = m->arena != NULL };
+    return makeMapWith(len, &opts);
+}
+
 /**
     Function returns the current number of key / value pairs in the given map.
     @param *m pointer to a map to return the size for
@@ -78,131 +261,1595 @@ int mapSize( Map *m )
 }
 
 /**
-    The key hashing function to use to help us compute the Jenkins 32-bit hash function
-    @param *key pointer to a key that we need to hash
-    @param length the length of the key
-    @return hash of the key as a 32 bit hash
-*/
-uint32_t jenkins_one_at_a_time_hash(const uint8_t *key, size_t length) 
+    Hashes a key with the map's hash function.
+    @param *m the map the key belongs to
+    @param *key the key to hash
+    @param len length of the key
+    @return hash of the key
+ */
+static uint32_t hashKey( Map *m, char const *key, size_t len )
+{
+    return m->hash((const uint8_t *) key, len);
+}
+
+/**
+    Allocates a node with room for a key, from the map's arena if it has one.
+    @param *m the map the node is for
+    @param len length of the key
+    @return pointer to the uninitialized node
+ */
+static Node *allocNode( Map *m, size_t len )
+{
+    size_t size = sizeof(Node) + len + 1;
+    return m->arena ? arenaAlloc(m->arena, size) : malloc(size);
+}
+
+/**
+    Frees a node that came from allocNode().
+    @param *m the map the node belongs to
+    @param *n the node to free
+ */
+static void releaseNode( Map *m, Node *n )
 {
-    uint32_t hash = 0;
-    size_t i = 0;
-    while (i != length) {
-        hash += key[i++];
-        hash += (hash << NUM_10);
-        hash ^= (hash >> NUM_6);
+    if (m->arena) {
+        arenaRelease(n);
+    } else {
+        free(n);
     }
-    hash += (hash << NUM_3);
-    hash ^= (hash >> NUM_11);
-    hash += (hash << NUM_15);
-    return hash;
 }
 
 /**
-    Sets a given key value pair in the map
-    @param *m the pointer to a map to put the key-value pair in
-    @param *key pointer to a key to put in the map
-    @param *val pointer to a value of the key
+    Returns the time a key expires.
+    @param *m the map
+    @param *key the key
+    @param *val its value
+    @return the time on the mapNow() clock, or 0 if the key never expires
  */
-void mapSet( Map *m, char const *key, Value *val ) 
+static double deadlineOf( Map *m, char const *key, Value const *val )
 {
-    if (m == NULL || key == NULL || val == NULL) {
+    return val->expires ? mapGet(m->expires, key)->as.d : 0;
+}
+
+/**
+    Checks whether a key's expiry time has passed, for the walks over the map that skip
+    expired keys instead of removing them.
+    @param *m the map
+    @param *key the key
+    @param *val its value
+    @param now the current time on the mapNow() clock
+    @return true if the key has expired
+ */
+static bool expiredAt( Map *m, char const *key, Value const *val, double now )
+{
+    return val->expires && mapGet(m->expires, key)->as.d <= now;
+}
+
+/** Size of a page, counted up by measurePair(). */
+typedef struct {
+  /** Number of pairs. */
+  int count;
+
+  /** Bytes of key characters, with their terminators. */
+  size_t keyBytes;
+} PageSize;
+
+/**
+    Counts one pair of a page in a PageSize.
+    @param *key the key
+    @param *val the value, unused
+    @param *arg the PageSize
+ */
+static void measurePair( char const *key, Value *val, void *arg )
+{
+    PageSize *size = arg;
+    size->count++;
+    size->keyBytes += strlen(key) + 1;
+}
+
+/** Where copyPair() puts the next pair of a page. */
+typedef struct {
+  /** The map the page is copied from. */
+  Map *m;
+
+  /** The copy being filled. */
+  PageCopy *copy;
+
+  /** Where the next key's characters go. */
+  char *keys;
+} PageFill;
+
+/**
+    Copies one pair into a PageCopy.  Custom values can't be copied and are left out.
+    @param *key the key
+    @param *val the value
+    @param *arg the PageFill
+ */
+static void copyPair( char const *key, Value *val, void *arg )
+{
+    PageFill *fill = arg;
+    Value *copy = valueCopy(val);
+    if (copy == NULL) {
         return;
     }
-    uint32_t hashVal = jenkins_one_at_a_time_hash((const uint8_t *) key, strlen(key));
-    int idx = hashVal % m->tlen;
-    Node *curr = m->table[idx];
-    while(curr != NULL) {
-        if (strcmp(curr->key, key) == 0) {
-            free(curr->val);
-            curr->val = val;
+    size_t len = strlen(key) + 1;
+    memcpy(fill->keys, key, len);
+    CopiedPair *pair = &fill->copy->pairs[fill->copy->count++];
+    pair->key = fill->keys;
+    pair->val = copy;
+    pair->deadline = deadlineOf(fill->m, key, val);
+    fill->keys += len;
+}
+
+/**
+    Calls a function for every pair in one page of the current table.
+    @param *m the map
+    @param page the page
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+ */
+static void visitPage( Map *m, int page, MapVisitor visit, void *arg )
+{
+    uint32_t first = (uint32_t) page * VIEW_PAGE;
+    if (m->engine == MAP_ROBIN_HOOD) {
+        robinVisit(m->robin, first, VIEW_PAGE, visit, arg);
+        return;
+    }
+    for (uint32_t i = first; i < first + VIEW_PAGE && i < (uint32_t) m->tlen; i++) {
+        for (Node *curr = m->table[i]; curr != NULL; curr = curr->next) {
+            visit(curr->key, curr->val, arg);
         }
-      curr = curr->next;
     }
-    Node *newMap = (Node *)malloc(sizeof(Node));
-    strncpy(newMap->key, key, KEY_LIMIT);
-    newMap->key[KEY_LIMIT] = '\0';
-    newMap->val = val;
-    newMap->next = m->table[idx];
-    m->table[idx] = newMap;
-    m->size++;
 }
 
 /**
-    Gets a value from the map based on the key
-    @param *m a pointer to a map
-    @param *key a pointer to key
-    @return Value the value of the given key
+    Copies a page of the table for a view, unless the view has read it already or
+    copied it before.  Called just before the page changes.
+    @param *v the view
+    @param page the page
  */
-Value *mapGet( Map *m, char const *key ) 
+static void copyPage( MapView *v, long page )
 {
-  
-    uint32_t hashVal = jenkins_one_at_a_time_hash((const uint8_t *) key, strlen(key));
-    int idx = hashVal % m->tlen;
-    Node *curr = m->table[idx];
-    while (curr != NULL) {
-        if (strcmp(curr->key, key) == 0) {
-            return curr->val;
+    if (page < v->next || page >= v->pages || v->copies[page] != NULL) {
+        return;
+    }
+    PageSize size = { 0, 0 };
+    visitPage(v->m, page, measurePair, &size);
+    size_t bytes = sizeof(PageCopy) + size.count * sizeof(CopiedPair) + size.keyBytes;
+    PageCopy *copy = malloc(bytes);
+    copy->count = 0;
+    PageFill fill = { v->m, copy, (char *) ( copy->pairs + size.count ) };
+    visitPage(v->m, page, copyPair, &fill);
+    for (int i = 0; i < copy->count; i++) {
+        bytes += valueSize(copy->pairs[i].val);
+    }
+    v->copies[page] = copy;
+    v->stats.pagesCopied++;
+    v->stats.pairsCopied += copy->count;
+    v->stats.bytesCopied += bytes;
+}
+
+/**
+    Frees a page copy and the values in it.
+    @param *copy the copy
+ */
+static void freePageCopy( PageCopy *copy )
+{
+    for (int i = 0; i < copy->count; i++) {
+        valueDestroy(copy->pairs[i].val);
+    }
+    free(copy);
+}
+
+/**
+    Lets the map's view, if it has one, copy the page holding a bucket of the current
+    table before the bucket changes.
+    @param *m the map
+    @param bucket the bucket
+ */
+static void viewWrite( Map *m, uint32_t bucket )
+{
+    if (m->view != NULL) {
+        copyPage(m->view, bucket / VIEW_PAGE);
+    }
+}
+
+/**
+    Lets the map's view, if it has one, copy every page it hasn't read yet, before the
+    table is replaced by a larger one.  The view never reads the live table again.
+    @param *m the map
+ */
+static void viewWriteAll( Map *m )
+{
+    for (int page = m->view ? m->view->next : 0; m->view && page < m->view->pages; page++) {
+        copyPage(m->view, page);
+    }
+}
+
+/**
+    Copies the pages holding a range of Robin Hood slots for a view before they change.
+    @param *arg the view
+    @param first the first slot about to change
+    @param count number of slots
+ */
+static void watchSlots( void *arg, uint32_t first, uint32_t count )
+{
+    for (uint32_t page = first / VIEW_PAGE; page <= ( first + count - 1 ) / VIEW_PAGE;
+         page++) {
+        copyPage(arg, page);
+    }
+}
+
+/**
+    Moves up to count buckets from the old table into the current one, and frees the
+    old table once it is empty.
+    @param *m the map that is growing
+    @param count number of old buckets to move
+ */
+static void migrateBuckets( Map *m, int count )
+{
+    while (m->oldTable != NULL && count-- > 0) {
+        Node *curr = m->oldTable[m->migrated];
+        while (curr != NULL) {
+            Node *next = curr->next;
+            int idx = curr->hash % m->tlen;
+            curr->next = m->table[idx];
+            m->table[idx] = curr;
+            curr = next;
+        }
+        m->oldTable[m->migrated++] = NULL;
+        if (m->migrated == m->oldLen) {
+            free(m->oldTable);
+            m->oldTable = NULL;
         }
     }
-    return NULL;
 }
 
 /**
-    Removes a given key-value pair from the map
-    @param *m pointer to a map
-    @param *key pointer to a key
-    @return bool returns true or false based on the fact if the key-value pair is successfully removed from the map
+    Starts growing the table to twice its length. The entries stay where they are and
+    are moved a few buckets at a time by later sets and removes.
+    @param *m the map to grow
  */
-bool mapRemove( Map *m, char const *key ) 
+static void startResize( Map *m )
 {
-    uint32_t hashVal = jenkins_one_at_a_time_hash((const uint8_t *) key, strlen(key));
-    int idx = hashVal % m->tlen;
-    Node *curr = m->table[idx];
-    Node *prev = NULL;
-    while (curr != NULL) {
-        if (strcmp(curr->key, key) == 0) {
-            if (prev == NULL) {
-                m->table[idx] = curr->next;
+    viewWriteAll(m);
+    // Only one old table at a time; finish any earlier resize first.
+    migrateBuckets(m, m->oldLen);
+    m->oldTable = m->table;
+    m->oldLen = m->tlen;
+    m->migrated = 0;
+    m->tlen *= 2;
+    m->table = (Node **) calloc(m->tlen, sizeof(Node *));
+    m->resizes++;
+}
+
+/**
+    Makes the table big enough to take the given number of entries without growing,
+    moving every entry into the larger table at once.  Used before bulk loads, where
+    growing a step at a time would rehash each entry several times.
+    @param *m the map to grow
+    @param entries number of entries the table should have room for
+ */
+static void reserve( Map *m, int entries )
+{
+    if (m->engine == MAP_ROBIN_HOOD) {
+        robinReserve(m->robin, entries);
+        return;
+    }
+    int len = m->tlen;
+    while (entries > len * m->maxLoad) {
+        len *= 2;
+    }
+    if (len == m->tlen) {
+        return;
+    }
+    viewWriteAll(m);
+    migrateBuckets(m, m->oldLen);
+    m->oldTable = m->table;
+    m->oldLen = m->tlen;
+    m->migrated = 0;
+    m->tlen = len;
+    m->table = (Node **) calloc(m->tlen, sizeof(Node *));
+    m->resizes++;
+    migrateBuckets(m, m->oldLen);
+}
+
+/**
+    Finds the link that points at the node for a key, looking in the current table
+    and then in the part of the old table that hasn't been moved yet.
+    @param *m the map to search
+    @param hashVal hash of the key
+    @param *key the key to find
+    @param len length of the key
+    @return pointer to the link holding the node, or NULL if the key isn't present
+ */
+static Node **findLink( Map *m, uint32_t hashVal, char const *key, size_t len )
+{
+    Node **link = &m->table[hashVal % m->tlen];
+    for (; *link != NULL; link = &(*link)->next) {
+        Node *n = *link;
+        if (n->hash == hashVal && n->len == len && memcmp(n->key, key, len) == 0) {
+            return link;
+        }
+    }
+    if (m->oldTable != NULL) {
+        int idx = hashVal % m->oldLen;
+        if (idx >= m->migrated) {
+            for (link = &m->oldTable[idx]; *link != NULL; link = &(*link)->next) {
+                Node *n = *link;
+                if (n->hash == hashVal && n->len == len && memcmp(n->key, key, len) == 0) {
+                    return link;
+                }
             }
-           
-            free(curr);
+        }
+    }
+    return NULL;
+}
 
-            m->size--;
-            return true;
+/**
+    Removes a key whose hash has already been computed, along with its expiry time.
+    @param *m the map
+    @param hashVal hash of the key
+    @param *key the key, which must not point into the map
+    @param len length of the key
+    @return true if the key was in the map
+ */
+static bool removeHashed( Map *m, uint32_t hashVal, char const *key, size_t len )
+{
+    if (m->order != NULL) {
+        skipListRemove(m->order, key);
+    }
+    Value *old;
+    if (m->engine == MAP_ROBIN_HOOD) {
+        old = robinRemove(m->robin, hashVal, key, len);
+        if (old == NULL) {
+            return false;
         }
+    } else {
+        migrateBuckets(m, MIGRATE_STEP);
+        Node **link = findLink(m, hashVal, key, len);
+        if (link == NULL) {
+            return false;
+        }
+        viewWrite(m, hashVal % m->tlen);
+        Node *curr = *link;
+        *link = curr->next;
+        old = curr->val;
+        releaseNode(m, curr);
+    }
+    m->valueBytes -= valueSize(old);
+    m->keyBytes -= len + 1;
+    m->size--;
+    if (old->expires) {
+        mapRemove(m->expires, key);
     }
-    return false;
+    valueDestroy(old);
+    return true;
 }
 
 /**
-    Frees a map
-    @param *m pointer to a map to free
+    Removes a key the map picked itself.  The key points into the entry, so it is
+    copied first, before the entry is freed.
+    @param *m the map
+    @param *key the key, as stored in the map
  */
-void freeMap( Map *m ) 
+static void dropEntry( Map *m, char const *key )
 {
-    /**
-    for (int i = 0; i < m->tlen; i++) {
-        free(m->table[i]);
+    size_t len = strlen(key);
+    char small[ SHORT_KEY ];
+    char *copy = len < sizeof(small) ? small : malloc(len + 1);
+    memcpy(copy, key, len + 1);
+    mapRemove(m, copy);
+    if (copy != small) {
+        free(copy);
     }
-    free(m->table);
-    free(m);
-    */
+}
 
-    for (int i = 0; i < m->tlen; i++) {
-        Node *curr = m->table[i];
+/**
+    Steps the map's random number generator (xorshift).
+    @param *m the map
+    @return the next random number
+ */
+static uint32_t nextRandom( Map *m )
+{
+    uint32_t x = m->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return m->seed = x;
+}
 
-        // Free each linked list at this index
-        while (curr != NULL) {
-            Node *next = curr->next;
+/**
+    Picks an entry from about a random place in the map: for a chained table, a random
+    node of the first non-empty chain at or after a random bucket.
+    @param *m the map
+    @param **key set to the entry's key, which points into the map
+    @return the entry's value, or NULL if none was found near the place picked
+ */
+static Value *sampleEntry( Map *m, char const **key )
+{
+    uint32_t r = nextRandom(m);
+    if (m->engine == MAP_ROBIN_HOOD) {
+        return robinSample(m->robin, r, key);
+    }
+    for (int t = 0; t < 2; t++) {
+        Node **table = t == 0 ? m->table : m->oldTable;
+        uint32_t start = t == 0 ? 0 : m->migrated;
+        uint32_t len = ( t == 0 ? m->tlen : m->oldLen ) - start;
+        for (uint32_t i = 0; table != NULL && i < SAMPLE_SCAN && i < len; i++) {
+            Node *n = table[start + ( r + i ) % len];
+            if (n == NULL) {
+                continue;
+            }
+            int count = 0;
+            for (Node *c = n; c != NULL; c = c->next) {
+                count++;
+            }
+            for (int k = ( r >> 16 ) % count; k > 0; k--) {
+                n = n->next;
+            }
+            *key = n->key;
+            return n->val;
+        }
+    }
+    return NULL;
+}
+
+/**
+    Returns the bytes a map's memory limit applies to: the table, the per-entry
+    bookkeeping, the keys and the values.
+    @param *m the map
+    @return the number of bytes
+ */
+static size_t usedBytes( Map *m )
+{
+    size_t table;
+    if (m->engine == MAP_ROBIN_HOOD) {
+        table = robinBytes(m->robin);
+    } else {
+        table = ( m->tlen + ( m->oldTable ? m->oldLen : 0 ) ) * sizeof(Node *) +
+                m->size * sizeof(Node);
+    }
+    return table + m->keyBytes + m->valueBytes;
+}
 
-            if (curr->val && curr->val->destroy) {
-                curr->val->destroy(curr->val);
+/**
+    Evicts keys until the map is back under its memory limit.  Each time, a few entries
+    are sampled and the one whose value was set or read longest ago goes, which comes
+    close to evicting the least recently used key without keeping every entry on a
+    list that each get would have to update.
+    @param *m the map
+    @param *keep value that was just set, which is never evicted
+ */
+static void evict( Map *m, Value const *keep )
+{
+    while (usedBytes(m) > m->maxBytes) {
+        char const *victim = NULL;
+        uint32_t oldest = 0;
+        for (int i = 0; i < EVICT_SAMPLES; i++) {
+            char const *key;
+            Value *val = sampleEntry(m, &key);
+            // Ages are differences, so the clock can wrap around.
+            if (val != NULL && val != keep &&
+                ( victim == NULL || (uint32_t) ( m->clock - val->touched ) > oldest )) {
+                victim = key;
+                oldest = m->clock - val->touched;
             }
-            free(curr);
-            curr = next;
         }
+        if (victim == NULL) {
+            return;
+        }
+        dropEntry(m, victim);
+        m->evicted++;
+    }
+}
+
+/**
+    Puts a value in the table under a key whose hash has already been computed.
+    @param *m the map
+    @param hashVal hash of the key
+    @param *key the key
+    @param len length of the key
+    @param *val the value
+    @return the value it replaced, or NULL if the key is new
+ */
+static Value *storeHashed( Map *m, uint32_t hashVal, char const *key, size_t len,
+                           Value *val )
+{
+    if (m->engine == MAP_ROBIN_HOOD) {
+        Value *old = robinSet(m->robin, hashVal, key, len, val);
+        if (old == NULL) {
+            m->keyBytes += len + 1;
+            m->size++;
+        }
+        return old;
+    }
+    migrateBuckets(m, MIGRATE_STEP);
+    viewWrite(m, hashVal % m->tlen);
+    Node **link = findLink(m, hashVal, key, len);
+    if (link != NULL) {
+        Value *old = (*link)->val;
+        (*link)->val = val;
+        return old;
+    }
+    double maxLoad = m->view != NULL ? m->maxLoad * VIEW_LOAD : m->maxLoad;
+    if (m->size + 1 > m->tlen * maxLoad) {
+        startResize(m);
+    }
+    int idx = hashVal % m->tlen;
+    Node *newMap = allocNode(m, len);
+    memcpy(newMap->key, key, len + 1);
+    newMap->hash = hashVal;
+    newMap->len = len;
+    newMap->val = val;
+    newMap->next = m->table[idx];
+    m->table[idx] = newMap;
+    m->keyBytes += len + 1;
+    m->size++;
+    return NULL;
+}
+
+/**
+    Sets a key whose hash has already been computed, then evicts keys if the map is
+    over its memory limit and checks a few keys with expiry times.
+    @param *m the map
+    @param hashVal hash of the key
+    @param *key the key
+    @param len length of the key
+    @param *val the value
+ */
+static void setHashed( Map *m, uint32_t hashVal, char const *key, size_t len, Value *val )
+{
+    if (m->order != NULL) {
+        skipListSet(m->order, key, val);
+    }
+    m->valueBytes += valueSize(val);
+    val->touched = m->clock++;
+    Value *old = storeHashed(m, hashVal, key, len, val);
+    if (old != NULL) {
+        m->valueBytes -= valueSize(old);
+        // The new value doesn't keep the old one's expiry time.
+        if (old->expires) {
+            mapRemove(m->expires, key);
+        }
+        valueDestroy(old);
+    }
+    if (m->maxBytes > 0) {
+        evict(m, val);
+    }
+    if (m->expires != NULL) {
+        mapExpire(m, EXPIRE_STEP);
+    }
+}
+
+/**
+    Sets a given key value pair in the map
+    @param *m the pointer to a map to put the key-value pair in
+    @param *key pointer to a key to put in the map
+    @param *val pointer to a value of the key
+ */
+void mapSet( Map *m, char const *key, Value *val ) 
+{
+    if (m == NULL || key == NULL || val == NULL) {
+        return;
+    }
+    size_t len = strlen(key);
+    setHashed(m, hashKey(m, key, len), key, len, val);
+}
+
+/**
+    Looks up a key whose hash has already been computed.  A key found to have expired
+    is removed, and a key found in a map with a memory limit is marked as just used.
+    @param *m the map
+    @param hashVal hash of the key
+    @param *key the key
+    @param len length of the key
+    @param now the current time on the mapNow() clock, which a batch of lookups reads
+               once so a key it names twice can't expire, and be freed, in between
+    @return the value, or NULL if the key isn't in the map
+ */
+static Value *getHashed( Map *m, uint32_t hashVal, char const *key, size_t len,
+                         double now )
+{
+    Value *val;
+    if (m->engine == MAP_ROBIN_HOOD) {
+        val = robinGet(m->robin, hashVal, key, len);
+    } else {
+        Node **link = findLink(m, hashVal, key, len);
+        val = link == NULL ? NULL : (*link)->val;
+    }
+    if (val == NULL) {
+        return NULL;
+    }
+    // Only keys with an expiry time pay for a second lookup.
+    if (expiredAt(m, key, val, now)) {
+        removeHashed(m, hashVal, key, len);
+        m->expired++;
+        return NULL;
+    }
+    if (m->maxBytes > 0) {
+        val->touched = m->clock++;
+    }
+    return val;
+}
+
+/**
+    Gets a value from the map based on the key
+    @param *m a pointer to a map
+    @param *key a pointer to key
+    @return Value the value of the given key
+ */
+Value *mapGet( Map *m, char const *key ) 
+{
+    size_t len = strlen(key);
+    return getHashed(m, hashKey(m, key, len), key, len, mapNow());
+}
+
+/**
+    Hashes a window of keys and asks the cache for the memory each lookup will start
+    at.  For chained tables that takes two rounds: the bucket entries first, then the
+    first node of each chain, which can only be found once its bucket is loaded.
+    @param *m the map
+    @param count number of keys, at most PREFETCH_WINDOW
+    @param *keys the keys
+    @param *lens filled in with the length of each key
+    @param *hashes filled in with the hash of each key
+ */
+static void prefetchKeys( Map *m, int count, char const *const *keys, size_t *lens,
+                          uint32_t *hashes )
+{
+    for (int i = 0; i < count; i++) {
+        lens[i] = strlen(keys[i]);
+        hashes[i] = hashKey(m, keys[i], lens[i]);
+        if (m->engine == MAP_ROBIN_HOOD) {
+            robinPrefetch(m->robin, hashes[i]);
+        } else {
+            __builtin_prefetch(&m->table[hashes[i] % m->tlen]);
+        }
+    }
+    if (m->engine == MAP_CHAINED) {
+        for (int i = 0; i < count; i++) {
+            Node *head = m->table[hashes[i] % m->tlen];
+            if (head != NULL) {
+                __builtin_prefetch(head);
+            }
+        }
+    }
+}
+
+/**
+    Looks up several keys at once.  Keys are hashed and their buckets prefetched a
+    window at a time before any of them is resolved, so the cache misses of one window
+    overlap instead of being paid one after another.  Every key is checked for expiry
+    against one reading of the clock, so no lookup can free a value an earlier one in
+    the batch returned.
+    @param *m pointer to the map
+    @param count number of keys
+    @param *keys the keys to look up
+    @param *vals filled in with the value of each key, or NULL for a missing key
+ */
+void mapGetMany( Map *m, int count, char const *const *keys, Value **vals )
+{
+    uint32_t hashes[ PREFETCH_WINDOW ];
+    size_t lens[ PREFETCH_WINDOW ];
+    double now = mapNow();
+    for (int start = 0; start < count; start += PREFETCH_WINDOW) {
+        int n = count - start < PREFETCH_WINDOW ? count - start : PREFETCH_WINDOW;
+        prefetchKeys(m, n, keys + start, lens, hashes);
+        for (int i = 0; i < n; i++) {
+            vals[start + i] = getHashed(m, hashes[i], keys[start + i], lens[i], now);
+        }
+    }
+}
+
+/**
+    Sets several keys at once, in order, prefetching a window of buckets ahead of the
+    sets the same way mapGetMany() does.
+    @param *m pointer to the map
+    @param count number of pairs
+    @param *keys the keys to set
+    @param *vals the value for each key
+ */
+void mapSetMany( Map *m, int count, char const *const *keys, Value **vals )
+{
+    uint32_t hashes[ PREFETCH_WINDOW ];
+    size_t lens[ PREFETCH_WINDOW ];
+    for (int start = 0; start < count; start += PREFETCH_WINDOW) {
+        int n = count - start < PREFETCH_WINDOW ? count - start : PREFETCH_WINDOW;
+        prefetchKeys(m, n, keys + start, lens, hashes);
+        for (int i = 0; i < n; i++) {
+            if (vals[start + i] != NULL) {
+                setHashed(m, hashes[i], keys[start + i], lens[i], vals[start + i]);
+            }
+        }
+    }
+}
+
+/**
+    Removes a given key-value pair from the map
+    @param *m pointer to a map
+    @param *key pointer to a key
+    @return bool returns true or false based on the fact if the key-value pair is successfully removed from the map
+ */
+bool mapRemove( Map *m, char const *key ) 
+{
+    size_t len = strlen(key);
+    return removeHashed(m, hashKey(m, key, len), key, len);
+}
+
+/**
+    Returns the clock expiry times are measured on.
+    @return seconds since the epoch
+ */
+double mapNow( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / NANOS;
+}
+
+/**
+    Gives a key an expiry time, kept in the map's table of expiry times, and flags its
+    value so lookups know to check it.
+    @param *m pointer to the map
+    @param *key the key, which must be in the map
+    @param deadline time the key expires, on the mapNow() clock; a time already past
+                    removes the key right away
+    @return false if the key isn't in the map
+ */
+bool mapExpireAt( Map *m, char const *key, double deadline )
+{
+    Value *val = mapGet(m, key);
+    if (val == NULL) {
+        return false;
+    }
+    if (deadline <= mapNow()) {
+        mapRemove(m, key);
+        m->expired++;
+        return true;
+    }
+    if (m->expires == NULL) {
+        MapOptions opts = { .hash = m->hash };
+        m->expires = makeMapWith(EXPIRE_BUCKETS, &opts);
+    }
+    mapSet(m->expires, key, makeDoubleIn(deadline, NULL));
+    val->expires = true;
+    return true;
+}
+
+/**
+    Returns the time a key expires, without checking whether it has passed, so it may
+    be called while the map is being walked.
+    @param *m pointer to the map
+    @param *key the key
+    @return the time on the mapNow() clock, or 0 if the key never expires or isn't in
+            the map
+ */
+double mapDeadline( Map *m, char const *key )
+{
+    // The expiry map's own values never expire, so looking in it changes nothing.
+    Value *deadline = m->expires ? mapGet(m->expires, key) : NULL;
+    return deadline ? deadline->as.d : 0;
+}
+
+/**
+    Returns how long a key has before it expires.
+    @param *m pointer to the map
+    @param *key the key
+    @return seconds left, -1 if the key has no expiry time, or -2 if it isn't in the map
+ */
+double mapTtl( Map *m, char const *key )
+{
+    Value *val = mapGet(m, key);
+    if (val == NULL) {
+        return -2;
+    }
+    return val->expires ? mapGet(m->expires, key)->as.d - mapNow() : -1;
+}
+
+/**
+    Checks a random sample of the keys that have expiry times and removes those that
+    have expired.
+    @param *m pointer to the map
+    @param samples number of keys to check
+    @return number of keys removed
+ */
+int mapExpire( Map *m, int samples )
+{
+    if (m->expires == NULL || m->expires->size == 0) {
+        return 0;
+    }
+    double now = mapNow();
+    int removed = 0;
+    for (int i = 0; i < samples && m->expires->size > 0; i++) {
+        char const *key;
+        Value *deadline = sampleEntry(m->expires, &key);
+        if (deadline != NULL && deadline->as.d <= now) {
+            dropEntry(m, key);
+            removed++;
+        }
+    }
+    m->expired += removed;
+    return removed;
+}
+
+/**
+    Adds a number to the int or double stored under a key, changing the stored Value in
+    place.  The Value keeps its size, so the byte counts don't change.
+    @param *m pointer to the map
+    @param *key the key
+    @param *delta the number to add, a VALUE_INT or VALUE_DOUBLE
+    @return the updated value, or NULL if the stored value isn't a number or an int sum
+            would overflow
+ */
+Value *mapIncrement( Map *m, char const *key, Value const *delta )
+{
+    size_t len = strlen(key);
+    uint32_t hashVal = hashKey(m, key, len);
+    Value *val = getHashed(m, hashVal, key, len, mapNow());
+    if (val != NULL) {
+        // The number changes in place, so an open view has to copy it first.
+        if (m->view != NULL && m->engine == MAP_ROBIN_HOOD) {
+            robinTouch(m->robin, hashVal, key, len);
+        } else if (m->view != NULL) {
+            viewWrite(m, hashVal % m->tlen);
+        }
+        return valueAdd(val, delta) ? val : NULL;
+    }
+    val = delta->type == VALUE_INT ? makeIntegerIn(delta->as.i, m->arena)
+                                   : makeDoubleIn(delta->as.d, m->arena);
+    setHashed(m, hashVal, key, len, val);
+    return val;
+}
+
+/**
+    Returns the arena the map allocates from, so values stored in it can come from the
+    same slabs.
+    @param *m pointer to the map
+    @return the map's arena, or NULL if it was made without one
+ */
+Arena *mapArena( Map *m )
+{
+    return m->arena;
+}
+
+/**
+    Measures the chains of a chained table, counting the buckets of the old table that
+    haven't been moved yet.
+    @param *m the map
+    @param *stats structure whose maxChain and meanChain fields are filled in
+ */
+static void chainStats( Map *m, MapStats *stats )
+{
+    int longest = 0, chains = 0;
+    for (int t = 0; t < 2; t++) {
+        Node **table = t == 0 ? m->table : m->oldTable;
+        int len = t == 0 ? m->tlen : m->oldLen;
+        for (int i = t == 0 ? 0 : m->migrated; table != NULL && i < len; i++) {
+            int n = 0;
+            for (Node *curr = table[i]; curr != NULL; curr = curr->next) {
+                n++;
+            }
+            longest = n > longest ? n : longest;
+            chains += n > 0;
+        }
+    }
+    stats->maxChain = longest;
+    stats->meanChain = chains ? (double) m->size / chains : 0;
+}
+
+/**
+    Reports the current shape of the map and the memory it uses.  The sizes are kept as
+    the map changes, but chain lengths are measured by walking the table, so this takes
+    time in proportion to the number of buckets.
+    @param *m pointer to the map
+    @param *stats structure to fill in
+ */
+void mapStats( Map *m, MapStats *stats )
+{
+    if (m->engine == MAP_ROBIN_HOOD) {
+        robinStats(m->robin, stats);
+    } else {
+        stats->buckets = m->tlen;
+        stats->resizes = m->resizes;
+        stats->resizing = m->oldTable != NULL;
+        chainStats(m, stats);
+        stats->tableBytes = (m->tlen + (m->oldTable ? m->oldLen : 0)) * sizeof(Node *);
+        stats->nodeBytes = m->size * sizeof(Node);
+    }
+    stats->entries = m->size;
+    stats->loadFactor = (double) m->size / stats->buckets;
+    stats->keyBytes = m->keyBytes;
+    stats->valueBytes = m->valueBytes;
+    stats->indexBytes = m->order ? skipListBytes(m->order) : 0;
+    stats->expiring = m->expires ? m->expires->size : 0;
+    stats->expired = m->expired;
+    stats->evicted = m->evicted;
+}
+
+/**
+    Calls a function for every key / value pair in the map, expired or not, in no
+    particular order.
+    @param *m pointer to the map
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+ */
+static void forEachEntry( Map *m, MapVisitor visit, void *arg )
+{
+    if (m->engine == MAP_ROBIN_HOOD) {
+        robinForEach(m->robin, visit, arg);
+        return;
+    }
+    for (int i = 0; i < m->tlen; i++) {
+        for (Node *curr = m->table[i]; curr != NULL; curr = curr->next) {
+            visit(curr->key, curr->val, arg);
+        }
+    }
+    for (int i = m->migrated; m->oldTable != NULL && i < m->oldLen; i++) {
+        for (Node *curr = m->oldTable[i]; curr != NULL; curr = curr->next) {
+            visit(curr->key, curr->val, arg);
+        }
+    }
+}
+
+/** A visitor that is only given the keys that haven't expired. */
+typedef struct {
+  /** The map being walked. */
+  Map *m;
+
+  /** Time the walk started, on the mapNow() clock. */
+  double now;
+
+  /** Function to call for each pair. */
+  MapVisitor visit;
+
+  /** Passed on to visit. */
+  void *arg;
+} LiveVisit;
+
+/**
+    Passes one pair on to a LiveVisit's function unless its key has expired.
+    @param *key the key
+    @param *val the value
+    @param *arg the LiveVisit
+ */
+static void visitLive( char const *key, Value *val, void *arg )
+{
+    LiveVisit *live = arg;
+    if (!expiredAt(live->m, key, val, live->now)) {
+        live->visit(key, val, live->arg);
+    }
+}
+
+/**
+    Calls a function for every key / value pair in the map, in no particular order.
+    Keys past their expiry time are skipped; they are left for a lookup or mapExpire()
+    to remove.  The map must not be changed until it returns.
+    @param *m pointer to the map
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+ */
+void mapForEach( Map *m, MapVisitor visit, void *arg )
+{
+    if (m->expires == NULL || m->expires->size == 0) {
+        forEachEntry(m, visit, arg);
+        return;
+    }
+    LiveVisit live = { m, mapNow(), visit, arg };
+    forEachEntry(m, visitLive, &live);
+}
+
+/** One pair, for sorting by key. */
+typedef struct {
+  /** The key. */
+  char const *key;
+
+  /** The value. */
+  Value *val;
+} KeyedValue;
+
+/**
+    Adds one pair to an array of KeyedValue.
+    @param *key the key
+    @param *val the value
+    @param *arg pointer to the next free element of the array
+ */
+static void gatherKeyed( char const *key, Value *val, void *arg )
+{
+    KeyedValue **next = arg;
+    (*next)->key = key;
+    (*next)->val = val;
+    (*next)++;
+}
+
+/**
+    Orders two pairs by key.
+    @param *a pointer to the first pair
+    @param *b pointer to the second pair
+    @return negative, zero or positive as for strcmp
+ */
+static int compareKeyed( void const *a, void const *b )
+{
+    return strcmp(( (KeyedValue const *) a )->key, ( (KeyedValue const *) b )->key);
+}
+
+/**
+    Returns the map's sorted index, building it from the table the first time.  Maps
+    that never scan a range don't pay for keeping one.  The keys are sorted once and
+    linked in order, which is much cheaper than inserting them one at a time.
+    @param *m the map
+    @return the index, kept up to date by every later set and remove
+ */
+static SkipList *orderIndex( Map *m )
+{
+    if (m->order != NULL) {
+        return m->order;
+    }
+    KeyedValue *pairs = malloc((m->size + 1) * sizeof(KeyedValue));
+    KeyedValue *next = pairs;
+    // Expired keys are still in the table, so they go in the index too.
+    forEachEntry(m, gatherKeyed, &next);
+    int count = next - pairs;
+    qsort(pairs, count, sizeof(KeyedValue), compareKeyed);
+
+    char const **keys = malloc((count + 1) * sizeof(char const *));
+    Value **vals = malloc((count + 1) * sizeof(Value *));
+    for (int i = 0; i < count; i++) {
+        keys[i] = pairs[i].key;
+        vals[i] = pairs[i].val;
+    }
+    m->order = makeSortedSkipList(count, keys, vals);
+    free(vals);
+    free(keys);
+    free(pairs);
+    return m->order;
+}
+
+/**
+    Calls a function for every key from one key to another, in strcmp() order.  Pairs
+    are visited straight out of the map's sorted index, which is built on the first call
+    and then kept up to date by mapSet() and mapRemove().  Expired keys are skipped.
+    @param *m pointer to the map
+    @param *from smallest key to visit, or NULL to start at the first key
+    @param *to largest key to visit, or NULL to go on to the last key
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+    @return number of pairs visited
+ */
+int mapScan( Map *m, char const *from, char const *to, MapVisitor visit, void *arg )
+{
+    double now = mapNow();
+    int count = 0;
+    for (SkipNode *n = skipListSeek(orderIndex(m), from); n != NULL; n = skipNodeNext(n)) {
+        if (to != NULL && strcmp(skipNodeKey(n), to) > 0) {
+            break;
+        }
+        if (expiredAt(m, skipNodeKey(n), skipNodeValue(n), now)) {
+            continue;
+        }
+        visit(skipNodeKey(n), skipNodeValue(n), arg);
+        count++;
+    }
+    return count;
+}
+
+/**
+    Calls a function for every key that starts with the given text, in strcmp() order.
+    Expired keys are skipped.
+    @param *m pointer to the map
+    @param *prefix text the keys must start with
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+    @return number of pairs visited
+ */
+int mapPrefix( Map *m, char const *prefix, MapVisitor visit, void *arg )
+{
+    // Keys with the prefix sort together, starting at the prefix itself.
+    size_t len = strlen(prefix);
+    double now = mapNow();
+    int count = 0;
+    for (SkipNode *n = skipListSeek(orderIndex(m), prefix); n != NULL; n = skipNodeNext(n)) {
+        if (strncmp(skipNodeKey(n), prefix, len) != 0) {
+            break;
+        }
+        if (expiredAt(m, skipNodeKey(n), skipNodeValue(n), now)) {
+            continue;
+        }
+        visit(skipNodeKey(n), skipNodeValue(n), arg);
+        count++;
+    }
+    return count;
+}
+
+/**
+    Adds one value to a MapAggregate if it is a number.
+    @param *key the key, unused
+    @param *val the value
+    @param *arg the MapAggregate
+ */
+static void aggregateValue( char const *key, Value *val, void *arg )
+{
+    MapAggregate *agg = arg;
+    if (val->type == VALUE_INT) {
+        agg->intSum += val->as.i;
+    } else if (val->type == VALUE_DOUBLE) {
+        agg->doubleSum += val->as.d;
+        agg->doubles++;
+    } else {
+        return;
+    }
+    if (agg->count++ == 0 || valueCompare(val, agg->min) < 0) {
+        agg->min = val;
+    }
+    if (agg->count == 1 || valueCompare(val, agg->max) > 0) {
+        agg->max = val;
+    }
+}
+
+/**
+    Counts, sums and finds the smallest and largest of the numbers in the map, or only
+    those whose keys start with a prefix.
+    @param *m pointer to the map
+    @param *prefix text the keys must start with, or NULL for every key
+    @param *agg structure to fill in
+ */
+void mapAggregate( Map *m, char const *prefix, MapAggregate *agg )
+{
+    *agg = (MapAggregate) { .count = 0 };
+    if (prefix != NULL) {
+        mapPrefix(m, prefix, aggregateValue, agg);
+    } else {
+        mapForEach(m, aggregateValue, agg);
+    }
+}
+
+/** Pairs gathered from a map so they can be written out together. */
+typedef struct {
+  /** The map they come from. */
+  Map *m;
+
+  /** Array of keys. */
+  char const **keys;
+
+  /** Array of values. */
+  Value **vals;
+
+  /** Array of the times the keys expire, 0 for those that never do. */
+  double *deadlines;
+
+  /** Number of pairs gathered so far. */
+  int count;
+} Pairs;
+
+/**
+    Adds one pair to a Pairs collection.
+    @param *key the key
+    @param *val the value
+    @param *arg the Pairs
+ */
+static void gatherPair( char const *key, Value *val, void *arg )
+{
+    Pairs *p = arg;
+    p->keys[p->count] = key;
+    p->vals[p->count] = val;
+    p->deadlines[p->count] = deadlineOf(p->m, key, val);
+    p->count++;
+}
+
+/**
+    Writes every key / value pair in the map to a binary snapshot file (see snapshot.h),
+    along with the time each key expires.  Keys that have expired already are left out.
+    @param *m pointer to the map
+    @param *path name of the file to write
+    @return false if the file couldn't be written or the map holds a custom value
+ */
+bool mapSave( Map *m, char const *path )
+{
+    Pairs p;
+    p.m = m;
+    p.keys = malloc((m->size + 1) * sizeof(char const *));
+    p.vals = malloc((m->size + 1) * sizeof(Value *));
+    p.deadlines = malloc((m->size + 1) * sizeof(double));
+    p.count = 0;
+    mapForEach(m, gatherPair, &p);
+    bool ok = writeSnapshot(path, m->hash, p.count, p.keys, p.vals, p.deadlines);
+    free(p.keys);
+    free(p.vals);
+    free(p.deadlines);
+    return ok;
+}
+
+/**
+    Makes a read-only view of the map as it is right now, which is then read a few
+    pages of the table at a time with mapViewNext() while the map keeps changing.
+    Nothing is copied up front: the table is split into pages of buckets (or slots),
+    and the first change to a page the view hasn't read yet copies that page first.
+    @param *m pointer to the map
+    @return the view, or NULL if the map already has one open
+ */
+MapView *mapSnapshot( Map *m )
+{
+    if (m->view != NULL) {
+        return NULL;
+    }
+    // Pages are cut from the current table, so every entry has to be in it.
+    uint32_t len;
+    MapView *v = malloc(sizeof(MapView));
+    if (m->engine == MAP_ROBIN_HOOD) {
+        len = robinWatch(m->robin, watchSlots, v);
+    } else {
+        migrateBuckets(m, m->oldLen);
+        len = m->tlen;
+    }
+    v->m = m;
+    v->pages = ( len + VIEW_PAGE - 1 ) / VIEW_PAGE;
+    v->next = 0;
+    v->copies = calloc(v->pages > 0 ? v->pages : 1, sizeof(PageCopy *));
+    v->stats = (MapViewStats) { .pages = v->pages };
+    m->view = v;
+    return v;
+}
+
+/**
+    Function called for each pair of a view by readView(), with the time its key
+    expires.
+    @param *key the key
+    @param *val the value
+    @param deadline time the key expires, on the mapNow() clock, or 0 if it never does
+    @param *arg the argument given to readView()
+ */
+typedef void (*ViewVisitor)( char const *key, Value *val, double deadline, void *arg );
+
+/** What readView() passes each pair of a page it reads in place to. */
+typedef struct {
+  /** The map being viewed. */
+  Map *m;
+
+  /** Time the pages are being read, on the mapNow() clock. */
+  double now;
+
+  /** Function to call for each pair. */
+  ViewVisitor visit;
+
+  /** Passed on to visit. */
+  void *arg;
+} ViewRead;
+
+/**
+    Passes one pair of a page read in place on to a ViewRead's function, with its
+    expiry time, unless it has expired.  A key's expiry time only changes along with
+    its page, so the map's is the one it had when the view was made.
+    @param *key the key
+    @param *val the value
+    @param *arg the ViewRead
+ */
+static void readLivePair( char const *key, Value *val, void *arg )
+{
+    ViewRead *read = arg;
+    double deadline = deadlineOf(read->m, key, val);
+    if (deadline == 0 || deadline > read->now) {
+        read->visit(key, val, deadline, read->arg);
+    }
+}
+
+/**
+    Reads the next pages of a view, calling a function for each key / value pair they
+    held when the view was made that hasn't expired since.  Pages that changed since
+    are read from their copies, which are freed once they have been read.
+    @param *v the view
+    @param pages number of pages to read
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+    @return true if there are pages left to read
+ */
+static bool readView( MapView *v, int pages, ViewVisitor visit, void *arg )
+{
+    ViewRead read = { v->m, mapNow(), visit, arg };
+    for (; pages > 0 && v->next < v->pages; pages--, v->next++) {
+        PageCopy *copy = v->copies[v->next];
+        if (copy == NULL) {
+            visitPage(v->m, v->next, readLivePair, &read);
+            continue;
+        }
+        for (int i = 0; i < copy->count; i++) {
+            CopiedPair *pair = &copy->pairs[i];
+            if (pair->deadline == 0 || pair->deadline > read.now) {
+                visit(pair->key, pair->val, pair->deadline, arg);
+            }
+        }
+        freePageCopy(copy);
+        v->copies[v->next] = NULL;
+    }
+    return v->next < v->pages;
+}
+
+/** A MapVisitor called by readView(), which has no use for expiry times. */
+typedef struct {
+  /** Function to call for each pair. */
+  MapVisitor visit;
+
+  /** Passed on to visit. */
+  void *arg;
+} ViewPass;
+
+/**
+    Passes one pair of a view on to a ViewPass's function.
+    @param *key the key
+    @param *val the value
+    @param deadline time the key expires, unused
+    @param *arg the ViewPass
+ */
+static void passViewPair( char const *key, Value *val, double deadline, void *arg )
+{
+    ViewPass *pass = arg;
+    pass->visit(key, val, pass->arg);
+}
+
+/**
+    Reads the next pages of a view, calling a function for each key / value pair they
+    held when the view was made.  Keys that have expired since are skipped.
+    @param *v the view
+    @param pages number of pages to read
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+    @return true if there are pages left to read
+ */
+bool mapViewNext( MapView *v, int pages, MapVisitor visit, void *arg )
+{
+    ViewPass pass = { visit, arg };
+    return readView(v, pages, passViewPair, &pass);
+}
+
+/**
+    Reports what a view has read and copied so far.
+    @param *v the view
+    @param *stats structure to fill in
+ */
+void mapViewStats( MapView *v, MapViewStats *stats )
+{
+    *stats = v->stats;
+    stats->pagesRead = v->next;
+}
+
+/**
+    Closes a view, freeing any pages it copied, so the map can have another.
+    @param *v the view to close
+ */
+void mapViewClose( MapView *v )
+{
+    for (int page = v->next; page < v->pages; page++) {
+        if (v->copies[page] != NULL) {
+            freePageCopy(v->copies[page]);
+        }
+    }
+    if (v->m->engine == MAP_ROBIN_HOOD) {
+        robinWatch(v->m->robin, NULL, NULL);
+    }
+    v->m->view = NULL;
+    free(v->copies);
+    free(v);
+}
+
+/** Representation of a snapshot file being written from a view. */
+struct MapSaveStruct {
+  /** The view the pairs are read from. */
+  MapView *view;
+
+  /** The file they are written to. */
+  SnapshotWriter *writer;
+};
+
+/**
+    Adds one pair to a snapshot file.
+    @param *key the key
+    @param *val the value
+    @param deadline time the key expires, on the mapNow() clock, or 0 if it never does
+    @param *arg the SnapshotWriter
+ */
+static void addToSnapshot( char const *key, Value *val, double deadline, void *arg )
+{
+    snapshotAdd(arg, key, val, deadline);
+}
+
+/**
+    Starts writing the map, as it is right now, to a snapshot file in the background:
+    each mapSaveStep() writes a few more pages of a view made by mapSnapshot(), and
+    the map may change in between.
+    @param *m pointer to the map
+    @param *path name of the file to write
+    @return the save, or NULL if the map already has a view open
+ */
+MapSave *mapSaveBegin( Map *m, char const *path )
+{
+    MapView *v = mapSnapshot(m);
+    if (v == NULL) {
+        return NULL;
+    }
+    MapSave *s = malloc(sizeof(MapSave));
+    s->view = v;
+    s->writer = startSnapshot(path, m->hash);
+    return s;
+}
+
+/**
+    Adds the next pages of the map to a background save.
+    @param *s the save
+    @param pages number of pages to add
+    @return true if there are pages left to add
+ */
+bool mapSaveStep( MapSave *s, int pages )
+{
+    return readView(s->view, pages, addToSnapshot, s->writer);
+}
+
+/**
+    Adds whatever pages are left to a background save, writes the file under a
+    temporary name renamed into place, and closes the save's view.
+    @param *s the save, which is freed
+    @return false if the file couldn't be written or the map held a custom value
+ */
+bool mapSaveEnd( MapSave *s )
+{
+    mapSaveStep(s, s->view->pages);
+    mapViewClose(s->view);
+    bool ok = finishSnapshot(s->writer);
+    free(s);
+    return ok;
+}
+
+/**
+    Reads a snapshot file written by mapSave() and sets each of its pairs in the map,
+    replacing the values of keys that are already there, with the expiry times they
+    were saved with.  Pairs whose time has passed since are left out.  Values come
+    from the map's arena if it has one.
+    @param *m pointer to the map
+    @param *path name of the file to read
+    @return false if the file can't be read or isn't a snapshot
+ */
+bool mapLoad( Map *m, char const *path )
+{
+    Snapshot *s = openSnapshot(path);
+    if (s == NULL) {
+        return false;
+    }
+    int count = snapshotSize(s);
+    reserve(m, m->size + count);
+    double now = mapNow();
+    for (int i = 0; i < count; i++) {
+        double deadline = snapshotDeadline(s, i);
+        if (deadline != 0 && deadline <= now) {
+            continue;
+        }
+        Value *val = snapshotValueIn(s, i, m->arena);
+        if (val != NULL) {
+            mapSet(m, snapshotKey(s, i), val);
+            if (deadline != 0) {
+                mapExpireAt(m, snapshotKey(s, i), deadline);
+            }
+        }
+    }
+    closeSnapshot(s);
+    return true;
+}
+
+/** The two maps mapAbsorb() is moving pairs between. */
+typedef struct {
+  /** Map the pairs go to. */
+  Map *dst;
+
+  /** Map they come from. */
+  Map *src;
+} Absorb;
+
+/**
+    Moves one pair into the destination map of a mapAbsorb(), along with its expiry
+    time if it has one.
+    @param *key the key
+    @param *val its value, which the destination map takes over
+    @param *arg the Absorb
+ */
+static void absorbPair( char const *key, Value *val, void *arg )
+{
+    Absorb *a = arg;
+    double deadline = 0;
+    if (val->expires) {
+        deadline = mapGet(a->src->expires, key)->as.d;
+        val->expires = false;
+    }
+    size_t len = strlen(key);
+    setHashed(a->dst, hashKey(a->dst, key, len), key, len, val);
+    if (deadline != 0) {
+        mapExpireAt(a->dst, key, deadline);
+    }
+}
+
+/**
+    Moves every pair of one map into another, replacing the values of keys that are
+    already there, and then frees the first map.  Values and their expiry times move
+    without being copied.  The maps must either both have an arena or both not have
+    one; the first map's arena joins the second's.
+    @param *dst the map to move the pairs into
+    @param *src the map to move them out of, which is freed
+ */
+void mapAbsorb( Map *dst, Map *src )
+{
+    Absorb a = { dst, src };
+    reserve(dst, dst->size + src->size);
+    if (src->engine == MAP_ROBIN_HOOD) {
+        robinDrain(src->robin, absorbPair, &a);
+    } else {
+        // Nodes left holding no value are freed without one.
+        migrateBuckets(src, src->oldLen);
+        for (int i = 0; i < src->tlen; i++) {
+            for (Node *curr = src->table[i]; curr != NULL; curr = curr->next) {
+                absorbPair(curr->key, curr->val, &a);
+                curr->val = NULL;
+            }
+        }
+    }
+    // Moved values (and, for now, the old nodes and keys) live on in src's slabs.
+    if (src->arena != NULL) {
+        arenaAdopt(dst->arena, src->arena);
+    }
+    freeMap(src);
+}
+
+/**
+    Frees every node in a chained map and the value it holds, then the table itself.
+    @param *m the map whose chains should be freed
+ */
+static void freeChains( Map *m )
+{
+    // Move whatever is left of an unfinished resize so there is one table to free.
+    migrateBuckets(m, m->oldLen);
+    for (int i = 0; i < m->tlen; i++) {
+        Node *curr = m->table[i];
+
+        // Free each linked list at this index
+        while (curr != NULL) {
+            Node *next = curr->next;
+
+            if (curr->val) {
+                valueDestroy(curr->val);
+            }
+            free(curr);
+            curr = next;
+        }
+    }
+    free(m->table);
+}
+
+/**
+    Frees a map.  Any view of it must be closed first.
+    @param *m pointer to a map to free
+ */
+void freeMap( Map *m ) 
+{
+    /**
+    for (int i = 0; i < m->tlen; i++) {
+        free(m->table[i]);
+    }
+    free(m->table);
+    free(m);
+    */
+
+    if (m->engine == MAP_ROBIN_HOOD) {
+        freeRobin(m->robin);
+    } else if (m->arena != NULL) {
+        // Nodes and values all live in the arena's slabs, so there is nothing
+        // to visit one entry at a time.
+        free(m->oldTable);
+        free(m->table);
+    } else {
+        freeChains(m);
+    }
+    if (m->arena != NULL) {
+        freeArena(m->arena);
+    }
+    if (m->order != NULL) {
+        freeSkipList(m->order);
+    }
+    if (m->expires != NULL) {
+        freeMap(m->expires);
     }
-    free(m->table);
     free(m);
 }
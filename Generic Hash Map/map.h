@@ -7,34 +7,180 @@
 #define MAP_H
 
 #include "value.h"
+#include "hash.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 /** Incomplete type for the Map representation. */
 typedef struct MapStruct Map;
 
-// Maximum length of a key.
-#define KEY_LIMIT 24
+/** Shape of a map at one moment, filled in by mapStats(). */
+typedef struct {
+  /** Number of key / value pairs. */
+  int entries;
+
+  /** Number of buckets (or slots) in the current table. */
+  int buckets;
+
+  /** Entries per bucket in the current table. */
+  double loadFactor;
+
+  /** Number of times the table has started growing. */
+  int resizes;
+
+  /** True while entries are still being moved out of the previous table. */
+  bool resizing;
+
+  /** Longest chain, or for MAP_ROBIN_HOOD the most slots read to find a stored key. */
+  int maxChain;
+
+  /** Mean length of the non-empty chains, or the mean number of slots read to find a
+      stored key. */
+  double meanChain;
+
+  /** Bytes in the bucket or slot arrays, counting one still being moved out of. */
+  size_t tableBytes;
+
+  /** Bytes of bookkeeping kept with each entry: chained nodes apart from their keys,
+      or the length in front of each Robin Hood key. */
+  size_t nodeBytes;
+
+  /** Bytes of key characters, with their terminators. */
+  size_t keyBytes;
+
+  /** Bytes taken by the values, as valueSize() counts them. */
+  size_t valueBytes;
+
+  /** Bytes of the sorted key index, or 0 if no range has been asked for yet. */
+  size_t indexBytes;
+
+  /** Number of keys that have an expiry time. */
+  int expiring;
+
+  /** Number of keys removed so far because they expired. */
+  long expired;
+
+  /** Number of keys evicted so far to stay under MapOptions.maxBytes. */
+  long evicted;
+} MapStats;
+
+/** Totals over the numbers in some or all of a map, filled in by mapAggregate(). */
+typedef struct {
+  /** Number of int and double values seen; strings and custom values are skipped. */
+  int count;
+
+  /** Number of those that were doubles.  If there are none, the sum is an exact int. */
+  int doubles;
+
+  /** Sum of the int values, kept exactly. */
+  long long intSum;
+
+  /** Sum of the double values. */
+  double doubleSum;
+
+  /** Smallest number seen, or NULL if there were none.  It points into the map. */
+  Value const *min;
+
+  /** Largest number seen, or NULL if there were none.  It points into the map. */
+  Value const *max;
+} MapAggregate;
+
+/** Incomplete type for a point-in-time view of a map, made by mapSnapshot(). */
+typedef struct MapViewStruct MapView;
+
+/** Incomplete type for a snapshot file being written from a view, by mapSaveBegin(). */
+typedef struct MapSaveStruct MapSave;
+
+/** What a view has cost so far, filled in by mapViewStats(). */
+typedef struct {
+  /** Number of pages the table was split into when the view was made. */
+  int pages;
+
+  /** Number of pages read so far. */
+  int pagesRead;
+
+  /** Number of pages copied because they were about to change before being read. */
+  int pagesCopied;
+
+  /** Number of key / value pairs in those copies. */
+  long pairsCopied;
+
+  /** Bytes the copies took, with their keys and values. */
+  size_t bytesCopied;
+} MapViewStats;
+
+/** Storage engines a Map can keep its key / value pairs in. */
+typedef enum {
+  /** Separately allocated nodes chained off each bucket (the default). */
+  MAP_CHAINED,
+
+  /** Open addressing over a flat slot array with Robin Hood probing. */
+  MAP_ROBIN_HOOD
+} MapEngine;
+
+/** Settings chosen when a map is made.  Fields left zero get the defaults. */
+typedef struct {
+  /** Storage engine for the key / value pairs, MAP_CHAINED by default. */
+  MapEngine engine;
+
+  /** Function used to hash keys, or NULL for jenkins_one_at_a_time_hash. */
+  HashFunction hash;
+
+  /** If true, nodes come from a per-map arena (see mapArena()). */
+  bool arena;
+
+  /** Entries per bucket (or, for MAP_ROBIN_HOOD, the fraction of slots in use) the
+      table may reach before it grows, or 0 for the engine's default. */
+  double maxLoad;
+
+  /** Most bytes the table, entries, keys and values may take (as mapStats() counts
+      them) before sets evict the least recently used keys, or 0 for no limit. */
+  size_t maxBytes;
+} MapOptions;
+
+/**
+    Function called for each key / value pair by mapForEach().
+    @param *key the key
+    @param *val the value stored for it
+    @param *arg the argument given to mapForEach()
+ */
+typedef void (*MapVisitor)( char const *key, Value *val, void *arg );
 
 /**
     This function makes an empty, dynamically allocated Map, initializing its fields and returning a pointer to it.
+    The table grows on its own as keys are added, a few buckets at a time.
     @param len gives the number of elements in the hash table.
     @return a pointer to a allocated map
  */
 Map *makeMap( int len );
+/**
+    Makes an empty map that stores its pairs using the given engine.
+    @param len gives the number of buckets (or initial slots) in the hash table.
+    @param engine the storage engine to use
+    @return a pointer to a allocated map
+ */
+Map *makeMapEngine( int len, MapEngine engine );
+/**
+    Makes an empty map with the given storage engine and hash function.
+    @param len gives the number of buckets (or initial slots) in the hash table.
+    @param *opts settings for the new map
+    @return a pointer to a allocated map
+ */
+Map *makeMapWith( int len, MapOptions const *opts );
+/**
+    Makes an empty map with the same engine, hash function and arena setting as
+    another, but no memory limit, so it can be filled and then handed to mapAbsorb().
+    @param *m the map to copy the settings of
+    @param len gives the number of buckets (or initial slots) in the hash table.
+    @return a pointer to a allocated map
+ */
+Map *makeMapLike( Map *m, int len );
 /**
     Function returns the current number of key / value pairs in the given map.
     @param *m pointer to a map to return the size for
     @return the size of the map
  */
 int mapSize( Map *m );
-/**
-    The key hashing function to use to help us compute the Jenkins 32-bit hash function
-    @param *key pointer to a key that we need to hash
-    @param length the length of the key
-    @return hash of the key as a 32 bit hash
-*/
-uint32_t jenkins_one_at_a_time_hash(const uint8_t *key, size_t length);
 /**
     Sets a given key value pair in the map
     @param *m the pointer to a map to put the key-value pair in
@@ -49,6 +195,26 @@ void mapSet( Map *m, char const *key, Value *val );
     @return Value the value of the given key
  */
 Value *mapGet( Map *m, char const *key );
+/**
+    Looks up several keys at once, hashing and prefetching a window of them before
+    resolving any, so their cache misses overlap.  Every key is checked for expiry
+    against one reading of the clock, so each value filled in stays valid until the
+    map is next changed, even when a key is named twice.
+    @param *m pointer to the map
+    @param count number of keys
+    @param *keys the keys to look up
+    @param *vals filled in with the value of each key, or NULL for a missing key
+ */
+void mapGetMany( Map *m, int count, char const *const *keys, Value **vals );
+/**
+    Sets several keys at once, in order, prefetching a window of buckets ahead of the
+    sets.  A later pair for the same key wins, as with separate mapSet() calls.
+    @param *m pointer to the map
+    @param count number of pairs
+    @param *keys the keys to set
+    @param *vals the value for each key; NULL entries are skipped
+ */
+void mapSetMany( Map *m, int count, char const *const *keys, Value **vals );
 /**
     Removes a given key-value pair from the map
     @param *m pointer to a map
@@ -58,7 +224,227 @@ Value *mapGet( Map *m, char const *key );
 bool mapRemove( Map *m, char const *key );
 
 /**
-    Frees a map
+    Adds a number to the int or double stored under a key, changing the stored Value in
+    place instead of replacing it, so nothing is allocated or freed.  A key that isn't
+    in the map is set to the number.
+    @param *m pointer to the map
+    @param *key the key
+    @param *delta the number to add, a VALUE_INT or VALUE_DOUBLE
+    @return the updated value, or NULL if the stored value isn't a number or an int sum
+            would overflow, in which case it is left alone
+ */
+Value *mapIncrement( Map *m, char const *key, Value const *delta );
+
+/**
+    Returns the clock expiry times are measured on: wall-clock time, so they still mean
+    the same thing when a log is replayed after a restart.
+    @return seconds since the epoch
+ */
+double mapNow( void );
+
+/**
+    Gives a key an expiry time, replacing any it had.  Once the time passes, the key
+    is removed by the first lookup that finds it, or sooner by mapExpire(), which every
+    set calls for a few keys.  Setting the key again drops its expiry time.
+    @param *m pointer to the map
+    @param *key the key, which must be in the map
+    @param deadline time the key expires, on the mapNow() clock; a time already past
+                    removes the key right away
+    @return false if the key isn't in the map
+ */
+bool mapExpireAt( Map *m, char const *key, double deadline );
+
+/**
+    Returns the time a key expires, without checking whether it has passed, so it may
+    be called while the map is being walked.
+    @param *m pointer to the map
+    @param *key the key
+    @return the time on the mapNow() clock, or 0 if the key never expires or isn't in
+            the map
+ */
+double mapDeadline( Map *m, char const *key );
+
+/**
+    Returns how long a key has before it expires.
+    @param *m pointer to the map
+    @param *key the key
+    @return seconds left, -1 if the key has no expiry time, or -2 if it isn't in the map
+ */
+double mapTtl( Map *m, char const *key );
+
+/**
+    Checks a random sample of the keys that have expiry times and removes those that
+    have expired, so keys nobody looks up again don't stay in memory.
+    @param *m pointer to the map
+    @param samples number of keys to check
+    @return number of keys removed
+ */
+int mapExpire( Map *m, int samples );
+
+/**
+    Returns the arena a map allocates its nodes from.  Values stored in a map made with
+    an arena must be allocated from this arena too (e.g. with parseIntegerIn()), because
+    freeMap() releases them with the arena's slabs instead of calling valueDestroy().
+    @param *m pointer to the map
+    @return the map's arena, or NULL if it was made without one
+ */
+Arena *mapArena( Map *m );
+
+/**
+    Reports the current shape of the map and the memory it uses.  The sizes are kept as
+    the map changes, but chain lengths are measured by walking the table, so this takes
+    time in proportion to the number of buckets.
+    @param *m pointer to the map
+    @param *stats structure to fill in
+ */
+void mapStats( Map *m, MapStats *stats );
+
+/**
+    Calls a function for every key / value pair in the map, in no particular order.
+    Keys past their expiry time are skipped.  The map must not be changed until it
+    returns.
+    @param *m pointer to the map
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+ */
+void mapForEach( Map *m, MapVisitor visit, void *arg );
+
+/**
+    Calls a function for every key from one key to another, in strcmp() order.  The
+    first call builds a sorted index of the keys, which mapSet() and mapRemove() keep
+    up to date from then on.  Expired keys are skipped.  The map must not be changed
+    until it returns.
+    @param *m pointer to the map
+    @param *from smallest key to visit, or NULL to start at the first key
+    @param *to largest key to visit, or NULL to go on to the last key
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+    @return number of pairs visited
+ */
+int mapScan( Map *m, char const *from, char const *to, MapVisitor visit, void *arg );
+
+/**
+    Calls a function for every key that starts with the given text, in strcmp() order.
+    Uses the same sorted index as mapScan(), and skips expired keys too.
+    @param *m pointer to the map
+    @param *prefix text the keys must start with
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+    @return number of pairs visited
+ */
+int mapPrefix( Map *m, char const *prefix, MapVisitor visit, void *arg );
+
+/**
+    Counts, sums and finds the smallest and largest of the numbers in the map, or only
+    those whose keys start with a prefix.  Values are read where they are stored.  A
+    prefix is found with the sorted index mapPrefix() uses; the whole map is walked
+    with mapForEach().
+    @param *m pointer to the map
+    @param *prefix text the keys must start with, or NULL for every key
+    @param *agg structure to fill in
+ */
+void mapAggregate( Map *m, char const *prefix, MapAggregate *agg );
+
+/**
+    Writes every key / value pair in the map to a binary snapshot file (see snapshot.h),
+    along with the time each key expires.  Keys that have expired already are left out.
+    @param *m pointer to the map
+    @param *path name of the file to write
+    @return false if the file couldn't be written or the map holds a custom value
+ */
+bool mapSave( Map *m, char const *path );
+
+/**
+    Makes a read-only view of the map as it is right now, which is then read a few
+    pages of the table at a time with mapViewNext() while the map keeps changing.
+    Nothing is copied up front: the table is split into pages of buckets (or slots),
+    and the first change to a page the view hasn't read yet copies that page first.
+    The cost is in proportion to how much of the map changes while the view is open,
+    not to its size, apart from one pointer per page.  Custom values can't be copied,
+    so they are left out of pages that change.  While a view is open a chained table
+    grows only once it is several times fuller than usual, and a Robin Hood table a
+    little fuller; when it does grow, every page not yet read is copied.
+    @param *m pointer to the map
+    @return the view, or NULL if the map already has one open
+ */
+MapView *mapSnapshot( Map *m );
+
+/**
+    Reads the next pages of a view, calling a function for each key / value pair they
+    held when the view was made.  Keys that have expired since are skipped.  The pairs
+    may be copies that are freed once the pages are read, so the visitor must not keep
+    pointers to them or change the map.
+    @param *v the view
+    @param pages number of pages to read
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+    @return true if there are pages left to read
+ */
+bool mapViewNext( MapView *v, int pages, MapVisitor visit, void *arg );
+
+/**
+    Reports what a view has read and copied so far.
+    @param *v the view
+    @param *stats structure to fill in
+ */
+void mapViewStats( MapView *v, MapViewStats *stats );
+
+/**
+    Closes a view, freeing any pages it copied, so the map can have another.  A view
+    must be closed before its map is freed.
+    @param *v the view to close
+ */
+void mapViewClose( MapView *v );
+
+/**
+    Starts writing the map, as it is right now, to a snapshot file in the background:
+    each mapSaveStep() writes a few more pages of a view made by mapSnapshot(), and
+    the map may change in between.
+    @param *m pointer to the map
+    @param *path name of the file to write
+    @return the save, or NULL if the map already has a view open
+ */
+MapSave *mapSaveBegin( Map *m, char const *path );
+
+/**
+    Adds the next pages of the map to a background save.
+    @param *s the save
+    @param pages number of pages to add
+    @return true if there are pages left to add
+ */
+bool mapSaveStep( MapSave *s, int pages );
+
+/**
+    Adds whatever pages are left to a background save, writes the file under a
+    temporary name renamed into place, and closes the save's view.
+    @param *s the save, which is freed
+    @return false if the file couldn't be written or the map held a custom value
+ */
+bool mapSaveEnd( MapSave *s );
+
+/**
+    Reads a snapshot file written by mapSave() and sets each of its pairs in the map,
+    replacing the values of keys that are already there, with the expiry times they
+    were saved with.  Pairs whose time has passed since are left out.  Values come
+    from the map's arena if it has one.
+    @param *m pointer to the map
+    @param *path name of the file to read
+    @return false if the file can't be read or isn't a snapshot
+ */
+bool mapLoad( Map *m, char const *path );
+
+/**
+    Moves every pair of one map into another, replacing the values of keys that are
+    already there, and then frees the first map.  Values and their expiry times move
+    without being copied.  The maps must either both have an arena or both not have
+    one; the first map's arena joins the second's.
+    @param *dst the map to move the pairs into
+    @param *src the map to move them out of, which is freed
+ */
+void mapAbsorb( Map *dst, Map *src );
+
+/**
+    Frees a map.  Any view of it must be closed first.
     @param *m pointer to a map to free
  */
 void freeMap( Map *m ); 
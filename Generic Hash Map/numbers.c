@@ -0,0 +1,221 @@
+/**
+    @file numbers.c
+    @author Sachi Vyas (smvyas)
+    A program that: Checks the number parsers in value.c against sscanf(), which they
+    replaced.  It tries a list of awkward inputs and then random ones, and every parser
+    has to accept the same strings and give the same int, or the same double bit for
+    bit, as "%d" and "%lf" followed by a check for trailing blanks.
+    Run it as "numbers [count]".
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "value.h"
+/** Random inputs tried when no count is given. */
+#define DEFAULT_COUNT 1000000
+/** Room for one generated input. */
+#define TEXT_BUFFER 96
+/** Most digits generated before or after the point. */
+#define MAX_DIGITS 24
+/** Most mismatches reported before giving up. */
+#define MAX_REPORTS 10
+
+/** Inputs near the edges of what the fast path handles, or that it leaves to sscanf. */
+static char const *const edgeCases[] = {
+  "", "0", "-0", "+0", "-0.0", "0.0", "00012", "-007.50", "1", "-1", "+1",
+  "2147483647", "2147483648", "-2147483648", "-2147483649", "99999999999",
+  "99999999999999999999", "1e5", "1.5e3", "1.5E-3", "1.5e+3", "5.", ".5", "-.5", ".",
+  "-", "+", "--5", "+-5", "1.2.3", "0x10", "0x1.8p3", "0X1P-2", "inf", "-inf", "nan",
+  "infinity", "INF.", "nan.", " 5", " 5.5", "\t-3", "5 ", "5.5 \t", "1.5e", "1.5e+",
+  "1.5e-x", "1e400.", "1.0e-400", "1.0e99999999999", "0.0e99999999999",
+  "9007199254740992.0", "9007199254740993.0", "9007199254740993", "0.1",
+  "0.30000000000000004", "123456789012345678901234567890.5",
+  "0.000000000000000000000000000001", "1.7976931348623157e308", "4.9e-324",
+  "2.2250738585072011e-308", "1e22.", "1e23.", "1.0e-22", "1.0e-23", "12abc", "1.5x",
+  "1_0", "1,5", "3.14159", "-2.5e-3", "21.5", "18"
+};
+
+/** Number of mismatches found so far. */
+static int mismatches = 0;
+
+/**
+    Parses a number the way value.c did before the fast path, with sscanf().
+    @param *str the text
+    @param *out filled in with the number
+    @return false if it isn't a number
+ */
+static bool referenceNumber( char const *str, Value *out )
+{
+    int n;
+    if (strchr(str, '.') != NULL) {
+        out->type = VALUE_DOUBLE;
+        if (sscanf(str, "%lf%n", &out->as.d, &n) != 1) {
+            return false;
+        }
+    } else {
+        out->type = VALUE_INT;
+        if (sscanf(str, "%d%n", &out->as.i, &n) != 1) {
+            return false;
+        }
+    }
+    return blankString(str + n);
+}
+
+/**
+    Reports a mismatch between a parser and sscanf().
+    @param *parser name of the parser
+    @param *str the input
+ */
+static void mismatch( char const *parser, char const *str )
+{
+    if (mismatches++ < MAX_REPORTS) {
+        fprintf(stderr, "Error: %s disagrees with sscanf on \"%s\"\n", parser, str);
+    }
+}
+
+/**
+    Tells whether two parse results are the same.  Doubles must match bit for bit, so
+    a wrong sign on zero or a last-place rounding difference shows up.
+    @param okA whether the first parse succeeded
+    @param *a its result
+    @param okB whether the second parse succeeded
+    @param *b its result
+    @return true if both failed, or both succeeded with the same value
+ */
+static bool sameResult( bool okA, Value const *a, bool okB, Value const *b )
+{
+    if (okA != okB) {
+        return false;
+    }
+    if (!okA) {
+        return true;
+    }
+    if (a->type != b->type) {
+        return false;
+    }
+    return a->type == VALUE_INT ? a->as.i == b->as.i
+                                : memcmp(&a->as.d, &b->as.d, sizeof(double)) == 0;
+}
+
+/**
+    Runs every parser on one input and checks each against sscanf().
+    @param *str the input
+ */
+static void check( char const *str )
+{
+    Value want, got;
+    bool wantOk = referenceNumber(str, &want);
+    if (!sameResult(parseNumber(str, &got), &got, wantOk, &want)) {
+        mismatch("parseNumber", str);
+    }
+
+    Value *val = parseNumberIn(str, NULL);
+    if (!sameResult(val != NULL, val, wantOk, &want)) {
+        mismatch("parseNumberIn", str);
+    }
+    if (val != NULL) {
+        valueDestroy(val);
+    }
+
+    int n;
+    want.type = VALUE_INT;
+    wantOk = sscanf(str, "%d%n", &want.as.i, &n) == 1 && blankString(str + n);
+    val = parseInteger(str);
+    if (!sameResult(val != NULL, val, wantOk, &want)) {
+        mismatch("parseInteger", str);
+    }
+    if (val != NULL) {
+        valueDestroy(val);
+    }
+
+    want.type = VALUE_DOUBLE;
+    wantOk = sscanf(str, "%lf%n", &want.as.d, &n) == 1 && blankString(str + n);
+    val = parseDouble(str);
+    if (!sameResult(val != NULL, val, wantOk, &want)) {
+        mismatch("parseDouble", str);
+    }
+    if (val != NULL) {
+        valueDestroy(val);
+    }
+}
+
+/**
+    Appends random digits, often starting with zeros.
+    @param *p where to write
+    @param count number of digits
+    @return pointer just past them
+ */
+static char *randomDigits( char *p, int count )
+{
+    bool zeros = rand() % 4 == 0;
+    for (int i = 0; i < count; i++) {
+        *p++ = zeros && i < count / 2 ? '0' : '0' + rand() % 10;
+    }
+    return p;
+}
+
+/**
+    Makes a random input: mostly well-formed ints and decimals of every length, with
+    exponents, signs, blanks and stray characters mixed in now and then.
+    @param *buf where to write it, with room for TEXT_BUFFER bytes
+ */
+static void randomInput( char *buf )
+{
+    char *p = buf;
+    if (rand() % 50 == 0) {
+        *p++ = ' ';
+    }
+    int sign = rand() % 4;
+    if (sign == 1) {
+        *p++ = '-';
+    } else if (sign == 2 && rand() % 4 == 0) {
+        *p++ = '+';
+    }
+    p = randomDigits(p, rand() % 3 == 0 ? rand() % ( MAX_DIGITS + 1 ) : rand() % 11);
+    if (rand() % 2 == 0) {
+        *p++ = '.';
+        p = randomDigits(p, rand() % 3 == 0 ? rand() % ( MAX_DIGITS + 1 ) : rand() % 7);
+    }
+    if (rand() % 8 == 0) {
+        *p++ = rand() % 2 ? 'e' : 'E';
+        int expSign = rand() % 3;
+        if (expSign > 0) {
+            *p++ = expSign == 1 ? '-' : '+';
+        }
+        p = randomDigits(p, rand() % 4);
+    }
+    if (rand() % 20 == 0) {
+        *p++ = " \t.xe-a"[rand() % 7];
+    }
+    *p = '\0';
+}
+
+/**
+   Starting point for the program.
+   @param argc number of command-line arguments.
+   @param argv array of strings given as command-line arguments.
+   @return exit status for the program.
+ */
+int main( int argc, char *argv[] )
+{
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_COUNT;
+    if (argc > 2 || count < 0) {
+        fprintf(stderr, "Usage: numbers [count]\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < sizeof(edgeCases) / sizeof(edgeCases[0]); i++) {
+        check(edgeCases[i]);
+    }
+    srand(1);
+    char buf[ TEXT_BUFFER ];
+    for (int i = 0; i < count; i++) {
+        randomInput(buf);
+        check(buf);
+    }
+    if (mismatches > 0) {
+        fprintf(stderr, "Error: %d mismatches\n", mismatches);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
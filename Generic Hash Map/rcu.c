@@ -0,0 +1,256 @@
+/**
+    @file rcu.c
+    @author Sachi Vyas (smvyas)
+    A program that: Keeps key / value pairs in chains that readers walk without a lock.
+    Writers never change a node a reader might be on except by swapping pointers
+    atomically, and unlinked nodes and values are handed to epoch.c instead of being freed.
+ */
+#include "rcu.h"
+#include "epoch.h"
+#include "map.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Smallest number of buckets we will allocate. */
+#define MIN_CAPACITY 8
+/** The table grows once it holds more than LOAD_NUM / LOAD_DEN entries per bucket. */
+#define LOAD_NUM 3
+/** Denominator for the maximum load factor. */
+#define LOAD_DEN 4
+
+/** Node containing a key / value pair.  Only val and next change once it is published. */
+typedef struct RcuNodeStruct {
+  /** Pointer to the value, swapped atomically when the key is set again. */
+  Value *val;
+
+  /** Pointer to the next node in the chain. */
+  struct RcuNodeStruct *next;
+
+  /** Full hash of the key. */
+  uint32_t hash;
+
+  /** Length of the key. */
+  uint32_t len;
+
+  /** String key for this entry, followed by a '\0'. */
+  char key[];
+} RcuNode;
+
+/** An array of chains, replaced as a whole when the table grows. */
+typedef struct {
+  /** Number of buckets minus one. */
+  uint32_t mask;
+
+  /** First node of each chain. */
+  RcuNode *heads[];
+} Buckets;
+
+/** Representation of a table with lock-free lookups. */
+struct RcuStruct {
+  /** Current bucket array, swapped atomically when the table grows. */
+  Buckets *buckets;
+
+  /** Number of keys. */
+  int size;
+};
+
+/**
+    Allocates an empty bucket array.
+    @param count number of buckets, a power of two
+    @return the array
+ */
+static Buckets *makeBuckets( uint32_t count )
+{
+    Buckets *b = calloc(1, sizeof(Buckets) + count * sizeof(RcuNode *));
+    b->mask = count - 1;
+    return b;
+}
+
+/**
+    Frees a bucket array that has been replaced, along with its nodes.  Their values
+    were carried over to the copies in the new array, so they are left alone.
+    @param *p the old bucket array
+ */
+static void freeOldBuckets( void *p )
+{
+    Buckets *b = p;
+    for (uint32_t i = 0; i <= b->mask; i++) {
+        RcuNode *n = b->heads[i];
+        while (n != NULL) {
+            RcuNode *next = n->next;
+            free(n);
+            n = next;
+        }
+    }
+    free(b);
+}
+
+/**
+    Frees a value once it is retired.
+    @param *p the value
+ */
+static void destroyValue( void *p )
+{
+    valueDestroy(p);
+}
+
+/**
+    Doubles the number of buckets.  Readers may be walking the old chains, so every node
+    is copied into the new array, which is then published with one atomic store.
+    @param *t the table to grow
+ */
+static void grow( RcuTable *t )
+{
+    Buckets *old = t->buckets;
+    Buckets *b = makeBuckets(( old->mask + 1 ) * 2);
+    for (uint32_t i = 0; i <= old->mask; i++) {
+        for (RcuNode *n = old->heads[i]; n != NULL; n = n->next) {
+            RcuNode *copy = malloc(sizeof(RcuNode) + n->len + 1);
+            memcpy(copy, n, sizeof(RcuNode) + n->len + 1);
+            copy->next = b->heads[n->hash & b->mask];
+            b->heads[n->hash & b->mask] = copy;
+        }
+    }
+    __atomic_store_n(&t->buckets, b, __ATOMIC_RELEASE);
+    epochRetire(old, freeOldBuckets);
+}
+
+/**
+    Finds the link that points at a key's node, for a writer.
+    @param *b the bucket array
+    @param hash hash of the key
+    @param *key the key to find
+    @return the link pointing at the node, or the empty link at the end of the chain
+ */
+static RcuNode **findLink( Buckets *b, uint32_t hash, char const *key )
+{
+    RcuNode **link = &b->heads[hash & b->mask];
+    while (*link != NULL && ( (*link)->hash != hash || strcmp((*link)->key, key) != 0 )) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+/**
+    Makes an empty table.
+    @param capacity requested number of buckets, rounded up to a power of two
+    @return a pointer to the allocated table
+ */
+RcuTable *makeRcuTable( int capacity )
+{
+    uint32_t cap = MIN_CAPACITY;
+    while (cap < (uint32_t) capacity) {
+        cap *= 2;
+    }
+    RcuTable *t = malloc(sizeof(RcuTable));
+    t->buckets = makeBuckets(cap);
+    t->size = 0;
+    return t;
+}
+
+/**
+    Looks up a key without taking a lock, and calls visit with its value if it is there.
+    Safe to call while another thread sets or removes keys.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the caller
+    @param *key pointer to the key to find
+    @param visit function to call with the value
+    @param *arg passed on to visit
+    @return true if the key was found
+ */
+bool rcuGet( RcuTable *t, uint32_t hash, char const *key, ValueVisitor visit, void *arg )
+{
+    epochEnter();
+    Buckets *b = __atomic_load_n(&t->buckets, __ATOMIC_ACQUIRE);
+    RcuNode *n = __atomic_load_n(&b->heads[hash & b->mask], __ATOMIC_ACQUIRE);
+    while (n != NULL && ( n->hash != hash || strcmp(n->key, key) != 0 )) {
+        n = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE);
+    }
+    if (n != NULL) {
+        visit(__atomic_load_n(&n->val, __ATOMIC_ACQUIRE), arg);
+    }
+    epochExit();
+    return n != NULL;
+}
+
+/**
+    Stores a key / value pair.  A replaced value is freed once no reader can still see
+    it.  Only one thread at a time may change the table.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the caller
+    @param *key pointer to the key to store
+    @param *val pointer to the value to store
+ */
+void rcuSet( RcuTable *t, uint32_t hash, char const *key, Value *val )
+{
+    RcuNode **link = findLink(t->buckets, hash, key);
+    if (*link != NULL) {
+        Value *old = __atomic_exchange_n(&(*link)->val, val, __ATOMIC_ACQ_REL);
+        epochRetire(old, destroyValue);
+        return;
+    }
+
+    if ((long) ( t->size + 1 ) * LOAD_DEN > (long) ( t->buckets->mask + 1 ) * LOAD_NUM) {
+        grow(t);
+    }
+    // Fill in the node completely before it becomes reachable.
+    size_t len = strlen(key);
+    RcuNode *n = malloc(sizeof(RcuNode) + len + 1);
+    n->val = val;
+    n->hash = hash;
+    n->len = len;
+    memcpy(n->key, key, len + 1);
+    RcuNode **head = &t->buckets->heads[hash & t->buckets->mask];
+    n->next = *head;
+    __atomic_store_n(head, n, __ATOMIC_RELEASE);
+    __atomic_store_n(&t->size, t->size + 1, __ATOMIC_RELAXED);
+}
+
+/**
+    Removes a key.  Its node and value are freed once no reader can still see them.
+    Only one thread at a time may change the table.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the caller
+    @param *key pointer to the key to remove
+    @return true if the key was in the table
+ */
+bool rcuRemove( RcuTable *t, uint32_t hash, char const *key )
+{
+    RcuNode **link = findLink(t->buckets, hash, key);
+    RcuNode *n = *link;
+    if (n == NULL) {
+        return false;
+    }
+    // A reader standing on n can still follow its next pointer, which we leave alone.
+    __atomic_store_n(link, n->next, __ATOMIC_RELEASE);
+    epochRetire(n->val, destroyValue);
+    epochRetire(n, free);
+    __atomic_store_n(&t->size, t->size - 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+    Returns the number of keys in the table.
+    @param *t pointer to the table
+    @return the number of keys
+ */
+int rcuSize( RcuTable *t )
+{
+    return __atomic_load_n(&t->size, __ATOMIC_RELAXED);
+}
+
+/**
+    Frees the table and every value in it right away.  No other thread may be using it.
+    @param *t pointer to the table to free
+ */
+void freeRcuTable( RcuTable *t )
+{
+    Buckets *b = t->buckets;
+    for (uint32_t i = 0; i <= b->mask; i++) {
+        for (RcuNode *n = b->heads[i]; n != NULL; n = n->next) {
+            valueDestroy(n->val);
+        }
+    }
+    freeOldBuckets(b);
+    free(t);
+}
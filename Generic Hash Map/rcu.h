@@ -0,0 +1,69 @@
+/**
+    @file rcu.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for rcu.c, a chained table whose lookups take no lock
+ */
+#ifndef RCU_H
+#define RCU_H
+
+#include "concurrent.h"
+#include "value.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Incomplete type for a table that readers search without locking. */
+typedef struct RcuStruct RcuTable;
+
+/**
+    Makes an empty table.
+    @param capacity requested number of buckets, rounded up to a power of two
+    @return a pointer to the allocated table
+ */
+RcuTable *makeRcuTable( int capacity );
+
+/**
+    Looks up a key without taking a lock, and calls visit with its value if it is there.
+    Safe to call while another thread sets or removes keys.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the caller
+    @param *key pointer to the key to find
+    @param visit function to call with the value
+    @param *arg passed on to visit
+    @return true if the key was found
+ */
+bool rcuGet( RcuTable *t, uint32_t hash, char const *key, ValueVisitor visit, void *arg );
+
+/**
+    Stores a key / value pair.  A replaced value is freed once no reader can still see
+    it.  Only one thread at a time may change the table.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the caller
+    @param *key pointer to the key to store
+    @param *val pointer to the value to store
+ */
+void rcuSet( RcuTable *t, uint32_t hash, char const *key, Value *val );
+
+/**
+    Removes a key.  Its node and value are freed once no reader can still see them.
+    Only one thread at a time may change the table.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the caller
+    @param *key pointer to the key to remove
+    @return true if the key was in the table
+ */
+bool rcuRemove( RcuTable *t, uint32_t hash, char const *key );
+
+/**
+    Returns the number of keys in the table.
+    @param *t pointer to the table
+    @return the number of keys
+ */
+int rcuSize( RcuTable *t );
+
+/**
+    Frees the table and every value in it right away.  No other thread may be using it.
+    @param *t pointer to the table to free
+ */
+void freeRcuTable( RcuTable *t );
+
+#endif
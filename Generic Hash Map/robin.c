@@ -0,0 +1,734 @@
+/**
+    @file robin.c
+    @author Sachi Vyas (smvyas)
+    A program that: Stores key / value pairs in a flat slot array using open addressing with
+    Robin Hood probing, so lookups walk neighboring slots instead of chasing pointers.
+    Beside the slots is an array of one-byte fingerprints, which lookups compare 16 at a
+    time so only slots whose fingerprint matches are read.
+ */
+#include "robin.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/** Number of fingerprints compared at once. */
+#define GROUP 16
+/** Smallest number of slots we will allocate; at least a group, so a group never
+    wraps onto itself. */
+#define MIN_CAPACITY GROUP
+/** Unless told otherwise, the table grows once it is more than LOAD_NUM / LOAD_DEN full. */
+#define LOAD_NUM 7
+/** Denominator for the maximum load factor. */
+#define LOAD_DEN 8
+/** Fullest a table may get whatever it is asked for, so probes always reach an empty slot. */
+#define MAX_LOAD 0.98
+/** Fingerprint of an empty slot. */
+#define CTRL_EMPTY 0
+/** Fingerprint of a slot in the old array whose entry has been moved or removed. */
+#define CTRL_DELETED 1
+/** Number of old slots moved into the new array by each set or remove while growing. */
+#define MIGRATE_STEP 8
+/** Most slots robinSample() looks through for an occupied one. */
+#define SAMPLE_SCAN 64
+/** Fullest a watched table gets before it grows, since growing makes the watcher copy
+    every slot it hasn't read yet. */
+#define WATCHED_LOAD 0.95
+
+/** A key stored outside the slot array, taking only as many bytes as it needs. */
+typedef struct {
+  /** Length of the key. */
+  uint32_t len;
+
+  /** The characters of the key, followed by a '\0'. */
+  char text[];
+} Key;
+
+/** One slot of the table.  Keys live outside the array so every slot is the same
+    small size whatever the length of its key. */
+typedef struct {
+  /** Pointer to the value, NULL if this slot is empty or TOMBSTONE if it was moved out. */
+  Value *val;
+
+  /** The key for this entry. */
+  Key *key;
+
+  /** Full hash of the key, so most mismatches never look at the key itself. */
+  uint32_t hash;
+
+  /** How far this entry sits from the slot its hash maps to. */
+  uint32_t dist;
+} Slot;
+
+/** Representation of an open-addressing hash table. */
+struct RobinStruct {
+  /** Array of slots, always a power of two long. */
+  Slot *slots;
+
+  /** Fingerprint of each slot, followed by copies of the first GROUP - 1 so a group
+      can be loaded at any slot without wrapping. */
+  uint8_t *ctrl;
+
+  /** Furthest any entry has been placed from its home slot; lookups stop here. */
+  uint32_t maxDist;
+
+  /** Number of slots minus one, used to wrap probe positions. */
+  uint32_t mask;
+
+  /** Number of occupied slots in the current array. */
+  int count;
+
+  /** Array we are growing out of, or NULL when no resize is in progress. */
+  Slot *old;
+
+  /** Fingerprints for the old array. */
+  uint8_t *oldCtrl;
+
+  /** Mask for the old array. */
+  uint32_t oldMask;
+
+  /** Furthest any entry in the old array is from its home slot. */
+  uint32_t oldMaxDist;
+
+  /** Number of live entries left in the old array. */
+  int oldCount;
+
+  /** Slots of the old array below this index have already been moved. */
+  uint32_t migrated;
+
+  /** Number of times the table has started growing. */
+  int resizes;
+
+  /** Fraction of the slots that may be used before the table grows. */
+  double maxLoad;
+
+  /** Arena the values come from, or NULL if they are on the heap. */
+  Arena *arena;
+
+  /** Arena the keys come from, owned by the table, so each key costs only its length
+      prefix and characters rounded up to the arena's granule, with no malloc header. */
+  Arena *keys;
+
+  /** Function told before slots of the current array change, or NULL. */
+  RobinWatch watch;
+
+  /** Argument passed to watch. */
+  void *watchArg;
+};
+
+/** Marks a slot in the old array whose entry has been moved or removed. Unlike an empty
+    slot it doesn't end a probe, so the entries after it can still be found. */
+static Value tombstone;
+
+/** Value pointer stored in tombstone slots. */
+#define TOMBSTONE ( &tombstone )
+
+/**
+    Makes a copy of a key in the table's key arena.
+    @param *t the table the key is for
+    @param *text the characters of the key
+    @param len length of the key
+    @return the copy
+ */
+static Key *makeKey( RobinTable *t, char const *text, size_t len )
+{
+    Key *k = arenaAlloc( t->keys, sizeof(Key) + len + 1 );
+    k->len = len;
+    memcpy( k->text, text, len );
+    k->text[ len ] = '\0';
+    return k;
+}
+
+/**
+    Gives a key made by makeKey() back to the key arena.
+    @param *k the key
+ */
+static void freeKey( Key *k )
+{
+    arenaRelease( k );
+}
+
+/**
+    Tells the table's watcher, if it has one, that a slot of the current array is about
+    to change.
+    @param *t the table
+    @param pos the slot
+ */
+static void touchSlot( RobinTable *t, uint32_t pos )
+{
+    if ( t->watch != NULL ) {
+        t->watch( t->watchArg, pos, 1 );
+    }
+}
+
+/**
+    Makes the one-byte fingerprint stored for a full slot: the top seven bits of the
+    hash, which don't pick the home slot, with the high bit set so it is never
+    CTRL_EMPTY or CTRL_DELETED.
+    @param hash hash of the key
+    @return the fingerprint
+ */
+static uint8_t fingerprint( uint32_t hash )
+{
+    return 0x80 | ( hash >> 25 );
+}
+
+/**
+    Sets the fingerprint of a slot, and its copy past the end of the array if it has one.
+    @param *ctrl the fingerprint array
+    @param mask number of slots in the array minus one
+    @param pos the slot
+    @param c the new fingerprint
+ */
+static void setCtrl( uint8_t *ctrl, uint32_t mask, uint32_t pos, uint8_t c )
+{
+    ctrl[ pos ] = c;
+    if ( pos < GROUP - 1 ) {
+        ctrl[ mask + 1 + pos ] = c;
+    }
+}
+
+/**
+    Compares a group of fingerprints with one value.
+    @param *group the first of GROUP fingerprints
+    @param c the value to look for
+    @return a mask with bit i set if group[ i ] is c
+ */
+static uint32_t matchGroup( uint8_t const *group, uint8_t c )
+{
+#ifdef __SSE2__
+    __m128i g = _mm_loadu_si128( (__m128i const *) group );
+    return _mm_movemask_epi8( _mm_cmpeq_epi8( g, _mm_set1_epi8( (char) c ) ) );
+#else
+    uint32_t bits = 0;
+    for ( int i = 0; i < GROUP; i++ ) {
+        bits |= (uint32_t) ( group[ i ] == c ) << i;
+    }
+    return bits;
+#endif
+}
+
+/**
+    Allocates a fingerprint array for a slot array, with every slot empty.
+    @param cap number of slots
+    @return the array
+ */
+static uint8_t *makeCtrl( uint32_t cap )
+{
+    return (uint8_t *) calloc( cap + GROUP - 1, 1 );
+}
+
+/**
+    Places an entry that is known not to be in the current array yet. Whenever the entry
+    we are carrying is further from home than the one in the slot, the two trade places.
+    @param *t the table to insert into
+    @param entry the entry to place, with dist set to zero
+ */
+static void placeSlot( RobinTable *t, Slot entry )
+{
+    uint32_t pos = entry.hash & t->mask;
+    for ( ;; ) {
+        Slot *s = &t->slots[ pos ];
+        if ( s->val == NULL || s->dist < entry.dist ) {
+            touchSlot( t, pos );
+            Slot tmp = *s;
+            *s = entry;
+            setCtrl( t->ctrl, t->mask, pos, fingerprint( entry.hash ) );
+            if ( entry.dist > t->maxDist ) {
+                t->maxDist = entry.dist;
+            }
+            if ( tmp.val == NULL ) {
+                break;
+            }
+            entry = tmp;
+        }
+        entry.dist++;
+        pos = ( pos + 1 ) & t->mask;
+    }
+    t->count++;
+}
+
+/**
+    Moves up to count slots of the old array into the current one, and frees the old
+    array once everything has been moved.
+    @param *t the table that is growing
+    @param count number of old slots to look at
+ */
+static void migrateSlots( RobinTable *t, uint32_t count )
+{
+    while ( t->old != NULL && count-- > 0 ) {
+        uint32_t pos = t->migrated++;
+        Slot *s = &t->old[ pos ];
+        if ( s->val != NULL && s->val != TOMBSTONE ) {
+            Slot entry = *s;
+            entry.dist = 0;
+            placeSlot( t, entry );
+            s->val = TOMBSTONE;
+            setCtrl( t->oldCtrl, t->oldMask, pos, CTRL_DELETED );
+            t->oldCount--;
+        }
+        if ( t->migrated > t->oldMask || t->oldCount == 0 ) {
+            free( t->old );
+            free( t->oldCtrl );
+            t->old = NULL;
+            t->oldCtrl = NULL;
+        }
+    }
+}
+
+/**
+    Starts growing the table to twice its size. Entries stay in the old array and are
+    moved a few slots at a time by later sets and removes.
+    @param *t the table to grow
+ */
+static void startResize( RobinTable *t )
+{
+    if ( t->watch != NULL ) {
+        t->watch( t->watchArg, 0, t->mask + 1 );
+    }
+    // Only one old array at a time; finish any earlier resize first.
+    migrateSlots( t, t->oldMask + 1 );
+    t->old = t->slots;
+    t->oldCtrl = t->ctrl;
+    t->oldMask = t->mask;
+    t->oldMaxDist = t->maxDist;
+    t->oldCount = t->count;
+    t->migrated = 0;
+    t->slots = (Slot *) calloc( ( t->mask + 1 ) * 2, sizeof( Slot ) );
+    t->ctrl = makeCtrl( ( t->mask + 1 ) * 2 );
+    t->maxDist = 0;
+    t->mask = t->mask * 2 + 1;
+    t->count = 0;
+    t->resizes++;
+}
+
+/**
+    Finds the slot holding a key in one slot array.  The probe goes a group of slots at
+    a time, reading only the slots whose fingerprint matches, and ends at the first
+    empty slot or once it is further from home than any entry.
+    @param *slots the array to search
+    @param *ctrl fingerprints for the array
+    @param mask number of slots in the array minus one
+    @param maxDist furthest any entry in the array is from its home slot
+    @param hash hash of the key
+    @param *key the key to find
+    @param len length of the key
+    @return pointer to the slot, or NULL if the key isn't present
+ */
+static Slot *findSlot( Slot *slots, uint8_t const *ctrl, uint32_t mask, uint32_t maxDist,
+                       uint32_t hash, char const *key, size_t len )
+{
+    uint8_t c = fingerprint( hash );
+    uint32_t pos = hash & mask;
+    // Most keys sit in or next to their home slot, so start loading it alongside the
+    // fingerprints instead of after them.
+    __builtin_prefetch( &slots[ pos ] );
+    for ( uint32_t dist = 0; dist <= maxDist; dist += GROUP ) {
+        uint32_t hits = matchGroup( ctrl + pos, c );
+        uint32_t empty = matchGroup( ctrl + pos, CTRL_EMPTY );
+        // Nothing past an empty slot belongs to this probe.
+        if ( empty != 0 ) {
+            hits &= ( empty & -empty ) - 1;
+        }
+        while ( hits != 0 ) {
+            Slot *s = &slots[ ( pos + __builtin_ctz( hits ) ) & mask ];
+            if ( s->hash == hash && s->val != TOMBSTONE && s->key->len == len &&
+                 memcmp( s->key->text, key, len ) == 0 ) {
+                return s;
+            }
+            hits &= hits - 1;
+        }
+        if ( empty != 0 ) {
+            break;
+        }
+        pos = ( pos + GROUP ) & mask;
+    }
+    return NULL;
+}
+
+/**
+    Finds the slot holding a key in the old array, if a resize is in progress.
+    @param *t the table to search
+    @param hash hash of the key
+    @param *key the key to find
+    @param len length of the key
+    @return pointer to the slot, or NULL if the key isn't there
+ */
+static Slot *findOld( RobinTable *t, uint32_t hash, char const *key, size_t len )
+{
+    if ( t->old == NULL ) {
+        return NULL;
+    }
+    return findSlot( t->old, t->oldCtrl, t->oldMask, t->oldMaxDist, hash, key, len );
+}
+
+/**
+    Makes an empty Robin Hood table with room for at least the given number of slots.
+    @param capacity requested number of slots, rounded up to a power of two
+    @param maxLoad fraction of the slots that may be used before the table grows, or 0
+                   for the default
+    @param *arena arena the values stored in the table come from, or NULL if they are
+                  on the heap
+    @return a pointer to the allocated table
+ */
+RobinTable *makeRobin( int capacity, double maxLoad, Arena *arena )
+{
+    uint32_t cap = MIN_CAPACITY;
+    while ( cap < (uint32_t) capacity ) {
+        cap *= 2;
+    }
+    RobinTable *t = (RobinTable *) malloc( sizeof( RobinTable ) );
+    t->slots = (Slot *) calloc( cap, sizeof( Slot ) );
+    t->ctrl = makeCtrl( cap );
+    t->maxDist = 0;
+    t->mask = cap - 1;
+    t->count = 0;
+    t->old = NULL;
+    t->oldCtrl = NULL;
+    t->oldMask = 0;
+    t->oldMaxDist = 0;
+    t->oldCount = 0;
+    t->migrated = 0;
+    t->resizes = 0;
+    t->maxLoad = maxLoad <= 0 ? (double) LOAD_NUM / LOAD_DEN
+                 : maxLoad < MAX_LOAD ? maxLoad : MAX_LOAD;
+    t->arena = arena;
+    t->keys = makeArena();
+    t->watch = NULL;
+    t->watchArg = NULL;
+    return t;
+}
+
+/**
+    Stores a key / value pair in the table. When the table gets too full it starts
+    growing, and each later set or remove moves a few entries into the larger array.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the map
+    @param *key pointer to the key to store
+    @param len length of the key
+    @param *val pointer to the value to store
+    @return the value previously stored under this key, or NULL if the key is new
+ */
+Value *robinSet( RobinTable *t, uint32_t hash, char const *key, size_t len, Value *val )
+{
+    migrateSlots( t, MIGRATE_STEP );
+    Slot *s = findSlot( t->slots, t->ctrl, t->mask, t->maxDist, hash, key, len );
+    if ( s != NULL ) {
+        touchSlot( t, s - t->slots );
+    } else {
+        s = findOld( t, hash, key, len );
+    }
+    if ( s != NULL ) {
+        Value *old = s->val;
+        s->val = val;
+        return old;
+    }
+
+    double maxLoad = t->watch != NULL && t->maxLoad < WATCHED_LOAD ? WATCHED_LOAD
+                                                                    : t->maxLoad;
+    if ( t->count + 1 > ( t->mask + 1 ) * maxLoad ) {
+        startResize( t );
+    }
+
+    Slot entry;
+    entry.val = val;
+    entry.hash = hash;
+    entry.dist = 0;
+    entry.key = makeKey( t, key, len );
+    placeSlot( t, entry );
+    return NULL;
+}
+
+/**
+    Looks up the value stored for a key.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the map
+    @param *key pointer to the key to find
+    @param len length of the key
+    @return the value for the key, or NULL if it isn't in the table
+ */
+Value *robinGet( RobinTable *t, uint32_t hash, char const *key, size_t len )
+{
+    Slot *s = findSlot( t->slots, t->ctrl, t->mask, t->maxDist, hash, key, len );
+    if ( s == NULL ) {
+        s = findOld( t, hash, key, len );
+    }
+    return s == NULL ? NULL : s->val;
+}
+
+/**
+    Starts loading the slot a key's probe begins at into the cache.  During a resize the
+    key may still be in the old array, but most lookups are answered by the new one.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the map
+ */
+void robinPrefetch( RobinTable *t, uint32_t hash )
+{
+    __builtin_prefetch( &t->ctrl[ hash & t->mask ] );
+    __builtin_prefetch( &t->slots[ hash & t->mask ] );
+}
+
+/**
+    Removes a key from the table. Entries in the current array are shifted back so no
+    tombstones are left there.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the map
+    @param *key pointer to the key to remove
+    @param len length of the key
+    @return the value that was stored for the key, or NULL if it wasn't in the table
+ */
+Value *robinRemove( RobinTable *t, uint32_t hash, char const *key, size_t len )
+{
+    migrateSlots( t, MIGRATE_STEP );
+    Slot *s = findOld( t, hash, key, len );
+    if ( s != NULL ) {
+        // The old array is never shifted, since that could slide entries behind
+        // the migration point.
+        Value *old = s->val;
+        freeKey( s->key );
+        s->val = TOMBSTONE;
+        setCtrl( t->oldCtrl, t->oldMask, s - t->old, CTRL_DELETED );
+        t->oldCount--;
+        return old;
+    }
+
+    s = findSlot( t->slots, t->ctrl, t->mask, t->maxDist, hash, key, len );
+    if ( s == NULL ) {
+        return NULL;
+    }
+    uint32_t pos = s - t->slots;
+    touchSlot( t, pos );
+    Value *old = s->val;
+    freeKey( s->key );
+
+    // Pull each following displaced entry one slot closer to home.
+    uint32_t next = ( pos + 1 ) & t->mask;
+    while ( t->slots[ next ].val != NULL && t->slots[ next ].dist > 0 ) {
+        touchSlot( t, next );
+        t->slots[ pos ] = t->slots[ next ];
+        t->slots[ pos ].dist--;
+        setCtrl( t->ctrl, t->mask, pos, t->ctrl[ next ] );
+        pos = next;
+        next = ( next + 1 ) & t->mask;
+    }
+    t->slots[ pos ].val = NULL;
+    setCtrl( t->ctrl, t->mask, pos, CTRL_EMPTY );
+    t->count--;
+    return old;
+}
+
+/**
+    Reports the number of slots, how often the table has grown, how long probes for
+    stored keys are, and the bytes taken by the slot arrays and key lengths.  Probe
+    lengths are found by walking the slots, so this takes time in proportion to the
+    size of the table.
+    @param *t pointer to the table
+    @param *stats structure whose buckets, resizes, resizing, maxChain, meanChain,
+                  tableBytes and nodeBytes fields are filled in
+ */
+void robinStats( RobinTable *t, MapStats *stats )
+{
+    stats->buckets = t->mask + 1;
+    stats->resizes = t->resizes;
+    stats->resizing = t->old != NULL;
+
+    long probes = 0, entries = 0;
+    uint32_t longest = 0;
+    for ( int a = 0; a < 2; a++ ) {
+        Slot const *slots = a == 0 ? t->slots : t->old;
+        uint32_t mask = a == 0 ? t->mask : t->oldMask;
+        for ( uint32_t i = 0; slots != NULL && i <= mask; i++ ) {
+            if ( slots[ i ].val != NULL && slots[ i ].val != TOMBSTONE ) {
+                probes += slots[ i ].dist + 1;
+                entries++;
+                longest = slots[ i ].dist + 1 > longest ? slots[ i ].dist + 1 : longest;
+            }
+        }
+    }
+    stats->maxChain = longest;
+    stats->meanChain = entries ? (double) probes / entries : 0;
+
+    stats->tableBytes = robinBytes( t ) - entries * sizeof( Key );
+    stats->nodeBytes = entries * sizeof( Key );
+}
+
+/**
+    Returns the bytes taken by the slot and fingerprint arrays and the lengths in front
+    of the keys, without walking the table.
+    @param *t pointer to the table
+    @return the number of bytes
+ */
+size_t robinBytes( RobinTable *t )
+{
+    size_t perSlot = sizeof( Slot ) + 1;
+    size_t bytes = ( t->mask + GROUP ) * perSlot + ( t->count + t->oldCount ) * sizeof( Key );
+    if ( t->old != NULL ) {
+        bytes += ( t->oldMask + GROUP ) * perSlot;
+    }
+    return bytes;
+}
+
+/**
+    Picks an entry close to a random position: the first occupied slot at or after it,
+    looking at no more than SAMPLE_SCAN slots of the current array and then of the
+    part of the old one not yet moved.
+    @param *t pointer to the table
+    @param start the random position
+    @param **key set to the entry's key
+    @return the entry's value, or NULL if no occupied slot was found
+ */
+Value *robinSample( RobinTable *t, uint32_t start, char const **key )
+{
+    for ( uint32_t i = 0; i < SAMPLE_SCAN && i <= t->mask; i++ ) {
+        Slot const *s = &t->slots[ ( start + i ) & t->mask ];
+        if ( s->val != NULL ) {
+            *key = s->key->text;
+            return s->val;
+        }
+    }
+    uint32_t left = t->old != NULL ? t->oldMask + 1 - t->migrated : 0;
+    for ( uint32_t i = 0; i < SAMPLE_SCAN && i < left; i++ ) {
+        Slot const *s = &t->old[ t->migrated + ( start + i ) % left ];
+        if ( s->val != NULL && s->val != TOMBSTONE ) {
+            *key = s->key->text;
+            return s->val;
+        }
+    }
+    return NULL;
+}
+
+/**
+    Calls a function for every key / value pair in the table.
+    @param *t pointer to the table
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+ */
+void robinForEach( RobinTable *t, MapVisitor visit, void *arg )
+{
+    for (uint32_t i = 0; i <= t->mask; i++) {
+        if (t->slots[i].val != NULL) {
+            visit(t->slots[i].key->text, t->slots[i].val, arg);
+        }
+    }
+    // Entries not yet moved out of the old array are still live there.
+    for (uint32_t i = t->migrated; t->old != NULL && i <= t->oldMask; i++) {
+        if (t->old[i].val != NULL && t->old[i].val != TOMBSTONE) {
+            visit(t->old[i].key->text, t->old[i].val, arg);
+        }
+    }
+}
+
+/**
+    Hands every key / value pair to a function that takes the value over, then empties
+    the table.  The keys stay in the key arena until the table is freed.
+    @param *t pointer to the table
+    @param visit function to call for each pair; the key is only valid during the call
+    @param *arg passed on to visit
+ */
+void robinDrain( RobinTable *t, MapVisitor visit, void *arg )
+{
+    migrateSlots( t, t->oldMask + 1 );
+    for ( uint32_t i = 0; i <= t->mask; i++ ) {
+        Slot *s = &t->slots[ i ];
+        if ( s->val != NULL ) {
+            visit( s->key->text, s->val, arg );
+            s->val = NULL;
+        }
+    }
+    memset( t->ctrl, 0, t->mask + GROUP );
+    t->count = 0;
+    t->maxDist = 0;
+}
+
+/**
+    Frees the table, along with every key and value still stored in it.  The keys go
+    with their arena's slabs; values from an arena are left to be freed with it.
+    @param *t pointer to the table to free
+ */
+void freeRobin( RobinTable *t )
+{
+    if ( t->arena == NULL ) {
+        migrateSlots( t, t->oldMask + 1 );
+        for ( uint32_t i = 0; i <= t->mask; i++ ) {
+            if ( t->slots[ i ].val != NULL ) {
+                valueDestroy( t->slots[ i ].val );
+            }
+        }
+    }
+    freeArena( t->keys );
+    free( t->old );
+    free( t->oldCtrl );
+    free( t->ctrl );
+    free( t->slots );
+    free( t );
+}
+
+/**
+    Grows the table, all at once, until it can take the given number of entries.  A
+    table filled from another one's slots in order has to be this size first, or the
+    entries pile up in the front of the smaller array and every probe gets long.
+    @param *t pointer to the table
+    @param entries number of entries the table should have room for
+ */
+void robinReserve( RobinTable *t, int entries )
+{
+    while ( entries > ( t->mask + 1 ) * t->maxLoad ) {
+        startResize( t );
+    }
+    migrateSlots( t, t->oldMask + 1 );
+}
+
+/**
+    Sets the function told before slots of the current array change, so a reader can
+    copy them first.  Any resize in progress is finished, so every entry is in the
+    array the watcher sees.  While a table is watched it fills up further before it
+    grows, and growing tells the watcher that every slot is about to change.
+    @param *t pointer to the table
+    @param watch function to tell, or NULL to stop
+    @param *arg passed on to watch
+    @return the number of slots in the current array
+ */
+uint32_t robinWatch( RobinTable *t, RobinWatch watch, void *arg )
+{
+    migrateSlots( t, t->oldMask + 1 );
+    t->watch = watch;
+    t->watchArg = arg;
+    return t->mask + 1;
+}
+
+/**
+    Tells the table's watcher that the slot holding a key is about to change, for a
+    caller about to change the key's value in place.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the map
+    @param *key the key
+    @param len length of the key
+ */
+void robinTouch( RobinTable *t, uint32_t hash, char const *key, size_t len )
+{
+    Slot *s = findSlot( t->slots, t->ctrl, t->mask, t->maxDist, hash, key, len );
+    if ( s != NULL ) {
+        touchSlot( t, s - t->slots );
+    }
+}
+
+/**
+    Calls a function for every key / value pair in a range of slots of the current
+    array.
+    @param *t pointer to the table
+    @param first the first slot
+    @param count number of slots; the range stops at the end of the array
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+ */
+void robinVisit( RobinTable *t, uint32_t first, uint32_t count, MapVisitor visit,
+                 void *arg )
+{
+    for ( uint32_t i = first; i < first + count && i <= t->mask; i++ ) {
+        if ( t->slots[ i ].val != NULL ) {
+            visit( t->slots[ i ].key->text, t->slots[ i ].val, arg );
+        }
+    }
+}
@@ -0,0 +1,173 @@
+/**
+    @file robin.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for robin.c, the open-addressing storage engine used by the map
+ */
+#ifndef ROBIN_H
+#define ROBIN_H
+
+#include "map.h"
+#include "value.h"
+#include "arena.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Incomplete type for an open-addressing (Robin Hood) hash table. */
+typedef struct RobinStruct RobinTable;
+
+/**
+    Makes an empty Robin Hood table with room for at least the given number of slots.
+    @param capacity requested number of slots, rounded up to a power of two
+    @param maxLoad fraction of the slots that may be used before the table grows, or 0
+                   for the default
+    @param *arena arena the values stored in the table come from, or NULL if they are
+                  on the heap
+    @return a pointer to the allocated table
+ */
+RobinTable *makeRobin( int capacity, double maxLoad, Arena *arena );
+
+/**
+    Stores a key / value pair in the table. When the table gets too full it starts
+    growing, and each later set or remove moves a few entries into the larger array.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the map
+    @param *key pointer to the key to store
+    @param len length of the key
+    @param *val pointer to the value to store
+    @return the value previously stored under this key, or NULL if the key is new
+ */
+Value *robinSet( RobinTable *t, uint32_t hash, char const *key, size_t len, Value *val );
+
+/**
+    Looks up the value stored for a key.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the map
+    @param *key pointer to the key to find
+    @param len length of the key
+    @return the value for the key, or NULL if it isn't in the table
+ */
+Value *robinGet( RobinTable *t, uint32_t hash, char const *key, size_t len );
+
+/**
+    Starts loading the slot a key's probe begins at into the cache, so a later
+    robinGet() or robinSet() for it doesn't have to wait on memory.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the map
+ */
+void robinPrefetch( RobinTable *t, uint32_t hash );
+
+/**
+    Removes a key from the table. Entries in the current array are shifted back so no
+    tombstones are left there.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the map
+    @param *key pointer to the key to remove
+    @param len length of the key
+    @return the value that was stored for the key, or NULL if it wasn't in the table
+ */
+Value *robinRemove( RobinTable *t, uint32_t hash, char const *key, size_t len );
+
+/**
+    Reports the number of slots, how often the table has grown, how long probes for
+    stored keys are, and the bytes taken by the slot arrays and key lengths.  Probe
+    lengths are found by walking the slots, so this takes time in proportion to the
+    size of the table.
+    @param *t pointer to the table
+    @param *stats structure whose buckets, resizes, resizing, maxChain, meanChain,
+                  tableBytes and nodeBytes fields are filled in
+ */
+void robinStats( RobinTable *t, MapStats *stats );
+
+/**
+    Returns the bytes taken by the slot and fingerprint arrays and the lengths in front
+    of the keys, without walking the table.
+    @param *t pointer to the table
+    @return the number of bytes
+ */
+size_t robinBytes( RobinTable *t );
+
+/**
+    Picks an entry close to a random position: the first occupied slot at or after it,
+    looking at no more than a few dozen slots.  Maps sample entries this way to find
+    ones to evict or expire.
+    @param *t pointer to the table
+    @param start the random position
+    @param **key set to the entry's key
+    @return the entry's value, or NULL if no occupied slot was found
+ */
+Value *robinSample( RobinTable *t, uint32_t start, char const **key );
+
+/**
+    Calls a function for every key / value pair in the table.
+    @param *t pointer to the table
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+ */
+void robinForEach( RobinTable *t, MapVisitor visit, void *arg );
+
+/**
+    Hands every key / value pair to a function that takes the value over, then empties
+    the table.  The keys stay in the key arena until the table is freed.
+    @param *t pointer to the table
+    @param visit function to call for each pair; the key is only valid during the call
+    @param *arg passed on to visit
+ */
+void robinDrain( RobinTable *t, MapVisitor visit, void *arg );
+
+/**
+    Grows the table, all at once, until it can take the given number of entries.
+    @param *t pointer to the table
+    @param entries number of entries the table should have room for
+ */
+void robinReserve( RobinTable *t, int entries );
+
+/**
+    Function told before slots of a table's current array change.
+    @param *arg the argument given to robinWatch()
+    @param first the first slot about to change
+    @param count number of slots about to change
+ */
+typedef void (*RobinWatch)( void *arg, uint32_t first, uint32_t count );
+
+/**
+    Sets the function told before slots of the current array change, so a reader can
+    copy them first.  Any resize in progress is finished, so every entry is in the
+    array the watcher sees.  While a table is watched it fills up further before it
+    grows, and growing tells the watcher that every slot is about to change.
+    @param *t pointer to the table
+    @param watch function to tell, or NULL to stop
+    @param *arg passed on to watch
+    @return the number of slots in the current array
+ */
+uint32_t robinWatch( RobinTable *t, RobinWatch watch, void *arg );
+
+/**
+    Tells the table's watcher that the slot holding a key is about to change, for a
+    caller about to change the key's value in place.
+    @param *t pointer to the table
+    @param hash hash of the key, computed by the map
+    @param *key the key
+    @param len length of the key
+ */
+void robinTouch( RobinTable *t, uint32_t hash, char const *key, size_t len );
+
+/**
+    Calls a function for every key / value pair in a range of slots of the current
+    array.
+    @param *t pointer to the table
+    @param first the first slot
+    @param count number of slots; the range stops at the end of the array
+    @param visit function to call for each pair
+    @param *arg passed on to visit
+ */
+void robinVisit( RobinTable *t, uint32_t first, uint32_t count, MapVisitor visit,
+                 void *arg );
+
+/**
+    Frees the table, along with every key and value still stored in it.  The keys go
+    with their arena's slabs; values from an arena are left to be freed with it.
+    @param *t pointer to the table to free
+ */
+void freeRobin( RobinTable *t );
+
+#endif
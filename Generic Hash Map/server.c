@@ -0,0 +1,495 @@
+/**
+    @file server.c
+    @author Sachi Vyas (smvyas)
+    A program that: Serves a map to many local clients from one thread.  An epoll loop
+    waits on a Unix domain socket and every client connection; each client's input is
+    read in large chunks, every complete frame in it is carried out, and the replies are
+    gathered in an output buffer and sent with as few writes as the socket allows.
+    Clients can pipeline requests, and runs of gets are looked up together with
+    mapGetMany() so their cache misses overlap.
+ */
+#define _GNU_SOURCE
+#include "server.h"
+#include "wire.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/** Most events handled per epoll_wait() call. */
+#define MAX_EVENTS 64
+/** Bytes of room made in a client's input buffer before each read. */
+#define READ_CHUNK ( 64 * 1024 )
+/** Most consecutive gets handed to mapGetMany() at once. */
+#define GET_BATCH 64
+/** Once a client has this many reply bytes unsent, its requests aren't read until
+    they drain, so a client that never reads can't make the server buffer without end. */
+#define OUTPUT_LIMIT ( 4 * 1024 * 1024 )
+/** Milliseconds the server waits with nothing to do before looking for expired keys. */
+#define EXPIRE_TICK 100
+/** Keys with expiry times checked in each round of an idle tick. */
+#define EXPIRE_SAMPLES 20
+/** Most rounds in one idle tick, so it never holds up a client for long. */
+#define EXPIRE_ROUNDS 16
+
+/** One connected client. */
+typedef struct {
+  /** The connection. */
+  int fd;
+
+  /** Position in the server's list of clients. */
+  int index;
+
+  /** Events the connection is registered for. */
+  uint32_t events;
+
+  /** Bytes read but not yet carried out, starting with a frame. */
+  char *in;
+
+  /** Number of bytes in the input buffer. */
+  size_t inLen;
+
+  /** Size of the input buffer. */
+  size_t inCap;
+
+  /** Replies waiting to be sent. */
+  char *out;
+
+  /** Number of bytes in the output buffer. */
+  size_t outLen;
+
+  /** Number of them already sent. */
+  size_t outSent;
+
+  /** Size of the output buffer. */
+  size_t outCap;
+
+  /** Copies of the keys being worked on, each followed by a '\0'. */
+  char *keys;
+
+  /** Size of the key buffer. */
+  size_t keysCap;
+} Client;
+
+/** State of a running server. */
+typedef struct {
+  /** The map being served. */
+  Map *map;
+
+  /** Log of changes, or NULL. */
+  Wal *wal;
+
+  /** The epoll instance. */
+  int epoll;
+
+  /** Every connected client. */
+  Client **clients;
+
+  /** Number of connected clients. */
+  int count;
+
+  /** Size of the client list. */
+  int cap;
+} Server;
+
+/** Set by the signal handler to end the event loop. */
+static volatile sig_atomic_t stopping = 0;
+
+/**
+    Asks the event loop to stop.
+    @param sig the signal that was caught
+ */
+static void stop( int sig )
+{
+    stopping = 1;
+}
+
+/**
+    Makes sure a buffer has room for a number of bytes, doubling it as needed.
+    @param **buf the buffer, which may be moved
+    @param *cap its size, updated if it grows
+    @param need number of bytes it has to hold
+ */
+static void reserveBytes( char **buf, size_t *cap, size_t need )
+{
+    if (need <= *cap) {
+        return;
+    }
+    size_t size = *cap ? *cap : READ_CHUNK;
+    while (size < need) {
+        size *= 2;
+    }
+    *buf = realloc(*buf, size);
+    *cap = size;
+}
+
+/**
+    Stops a program if a change couldn't be added to the log, like the driver does.
+    @param ok result of adding the record
+ */
+static void checkLog( bool ok )
+{
+    if (!ok) {
+        fprintf(stderr, "Error: Cannot write log\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+    Adds a reply to a client's output buffer.
+    @param *c the client
+    @param status the outcome
+    @param *val value to send back, or NULL for none
+ */
+static void putReply( Client *c, WireStatus status, Value const *val )
+{
+    size_t body = 1 + ( val ? wireValueSize(val) : 0 );
+    reserveBytes(&c->out, &c->outCap, c->outLen + WIRE_HEADER + body);
+    char *p = wirePutU32(c->out + c->outLen, body);
+    *p++ = status;
+    if (val) {
+        p = wirePutValue(p, val);
+    }
+    c->outLen = p - c->out;
+}
+
+/**
+    Looks up a run of gets together and adds their replies in order.
+    @param *s the server
+    @param *c the client that sent them
+    @param count number of gets
+    @param **keys their keys
+ */
+static void flushGets( Server *s, Client *c, int count, char const **keys )
+{
+    Value *vals[ GET_BATCH ];
+    mapGetMany(s->map, count, keys, vals);
+    for (int i = 0; i < count; i++) {
+        putReply(c, vals[i] ? WIRE_OK : WIRE_MISSING, vals[i]);
+    }
+}
+
+/**
+    Carries out any request but a well-formed get, and adds its reply.
+    @param *s the server
+    @param *c the client that sent it
+    @param *body the frame body
+    @param len length of the body
+    @param *key copy of the key, followed by a '\0', or NULL if the body is malformed
+ */
+static void handleRequest( Server *s, Client *c, char const *body, size_t len,
+                           char const *key )
+{
+    char const *end = body + len;
+    if (key == NULL) {
+        putReply(c, WIRE_BAD, NULL);
+        return;
+    }
+    size_t keyLen = wireGetU32(body + 1);
+    char const *rest = body + WIRE_REQUEST_HEADER + keyLen;
+    if (body[0] == WIRE_SET && keyLen > 0) {
+        Value *val;
+        char const *after = wireGetValue(rest, end, mapArena(s->map), &val);
+        if (after != end) {
+            if (val) {
+                valueDestroy(val);
+            }
+            putReply(c, WIRE_BAD, NULL);
+            return;
+        }
+        if (s->wal) {
+            checkLog(walSet(s->wal, key, val));
+        }
+        mapSet(s->map, key, val);
+        putReply(c, WIRE_OK, NULL);
+    }
+    else if (body[0] == WIRE_REMOVE && keyLen > 0 && rest == end) {
+        if (s->wal) {
+            checkLog(walRemove(s->wal, key));
+        }
+        putReply(c, mapRemove(s->map, key) ? WIRE_OK : WIRE_MISSING, NULL);
+    }
+    else if (body[0] == WIRE_SIZE && keyLen == 0 && rest == end) {
+        Value size = { .type = VALUE_INT, .as.i = mapSize(s->map) };
+        putReply(c, WIRE_OK, &size);
+    }
+    else if (body[0] == WIRE_GET && keyLen > 0 && rest == end) {
+        Value *val = mapGet(s->map, key);
+        putReply(c, val ? WIRE_OK : WIRE_MISSING, val);
+    }
+    else {
+        putReply(c, WIRE_BAD, NULL);
+    }
+}
+
+/**
+    Copies a request's key into the client's key buffer so it can be used as a string.
+    @param *c the client, whose key buffer has room for the key
+    @param *used bytes of the key buffer already taken, advanced past the copy
+    @param *body the frame body
+    @param len length of the body
+    @return the copy, or NULL if the key runs past the body or holds a '\0'
+ */
+static char const *copyKey( Client *c, size_t *used, char const *body, size_t len )
+{
+    if (len < WIRE_REQUEST_HEADER) {
+        return NULL;
+    }
+    size_t keyLen = wireGetU32(body + 1);
+    char const *key = body + WIRE_REQUEST_HEADER;
+    if (keyLen > len - WIRE_REQUEST_HEADER || memchr(key, '\0', keyLen) != NULL) {
+        return NULL;
+    }
+    char *copy = c->keys + *used;
+    memcpy(copy, key, keyLen);
+    copy[keyLen] = '\0';
+    *used += keyLen + 1;
+    return copy;
+}
+
+/**
+    Carries out every complete frame in a client's input buffer and keeps any partial
+    frame for the next read.
+    @param *s the server
+    @param *c the client
+    @return false if the client sent a frame longer than WIRE_MAX_FRAME
+ */
+static bool processInput( Server *s, Client *c )
+{
+    // Keys are shorter than the frames they come in, so this is room for all of them.
+    reserveBytes(&c->keys, &c->keysCap, c->inLen + 1);
+    size_t used = 0;
+    char const *gets[ GET_BATCH ];
+    int pending = 0;
+    size_t pos = 0;
+    bool ok = true;
+    while (c->inLen - pos >= WIRE_HEADER) {
+        uint32_t len = wireGetU32(c->in + pos);
+        if (len > WIRE_MAX_FRAME) {
+            ok = false;
+            break;
+        }
+        if (c->inLen - pos - WIRE_HEADER < len) {
+            break;
+        }
+        char const *body = c->in + pos + WIRE_HEADER;
+        pos += WIRE_HEADER + len;
+        char const *key = copyKey(c, &used, body, len);
+        if (key != NULL && body[0] == WIRE_GET && key[0] != '\0' &&
+            WIRE_REQUEST_HEADER + strlen(key) == len) {
+            gets[pending++] = key;
+            if (pending == GET_BATCH) {
+                flushGets(s, c, pending, gets);
+                pending = 0;
+            }
+            continue;
+        }
+        // Replies go out in request order, so earlier gets are answered first.
+        flushGets(s, c, pending, gets);
+        pending = 0;
+        handleRequest(s, c, body, len, key);
+    }
+    flushGets(s, c, pending, gets);
+    memmove(c->in, c->in + pos, c->inLen - pos);
+    c->inLen -= pos;
+    return ok;
+}
+
+/**
+    Reads up to a chunk of what a client has sent.  Reading no more than that per
+    event keeps one busy client from starving the others; the rest is still there the
+    next time epoll_wait() returns.
+    @param *c the client
+    @return false if the client has closed the connection or it failed
+ */
+static bool readInput( Client *c )
+{
+    reserveBytes(&c->in, &c->inCap, c->inLen + READ_CHUNK);
+    ssize_t n;
+    do {
+        n = read(c->fd, c->in + c->inLen, c->inCap - c->inLen);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) {
+        c->inLen += n;
+        return true;
+    }
+    return n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK );
+}
+
+/**
+    Sends as many waiting replies as the socket will take, and registers the client
+    for the events it now needs: input unless its replies are backed up, and output
+    while any are waiting.
+    @param *s the server
+    @param *c the client
+    @return false if the connection failed
+ */
+static bool sendOutput( Server *s, Client *c )
+{
+    while (c->outSent < c->outLen) {
+        ssize_t n = send(c->fd, c->out + c->outSent, c->outLen - c->outSent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK )) {
+            break;
+        }
+        if (n < 0) {
+            return false;
+        }
+        c->outSent += n;
+    }
+    if (c->outSent == c->outLen) {
+        c->outSent = c->outLen = 0;
+    }
+    size_t waiting = c->outLen - c->outSent;
+    uint32_t events = ( waiting < OUTPUT_LIMIT ? EPOLLIN : 0 ) | ( waiting ? EPOLLOUT : 0 );
+    if (events != c->events) {
+        struct epoll_event ev = { .events = events, .data.ptr = c };
+        epoll_ctl(s->epoll, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = events;
+    }
+    return true;
+}
+
+/**
+    Disconnects a client and frees it.
+    @param *s the server
+    @param *c the client
+ */
+static void closeClient( Server *s, Client *c )
+{
+    close(c->fd);
+    s->clients[c->index] = s->clients[--s->count];
+    s->clients[c->index]->index = c->index;
+    free(c->in);
+    free(c->out);
+    free(c->keys);
+    free(c);
+}
+
+/**
+    Removes expired keys while the server is idle.  Rounds of samples keep going while
+    more than a quarter of each turns out to have expired, as then there are likely
+    many more.
+    @param *map the map
+ */
+static void expireIdle( Map *map )
+{
+    int rounds = 0;
+    while (rounds++ < EXPIRE_ROUNDS && mapExpire(map, EXPIRE_SAMPLES) > EXPIRE_SAMPLES / 4) {
+    }
+}
+
+/**
+    Accepts every connection waiting on the listening socket.
+    @param *s the server
+    @param listener the listening socket
+ */
+static void acceptClients( Server *s, int listener )
+{
+    int fd;
+    while ((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        Client *c = calloc(1, sizeof(Client));
+        c->fd = fd;
+        c->events = EPOLLIN;
+        if (s->count == s->cap) {
+            s->cap = s->cap ? s->cap * 2 : MAX_EVENTS;
+            s->clients = realloc(s->clients, s->cap * sizeof(Client *));
+        }
+        c->index = s->count;
+        s->clients[s->count++] = c;
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        epoll_ctl(s->epoll, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+/**
+    Opens the listening socket.
+    @param *path name of the socket
+    @return the socket, or -1 if it couldn't be opened
+ */
+static int listenOn( char const *path )
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+    Serves a map on a Unix domain socket until the program gets SIGINT or SIGTERM.
+    Requests are the frames described in wire.h; any number of clients may connect, and
+    each may send many requests before reading the replies, which come back in order.
+    @param *map the map every client works on
+    @param *wal log to add each set and remove to, or NULL
+    @param *path name of the socket; an old socket of that name is replaced
+    @return false if the socket couldn't be set up
+ */
+bool runServer( Map *map, Wal *wal, char const *path )
+{
+    int listener = listenOn(path);
+    if (listener < 0) {
+        return false;
+    }
+    Server s = { .map = map, .wal = wal, .epoll = epoll_create1(EPOLL_CLOEXEC) };
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(s.epoll, EPOLL_CTL_ADD, listener, &ev);
+
+    // No SA_RESTART, so a signal wakes epoll_wait() up.
+    struct sigaction action = { .sa_handler = stop };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    struct epoll_event events[ MAX_EVENTS ];
+    while (!stopping) {
+        int n = epoll_wait(s.epoll, events, MAX_EVENTS, EXPIRE_TICK);
+        if (n == 0) {
+            expireIdle(map);
+        }
+        for (int i = 0; i < n; i++) {
+            Client *c = events[i].data.ptr;
+            if (c == NULL) {
+                acceptClients(&s, listener);
+                continue;
+            }
+            bool open = true;
+            if (events[i].events & ( EPOLLIN | EPOLLHUP | EPOLLERR )) {
+                open = readInput(c);
+                // Whatever arrived before the client hung up is still answered.
+                if (!processInput(&s, c)) {
+                    open = false;
+                }
+            }
+            if (!sendOutput(&s, c) || !open) {
+                closeClient(&s, c);
+            }
+        }
+    }
+
+    while (s.count > 0) {
+        closeClient(&s, s.clients[0]);
+    }
+    free(s.clients);
+    close(s.epoll);
+    close(listener);
+    unlink(path);
+    return true;
+}
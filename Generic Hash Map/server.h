@@ -0,0 +1,25 @@
+/**
+    @file server.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for server.c, which serves a map to local clients over a socket
+ */
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "map.h"
+#include "wal.h"
+#include <stdbool.h>
+
+/**
+    Serves a map on a Unix domain socket until the program gets SIGINT or SIGTERM.
+    Requests are the frames described in wire.h; any number of clients may connect, and
+    each may send many requests before reading the replies, which come back in order.
+    While no requests are coming in, keys whose time to live has passed are removed.
+    @param *map the map every client works on
+    @param *wal log to add each set and remove to, or NULL
+    @param *path name of the socket; an old socket of that name is replaced
+    @return false if the socket couldn't be set up
+ */
+bool runServer( Map *map, Wal *wal, char const *path );
+
+#endif
@@ -0,0 +1,270 @@
+/**
+    @file skiplist.c
+    @author Sachi Vyas (smvyas)
+    A program that: Keeps a map's keys in sorted order so ranges of them can be visited
+    without sorting.  Each entry is one allocation holding only as many forward links
+    as its height, followed by the key, so short entries fit in one cache line.
+ */
+#include "skiplist.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/** Tallest an entry can be; enough for about 4^16 keys. */
+#define MAX_LEVEL 16
+/** Seed for the random heights, fixed so runs are repeatable. */
+#define SEED 0x9E3779B97F4A7C15ULL
+
+/** One key in the list. */
+struct SkipNodeStruct {
+  /** The value the map stores for the key. */
+  Value *val;
+
+  /** Number of forward links. */
+  int height;
+
+  /** Next entry at each level, lowest first, followed by the key and a '\0'. */
+  struct SkipNodeStruct *next[];
+};
+
+/**
+    Finds the key stored after an entry's links.
+    @param *n the entry
+    @return the key
+ */
+static char *nodeKey( SkipNode *n )
+{
+    return (char *) ( n->next + n->height );
+}
+
+/** Representation of a skip list. */
+struct SkipListStruct {
+  /** Number of levels in use. */
+  int levels;
+
+  /** State of the random number generator used to pick heights. */
+  uint64_t random;
+
+  /** Bytes taken by the list and its entries. */
+  size_t bytes;
+
+  /** Links from the front of the list at each level. */
+  SkipNode *head[ MAX_LEVEL ];
+};
+
+/**
+    Picks a height for a new entry: each level up is a quarter as likely as the last.
+    @param *l the list, whose generator is advanced
+    @return a height from 1 to MAX_LEVEL
+ */
+static int randomHeight( SkipList *l )
+{
+    // xorshift64, plenty random enough for balancing.
+    l->random ^= l->random << 13;
+    l->random ^= l->random >> 7;
+    l->random ^= l->random << 17;
+    int height = 1 + __builtin_ctzll(l->random | ( 1ULL << 62 )) / 2;
+    return height < MAX_LEVEL ? height : MAX_LEVEL;
+}
+
+/**
+    Finds, at every level, the link that would have to change to insert or remove a key.
+    @param *l the list
+    @param *key the key
+    @param *links filled in with MAX_LEVEL links; links[0] points at the first entry
+                  whose key is not less than key
+ */
+static void findLinks( SkipList *l, char const *key, SkipNode ***links )
+{
+    SkipNode **level = l->head;
+    for (int i = l->levels - 1; i >= 0; i--) {
+        while (level[i] != NULL && strcmp(nodeKey(level[i]), key) < 0) {
+            level = level[i]->next;
+        }
+        links[i] = &level[i];
+    }
+    for (int i = l->levels; i < MAX_LEVEL; i++) {
+        links[i] = &l->head[i];
+    }
+}
+
+/**
+    Makes an empty skip list.
+    @return a pointer to the allocated list
+ */
+SkipList *makeSkipList( void )
+{
+    SkipList *l = calloc(1, sizeof(SkipList));
+    l->bytes = sizeof(SkipList);
+    l->levels = 1;
+    l->random = SEED;
+    return l;
+}
+
+/**
+    Allocates an entry with a random height.
+    @param *l the list the entry is for
+    @param *key the key
+    @param *val the value
+    @return the entry, not linked in yet
+ */
+static SkipNode *makeNode( SkipList *l, char const *key, Value *val )
+{
+    int height = randomHeight(l);
+    size_t size = sizeof(SkipNode) + height * sizeof(SkipNode *) + strlen(key) + 1;
+    SkipNode *n = malloc(size);
+    l->bytes += size;
+    n->val = val;
+    n->height = height;
+    strcpy(nodeKey(n), key);
+    if (height > l->levels) {
+        l->levels = height;
+    }
+    return n;
+}
+
+/**
+    Makes a skip list holding keys that are already sorted, linking each entry in at
+    the end instead of searching for its place.
+    @param count number of keys
+    @param **keys the keys, in strictly increasing strcmp() order
+    @param **vals the value for each key
+    @return a pointer to the allocated list
+ */
+SkipList *makeSortedSkipList( int count, char const **keys, Value **vals )
+{
+    SkipList *l = makeSkipList();
+    // The last link at each level, which the next entry tall enough gets hooked onto.
+    SkipNode **tails[ MAX_LEVEL ];
+    for (int i = 0; i < MAX_LEVEL; i++) {
+        tails[i] = &l->head[i];
+    }
+    for (int k = 0; k < count; k++) {
+        SkipNode *n = makeNode(l, keys[k], vals[k]);
+        for (int i = 0; i < n->height; i++) {
+            *tails[i] = n;
+            n->next[i] = NULL;
+            tails[i] = &n->next[i];
+        }
+    }
+    return l;
+}
+
+/**
+    Adds a key to the list, or points an existing key at a new value.
+    @param *l pointer to the list
+    @param *key the key
+    @param *val the value the map now stores for the key
+ */
+void skipListSet( SkipList *l, char const *key, Value *val )
+{
+    SkipNode **links[ MAX_LEVEL ];
+    findLinks(l, key, links);
+    SkipNode *found = *links[0];
+    if (found != NULL && strcmp(nodeKey(found), key) == 0) {
+        found->val = val;
+        return;
+    }
+
+    SkipNode *n = makeNode(l, key, val);
+    for (int i = 0; i < n->height; i++) {
+        n->next[i] = *links[i];
+        *links[i] = n;
+    }
+}
+
+/**
+    Removes a key from the list.  The value is left alone; it belongs to the map.
+    @param *l pointer to the list
+    @param *key the key to remove
+    @return true if the key was in the list
+ */
+bool skipListRemove( SkipList *l, char const *key )
+{
+    SkipNode **links[ MAX_LEVEL ];
+    findLinks(l, key, links);
+    SkipNode *n = *links[0];
+    if (n == NULL || strcmp(nodeKey(n), key) != 0) {
+        return false;
+    }
+    for (int i = 0; i < n->height; i++) {
+        *links[i] = n->next[i];
+    }
+    while (l->levels > 1 && l->head[l->levels - 1] == NULL) {
+        l->levels--;
+    }
+    l->bytes -= sizeof(SkipNode) + n->height * sizeof(SkipNode *) + strlen(nodeKey(n)) + 1;
+    free(n);
+    return true;
+}
+
+/**
+    Finds the first key that is not less than the given one, in strcmp() order.
+    @param *l pointer to the list
+    @param *key where to start, or NULL for the smallest key
+    @return the entry, or NULL if every key is smaller
+ */
+SkipNode *skipListSeek( SkipList *l, char const *key )
+{
+    if (key == NULL) {
+        return l->head[0];
+    }
+    SkipNode **links[ MAX_LEVEL ];
+    findLinks(l, key, links);
+    return *links[0];
+}
+
+/**
+    Steps to the entry with the next larger key.
+    @param *n an entry
+    @return the next entry, or NULL at the end of the list
+ */
+SkipNode *skipNodeNext( SkipNode *n )
+{
+    return n->next[0];
+}
+
+/**
+    Returns the key of an entry.
+    @param *n an entry
+    @return the key
+ */
+char const *skipNodeKey( SkipNode *n )
+{
+    return nodeKey(n);
+}
+
+/**
+    Returns the value of an entry.
+    @param *n an entry
+    @return the value the map stores for the key
+ */
+Value *skipNodeValue( SkipNode *n )
+{
+    return n->val;
+}
+
+/**
+    Returns the number of bytes the list and its entries take, not counting the values.
+    @param *l the list
+    @return its size in bytes
+ */
+size_t skipListBytes( SkipList *l )
+{
+    return l->bytes;
+}
+
+/**
+    Frees the list and its entries, but not the values.
+    @param *l pointer to the list to free
+ */
+void freeSkipList( SkipList *l )
+{
+    SkipNode *n = l->head[0];
+    while (n != NULL) {
+        SkipNode *next = n->next[0];
+        free(n);
+        n = next;
+    }
+    free(l);
+}
@@ -0,0 +1,93 @@
+/**
+    @file skiplist.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for skiplist.c, the sorted index a map keeps over its keys
+ */
+#ifndef SKIPLIST_H
+#define SKIPLIST_H
+
+#include "map.h"
+#include "value.h"
+#include <stdbool.h>
+
+/** Incomplete type for a sorted skip list of keys. */
+typedef struct SkipListStruct SkipList;
+
+/** Incomplete type for one entry of a skip list. */
+typedef struct SkipNodeStruct SkipNode;
+
+/**
+    Makes an empty skip list.
+    @return a pointer to the allocated list
+ */
+SkipList *makeSkipList( void );
+
+/**
+    Makes a skip list holding keys that are already sorted, linking each entry in at
+    the end instead of searching for its place.
+    @param count number of keys
+    @param **keys the keys, in strictly increasing strcmp() order
+    @param **vals the value for each key
+    @return a pointer to the allocated list
+ */
+SkipList *makeSortedSkipList( int count, char const **keys, Value **vals );
+
+/**
+    Adds a key to the list, or points an existing key at a new value.
+    @param *l pointer to the list
+    @param *key the key
+    @param *val the value the map now stores for the key
+ */
+void skipListSet( SkipList *l, char const *key, Value *val );
+
+/**
+    Removes a key from the list.  The value is left alone; it belongs to the map.
+    @param *l pointer to the list
+    @param *key the key to remove
+    @return true if the key was in the list
+ */
+bool skipListRemove( SkipList *l, char const *key );
+
+/**
+    Finds the first key that is not less than the given one, in strcmp() order.
+    @param *l pointer to the list
+    @param *key where to start, or NULL for the smallest key
+    @return the entry, or NULL if every key is smaller
+ */
+SkipNode *skipListSeek( SkipList *l, char const *key );
+
+/**
+    Steps to the entry with the next larger key.
+    @param *n an entry
+    @return the next entry, or NULL at the end of the list
+ */
+SkipNode *skipNodeNext( SkipNode *n );
+
+/**
+    Returns the key of an entry.
+    @param *n an entry
+    @return the key
+ */
+char const *skipNodeKey( SkipNode *n );
+
+/**
+    Returns the value of an entry.
+    @param *n an entry
+    @return the value the map stores for the key
+ */
+Value *skipNodeValue( SkipNode *n );
+
+/**
+    Returns the number of bytes the list and its entries take, not counting the values.
+    @param *l the list
+    @return its size in bytes
+ */
+size_t skipListBytes( SkipList *l );
+
+/**
+    Frees the list and its entries, but not the values.
+    @param *l pointer to the list to free
+ */
+void freeSkipList( SkipList *l );
+
+#endif
@@ -0,0 +1,594 @@
+/**
+    @file snapshot.c
+    @author Sachi Vyas (smvyas)
+    A program that: Writes a map's pairs to a compact binary file and reads them back.  The
+    file holds a header, a hash index, fixed-size entries and then the string bytes (the
+    keys and the string values), all at offsets that can be used straight from an mmap of
+    the file, so lookups need no parsing.  Numbers are stored in the machine's own byte
+    order.  Keys with a time to live keep their absolute expiry time.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "snapshot.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** First bytes of every snapshot file, including the format version. */
+#define MAGIC "HMAPSNP3"
+/** Length of the magic string and of the hash name field. */
+#define NAME_FIELD 8
+/** Entries, and everything after the index, start on a multiple of this. */
+#define ALIGNMENT 8
+/** Entries a writer makes room for at first */
+#define WRITER_ENTRIES 1024
+/** Bytes of string data a writer makes room for at first */
+#define WRITER_STRINGS 16384
+
+/** Header at the start of a snapshot file. */
+typedef struct {
+  /** MAGIC, without a terminator. */
+  char magic[ NAME_FIELD ];
+
+  /** Name of the hash function the index uses, padded with '\0'. */
+  char hash[ NAME_FIELD ];
+
+  /** Number of entries. */
+  uint32_t count;
+
+  /** Number of index buckets, a power of two. */
+  uint32_t buckets;
+
+  /** Number of bytes of string data at the end of the file. */
+  uint64_t strings;
+} Header;
+
+/** One key / value pair in the file. */
+typedef struct {
+  /** Offset of the key's characters in the string data, which are followed by a '\0'. */
+  uint64_t key;
+
+  /** The value itself, or where its characters start in the string data. */
+  union {
+    /** An integer value. */
+    int32_t i;
+
+    /** A double value. */
+    double d;
+
+    /** Offset of a string value's characters, which are followed by a '\0'. */
+    uint64_t offset;
+  } as;
+
+  /** Time the key expires, on the mapNow() clock, or 0 if it never does. */
+  double deadline;
+
+  /** Hash of the key with the file's hash function. */
+  uint32_t hash;
+
+  /** Number of the next entry in the same bucket plus one, or 0 at the end. */
+  uint32_t next;
+
+  /** Length of a string value. */
+  uint32_t len;
+
+  /** Length of the key. */
+  uint32_t keyLen;
+
+  /** Kind of value, one of ValueType. */
+  uint8_t type;
+} Entry;
+
+/** Representation of a snapshot file being written a pair at a time. */
+struct SnapshotWriterStruct {
+  /** Name of the file to write. */
+  char *path;
+
+  /** Function used for the file's lookup index. */
+  HashFunction hash;
+
+  /** The file's header, counting the entries and string bytes added so far. */
+  Header header;
+
+  /** The entries added so far. */
+  Entry *entries;
+
+  /** Number of entries there is room for. */
+  uint32_t cap;
+
+  /** Copies of the keys and string values, laid out as in the file. */
+  char *strings;
+
+  /** Number of bytes there is room for in strings. */
+  size_t stringCap;
+
+  /** False once a pair that can't be written out has been added. */
+  bool ok;
+};
+
+/** Representation of a mapped snapshot file. */
+struct SnapshotStruct {
+  /** Start of the mapping. */
+  char *base;
+
+  /** Length of the mapping. */
+  size_t len;
+
+  /** The file's header. */
+  Header const *header;
+
+  /** The hash index: the first entry of each bucket, plus one. */
+  uint32_t const *index;
+
+  /** The entries. */
+  Entry const *entries;
+
+  /** The string data. */
+  char const *strings;
+
+  /** Function the index was built with. */
+  HashFunction hash;
+};
+
+/**
+    Returns the number of bytes the index takes, padded so the entries are aligned.
+    @param buckets number of buckets
+    @return size of the index in bytes
+ */
+static size_t indexBytes( uint32_t buckets )
+{
+    size_t bytes = buckets * sizeof(uint32_t);
+    return ( bytes + ALIGNMENT - 1 ) / ALIGNMENT * ALIGNMENT;
+}
+
+/**
+    Fills in the header's magic string and hash name for a new file.
+    @param *header the header to fill in
+    @param *hash function used for the file's lookup index, which may be changed to
+                 jenkins_one_at_a_time_hash if it is NULL or unnamed
+ */
+static void startHeader( Header *header, HashFunction *hash )
+{
+    char const *name = *hash ? hashName(*hash) : NULL;
+    if (name == NULL) {
+        *hash = jenkins_one_at_a_time_hash;
+        name = hashName(*hash);
+    }
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, MAGIC, NAME_FIELD);
+    memcpy(header->hash, name, strlen(name));
+}
+
+/**
+    Fills in the entry for one pair, giving out offsets in the string data for its key
+    and, if it has one, its string value.
+    @param *header the file's header, whose string length grows
+    @param hash function used for the file's lookup index
+    @param *e the entry to fill in
+    @param *key the key
+    @param *val the value
+    @param deadline time the key expires, on the mapNow() clock, or 0 if it never does
+    @return false if the value is VALUE_CUSTOM, which can't be written out
+ */
+static bool fillEntry( Header *header, HashFunction hash, Entry *e, char const *key,
+                       Value const *val, double deadline )
+{
+    e->deadline = deadline;
+    e->keyLen = strlen(key);
+    e->key = header->strings;
+    header->strings += e->keyLen + 1;
+    e->type = val->type;
+    e->hash = hash((const uint8_t *) key, e->keyLen);
+    switch (val->type) {
+    case VALUE_INT:
+        e->as.i = val->as.i;
+        return true;
+    case VALUE_DOUBLE:
+        e->as.d = val->as.d;
+        return true;
+    case VALUE_SHORT_STRING:
+    case VALUE_STRING:
+        e->len = strlen(valueString(val));
+        e->as.offset = header->strings;
+        header->strings += e->len + 1;
+        return true;
+    default:
+        // Custom values have no way to write themselves out.
+        return false;
+    }
+}
+
+/**
+    Function that writes a file's string data, in the order the offsets were given out.
+    @param *fp the file, positioned after the entries
+    @param *arg the argument given to writeFile()
+    @return true if everything was written
+ */
+typedef bool (*StringWriter)( FILE *fp, void *arg );
+
+/**
+    Builds the hash index over a file's entries and writes the whole file under a
+    temporary name, renaming it into place once it is complete.
+    @param *path name of the file to write
+    @param *header the header, with its count and string length filled in
+    @param *entries the entries, whose next fields are filled in here
+    @param writeStrings function that writes the string data
+    @param *arg argument passed to writeStrings
+    @return true if the file was written
+ */
+static bool writeFile( char const *path, Header *header, Entry *entries,
+                       StringWriter writeStrings, void *arg )
+{
+    header->buckets = 1;
+    while (header->buckets < header->count) {
+        header->buckets *= 2;
+    }
+    uint32_t *index = calloc(indexBytes(header->buckets), 1);
+    for (uint32_t i = 0; i < header->count; i++) {
+        uint32_t *bucket = &index[entries[i].hash & ( header->buckets - 1 )];
+        entries[i].next = *bucket;
+        *bucket = i + 1;
+    }
+
+    size_t tmpLen = strlen(path) + sizeof(".tmp");
+    char *tmp = malloc(tmpLen);
+    snprintf(tmp, tmpLen, "%s.tmp", path);
+    FILE *fp = fopen(tmp, "wb");
+    bool ok = fp != NULL;
+    if (fp != NULL) {
+        ok = fwrite(header, sizeof(*header), 1, fp) == 1 &&
+             fwrite(index, indexBytes(header->buckets), 1, fp) == 1 &&
+             fwrite(entries, sizeof(Entry), header->count, fp) == header->count &&
+             writeStrings(fp, arg);
+        ok = fclose(fp) == 0 && ok;
+        if (ok) {
+            ok = rename(tmp, path) == 0;
+        }
+        if (!ok) {
+            remove(tmp);
+        }
+    }
+    free(tmp);
+    free(index);
+    return ok;
+}
+
+/** The pairs writeSnapshot() is writing, for writePairStrings(). */
+typedef struct {
+  /** The keys. */
+  char const **keys;
+
+  /** The values. */
+  Value **vals;
+
+  /** The entries filled in for them. */
+  Entry const *entries;
+
+  /** Number of pairs. */
+  int count;
+} PairList;
+
+/**
+    Writes each key followed by its string value, straight from the pairs.
+    @param *fp the file
+    @param *arg the PairList
+    @return true if everything was written
+ */
+static bool writePairStrings( FILE *fp, void *arg )
+{
+    PairList *list = arg;
+    bool ok = true;
+    for (int i = 0; i < list->count && ok; i++) {
+        ok = fwrite(list->keys[i], list->entries[i].keyLen + 1, 1, fp) == 1;
+        if (ok && ( list->entries[i].type == VALUE_SHORT_STRING ||
+                    list->entries[i].type == VALUE_STRING )) {
+            ok = fwrite(valueString(list->vals[i]), list->entries[i].len + 1, 1, fp) == 1;
+        }
+    }
+    return ok;
+}
+
+/**
+    Writes key / value pairs to a snapshot file.  The file is written under a temporary
+    name and renamed into place, so a reader never sees half of one.
+    @param *path name of the file to write
+    @param hash function used for the file's lookup index; NULL or an unnamed function
+                means jenkins_one_at_a_time_hash
+    @param count number of pairs
+    @param *keys array of count keys
+    @param *vals array of count values, none of them VALUE_CUSTOM
+    @param *deadlines array of count expiry times on the mapNow() clock, 0 for a key
+                      that never expires, or NULL if none of them do
+    @return true if the file was written
+ */
+bool writeSnapshot( char const *path, HashFunction hash, int count, char const **keys,
+                    Value **vals, double const *deadlines )
+{
+    Header header;
+    startHeader(&header, &hash);
+    header.count = count;
+    Entry *entries = calloc(count > 0 ? count : 1, sizeof(Entry));
+    bool ok = true;
+    for (int i = 0; i < count && ok; i++) {
+        ok = fillEntry(&header, hash, &entries[i], keys[i], vals[i],
+                       deadlines ? deadlines[i] : 0);
+    }
+    PairList list = { keys, vals, entries, count };
+    ok = ok && writeFile(path, &header, entries, writePairStrings, &list);
+    free(entries);
+    return ok;
+}
+
+/**
+    Starts a snapshot file that is given its pairs one at a time, for a writer that
+    can't hold on to the keys and values until the end.
+    @param *path name of the file to write
+    @param hash function used for the file's lookup index; NULL or an unnamed function
+                means jenkins_one_at_a_time_hash
+    @return the new writer
+ */
+SnapshotWriter *startSnapshot( char const *path, HashFunction hash )
+{
+    SnapshotWriter *w = calloc(1, sizeof(SnapshotWriter));
+    startHeader(&w->header, &hash);
+    w->hash = hash;
+    w->path = malloc(strlen(path) + 1);
+    strcpy(w->path, path);
+    w->ok = true;
+    return w;
+}
+
+/**
+    Adds a key / value pair to a snapshot file being written.  The key and value are
+    copied, so they may change or be freed once this returns.
+    @param *w the writer
+    @param *key the key
+    @param *val the value; a VALUE_CUSTOM one makes finishSnapshot() fail
+    @param deadline time the key expires, on the mapNow() clock, or 0 if it never does
+ */
+void snapshotAdd( SnapshotWriter *w, char const *key, Value const *val, double deadline )
+{
+    if (w->header.count == w->cap) {
+        w->cap = w->cap ? w->cap * 2 : WRITER_ENTRIES;
+        w->entries = realloc(w->entries, w->cap * sizeof(Entry));
+    }
+    Entry *e = &w->entries[w->header.count++];
+    memset(e, 0, sizeof(Entry));
+    w->ok = fillEntry(&w->header, w->hash, e, key, val, deadline) && w->ok;
+    if (w->header.strings > w->stringCap) {
+        while (w->header.strings > w->stringCap) {
+            w->stringCap = w->stringCap ? w->stringCap * 2 : WRITER_STRINGS;
+        }
+        w->strings = realloc(w->strings, w->stringCap);
+    }
+    memcpy(w->strings + e->key, key, e->keyLen + 1);
+    if (e->type == VALUE_SHORT_STRING || e->type == VALUE_STRING) {
+        memcpy(w->strings + e->as.offset, valueString(val), e->len + 1);
+    }
+}
+
+/**
+    Writes a writer's string data, which it holds all of.
+    @param *fp the file
+    @param *arg the SnapshotWriter
+    @return true if everything was written
+ */
+static bool writeHeldStrings( FILE *fp, void *arg )
+{
+    SnapshotWriter *w = arg;
+    return w->header.strings == 0 ||
+           fwrite(w->strings, w->header.strings, 1, fp) == 1;
+}
+
+/**
+    Writes out a snapshot file given its pairs by snapshotAdd(), under a temporary name
+    renamed into place, and frees the writer.
+    @param *w the writer
+    @return true if the file was written
+ */
+bool finishSnapshot( SnapshotWriter *w )
+{
+    bool ok = w->ok &&
+              writeFile(w->path, &w->header, w->entries, writeHeldStrings, w);
+    free(w->path);
+    free(w->entries);
+    free(w->strings);
+    free(w);
+    return ok;
+}
+
+/**
+    Maps a snapshot file into memory.  Nothing is parsed or copied: lookups read the
+    file's index and entries in place.
+    @param *path name of the file to open
+    @return the snapshot, or NULL if the file can't be read or isn't a snapshot
+ */
+Snapshot *openSnapshot( char const *path )
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(Header)) {
+        close(fd);
+        return NULL;
+    }
+    char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    // Check that the header is ours and that the sections it describes fill the file.
+    Header const *h = (Header const *) base;
+    HashFunction hash = NULL;
+    if (memcmp(h->magic, MAGIC, NAME_FIELD) == 0 && memchr(h->hash, '\0', NAME_FIELD)) {
+        hash = hashByName(h->hash);
+    }
+    uint64_t expected = sizeof(Header) + indexBytes(h->buckets) +
+                        (uint64_t) h->count * sizeof(Entry) + h->strings;
+    if (hash == NULL || h->buckets == 0 || ( h->buckets & ( h->buckets - 1 ) ) != 0 ||
+        expected != (uint64_t) st.st_size) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    Snapshot *s = malloc(sizeof(Snapshot));
+    s->base = base;
+    s->len = st.st_size;
+    s->header = h;
+    s->index = (uint32_t const *) ( base + sizeof(Header) );
+    s->entries = (Entry const *) ( base + sizeof(Header) + indexBytes(h->buckets) );
+    s->strings = (char const *) ( s->entries + h->count );
+    s->hash = hash;
+    return s;
+}
+
+/**
+    Returns the number of key / value pairs in a snapshot.
+    @param *s the snapshot
+    @return the number of pairs
+ */
+int snapshotSize( Snapshot *s )
+{
+    return s->header->count;
+}
+
+/**
+    Finds characters in the string data, making sure they lie inside the file.
+    @param *s the snapshot
+    @param offset where the characters start
+    @param len number of characters, not counting the '\0' after them
+    @return the characters, or NULL if they run outside the string data
+ */
+static char const *stringAt( Snapshot *s, uint64_t offset, uint32_t len )
+{
+    if (offset >= s->header->strings || len >= s->header->strings - offset ||
+        s->strings[offset + len] != '\0') {
+        return NULL;
+    }
+    return s->strings + offset;
+}
+
+/**
+    Returns the key of one entry.
+    @param *s the snapshot
+    @param i index of the entry, from 0 to snapshotSize() - 1
+    @return the key, which points into the mapped file
+ */
+char const *snapshotKey( Snapshot *s, int i )
+{
+    Entry const *e = &s->entries[i];
+    char const *key = stringAt(s, e->key, e->keyLen);
+    return key ? key : "";
+}
+
+/**
+    Returns the time one entry's key expires.
+    @param *s the snapshot
+    @param i index of the entry, from 0 to snapshotSize() - 1
+    @return the time on the mapNow() clock, or 0 if the key never expires
+ */
+double snapshotDeadline( Snapshot *s, int i )
+{
+    return s->entries[i].deadline;
+}
+
+/**
+    Finds the characters of a string entry, making sure they lie inside the file.
+    @param *s the snapshot
+    @param *e the entry
+    @return the characters, or NULL if the entry points outside the string data
+ */
+static char const *entryString( Snapshot *s, Entry const *e )
+{
+    return stringAt(s, e->as.offset, e->len);
+}
+
+/**
+    Makes a new value holding a copy of one entry's value.
+    @param *s the snapshot
+    @param i index of the entry, from 0 to snapshotSize() - 1
+    @param *arena arena to allocate the value from, or NULL to use the heap
+    @return the new value, or NULL if the entry is damaged
+ */
+Value *snapshotValueIn( Snapshot *s, int i, Arena *arena )
+{
+    Entry const *e = &s->entries[i];
+    switch (e->type) {
+    case VALUE_INT:
+        return makeIntegerIn(e->as.i, arena);
+    case VALUE_DOUBLE:
+        return makeDoubleIn(e->as.d, arena);
+    case VALUE_SHORT_STRING:
+    case VALUE_STRING: {
+        char const *text = entryString(s, e);
+        return text ? makeStringIn(text, e->len, arena) : NULL;
+    }
+    default:
+        return NULL;
+    }
+}
+
+/**
+    Looks up a key through the file's own hash index, without loading anything.
+    @param *s the snapshot
+    @param *key the key to find
+    @param *out filled in with the value.  A long string points into the mapped file,
+                so it is only good until closeSnapshot() and must not be destroyed.
+    @return true if the key was found and hasn't expired
+ */
+bool snapshotGet( Snapshot *s, char const *key, Value *out )
+{
+    size_t len = strlen(key);
+    uint32_t h = s->hash((const uint8_t *) key, len);
+    uint32_t n = s->index[h & ( s->header->buckets - 1 )];
+    while (n != 0 && n <= s->header->count) {
+        Entry const *e = &s->entries[n - 1];
+        char const *text = e->hash == h && e->keyLen == len ? stringAt(s, e->key, len) : NULL;
+        if (text != NULL && memcmp(text, key, len) == 0) {
+            if (e->deadline != 0 && e->deadline <= mapNow()) {
+                return false;
+            }
+            out->fromArena = false;
+            out->type = e->type;
+            if (e->type == VALUE_INT) {
+                out->as.i = e->as.i;
+                return true;
+            } else if (e->type == VALUE_DOUBLE) {
+                out->as.d = e->as.d;
+                return true;
+            }
+            char const *text = entryString(s, e);
+            if (text == NULL || ( e->type != VALUE_SHORT_STRING && e->type != VALUE_STRING )) {
+                return false;
+            }
+            if (e->len < SMALL_STRING) {
+                out->type = VALUE_SHORT_STRING;
+                memcpy(out->as.str, text, e->len + 1);
+            } else {
+                out->type = VALUE_STRING;
+                out->as.ref.data = (void *) text;
+                out->as.ref.ops = NULL;
+            }
+            return true;
+        }
+        n = e->next;
+    }
+    return false;
+}
+
+/**
+    Unmaps a snapshot file.
+    @param *s the snapshot to close
+ */
+void closeSnapshot( Snapshot *s )
+{
+    munmap(s->base, s->len);
+    free(s);
+}
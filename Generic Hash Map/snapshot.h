@@ -0,0 +1,121 @@
+/**
+    @file snapshot.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for snapshot.c, the binary file format mapSave() writes and
+    mapLoad() reads
+ */
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "map.h"
+#include "value.h"
+#include "hash.h"
+#include <stdbool.h>
+
+/** Incomplete type for a snapshot file mapped into memory. */
+typedef struct SnapshotStruct Snapshot;
+
+/** Incomplete type for a snapshot file being written a pair at a time. */
+typedef struct SnapshotWriterStruct SnapshotWriter;
+
+/**
+    Writes key / value pairs to a snapshot file.  The file is written under a temporary
+    name and renamed into place, so a reader never sees half of one.
+    @param *path name of the file to write
+    @param hash function used for the file's lookup index; NULL or an unnamed function
+                means jenkins_one_at_a_time_hash
+    @param count number of pairs
+    @param *keys array of count keys
+    @param *vals array of count values, none of them VALUE_CUSTOM
+    @param *deadlines array of count expiry times on the mapNow() clock, 0 for a key
+                      that never expires, or NULL if none of them do
+    @return true if the file was written
+ */
+bool writeSnapshot( char const *path, HashFunction hash, int count, char const **keys,
+                    Value **vals, double const *deadlines );
+
+/**
+    Starts a snapshot file that is given its pairs one at a time, for a writer that
+    can't hold on to the keys and values until the end.
+    @param *path name of the file to write
+    @param hash function used for the file's lookup index; NULL or an unnamed function
+                means jenkins_one_at_a_time_hash
+    @return the new writer
+ */
+SnapshotWriter *startSnapshot( char const *path, HashFunction hash );
+
+/**
+    Adds a key / value pair to a snapshot file being written.  The key and value are
+    copied, so they may change or be freed once this returns.
+    @param *w the writer
+    @param *key the key
+    @param *val the value; a VALUE_CUSTOM one makes finishSnapshot() fail
+    @param deadline time the key expires, on the mapNow() clock, or 0 if it never does
+ */
+void snapshotAdd( SnapshotWriter *w, char const *key, Value const *val, double deadline );
+
+/**
+    Writes out a snapshot file given its pairs by snapshotAdd(), under a temporary name
+    renamed into place, and frees the writer.
+    @param *w the writer
+    @return true if the file was written
+ */
+bool finishSnapshot( SnapshotWriter *w );
+
+/**
+    Maps a snapshot file into memory.  Nothing is parsed or copied: lookups read the
+    file's index and entries in place.
+    @param *path name of the file to open
+    @return the snapshot, or NULL if the file can't be read or isn't a snapshot
+ */
+Snapshot *openSnapshot( char const *path );
+
+/**
+    Returns the number of key / value pairs in a snapshot.
+    @param *s the snapshot
+    @return the number of pairs
+ */
+int snapshotSize( Snapshot *s );
+
+/**
+    Returns the key of one entry.
+    @param *s the snapshot
+    @param i index of the entry, from 0 to snapshotSize() - 1
+    @return the key, which points into the mapped file
+ */
+char const *snapshotKey( Snapshot *s, int i );
+
+/**
+    Makes a new value holding a copy of one entry's value.
+    @param *s the snapshot
+    @param i index of the entry, from 0 to snapshotSize() - 1
+    @param *arena arena to allocate the value from, or NULL to use the heap
+    @return the new value, or NULL if the entry is damaged
+ */
+Value *snapshotValueIn( Snapshot *s, int i, Arena *arena );
+
+/**
+    Returns the time one entry's key expires.
+    @param *s the snapshot
+    @param i index of the entry, from 0 to snapshotSize() - 1
+    @return the time on the mapNow() clock, or 0 if the key never expires
+ */
+double snapshotDeadline( Snapshot *s, int i );
+
+/**
+    Looks up a key through the file's own hash index, without loading anything.
+    @param *s the snapshot
+    @param *key the key to find
+    @param *out filled in with the value.  A long string points into the mapped file,
+                so it is only good until closeSnapshot() and must not be destroyed.
+    @return true if the key was found and hasn't expired
+ */
+bool snapshotGet( Snapshot *s, char const *key, Value *out );
+
+/**
+    Unmaps a snapshot file.
+    @param *s the snapshot to close
+ */
+void closeSnapshot( Snapshot *s );
+
+#endif
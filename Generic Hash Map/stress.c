@@ -0,0 +1,205 @@
+/**
+    @file stress.c
+    @author Sachi Vyas (smvyas)
+    A program that: Hammers a shared map with gets, sets and removes from several threads
+    and checks every value a lookup sees.  Build it with "make stress-asan" so a lookup
+    that reads a freed node or value is reported instead of passing by luck.
+    Run it as "stress [iterations]".
+ */
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "map.h"
+#include "value.h"
+#include "concurrent.h"
+/** Number of threads sharing the map. */
+#define THREADS 4
+/** Number of distinct keys; few enough that threads keep running into each other. */
+#define KEYS 512
+/** Operations each thread performs when no count is given. */
+#define DEFAULT_ITERATIONS 200000
+/** Percentage of operations that are gets. */
+#define READ_PERCENT 70
+/** Different strings each key's values are made from. */
+#define SHARED_STRINGS 8
+/** Room for a key, or for the text of a value. */
+#define TEXT_BUFFER 64
+
+/** What a lookup expects to find, and where it records problems. */
+typedef struct {
+  /** Index of the key that was looked up. */
+  int index;
+
+  /** Number of wrong values seen. */
+  int *errors;
+} Check;
+
+/** One thread's share of the work. */
+typedef struct {
+  /** The shared map. */
+  ConcurrentMap *map;
+
+  /** Number of operations to perform. */
+  int iterations;
+
+  /** Seed for this thread's random choices. */
+  uint32_t seed;
+
+  /** Number of wrong values this thread saw. */
+  int errors;
+} Worker;
+
+/**
+    Makes the key with the given index.
+    @param *key buffer to fill in
+    @param index index of the key
+ */
+static void makeKey( char *key, int index )
+{
+    snprintf(key, TEXT_BUFFER, "key-%d", index);
+}
+
+/**
+    Makes a value that records which key it belongs to: either an integer that is the
+    index modulo KEYS, or a string too long to be stored inline that starts with it.
+    There are only a few strings per key, so interned ones are shared between sets.
+    @param index index of the key
+    @param r random number picking the kind and contents of the value
+    @return the new value
+ */
+static Value *makeValueFor( int index, uint32_t r )
+{
+    char text[ TEXT_BUFFER ];
+    if (r & 1) {
+        snprintf(text, sizeof(text), "%d", index + KEYS * (int) ( r % 1000 ));
+        return parseInteger(text);
+    }
+    snprintf(text, sizeof(text), "\"v%d: a string stored on the heap %u\"", index,
+             r % SHARED_STRINGS);
+    return parseString(text);
+}
+
+/**
+    Checks that a value found for a key was made for that key.
+    @param *val the value that was found
+    @param *arg the Check for this lookup
+ */
+static void checkValue( Value const *val, void *arg )
+{
+    Check *c = arg;
+    int index = -1;
+    if (val->type == VALUE_INT) {
+        index = val->as.i % KEYS;
+    } else if (val->type == VALUE_STRING) {
+        sscanf(valueString(val), "\"v%d:", &index);
+    }
+    if (index != c->index) {
+        (*c->errors)++;
+    }
+}
+
+/**
+    Runs one thread's mix of random gets, sets and removes.
+    @param *arg the thread's Worker
+    @return NULL
+ */
+static void *runWorker( void *arg )
+{
+    Worker *w = arg;
+    uint32_t x = w->seed;
+    char key[ TEXT_BUFFER ];
+    for (int i = 0; i < w->iterations; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        int index = x % KEYS;
+        makeKey(key, index);
+        int pick = ( x >> 16 ) % 100;
+        if (pick < READ_PERCENT) {
+            Check c = { index, &w->errors };
+            concurrentMapGet(w->map, key, checkValue, &c);
+        } else if (pick % 2 == 0) {
+            concurrentMapSet(w->map, key, makeValueFor(index, x >> 8));
+        } else {
+            concurrentMapRemove(w->map, key);
+        }
+    }
+    return NULL;
+}
+
+/**
+    Runs every thread against one map, then checks what is left in it.
+    @param *what name of the map being tested
+    @param *m the map, which is freed afterward
+    @param iterations operations per thread
+    @return true if no thread saw a wrong value and the map is consistent
+ */
+static bool stress( char const *what, ConcurrentMap *m, int iterations )
+{
+    pthread_t ids[ THREADS ];
+    Worker workers[ THREADS ];
+    for (int i = 0; i < THREADS; i++) {
+        workers[i] = (Worker) { m, iterations, 2463534242u + i * 7919, 0 };
+        pthread_create(&ids[i], NULL, runWorker, &workers[i]);
+    }
+    int errors = 0;
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(ids[i], NULL);
+        errors += workers[i].errors;
+    }
+
+    // Now that the map is quiet, every key should hold a value made for it and the
+    // size should match the keys we can find.
+    int found = 0;
+    char key[ TEXT_BUFFER ];
+    for (int i = 0; i < KEYS; i++) {
+        makeKey(key, i);
+        Check c = { i, &errors };
+        found += concurrentMapGet(m, key, checkValue, &c);
+    }
+    if (found != concurrentMapSize(m)) {
+        errors++;
+    }
+    freeConcurrentMap(m);
+
+    printf("%-16s %d threads x %d operations, %d errors\n", what, THREADS, iterations,
+           errors);
+    return errors == 0;
+}
+
+/**
+   Starting point for the program.
+   @param argc number of command-line arguments.
+   @param argv array of strings given as command-line arguments.
+   @return exit status for the program.
+ */
+int main( int argc, char *argv[] )
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+    if (argc > 2 || iterations <= 0) {
+        fprintf(stderr, "Usage: stress [iterations]\n");
+        return EXIT_FAILURE;
+    }
+
+    // Start the tables small so they grow while lookups are walking them.
+    MapOptions opts = { .engine = MAP_CHAINED };
+    bool ok = stress("lock-free", makeLockFreeMap(8, 4, NULL), iterations);
+    ok = stress("striped", makeConcurrentMap(8, 4, &opts), iterations) && ok;
+    opts.engine = MAP_ROBIN_HOOD;
+    ok = stress("striped/robin", makeConcurrentMap(8, 4, &opts), iterations) && ok;
+
+    // Interned strings are shared between values that threads destroy at once, and
+    // every one should be freed with the last value using it.
+    valueIntern(true);
+    ok = stress("lock-free/intern", makeLockFreeMap(8, 4, NULL), iterations) && ok;
+    ValueStats values;
+    valueStats(&values);
+    if (values.internedStrings != 0) {
+        printf("%ld interned strings left over\n", values.internedStrings);
+        ok = false;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -126,8 +126,13 @@ runTest() {
   echo "Test $TESTNO"
   rm -f output.txt stderr.txt
 
-  echo "   ./driver ${args[@]} < input-$TESTNO.txt > output.txt 2> stderr.txt"
-  ./driver ${args[@]} < input-$TESTNO.txt > output.txt 2> stderr.txt
+  if [ -n "$piped" ]; then
+    echo "   cat input-$TESTNO.txt | ./driver ${args[@]} > output.txt 2> stderr.txt"
+    cat input-$TESTNO.txt | ./driver ${args[@]} > output.txt 2> stderr.txt
+  else
+    echo "   ./driver ${args[@]} < input-$TESTNO.txt > output.txt 2> stderr.txt"
+    ./driver ${args[@]} < input-$TESTNO.txt > output.txt 2> stderr.txt
+  fi
   ASTATUS=$?
 
   if ! checkStatus "$ESTATUS" "$ASTATUS" ||
@@ -184,6 +189,353 @@ if [ -x driver ]; then
 
     args=(-bad -arguments)
     runTest 11 1
+
+    args=()
+    runTest 12 0
+
+    args=()
+    runTest 15 0
+
+    args=()
+    runTest 16 1
+
+    args=()
+    runTest 17 0
+
+    args=()
+    runTest 18 0
+
+    args=()
+    runTest 19 1
+
+    args=()
+    runTest 20 1
+
+    # Long strings set more than once share one interned copy.
+    args=(-intern)
+    runTest 21 0
+
+    # Run the same tests against the open-addressing engine.
+    for i in 01 02 03 04 05 06 07 08 10 12 15 16 17 19 20
+    do
+	args=(-robin)
+	runTest $i $( [ -f "error-$i.txt" ] && echo 1 || echo 0 )
+    done
+
+    args=(-term -robin)
+    runTest 09 0
+
+    # Allocating from an arena shouldn't change anything either.
+    for i in 03 05 06 08 12 15 16 17 18 19 20
+    do
+	args=(-arena)
+	runTest $i $( [ -f "error-$i.txt" ] && echo 1 || echo 0 )
+    done
+
+    # The output shouldn't depend on the hash function.
+    for h in fnv1a word
+    do
+	args=(-hash $h)
+	runTest 04 0
+	args=(-robin -hash $h)
+	runTest 08 1
+    done
+
+    # Batch mode parses and runs commands in groups but should print the same thing.
+    for i in 01 02 03 04 05 06 07 08 10 12 15 16 17 18 19 20
+    do
+	args=(-batch)
+	runTest $i $( [ -f "error-$i.txt" ] && echo 1 || echo 0 )
+    done
+
+    args=(-batch -robin -arena)
+    runTest 08 1
+
+    args=(-batch -intern)
+    runTest 21 0
+
+    # Redirected files are mapped into memory; piped input takes the streaming path.
+    piped=1
+    for i in 01 02 03 04 05 06 07 08 10
+    do
+	args=()
+	runTest $i $( [ -f "error-$i.txt" ] && echo 1 || echo 0 )
+	args=(-batch)
+	runTest $i $( [ -f "error-$i.txt" ] && echo 1 || echo 0 )
+    done
+    piped=
+
+    rm -f test-12.snap test-17.snap
+
+    # Test 14 starts from whatever the log kept of test 13, so each pair shares one log.
+    for commit in "128 10" "1 0" "0 5"
+    do
+	rm -f test-13.wal test-13.snap
+	args=(-wal test-13.wal -commit $commit)
+	runTest 13 0
+	runTest 14 0
+    done
+    rm -f test-13.wal test-13.snap
+
+    # A load is logged as the pairs it set, so the log replays the same map after the
+    # snapshot file is overwritten or removed.
+    echo "Log test with the loaded snapshot changed"
+    echo "   (load test-12.snap; set y 2) | ./driver -wal test-12.wal"
+    rm -f test-12.wal test-12.snap
+    (echo "set x 1"; echo "set t 5 ex 1000"; echo "save test-12.snap") | ./driver 2> stderr.txt
+    (echo "load test-12.snap"; echo "set y 2") | ./driver -wal test-12.wal 2>> stderr.txt
+    (echo "set x 99"; echo "set z 3"; echo "save test-12.snap") | ./driver 2>> stderr.txt
+    replayed=$( (echo "get x"; echo "get y"; echo "ttl t"; echo "size") |
+		./driver -wal test-12.wal 2>> stderr.txt )
+    rm -f test-12.snap
+    removed=$( (echo "get x"; echo "get y"; echo "ttl t"; echo "size") |
+	       ./driver -wal test-12.wal 2>> stderr.txt )
+    if [ "$replayed" != $'1\n2\n1000\n3' ] || [ "$removed" != "$replayed" ] ||
+       [ -s stderr.txt ]; then
+	fail "FAILED - the log didn't replay the load once the snapshot changed."
+    else
+	echo "Log test with the loaded snapshot changed PASS"
+    fi
+    rm -f test-12.wal test-12.snap
+
+    # Keys given a short time to live should be gone once it passes, whether they are
+    # read again or not.  Scans and sums should skip them before anything removes them,
+    # and a replayed log or a loaded snapshot should keep the time each key expires at.
+    for mode in "" "-robin"
+    do
+	echo "Expiry test $mode"
+	rm -f test-20.wal test-20.snap test-20-bg.snap
+	echo "   (set a 1 ex 0.1; save; bgsave; sleep 0.4; scan a z; ttl a) | ./driver $mode -wal test-20.wal"
+	output=$( (echo "set a 1 ex 0.1"; echo "set b 2 ex 1000"; echo "set c 3"; echo "set d 4 ex 0.6"
+		   echo "save test-20.snap"; echo "bgsave test-20-bg.snap"; sleep 0.4
+		   echo "scan a z"; echo "sum"; echo "ttl a"; echo "ttl b"; echo "get c") |
+		  ./driver $mode -wal test-20.wal 2> stderr.txt )
+	replayed=$( (echo "ttl a"; echo "ttl b"; echo "ttl c") |
+		    ./driver $mode -wal test-20.wal 2>> stderr.txt )
+	sleep 0.4
+	loaded=$(for snap in test-20.snap test-20-bg.snap; do
+		     (echo "load $snap"; echo "ttl a"; echo "ttl b"; echo "ttl d"; echo "scan a z") |
+			 ./driver $mode 2>> stderr.txt; done)
+	if [ "$output" != $'b 2\nc 3\nd 4\n9\n-2\n1000\n3' ] ||
+	   [ "$replayed" != $'-2\n1000\n-1' ] ||
+	   [ "$loaded" != $'-2\n1000\n-2\nb 2\nc 3\n-2\n1000\n-2\nb 2\nc 3' ] ||
+	   [ -s stderr.txt ]; then
+	    fail "FAILED - keys didn't expire when they should have."
+	else
+	    echo "Expiry test $mode PASS"
+	fi
+	rm -f test-20.wal test-20.snap test-20-bg.snap
+    done
+    # An incr keeps the key's time to live, in the log as well as the map.
+    for mode in "" "-robin"
+    do
+	echo "Expiry test with incr $mode"
+	echo "   (set k 1 ex 1000; incr k 1) | ./driver $mode -wal test-20.wal; ttl k after restarting"
+	rm -f test-20.wal
+	(echo "set k 1 ex 1000"; echo "incr k 1") | ./driver $mode -wal test-20.wal > /dev/null 2> stderr.txt
+	replayed=$( (echo "ttl k"; echo "get k") | ./driver $mode -wal test-20.wal 2>> stderr.txt )
+	if [ "$replayed" != $'1000\n2' ] || [ -s stderr.txt ]; then
+	    fail "FAILED - an incr made an expiring key permanent once the log was replayed."
+	else
+	    echo "Expiry test with incr $mode PASS"
+	fi
+	rm -f test-20.wal
+    done
+
+    # Under a memory cap the least recently used keys are evicted to make room, so the
+    # bytes the entries take should never pass it.
+    for mode in "" "-robin" "-arena"
+    do
+	echo "Eviction test $mode"
+	echo "   20000 sets | ./driver $mode -maxmemory 200000"
+	used=$( (for i in $(seq 1 20000); do echo "set key-$i \"value number $i\""; done
+		 echo "stats") | ./driver $mode -maxmemory 200000 2> stderr.txt |
+		awk '/^(table|node|key|value)-bytes/ { b += $2 } /^evicted/ { e = $2 }
+		     END { print ( b <= 200000 && e > 0 ) ? "ok" : b }' )
+	if [ "$used" != "ok" ] || [ -s stderr.txt ]; then
+	    fail "FAILED - the map used $used bytes under a 200000 byte cap."
+	else
+	    echo "Eviction test $mode PASS"
+	fi
+    done
+
+    # A bulk load on any number of threads should leave the map just as running the
+    # same commands one at a time does, including over keys a log already holds.
+    awk 'BEGIN { srand(7); for (i = 0; i < 30000; i++) { k = int(rand() * 3000); r = rand();
+	   if (r < 0.2) print "remove key-" k; else if (r < 0.3) print "set key-" k " " i " ex 1000";
+	   else if (r < 0.5) print "set key-" k " \"text " i "\""; else if (r < 0.55) print "set key-" k " 1.5x";
+	   else if (r < 0.7) print "set key-" k " " i ".25"; else print "set key-" k " " i } }' > test-bulk.txt
+    awk 'BEGIN { for (k = 0; k < 3000; k += 2) print "set key-" k " old" }' > test-bulk-old.txt
+    awk 'BEGIN { for (k = 0; k < 3000; k++) print "ttl key-" k; print "scan ! ~"; print "size" }' > test-bulk-query.txt
+    cat test-bulk-old.txt test-bulk.txt test-bulk-query.txt | ./driver > test-bulk-expected.txt
+    for mode in "" "-robin" "-arena" "-robin -arena"
+    do
+	for threads in 1 2 3 8
+	do
+	    echo "Bulk load test $mode -threads $threads"
+	    echo "   ./driver $mode -wal test-bulk.wal -load test-bulk.txt -threads $threads < test-bulk-query.txt"
+	    rm -f test-bulk.wal
+	    ./driver $mode -wal test-bulk.wal < test-bulk-old.txt 2> stderr.txt
+	    ./driver $mode -wal test-bulk.wal -load test-bulk.txt -threads $threads \
+		     < test-bulk-query.txt > output.txt 2>> stderr.txt
+	    if ! diff -q test-bulk-expected.txt output.txt > /dev/null || [ -s stderr.txt ]; then
+		fail "FAILED - the bulk load left the map different from running the commands in order."
+	    elif ! ./driver $mode -wal test-bulk.wal < test-bulk-query.txt |
+		   diff -q test-bulk-expected.txt - > /dev/null; then
+		fail "FAILED - replaying the log didn't repeat the bulk load."
+	    else
+		echo "Bulk load test $mode -threads $threads PASS"
+	    fi
+	done
+    done
+    echo "Bulk load test with a bad line"
+    (echo "set a 1"; echo "remove b"; echo "get a"; echo "set c 2") > test-bulk.txt
+    output=$(echo "size" | ./driver -load test-bulk.txt -threads 2 2>&1)
+    if [ $? -ne 1 ] || [ "$output" != "Error: Invalid command on line 3 of test-bulk.txt" ]; then
+	fail "FAILED - the bulk load didn't report the bad line."
+    else
+	echo "Bulk load test with a bad line PASS"
+    fi
+    # The log keeps what the load did, with absolute expiry times, so a replay after the
+    # file is gone and a key's time has passed neither fails nor revives the key.
+    echo "Bulk load test with a log and an expiring key"
+    echo "   ./driver -wal test-bulk.wal -load test-bulk.txt; sleep 0.5; rm test-bulk.txt"
+    rm -f test-bulk.wal
+    (echo "set a 1 ex 0.3"; echo "set b 2"; echo "set c 3 ex 1000"; echo "remove d") > test-bulk.txt
+    echo "set d 4" | ./driver -wal test-bulk.wal 2> stderr.txt
+    ./driver -wal test-bulk.wal -load test-bulk.txt -threads 2 < /dev/null 2>> stderr.txt
+    sleep 0.5
+    rm -f test-bulk.txt
+    output=$( (echo "ttl a"; echo "get b"; echo "ttl c"; echo "ttl d"; echo "size") |
+	      ./driver -wal test-bulk.wal 2>> stderr.txt )
+    if [ "$output" != $'-2\n2\n1000\n-2\n2' ] || [ -s stderr.txt ]; then
+	fail "FAILED - replaying the log didn't repeat the bulk load as it was."
+    else
+	echo "Bulk load test with a log and an expiring key PASS"
+    fi
+    rm -f test-bulk.txt test-bulk-old.txt test-bulk-query.txt test-bulk-expected.txt test-bulk.wal
+
+    # A background save writes the map as it was when bgsave ran, however much the
+    # commands after it change, so it should match a save run at the same point.  The
+    # mset lines add enough keys during the save to make a Robin Hood table grow.
+    awk 'BEGIN { srand(7); for (i = 0; i < 50000; i++) print "set k" i " " (i % 3 ? i : "\"text " i "\"");
+	   for (i = 0; i < 2000; i++) print "set c" i " " i; print "SAVE test-bgsave.snap";
+	   for (i = 0; i < 15000; i++) { k = int(rand() * 50000); r = rand();
+	     if (i < 100) { line = "mset"; for (j = 0; j < 200; j++) line = line " m" i "-" j " " j; print line }
+	     if (r < 0.3) print "set k" k " \"changed " i "\""; else if (r < 0.5) print "remove k" k;
+	     else if (r < 0.8) print "incr c" k % 2000 " 5"; else print "set k" k " 1.5" } }' > test-bgsave.txt
+    (echo "load test-bgsave.snap"; echo "scan ! ~") > test-bgsave-query.txt
+    for mode in "" "-robin" "-arena" "-batch" "-robin -batch"
+    do
+	echo "Background save test $mode"
+	echo "   ./driver $mode < test-bgsave.txt, with bgsave in place of save"
+	rm -f test-bgsave.snap
+	sed 's/^SAVE/save/' test-bgsave.txt | ./driver $mode > test-bgsave-run.txt
+	./driver < test-bgsave-query.txt > test-bgsave-expected.txt
+	rm -f test-bgsave.snap
+	sed 's/^SAVE/bgsave/' test-bgsave.txt | ./driver $mode > output.txt 2> stderr.txt
+	if ! diff -q test-bgsave-run.txt output.txt > /dev/null || [ -s stderr.txt ]; then
+	    fail "FAILED - the background save changed what the other commands did."
+	elif ! ./driver < test-bgsave-query.txt | diff -q test-bgsave-expected.txt - > /dev/null; then
+	    fail "FAILED - the background save didn't write the map as it was at bgsave."
+	else
+	    echo "Background save test $mode PASS"
+	fi
+    done
+    echo "Background save test with a save already running"
+    output=$( (echo "bgsave test-bgsave.snap"; echo "bgsave test-bgsave.snap") | ./driver 2>&1)
+    if [ $? -ne 1 ] || [ "$output" != "Error: Cannot bgsave test-bgsave.snap" ]; then
+	fail "FAILED - a second bgsave didn't fail while the first was running."
+    else
+	echo "Background save test with a save already running PASS"
+    fi
+    # A command that stops the program should still leave a running save's file behind.
+    for bad in "get" "get missing"
+    do
+	echo "Background save test stopped by \"$bad\""
+	echo "   (set k0 .. k19999; set a 1; bgsave test-bgsave.snap; set a 2; $bad) | ./driver"
+	rm -f test-bgsave.snap
+	(seq 0 19999 | sed 's/.*/set k& &/'; echo "set a 1"; echo "bgsave test-bgsave.snap"
+	 echo "set a 2"; echo "$bad") | ./driver > /dev/null 2>&1
+	status=$?
+	output=$( (echo "load test-bgsave.snap"; echo "get a") | ./driver 2>&1)
+	if [ $status -ne 1 ] || [ "$output" != "1" ] || [ -e test-bgsave.snap.tmp ]; then
+	    fail "FAILED - an error after bgsave didn't leave the finished file."
+	else
+	    echo "Background save test stopped by \"$bad\" PASS"
+	fi
+    done
+    rm -f test-bgsave.txt test-bgsave-query.txt test-bgsave-expected.txt test-bgsave.snap test-bgsave-run.txt
+
+    # With -latency every phase of every command is timed, and the histograms are
+    # written at exit, a line per command and phase, with the percentiles in order.
+    (for i in $(seq 1 300); do echo "set key-$i $i"; echo "get key-$i"; done
+     for i in $(seq 1 100); do echo "remove key-$i"; done; echo "size") > test-latency-input.txt
+    for mode in "" "-batch"
+    do
+	echo "Latency test $mode"
+	echo "   ./driver $mode -latency test-latency.txt < test-latency-input.txt"
+	rm -f test-latency.txt
+	./driver $mode -latency test-latency.txt < test-latency-input.txt > output.txt 2> stderr.txt
+	rows=$(awk '!/^#/ { if (NF != 10 || $4 > $5 || $5 > $10 || $4 > $6 || $6 > $7 ||
+			       $7 > $8 || $8 > $9 || $9 > $10) print "bad"; else print $1, $2, $3 }' \
+		   test-latency.txt | tr '\n' ' ')
+	if [ "$rows" != "set read 300 set parse 300 set execute 300 get read 300 get parse 300 get execute 300 get print 300 remove read 100 remove parse 100 remove execute 100 size read 1 size parse 1 size execute 1 size print 1 " ] ||
+	       [ -s stderr.txt ]; then
+	    fail "FAILED - the latency histograms didn't count every phase of every command."
+	else
+	    echo "Latency test $mode PASS"
+	fi
+    done
+    rm -f test-latency.txt test-latency-input.txt
+
+    # Serve the map on a socket and let the load generator check every reply.  The
+    # driver should shut down cleanly and remove its socket when it is told to stop.
+    for mode in "" "-robin -arena"
+    do
+	echo "Server test $mode"
+	echo "   ./driver $mode -serve test-server.sock & ./loadgen test-server.sock 4 16 20000"
+	./driver $mode -serve test-server.sock 2> stderr.txt &
+	server=$!
+	if ! ./loadgen test-server.sock 4 16 20000 > output.txt 2>> stderr.txt; then
+	    cat stderr.txt
+	    fail "FAILED - the server gave a wrong reply."
+	fi
+	kill $server
+	if ! wait $server; then
+	    fail "FAILED - the server didn't exit successfully when stopped."
+	elif [ -e test-server.sock ]; then
+	    fail "FAILED - the server didn't remove its socket."
+	else
+	    echo "Server test $mode PASS"
+	fi
+	rm -f test-server.sock
+    done
+
+    # The number parsers have to read every input exactly as sscanf() does.
+    echo "Parser test"
+    echo "   make numbers && ./numbers"
+    if ! make numbers > /dev/null 2>&1; then
+	fail "The parser test didn't compile."
+    elif ! ./numbers > stderr.txt 2>&1; then
+	cat stderr.txt
+	fail "FAILED - a number parser disagreed with sscanf."
+    else
+	echo "Parser test PASS"
+    fi
+
+    # Hammer the shared maps from several threads.  The sanitizer stops the program if
+    # a lookup ever reads a node or value that has already been freed.
+    echo "Stress test"
+    echo "   make stress-asan && ./stress-asan"
+    if ! make stress-asan > /dev/null 2>&1; then
+	fail "The stress test didn't compile."
+    elif ! ./stress-asan > stderr.txt 2>&1; then
+	cat stderr.txt
+	fail "FAILED - the stress test found wrong or freed values."
+    else
+	echo "Stress test PASS"
+    fi
 else
     fail "Your driver program didn't compile, so it couldn't be tested."
 fi
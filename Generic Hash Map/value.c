@@ -4,10 +4,72 @@
     A program that: Helps us parse through the line to get the integer, double, and string components
  */
 #include "value.h"
+#include "arena.h"
+#include "intern.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <float.h>
+
+/** Room for the digits and sign of any int */
+#define INT_DIGITS 12
+/** Most significant digits a 64-bit mantissa can hold without overflowing */
+#define MANTISSA_DIGITS 19
+/** Largest mantissa a double holds exactly, 2^53 */
+#define EXACT_MANTISSA ( (uint64_t) 1 << 53 )
+/** Largest power of ten a double holds exactly */
+#define EXACT_POWER 22
+/** Exponent digits past this size are left to sscanf */
+#define EXPONENT_LIMIT 100000
+/** Strings shorter than this are unescaped on the stack before they are interned */
+#define INTERN_SCRATCH 256
+
+/** A number as scanNumber() reads it: mantissa times ten to the scale. */
+typedef struct {
+  /** True if there was a '-' sign. */
+  bool negative;
+
+  /** Up to MANTISSA_DIGITS significant digits. */
+  uint64_t mantissa;
+
+  /** Power of ten the mantissa is multiplied by. */
+  int scale;
+
+  /** True if the digits had a decimal point. */
+  bool point;
+
+  /** True if there was an exponent. */
+  bool exponent;
+
+  /** True if nonzero digits past MANTISSA_DIGITS were dropped. */
+  bool truncated;
+} Decimal;
+
+/** What the fast number parser made of a string. */
+typedef enum {
+  /** A number, which it parsed. */
+  SCAN_OK,
+  /** Not a number, which sscanf() would have said too. */
+  SCAN_BAD,
+  /** Something only sscanf() can settle, like leading blanks, hex, inf or overflow. */
+  SCAN_SLOW
+} ScanResult;
+
+/** Powers of ten a double holds exactly. */
+static double const exactPowers[ EXACT_POWER + 1 ] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/** Blocks handed out by allocIn() and taken back by freeIn().  Values are made and
+    freed from several threads at once, so the counts are kept with relaxed atomic adds,
+    which cost about as much as plain ones when no other thread is counting. */
+static ValueStats counts;
+
+/** True if long strings made on the heap should share interned characters. */
+static bool interning = false;
 
 /**
     Checks if a string is blank
@@ -27,46 +89,467 @@ bool blankString( char const *str )
 }
 
 /**
-    Generic destroy method, suitable for most types of values.  It
-    assumes the data can be freed as a single block of heap memory.
-    @param *v pointer to a value to destroy
+    Reports how many blocks have been allocated and freed for values so far, by every
+    thread.
+    @param *stats structure to fill in
+ */
+void valueStats( ValueStats *stats )
+{
+  stats->allocations = __atomic_load_n( &counts.allocations, __ATOMIC_RELAXED );
+  stats->frees = __atomic_load_n( &counts.frees, __ATOMIC_RELAXED );
+  InternStats interned;
+  internStats( &interned );
+  stats->internedStrings = interned.strings;
+  stats->internSavedBytes = interned.savedBytes;
+}
+
+/**
+    Turns interning of long strings on or off for values made from then on.
+    @param on true to intern strings, false to copy them
+ */
+void valueIntern( bool on )
+{
+  interning = on;
+}
+
+/**
+    Returns the number of bytes a value takes: the Value itself, plus the block a long
+    string's characters are kept in.
+    @param *v the value
+    @return its size in bytes
+ */
+size_t valueSize( Value const *v )
+{
+  if ( v->type == VALUE_STRING && ! v->interned )
+    return sizeof( Value ) + strlen( v->as.ref.data ) + 1;
+  return sizeof( Value );
+}
+
+/**
+    Returns true if a value's payload is stored inside the Value rather than in a
+    separate block.
+    @param *v the value to check
+    @return true for ints, doubles and short strings
+ */
+bool valueIsInline( Value const *v )
+{
+  return v->type != VALUE_STRING && v->type != VALUE_CUSTOM;
+}
+
+/**
+    Allocates memory for a value, from the arena if one is given and from the heap if not.
+    @param *arena arena to allocate from, or NULL
+    @param size number of bytes needed
+    @return pointer to the memory
+ */
+static void *allocIn( Arena *arena, size_t size )
+{
+    __atomic_fetch_add( &counts.allocations, 1, __ATOMIC_RELAXED );
+    return arena ? arenaAlloc( arena, size ) : malloc( size );
+}
+
+/**
+    Frees memory that came from allocIn().  Arena blocks know their own arena.
+    @param fromArena true if the memory came from an arena
+    @param *p pointer to the memory
+ */
+static void freeIn( bool fromArena, void *p )
+{
+    __atomic_fetch_add( &counts.frees, 1, __ATOMIC_RELAXED );
+    if ( fromArena ) {
+        arenaRelease( p );
+    } else {
+        free( p );
+    }
+}
+
+/**
+    Allocates a value struct and fills in its header.
+    @param *arena arena to allocate from, or NULL to use the heap
+    @param type kind of value it will hold
+    @return pointer to the new value, with its payload not yet filled in
+ */
+static Value *makeValue( Arena *arena, ValueType type )
+{
+    Value *this = (Value *) allocIn( arena, sizeof( Value ) );
+    this->type = type;
+    this->fromArena = arena != NULL;
+    this->expires = false;
+    this->interned = false;
+    this->touched = 0;
+    return this;
+}
+
+/**
+    Prints an int to standard output without going through printf's format parsing.
+    @param val the integer to print
+ */
+static void printInt( int val )
+{
+  char buf[ INT_DIGITS ];
+  char *p = buf + sizeof( buf );
+  unsigned int mag = val < 0 ? 0u - (unsigned int) val : (unsigned int) val;
+  do {
+    *--p = '0' + mag % 10;
+    mag /= 10;
+  } while ( mag != 0 );
+  if ( val < 0 )
+    *--p = '-';
+  fwrite( p, 1, buf + sizeof( buf ) - p, stdout );
+}
+
+/**
+    Prints a value to the terminal.
+    @param *v the value to print
+ */
+void valuePrint( Value const *v )
+{
+  switch ( v->type ) {
+    case VALUE_INT:
+      printInt( v->as.i );
+      break;
+    case VALUE_DOUBLE:
+      printf( "%lf", v->as.d );
+      break;
+    case VALUE_SHORT_STRING:
+    case VALUE_STRING:
+      printf( "%s", valueString( v ) );
+      break;
+    default:
+      v->as.ref.ops->print( v );
+  }
+}
+
+/**
+    Frees a value and any block its payload is kept in.
+    @param *v the value to free
+ */
+void valueDestroy( Value *v )
+{
+  switch ( v->type ) {
+    case VALUE_CUSTOM:
+      v->as.ref.ops->destroy( v );
+      return;
+    case VALUE_STRING:
+      if ( v->interned )
+        internRelease( v->as.ref.data );
+      else
+        freeIn( v->fromArena, v->as.ref.data );
+      break;
+    default:
+      break;
+  }
+  freeIn( v->fromArena, v );
+}
+
+/**
+    Returns the numeric value of an int or double.
+    @param *v the value, which must be a VALUE_INT or VALUE_DOUBLE
+    @return its value as a double
+ */
+static double valueNumber( Value const *v )
+{
+  return v->type == VALUE_INT ? v->as.i : v->as.d;
+}
+
+/**
+    Groups the kinds of value so ints compare with doubles and short strings
+    with long ones.
+    @param type the kind of value
+    @return a rank shared by kinds that compare with each other
+ */
+static int typeRank( ValueType type )
+{
+  switch ( type ) {
+    case VALUE_INT:
+    case VALUE_DOUBLE:
+      return 0;
+    case VALUE_SHORT_STRING:
+    case VALUE_STRING:
+      return 1;
+    default:
+      return 2;
+  }
+}
+
+/**
+    Orders two values.  Numbers compare by value (ints and doubles with each other),
+    strings compare with strcmp, and values of different kinds order by kind.
+    @param *a the first value
+    @param *b the second value
+    @return negative, zero or positive as a is less than, equal to or greater than b
+ */
+int valueCompare( Value const *a, Value const *b )
+{
+  int ra = typeRank( a->type ), rb = typeRank( b->type );
+  if ( ra != rb )
+    return ra - rb;
+
+  switch ( ra ) {
+    case 0:
+      if ( a->type == VALUE_INT && b->type == VALUE_INT )
+        return ( a->as.i > b->as.i ) - ( a->as.i < b->as.i );
+      return ( valueNumber( a ) > valueNumber( b ) ) - ( valueNumber( a ) < valueNumber( b ) );
+    case 1:
+      return strcmp( valueString( a ), valueString( b ) );
+    default:
+      if ( a->as.ref.ops == b->as.ref.ops && a->as.ref.ops->compare )
+        return a->as.ref.ops->compare( a, b );
+      return ( a > b ) - ( a < b );
+  }
+}
+
+/**
+    Adds a number to an int or double value in place.  An int plus a double becomes a
+    double, which fits in the same Value, so nothing is allocated either way.
+    @param *v the value to change
+    @param *delta the number to add, a VALUE_INT or VALUE_DOUBLE
+    @return false, leaving v alone, if v isn't a number or an int sum would overflow
+ */
+bool valueAdd( Value *v, Value const *delta )
+{
+  if ( v->type == VALUE_INT && delta->type == VALUE_INT ) {
+    int sum;
+    if ( __builtin_add_overflow( v->as.i, delta->as.i, &sum ) )
+      return false;
+    v->as.i = sum;
+    return true;
+  }
+  if ( typeRank( v->type ) != 0 )
+    return false;
+  v->as.d = valueNumber( v ) + valueNumber( delta );
+  v->type = VALUE_DOUBLE;
+  return true;
+}
+
+/**
+    Returns the text of a string value.
+    @param *v the value, which must be a VALUE_SHORT_STRING or VALUE_STRING
+    @return pointer to the string's characters
+ */
+char const *valueString( Value const *v )
+{
+  return v->type == VALUE_SHORT_STRING ? v->as.str : (char const *) v->as.ref.data;
+}
+
+/**
+    Makes an integer value.
+    @param val the integer
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return new Value containing the integer
+*/
+Value *makeIntegerIn( int val, Arena *arena )
+{
+    Value *this = makeValue( arena, VALUE_INT );
+    this->as.i = val;
+    return this;
+}
+
+/**
+    Makes a double value.
+    @param val the double
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return new Value containing the double
+*/
+Value *makeDoubleIn( double val, Arena *arena )
+{
+    Value *this = makeValue( arena, VALUE_DOUBLE );
+    this->as.d = val;
+    return this;
+}
+
+/**
+    Makes a string value holding a copy of the given characters, which are taken as they
+    are, without any unescaping.
+    @param *text the characters of the string
+    @param len number of characters
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return new Value containing the string
+*/
+Value *makeStringIn( char const *text, size_t len, Arena *arena )
+{
+    Value *this = makeValue( arena, len < SMALL_STRING ? VALUE_SHORT_STRING : VALUE_STRING );
+    char *copy = this->as.str;
+    if ( this->type == VALUE_STRING ) {
+        this->as.ref.ops = NULL;
+        if ( interning && arena == NULL ) {
+            this->as.ref.data = internString( text, len );
+            this->interned = true;
+            return this;
+        }
+        copy = (char *) allocIn( arena, len + 1 );
+        this->as.ref.data = copy;
+    }
+    memcpy( copy, text, len );
+    copy[ len ] = '\0';
+    return this;
+}
+
+/**
+    Makes a heap copy of a built-in value, wherever the original was allocated.
+    @param *v the value to copy
+    @return new Value equal to v, or NULL if v is VALUE_CUSTOM
+*/
+Value *valueCopy( Value const *v )
+{
+    switch ( v->type ) {
+    case VALUE_INT:
+        return makeIntegerIn( v->as.i, NULL );
+    case VALUE_DOUBLE:
+        return makeDoubleIn( v->as.d, NULL );
+    case VALUE_SHORT_STRING:
+    case VALUE_STRING: {
+        char const *text = valueString( v );
+        return makeStringIn( text, strlen( text ), NULL );
+    }
+    default:
+        return NULL;
+    }
+}
+
+/**
+    Reads a number in one pass: an optional sign, digits with at most one decimal
+    point, an optional exponent and then nothing but blanks.  Only the first
+    MANTISSA_DIGITS significant digits are kept.
+    @param *str the text
+    @param *d filled in with the number
+    @return SCAN_OK if it was read, SCAN_BAD if sscanf() would reject it too, or
+            SCAN_SLOW if only sscanf() can tell
  */
-static void destroyGeneric( Value *v )
+static ScanResult scanNumber( char const *str, Decimal *d )
 {
-    //printf("Destroying value of type: %p\n", v->data);
+    char const *p = str;
+    d->negative = *p == '-';
+    if ( *p == '-' || *p == '+' )
+        p++;
+    d->mantissa = 0;
+    d->scale = 0;
+    d->point = d->exponent = d->truncated = false;
+
+    // Leading zeros aren't significant, so they don't count toward the limit.
+    int kept = 0, seen = 0;
+    for ( ; ; p++ ) {
+        if ( *p >= '0' && *p <= '9' ) {
+            if ( kept < MANTISSA_DIGITS ) {
+                d->mantissa = d->mantissa * 10 + ( *p - '0' );
+                kept += d->mantissa != 0;
+                d->scale -= d->point;
+            } else {
+                d->truncated |= *p != '0';
+                d->scale += ! d->point;
+            }
+            seen++;
+        } else if ( *p == '.' && ! d->point ) {
+            d->point = true;
+        } else {
+            break;
+        }
+    }
+    if ( seen == 0 )
+        return isspace( (unsigned char) *str ) || isalpha( (unsigned char) *p ) ? SCAN_SLOW : SCAN_BAD;
 
-  free( v->data );
-  free( v );
+    if ( *p == 'e' || *p == 'E' ) {
+        char const *e = p + 1;
+        bool down = *e == '-';
+        if ( *e == '-' || *e == '+' )
+            e++;
+        if ( *e < '0' || *e > '9' )
+            return SCAN_SLOW;
+        int power = 0;
+        for ( ; *e >= '0' && *e <= '9'; e++ ) {
+            if ( power < EXPONENT_LIMIT )
+                power = power * 10 + ( *e - '0' );
+        }
+        d->scale += down ? -power : power;
+        d->exponent = true;
+        p = e;
+    }
+
+    if ( blankString( p ) )
+        return SCAN_OK;
+    // A hex number reads differently to sscanf() than the digits before the 'x'.
+    return *p == 'x' || *p == 'X' ? SCAN_SLOW : SCAN_BAD;
 }
 
 /**
-    Print method for Integer.
-    @param *v pointer to a value integer to print
+    Turns a scanned number into an int, the way "%d" would read it.
+    @param *d the number
+    @param *out set to the int
+    @return SCAN_OK, SCAN_BAD if it has a point or exponent "%d" would stop at, or
+            SCAN_SLOW if it's out of range
  */
-static void printInteger( Value const *v )
+static ScanResult decimalInt( Decimal const *d, int *out )
 {
-  // Print the data as an integer.
-  printf( "%d", * (int *) v->data );
+    if ( d->point || d->exponent )
+        return SCAN_BAD;
+    if ( d->scale != 0 || d->mantissa > (uint64_t) INT_MAX + d->negative )
+        return SCAN_SLOW;
+    *out = d->negative ? (int) -(long long) d->mantissa : (int) d->mantissa;
+    return SCAN_OK;
 }
 
 /**
-    Print method for double
-    @param *v pointer to value double to print
+    Turns a scanned number into a double.  When the mantissa and the power of ten are
+    both exact doubles, one multiply or divide rounds correctly, so the result is the
+    same as strtod()'s (Clinger's fast path).
+    @param *d the number
+    @param *out set to the double
+    @return SCAN_OK, or SCAN_SLOW if the fast path can't round it correctly
  */
-static void printDouble( Value const *v )
+static ScanResult decimalDouble( Decimal const *d, double *out )
 {
-  // Print the data as an integer.
-  printf( "%lf", * (double *) v->data );
+    // Wider intermediate results would round twice.
+    if ( FLT_EVAL_METHOD != 0 || d->truncated || d->mantissa > EXACT_MANTISSA )
+        return SCAN_SLOW;
+    double val = (double) d->mantissa;
+    if ( d->mantissa != 0 ) {
+        if ( d->scale < -EXACT_POWER || d->scale > EXACT_POWER )
+            return SCAN_SLOW;
+        if ( d->scale < 0 )
+            val /= exactPowers[ -d->scale ];
+        else
+            val *= exactPowers[ d->scale ];
+    }
+    *out = d->negative ? -val : val;
+    return SCAN_OK;
 }
 
 /**
-    Print method for string
-    @param *v pointer to value string to print
+    Reads an int, with nothing but blanks after it.
+    @param *str the text
+    @param *out set to the int
+    @return false if the text isn't an int
  */
-static void printString( Value const *v )
+static bool readInteger( char const *str, int *out )
 {
-  // Print the data as an string
-  printf( "%s", (char *) v->data );
+    Decimal d;
+    ScanResult result = scanNumber( str, &d );
+    if ( result == SCAN_OK )
+        result = decimalInt( &d, out );
+    if ( result != SCAN_SLOW )
+        return result == SCAN_OK;
+
+    int n;
+    return sscanf( str, "%d%n", out, &n ) == 1 && blankString( str + n );
+}
+
+/**
+    Reads a double, with nothing but blanks after it.
+    @param *str the text
+    @param *out set to the double
+    @return false if the text isn't a double
+ */
+static bool readDouble( char const *str, double *out )
+{
+    Decimal d;
+    ScanResult result = scanNumber( str, &d );
+    if ( result == SCAN_OK )
+        result = decimalDouble( &d, out );
+    if ( result != SCAN_SLOW )
+        return result == SCAN_OK;
+
+    int n;
+    return sscanf( str, "%lf%n", out, &n ) == 1 && blankString( str + n );
 }
 
 /** If possible, parse an integer from the given string and return a
@@ -77,24 +560,23 @@ static void printString( Value const *v )
 */
 Value *parseInteger( char const *str )
 {
-    // Parse an integer value from the given string.
-    int val, n;
-    if ( sscanf( str, "%d%n", &val, &n ) != 1 )
-        return NULL;
+    return parseIntegerIn( str, NULL );
+}
 
-    // Make sure there's nothing extra after the integer value
-    if ( ! blankString( str + n ) )
+/**
+    Parses an integer like parseInteger(), allocating the value from an arena.
+    @param *str String from which to parse an integer.
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return new Value containing the integer, or NULL if it's not in the proper format.
+*/
+Value *parseIntegerIn( char const *str, Arena *arena )
+{
+    int val;
+    if ( ! readInteger( str, &val ) )
         return NULL;
     
-    // Allocate space for the value struct and the integer in its data field.
-    Value *this = (Value *) malloc( sizeof( Value ) );
-    this->data = malloc( sizeof( int ) );
-    * (int *) this->data = val;
-
-    // Fill in function pointers and return this value.
-    this->print = printInteger;
-    this->destroy = destroyGeneric;
-    return this;
+    // The integer lives inside the value struct.
+    return makeIntegerIn( val, arena );
 }
 
 /**
@@ -104,25 +586,23 @@ Value *parseInteger( char const *str )
 */
 Value *parseDouble( char const *str ) 
 {
-    double val;
-    int n;
-    if (sscanf( str, "%lf%n", &val, &n ) != 1) {
-        return NULL;
-    }
+    return parseDoubleIn( str, NULL );
+}
 
-    if ( ! blankString( str + n ) ) {
+/**
+    Parses a double like parseDouble(), allocating the value from an arena.
+    @param *str pointer to a string to parse a double from
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return Value the double parsed from the string
+*/
+Value *parseDoubleIn( char const *str, Arena *arena )
+{
+    double val;
+    if ( ! readDouble( str, &val ) ) {
         return NULL;
     }
 
-    Value *this = (Value *)malloc(sizeof(Value));
-    this->data = malloc(sizeof(double));
-   
-    * (double *) this->data = val;
-
-    this->print = printDouble;
-    //printf("Destroying value of type: %p\n", this->data);
-    this->destroy = destroyGeneric;
-    return this;
+    return makeDoubleIn(val, arena);
 }
 
 /**
@@ -131,8 +611,26 @@ Value *parseDouble( char const *str )
     @return Value the integer parsed from the string
 */
 Value *parseString(char const *str) {
+    return parseStringIn(str, NULL);
+}
+
+/**
+    Parses a string like parseString(), allocating the value from an arena.
+    @param *str pointer to the quoted string to parse
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return Value the string parsed, or NULL if it has a bad escape sequence
+*/
+Value *parseStringIn(char const *str, Arena *arena) {
     
-    char *unescapedStr = (char *)malloc(strlen(str) + 1);
+    // Unescaping never makes a string longer, so short input fits in the value itself.
+    // An interned string is unescaped into scratch space first, to look it up by.
+    size_t len = strlen(str);
+    Value *this = makeValue(arena, len < SMALL_STRING ? VALUE_SHORT_STRING : VALUE_STRING);
+    char scratch[ INTERN_SCRATCH ];
+    this->interned = this->type == VALUE_STRING && interning && arena == NULL;
+    char *unescapedStr = len < SMALL_STRING ? this->as.str
+                       : !this->interned    ? (char *)allocIn(arena, len + 1)
+                       : len < sizeof(scratch) ? scratch : (char *)malloc(len + 1);
     const char *escapeStr = str;
     char *withoutEscape = unescapedStr;
 
@@ -153,7 +651,12 @@ Value *parseString(char const *str) {
                     *withoutEscape++ = '\\';
                     break;
                 default:
-                    free(unescapedStr);
+                    if (this->interned && unescapedStr != scratch) {
+                        free(unescapedStr);
+                    } else if (this->type == VALUE_STRING && !this->interned) {
+                        freeIn(this->fromArena, unescapedStr);
+                    }
+                    freeIn(this->fromArena, this);
                     return NULL;
                 
             }
@@ -164,11 +667,76 @@ Value *parseString(char const *str) {
     }
     *withoutEscape = '\0'; 
 
-    Value *this = (Value *)malloc(sizeof(Value));
-  
-    this->data = unescapedStr;
-    this->print = printString;
-    this->destroy = destroyGeneric;
+    if (this->interned) {
+        this->as.ref.data = internString(unescapedStr, withoutEscape - unescapedStr);
+        if (unescapedStr != scratch) {
+            free(unescapedStr);
+        }
+    } else if (this->type == VALUE_STRING) {
+        this->as.ref.data = unescapedStr;
+    }
+    if (this->type == VALUE_STRING) {
+        this->as.ref.ops = NULL;
+    }
     return this;
 }
 
+/**
+    Parses a number the way the driver reads a set: a double if it has a '.', or else
+    an integer.  The number is stored in a Value the caller provides, so nothing is
+    allocated.
+    @param *str the number, with nothing but blanks after it
+    @param *out filled in with the number
+    @return false if the string isn't a number
+*/
+bool parseNumber( char const *str, Value *out )
+{
+    out->fromArena = false;
+    // The point is found by the same pass that reads the digits.
+    Decimal d;
+    ScanResult result = scanNumber( str, &d );
+    if ( result == SCAN_OK ) {
+        out->type = d.point ? VALUE_DOUBLE : VALUE_INT;
+        result = d.point ? decimalDouble( &d, &out->as.d ) : decimalInt( &d, &out->as.i );
+    }
+    if ( result != SCAN_SLOW )
+        return result == SCAN_OK;
+
+    if ( strchr( str, '.' ) != NULL ) {
+        out->type = VALUE_DOUBLE;
+        return readDouble( str, &out->as.d );
+    }
+    out->type = VALUE_INT;
+    return readInteger( str, &out->as.i );
+}
+
+/**
+    Parses a number like parseNumber() into a new value.
+    @param *str the number, with nothing but blanks after it
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return new Value containing the number, or NULL if the string isn't a number
+*/
+Value *parseNumberIn( char const *str, Arena *arena )
+{
+    Value num;
+    if ( ! parseNumber( str, &num ) )
+        return NULL;
+    if ( num.type == VALUE_DOUBLE )
+        return makeDoubleIn( num.as.d, arena );
+    return makeIntegerIn( num.as.i, arena );
+}
+
+/**
+    Parses the value of a set: a quoted string, or a number, which is a double if it
+    has a '.' and otherwise an integer.
+    @param *text the value, followed by a '\0' at text + len
+    @param len number of characters in the value
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return the value, or NULL if it isn't in the proper format
+*/
+Value *parseValueIn( char const *text, size_t len, Arena *arena )
+{
+    if ( text[ 0 ] == '"' && text[ len - 1 ] == '"' )
+        return parseStringIn( text, arena );
+    return parseNumberIn( text, arena );
+}
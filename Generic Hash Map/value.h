@@ -6,10 +6,36 @@
 #ifndef VALUE_H
 #define VALUE_H
 
+#include "arena.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-/** Abstract type used to represent an arbitrary type of value. */
-typedef struct ValueStruct {
+/** Largest string payload, including its terminator, kept inside the Value itself. */
+#define SMALL_STRING 16
+
+/** Kinds of value, stored in one byte at the front of every Value. */
+typedef enum {
+  /** An int, stored in as.i. */
+  VALUE_INT,
+
+  /** A double, stored in as.d. */
+  VALUE_DOUBLE,
+
+  /** A string shorter than SMALL_STRING, stored in as.str. */
+  VALUE_SHORT_STRING,
+
+  /** A longer string in its own block, pointed to by as.ref.data. */
+  VALUE_STRING,
+
+  /** A user-defined type whose methods are reached through as.ref.ops. */
+  VALUE_CUSTOM
+} ValueType;
+
+struct ValueStruct;
+
+/** Methods for a user-defined (VALUE_CUSTOM) type of value. */
+typedef struct {
   /** Pointer to a function that prints this value to the terminal.
       @param v Pointer to the value object to print. */
   void (*print)( struct ValueStruct const *v );
@@ -18,10 +44,143 @@ typedef struct ValueStruct {
       @param v Pointer to the value object to free. */
   void (*destroy)( struct ValueStruct *v );
 
-  /** Arbitrary data used to represent the integer/string/etc for this value. */
-  void *data;
+  /** Pointer to a function that orders two values of this type, or NULL to
+      order them by address.
+      @param a Pointer to the first value.
+      @param b Pointer to the second value.
+      @return negative, zero or positive as a is less than, equal to or greater than b. */
+  int (*compare)( struct ValueStruct const *a, struct ValueStruct const *b );
+} ValueOps;
+
+/** Abstract type used to represent an arbitrary type of value.  Built-in types
+    are told apart by a one-byte tag and handled by a switch in valuePrint(),
+    valueDestroy() and valueCompare(); only custom types carry method pointers. */
+typedef struct ValueStruct {
+  /** Kind of value, one of ValueType. */
+  unsigned char type;
+
+  /** True if this value was allocated from an arena rather than the heap. */
+  unsigned char fromArena;
+
+  /** True if the map holding this value keeps an expiry time for its key. */
+  unsigned char expires;
+
+  /** True if a VALUE_STRING's characters are a shared copy from the intern table. */
+  unsigned char interned;
+
+  /** Reading of the holding map's access clock when this value was last set or read,
+      used to pick entries to evict.  It fits in what would otherwise be padding. */
+  uint32_t touched;
+
+  /** The payload.  Ints, doubles and short strings are stored right here. */
+  union {
+    /** An integer payload. */
+    int i;
+
+    /** A double payload. */
+    double d;
+
+    /** A string payload of fewer than SMALL_STRING characters. */
+    char str[ SMALL_STRING ];
+
+    /** A payload kept in a separate block. */
+    struct {
+      /** Arbitrary data used to represent the string/etc for this value. */
+      void *data;
+
+      /** Methods for a VALUE_CUSTOM value; unused for VALUE_STRING. */
+      ValueOps const *ops;
+    } ref;
+  } as;
 } Value;
 
+/** Counts of the blocks values have taken from the heap or an arena, filled in by
+    valueStats(). */
+typedef struct {
+  /** Number of blocks allocated for values and their payloads. */
+  long allocations;
+
+  /** Number of those blocks freed again. */
+  long frees;
+
+  /** Number of distinct strings long string values share through the intern table. */
+  long internedStrings;
+
+  /** Bytes sharing those strings saves over giving every value its own copy. */
+  long internSavedBytes;
+} ValueStats;
+
+/**
+    Reports how many blocks have been allocated and freed for values so far, by every
+    thread.
+    @param *stats structure to fill in
+ */
+void valueStats( ValueStats *stats );
+
+/**
+    Turns interning of long strings on or off for values made from then on.  While it
+    is on, string values too long to keep inline that are made on the heap share one
+    reference-counted copy of their characters with every other such value holding
+    the same string.  Values from an arena always get their own copy, since the arena
+    frees them without destroying them one at a time.
+    @param on true to intern strings, false to copy them
+ */
+void valueIntern( bool on );
+
+/**
+    Returns the number of bytes a value takes: the Value itself, plus the block a long
+    string's characters are kept in.  Interned characters aren't counted, since no one
+    value owns them; valueStats() reports what they take.
+    @param *v the value
+    @return its size in bytes
+ */
+size_t valueSize( Value const *v );
+
+/**
+    Returns true if a value's payload is stored inside the Value rather than in a
+    separate block.
+    @param *v the value to check
+    @return true for ints, doubles and short strings
+ */
+bool valueIsInline( Value const *v );
+
+/**
+    Prints a value to the terminal.
+    @param *v the value to print
+ */
+void valuePrint( Value const *v );
+
+/**
+    Frees a value and any block its payload is kept in.
+    @param *v the value to free
+ */
+void valueDestroy( Value *v );
+
+/**
+    Orders two values.  Numbers compare by value (ints and doubles with each other),
+    strings compare with strcmp, and values of different kinds order by kind.
+    @param *a the first value
+    @param *b the second value
+    @return negative, zero or positive as a is less than, equal to or greater than b
+ */
+int valueCompare( Value const *a, Value const *b );
+
+/**
+    Adds a number to an int or double value in place.  An int plus a double becomes a
+    double, which fits in the same Value, so nothing is allocated either way.
+    @param *v the value to change
+    @param *delta the number to add, a VALUE_INT or VALUE_DOUBLE
+    @return false, leaving v alone, if v isn't a number or an int sum would overflow
+ */
+bool valueAdd( Value *v, Value const *delta );
+
+/**
+    Returns the text of a string value.
+    @param *v the value, which must be a VALUE_SHORT_STRING or VALUE_STRING
+    @return pointer to the string's characters
+ */
+char const *valueString( Value const *v );
+
 /** Return true if the given string contains only whitespace.  This
     is useful for making sure there's nothing extra at the end of a line
     of user input.
@@ -30,6 +189,39 @@ typedef struct ValueStruct {
 */
 bool blankString( char const *str );
 
+/**
+    Makes an integer value.
+    @param val the integer
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return new Value containing the integer
+*/
+Value *makeIntegerIn( int val, Arena *arena );
+
+/**
+    Makes a double value.
+    @param val the double
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return new Value containing the double
+*/
+Value *makeDoubleIn( double val, Arena *arena );
+
+/**
+    Makes a string value holding a copy of the given characters, which are taken as they
+    are, without any unescaping.
+    @param *text the characters of the string
+    @param len number of characters
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return new Value containing the string
+*/
+Value *makeStringIn( char const *text, size_t len, Arena *arena );
+
+/**
+    Makes a heap copy of a built-in value, wherever the original was allocated.
+    @param *v the value to copy
+    @return new Value equal to v, or NULL if v is VALUE_CUSTOM
+*/
+Value *valueCopy( Value const *v );
+
 /** If possible, parse an integer from the given string and return a
     Value instance containing it.  Return NULL if the string isn't in the
     proper format.
@@ -49,5 +241,54 @@ Value *parseDouble( char const *str );
     @return Value the integer parsed from the string
 */
 Value *parseString( char const *str );
+
+/**
+    Parses an integer like parseInteger(), allocating the value from an arena.
+    valueDestroy() gives the memory back to the arena's free lists.
+    @param *str String from which to parse an integer.
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return new Value containing the integer, or NULL if it's not in the proper format.
+*/
+Value *parseIntegerIn( char const *str, Arena *arena );
+/**
+    Parses a double like parseDouble(), allocating the value from an arena.
+    @param *str pointer to a string to parse a double from
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return Value the double parsed from the string
+*/
+Value *parseDoubleIn( char const *str, Arena *arena );
+/**
+    Parses a string like parseString(), allocating the value from an arena.
+    @param *str pointer to the quoted string to parse
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return Value the string parsed, or NULL if it has a bad escape sequence
+*/
+Value *parseStringIn( char const *str, Arena *arena );
+/**
+    Parses a number the way the driver reads a set: a double if it has a '.', or else
+    an integer.  The number is stored in a Value the caller provides, so nothing is
+    allocated.
+    @param *str the number, with nothing but blanks after it
+    @param *out filled in with the number
+    @return false if the string isn't a number
+*/
+bool parseNumber( char const *str, Value *out );
+/**
+    Parses a number like parseNumber() into a new value, in a single pass that finds
+    the type as it reads the digits.
+    @param *str the number, with nothing but blanks after it
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return new Value containing the number, or NULL if the string isn't a number
+*/
+Value *parseNumberIn( char const *str, Arena *arena );
+/**
+    Parses the value of a set: a quoted string, or a number, which is a double if it
+    has a '.' and otherwise an integer.
+    @param *text the value, followed by a '\0' at text + len
+    @param len number of characters in the value
+    @param *arena arena to allocate from, or NULL to use the heap
+    @return the value, or NULL if it isn't in the proper format
+*/
+Value *parseValueIn( char const *text, size_t len, Arena *arena );
  
 #endif
@@ -0,0 +1,539 @@
+/**
+    @file wal.c
+    @author Sachi Vyas (smvyas)
+    A program that: Keeps a write-ahead log of sets and removes so a map can be rebuilt
+    after a crash.  Records are gathered in memory and written with one write and one
+    fsync per group, either when enough of them are waiting or when the oldest has
+    waited long enough; a background thread handles the time limit.
+
+    Each record is a 4-byte body length, a 4-byte FNV-1a checksum of the body, and the
+    body: an operation byte ('S' set, 'R' remove or 'E' expire), a ValueType byte, a
+    4-byte key length, the key, and the payload (an int, a double, or string
+    characters).  An expire record's payload is the key's expiry time as a double.
+    Numbers are in the machine's own byte order.  A load is logged as the pairs it set,
+    so the log never depends on another file.  Older logs may still hold 'L' (load of a
+    snapshot) or 'B' (bulk load of a command file) records naming a file, which are
+    replayed by loading the file again.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "wal.h"
+#include "hash.h"
+#include "bulk.h"
+#include "snapshot.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/** Bytes before each record's body: its length and its checksum. */
+#define RECORD_HEADER 8
+/** Bytes of the body before the key: operation, value type and key length. */
+#define BODY_HEADER 6
+/** Keys up to this long are copied to the stack when a record is replayed. */
+#define SHORT_KEY 64
+/** Starting size of the record buffers. */
+#define BUFFER_START 4096
+/** Operation byte for a set. */
+#define OP_SET 'S'
+/** Operation byte for a remove. */
+#define OP_REMOVE 'R'
+/** Operation byte for giving a key an expiry time. */
+#define OP_EXPIRE 'E'
+/** Operation byte older logs used for a load of a snapshot file. */
+#define OP_LOAD 'L'
+/** Operation byte older logs used for a bulk load of a command file. */
+#define OP_BULK 'B'
+/** Nanoseconds in a millisecond */
+#define NANOS_PER_MILLI 1000000L
+/** Nanoseconds in a second */
+#define NANOS_PER_SECOND 1000000000L
+
+/** Representation of an open log. */
+struct WalStruct {
+  /** Descriptor of the log file, opened for appending. */
+  int fd;
+
+  /** Guards the buffer and the counts below. */
+  pthread_mutex_t lock;
+
+  /** Held while a group is written and synced, so groups reach the file in order. */
+  pthread_mutex_t commitLock;
+
+  /** Wakes the background thread when a record starts a new group or the log closes. */
+  pthread_cond_t wake;
+
+  /** Records waiting to be committed. */
+  char *buf;
+
+  /** Number of bytes in buf. */
+  size_t len;
+
+  /** Capacity of buf. */
+  size_t cap;
+
+  /** Second buffer, swapped with buf so records can be added during a commit. */
+  char *spare;
+
+  /** Capacity of spare. */
+  size_t spareCap;
+
+  /** Number of records waiting. */
+  int pending;
+
+  /** When the oldest waiting record was added, on the clock the flusher waits with. */
+  struct timespec oldest;
+
+  /** Records per commit, or 0. */
+  int groupRecords;
+
+  /** Longest wait in milliseconds, or 0. */
+  int groupMillis;
+
+  /** Number of commits that reached the disk. */
+  long commits;
+
+  /** True once a commit has failed. */
+  bool failed;
+
+  /** True when the background thread should exit. */
+  bool stop;
+
+  /** The background thread, if groupMillis is set. */
+  pthread_t flusher;
+};
+
+/**
+    Writes a whole buffer to a file, retrying after short writes.
+    @param fd the file
+    @param *p the bytes to write
+    @param len number of bytes
+    @return true if every byte was written
+ */
+static bool writeAll( int fd, char const *p, size_t len )
+{
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+    Writes and syncs the records waiting in the buffer.  New records can be added to the
+    other buffer while this one is on its way to the disk.
+    @param *w the log
+    @return false if the records couldn't be written
+ */
+static bool commit( Wal *w )
+{
+    pthread_mutex_lock(&w->commitLock);
+    pthread_mutex_lock(&w->lock);
+    char *group = w->buf;
+    size_t len = w->len;
+    w->buf = w->spare;
+    w->spare = group;
+    size_t cap = w->cap;
+    w->cap = w->spareCap;
+    w->spareCap = cap;
+    w->len = 0;
+    w->pending = 0;
+    pthread_mutex_unlock(&w->lock);
+
+    bool ok = len == 0 || ( writeAll(w->fd, group, len) && fsync(w->fd) == 0 );
+    if (len > 0 && ok) {
+        w->commits++;
+    }
+    pthread_mutex_unlock(&w->commitLock);
+    if (!ok) {
+        pthread_mutex_lock(&w->lock);
+        w->failed = true;
+        pthread_mutex_unlock(&w->lock);
+    }
+    return ok;
+}
+
+/**
+    Background thread that commits a group once its first record has waited groupMillis.
+    The deadline is worked out again each time the thread wakes, from whichever record
+    is oldest then, so a full group committed meanwhile doesn't push it back.
+    @param *arg the log
+    @return NULL
+ */
+static void *runFlusher( void *arg )
+{
+    Wal *w = arg;
+    pthread_mutex_lock(&w->lock);
+    while (!w->stop) {
+        if (w->pending == 0) {
+            pthread_cond_wait(&w->wake, &w->lock);
+            continue;
+        }
+        struct timespec deadline = w->oldest;
+        deadline.tv_nsec += w->groupMillis * NANOS_PER_MILLI;
+        deadline.tv_sec += deadline.tv_nsec / NANOS_PER_SECOND;
+        deadline.tv_nsec %= NANOS_PER_SECOND;
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (now.tv_sec < deadline.tv_sec ||
+            ( now.tv_sec == deadline.tv_sec && now.tv_nsec < deadline.tv_nsec )) {
+            pthread_cond_timedwait(&w->wake, &w->lock, &deadline);
+            continue;
+        }
+        pthread_mutex_unlock(&w->lock);
+        commit(w);
+        pthread_mutex_lock(&w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/**
+    Adds one record to the buffer, and commits the group if it is full.
+    @param *w the log
+    @param op the operation byte
+    @param type the value type byte
+    @param *key the key, or NULL for none
+    @param *payload the payload bytes
+    @param plen number of payload bytes
+    @return false if an earlier commit failed or this one did
+ */
+static bool append( Wal *w, char op, ValueType type, char const *key, void const *payload,
+                    size_t plen )
+{
+    uint32_t klen = key ? strlen(key) : 0;
+    uint32_t body = BODY_HEADER + klen + plen;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->len + RECORD_HEADER + body > w->cap) {
+        while (w->len + RECORD_HEADER + body > w->cap) {
+            w->cap *= 2;
+        }
+        w->buf = realloc(w->buf, w->cap);
+    }
+    char *rec = w->buf + w->len;
+    char *p = rec + RECORD_HEADER;
+    p[0] = op;
+    p[1] = type;
+    memcpy(p + 2, &klen, sizeof(klen));
+    if (klen > 0) {
+        memcpy(p + BODY_HEADER, key, klen);
+    }
+    if (plen > 0) {
+        memcpy(p + BODY_HEADER + klen, payload, plen);
+    }
+    uint32_t check = fnv1a_hash((const uint8_t *) p, body);
+    memcpy(rec, &body, sizeof(body));
+    memcpy(rec + sizeof(body), &check, sizeof(check));
+    w->len += RECORD_HEADER + body;
+
+    w->pending++;
+    if (w->pending == 1 && w->groupMillis > 0) {
+        clock_gettime(CLOCK_REALTIME, &w->oldest);
+        pthread_cond_signal(&w->wake);
+    }
+    bool full = w->groupRecords > 0 && w->pending >= w->groupRecords;
+    bool ok = !w->failed;
+    pthread_mutex_unlock(&w->lock);
+
+    if (full) {
+        ok = commit(w) && ok;
+    }
+    return ok;
+}
+
+/**
+    Applies one record's body to a map.
+    @param *m the map
+    @param *p the body
+    @param len length of the body
+    @return false if the record names a file that can't be loaded any more
+ */
+static bool applyRecord( Map *m, char const *p, uint32_t len )
+{
+    uint32_t klen = 0;
+    if (len >= BODY_HEADER) {
+        memcpy(&klen, p + 2, sizeof(klen));
+    }
+    if (len < BODY_HEADER || klen > len - BODY_HEADER) {
+        return true;
+    }
+    char small[ SHORT_KEY ];
+    char *key = klen < sizeof(small) ? small : malloc(klen + 1);
+    memcpy(key, p + BODY_HEADER, klen);
+    key[klen] = '\0';
+    char const *payload = p + BODY_HEADER + klen;
+    size_t plen = len - BODY_HEADER - klen;
+    Arena *arena = mapArena(m);
+    bool ok = true;
+
+    if (p[0] == OP_REMOVE) {
+        mapRemove(m, key);
+    } else if (p[0] == OP_SET && p[1] == VALUE_INT && plen == sizeof(int)) {
+        int i;
+        memcpy(&i, payload, sizeof(i));
+        mapSet(m, key, makeIntegerIn(i, arena));
+    } else if (p[0] == OP_SET && p[1] == VALUE_DOUBLE && plen == sizeof(double)) {
+        double d;
+        memcpy(&d, payload, sizeof(d));
+        mapSet(m, key, makeDoubleIn(d, arena));
+    } else if (p[0] == OP_SET && ( p[1] == VALUE_SHORT_STRING || p[1] == VALUE_STRING )) {
+        mapSet(m, key, makeStringIn(payload, plen, arena));
+    } else if (p[0] == OP_EXPIRE && plen == sizeof(double)) {
+        double deadline;
+        memcpy(&deadline, payload, sizeof(deadline));
+        mapExpireAt(m, key, deadline);
+    } else if (p[0] == OP_LOAD || p[0] == OP_BULK) {
+        char *path = malloc(plen + 1);
+        memcpy(path, payload, plen);
+        path[plen] = '\0';
+        if (p[0] == OP_LOAD) {
+            ok = mapLoad(m, path);
+        } else {
+            BulkStats stats;
+            ok = bulkLoad(m, path, bulkThreads(), NULL, &stats);
+        }
+        free(path);
+    }
+    if (key != small) {
+        free(key);
+    }
+    return ok;
+}
+
+/**
+    Replays a log into a map, in the order the changes were made.  A record cut off or
+    damaged by a crash ends the log: it and anything after it are dropped from the file,
+    so new records are appended after the last good one.
+    @param *path name of the log file; a missing file is an empty log
+    @param *m the map to apply the changes to
+    @return number of records replayed, or -1 if the file can't be read or an older
+            record names a file that can't be loaded any more
+ */
+int walRecover( char const *path, Map *m )
+{
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    char *data = malloc(size > 0 ? size : 1);
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = read(fd, data + got, size - got);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+
+    int records = 0;
+    size_t pos = 0;
+    while (got - pos >= RECORD_HEADER) {
+        uint32_t body, check;
+        memcpy(&body, data + pos, sizeof(body));
+        memcpy(&check, data + pos + sizeof(body), sizeof(check));
+        if (body > got - pos - RECORD_HEADER ||
+            fnv1a_hash((const uint8_t *) data + pos + RECORD_HEADER, body) != check) {
+            break;
+        }
+        if (!applyRecord(m, data + pos + RECORD_HEADER, body)) {
+            free(data);
+            close(fd);
+            return -1;
+        }
+        pos += RECORD_HEADER + body;
+        records++;
+    }
+    if (pos < size && ftruncate(fd, pos) != 0) {
+        records = -1;
+    }
+    free(data);
+    close(fd);
+    return records;
+}
+
+/**
+    Opens a log for appending.  Records are collected in memory and written and synced
+    together (group commit): once groupRecords of them are waiting, or groupMillis
+    milliseconds after the first one was added, whichever comes first.
+    @param *path name of the log file, created if it doesn't exist
+    @param groupRecords records per commit, or 0 to commit only on time
+    @param groupMillis longest a record waits to be committed, or 0 to commit only on count
+    @return the log, or NULL if the file can't be opened
+ */
+Wal *openWal( char const *path, int groupRecords, int groupMillis )
+{
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    Wal *w = malloc(sizeof(Wal));
+    w->fd = fd;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_mutex_init(&w->commitLock, NULL);
+    pthread_cond_init(&w->wake, NULL);
+    w->cap = w->spareCap = BUFFER_START;
+    w->buf = malloc(w->cap);
+    w->spare = malloc(w->spareCap);
+    w->len = 0;
+    w->pending = 0;
+    w->oldest.tv_sec = 0;
+    w->oldest.tv_nsec = 0;
+    w->groupRecords = groupRecords;
+    w->groupMillis = groupMillis;
+    w->commits = 0;
+    w->failed = false;
+    w->stop = false;
+    if (groupMillis > 0) {
+        pthread_create(&w->flusher, NULL, runFlusher, w);
+    }
+    return w;
+}
+
+/**
+    Adds a set to the log.
+    @param *w the log
+    @param *key the key being set
+    @param *val the value it is set to, which must not be VALUE_CUSTOM
+    @return false if an earlier commit failed
+ */
+bool walSet( Wal *w, char const *key, Value const *val )
+{
+    switch (val->type) {
+    case VALUE_INT:
+        return append(w, OP_SET, VALUE_INT, key, &val->as.i, sizeof(val->as.i));
+    case VALUE_DOUBLE:
+        return append(w, OP_SET, VALUE_DOUBLE, key, &val->as.d, sizeof(val->as.d));
+    case VALUE_SHORT_STRING:
+    case VALUE_STRING: {
+        char const *text = valueString(val);
+        return append(w, OP_SET, val->type, key, text, strlen(text));
+    }
+    default:
+        return false;
+    }
+}
+
+/**
+    Adds a remove to the log.
+    @param *w the log
+    @param *key the key being removed
+    @return false if an earlier commit failed
+ */
+bool walRemove( Wal *w, char const *key )
+{
+    return append(w, OP_REMOVE, VALUE_INT, key, NULL, 0);
+}
+
+/**
+    Adds an expiry time for a key to the log.  The time is absolute, so a key whose
+    time passed before the log is replayed is removed by the replay.
+    @param *w the log
+    @param *key the key
+    @param deadline time the key expires, on the mapNow() clock
+    @return false if an earlier commit failed
+ */
+bool walExpire( Wal *w, char const *key, double deadline )
+{
+    return append(w, OP_EXPIRE, VALUE_DOUBLE, key, &deadline, sizeof(deadline));
+}
+
+/**
+    Adds a load of a snapshot file to the log, as a set of each pair mapLoad() takes
+    from it and an expiry time for each key that has one.  The file may be changed or
+    removed afterwards without changing what the log replays.
+    @param *w the log
+    @param *path name of the snapshot file, which should be the one just loaded
+    @return false if the file can't be read or an earlier commit failed
+ */
+bool walLoad( Wal *w, char const *path )
+{
+    Snapshot *s = openSnapshot(path);
+    if (s == NULL) {
+        return false;
+    }
+    double now = mapNow();
+    bool ok = true;
+    for (int i = 0; i < snapshotSize(s) && ok; i++) {
+        double deadline = snapshotDeadline(s, i);
+        Value *val = deadline != 0 && deadline <= now ? NULL : snapshotValueIn(s, i, NULL);
+        if (val == NULL) {
+            continue;
+        }
+        ok = walSet(w, snapshotKey(s, i), val) &&
+             ( deadline == 0 || walExpire(w, snapshotKey(s, i), deadline) );
+        valueDestroy(val);
+    }
+    closeSnapshot(s);
+    return ok;
+}
+
+/**
+    Writes and syncs every record still waiting.
+    @param *w the log
+    @return false if the records couldn't be written
+ */
+bool walSync( Wal *w )
+{
+    bool ok = commit(w);
+    pthread_mutex_lock(&w->lock);
+    ok = ok && !w->failed;
+    pthread_mutex_unlock(&w->lock);
+    return ok;
+}
+
+/**
+    Returns how many times records have been written and synced.
+    @param *w the log
+    @return number of commits
+ */
+long walCommits( Wal *w )
+{
+    pthread_mutex_lock(&w->commitLock);
+    long commits = w->commits;
+    pthread_mutex_unlock(&w->commitLock);
+    return commits;
+}
+
+/**
+    Commits any waiting records and closes the log.
+    @param *w the log to close
+    @return false if the last records couldn't be written
+ */
+bool closeWal( Wal *w )
+{
+    if (w->groupMillis > 0) {
+        pthread_mutex_lock(&w->lock);
+        w->stop = true;
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->flusher, NULL);
+    }
+    bool ok = walSync(w);
+    ok = close(w->fd) == 0 && ok;
+    pthread_mutex_destroy(&w->lock);
+    pthread_mutex_destroy(&w->commitLock);
+    pthread_cond_destroy(&w->wake);
+    free(w->buf);
+    free(w->spare);
+    free(w);
+    return ok;
+}
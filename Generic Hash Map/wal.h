@@ -0,0 +1,96 @@
+/**
+    @file wal.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for wal.c, an append-only log of the changes made to a map
+ */
+#ifndef WAL_H
+#define WAL_H
+
+#include "map.h"
+#include "value.h"
+#include <stdbool.h>
+
+/** Incomplete type for an open write-ahead log. */
+typedef struct WalStruct Wal;
+
+/**
+    Replays a log into a map, in the order the changes were made.  A record cut off or
+    damaged by a crash ends the log: it and anything after it are dropped from the file,
+    so new records are appended after the last good one.
+    @param *path name of the log file; a missing file is an empty log
+    @param *m the map to apply the changes to
+    @return number of records replayed, or -1 if the file can't be read or an older
+            record names a file that can't be loaded any more
+ */
+int walRecover( char const *path, Map *m );
+
+/**
+    Opens a log for appending.  Records are collected in memory and written and synced
+    together (group commit): once groupRecords of them are waiting, or groupMillis
+    milliseconds after the first one was added, whichever comes first.
+    @param *path name of the log file, created if it doesn't exist
+    @param groupRecords records per commit, or 0 to commit only on time
+    @param groupMillis longest a record waits to be committed, or 0 to commit only on count
+    @return the log, or NULL if the file can't be opened
+ */
+Wal *openWal( char const *path, int groupRecords, int groupMillis );
+
+/**
+    Adds a set to the log.
+    @param *w the log
+    @param *key the key being set
+    @param *val the value it is set to, which must not be VALUE_CUSTOM
+    @return false if an earlier commit failed
+ */
+bool walSet( Wal *w, char const *key, Value const *val );
+
+/**
+    Adds a remove to the log.
+    @param *w the log
+    @param *key the key being removed
+    @return false if an earlier commit failed
+ */
+bool walRemove( Wal *w, char const *key );
+
+/**
+    Adds an expiry time for a key to the log.  The time is absolute, so a key whose
+    time passed before the log is replayed is removed by the replay.
+    @param *w the log
+    @param *key the key
+    @param deadline time the key expires, on the mapNow() clock
+    @return false if an earlier commit failed
+ */
+bool walExpire( Wal *w, char const *key, double deadline );
+
+/**
+    Adds a load of a snapshot file to the log, as a set of each pair mapLoad() takes
+    from it and an expiry time for each key that has one.  The file may be changed or
+    removed afterwards without changing what the log replays.
+    @param *w the log
+    @param *path name of the snapshot file, which should be the one just loaded
+    @return false if the file can't be read or an earlier commit failed
+ */
+bool walLoad( Wal *w, char const *path );
+
+/**
+    Writes and syncs every record still waiting.
+    @param *w the log
+    @return false if the records couldn't be written
+ */
+bool walSync( Wal *w );
+
+/**
+    Returns how many times records have been written and synced.
+    @param *w the log
+    @return number of commits
+ */
+long walCommits( Wal *w );
+
+/**
+    Commits any waiting records and closes the log.
+    @param *w the log to close
+    @return false if the last records couldn't be written
+ */
+bool closeWal( Wal *w );
+
+#endif
@@ -0,0 +1,150 @@
+/**
+    @file wire.c
+    @author Sachi Vyas (smvyas)
+    A program that: Encodes and decodes the length-prefixed binary frames the driver's server
+    mode speaks over a Unix domain socket.  Both ends are on the same machine, so numbers
+    are in its own byte order, as in the snapshot and log files.
+ */
+#include "wire.h"
+#include <string.h>
+
+/**
+    Reads a 4-byte number in the machine's byte order from any address.
+    @param *p where the number is
+    @return the number
+ */
+uint32_t wireGetU32( char const *p )
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+    Writes a 4-byte number in the machine's byte order to any address.
+    @param *p where to write it
+    @param v the number
+    @return pointer just past it
+ */
+char *wirePutU32( char *p, uint32_t v )
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+/**
+    Returns how many bytes a value takes in a frame.
+    @param *v the value, which must not be VALUE_CUSTOM
+    @return its encoded size
+ */
+size_t wireValueSize( Value const *v )
+{
+    switch (v->type) {
+    case VALUE_INT:
+        return 1 + sizeof(int32_t);
+    case VALUE_DOUBLE:
+        return 1 + sizeof(double);
+    default:
+        return 1 + sizeof(uint32_t) + strlen(valueString(v));
+    }
+}
+
+/**
+    Encodes a value: a ValueType byte, then 4 bytes of int, 8 bytes of double, or a
+    4-byte length and the characters of a string.  Short strings are sent as
+    VALUE_STRING too.
+    @param *p where to write, with room for wireValueSize() bytes
+    @param *v the value, which must not be VALUE_CUSTOM
+    @return pointer just past the encoded value
+ */
+char *wirePutValue( char *p, Value const *v )
+{
+    if (v->type == VALUE_INT) {
+        int32_t i = v->as.i;
+        *p++ = VALUE_INT;
+        memcpy(p, &i, sizeof(i));
+        return p + sizeof(i);
+    }
+    if (v->type == VALUE_DOUBLE) {
+        *p++ = VALUE_DOUBLE;
+        memcpy(p, &v->as.d, sizeof(double));
+        return p + sizeof(double);
+    }
+    char const *text = valueString(v);
+    size_t len = strlen(text);
+    *p++ = VALUE_STRING;
+    p = wirePutU32(p, len);
+    memcpy(p, text, len);
+    return p + len;
+}
+
+/**
+    Decodes a value written by wirePutValue().
+    @param *p start of the encoded value
+    @param *end end of the frame it is in
+    @param *arena arena to allocate the value from, or NULL to use the heap
+    @param **val set to the value, or to NULL if it is cut off or has a bad type
+    @return pointer just past the value, or NULL if it couldn't be decoded
+ */
+char const *wireGetValue( char const *p, char const *end, Arena *arena, Value **val )
+{
+    *val = NULL;
+    if (p >= end) {
+        return NULL;
+    }
+    char type = *p++;
+    if (type == VALUE_INT && end - p >= sizeof(int32_t)) {
+        int32_t i;
+        memcpy(&i, p, sizeof(i));
+        *val = makeIntegerIn(i, arena);
+        return p + sizeof(i);
+    }
+    if (type == VALUE_DOUBLE && end - p >= sizeof(double)) {
+        double d;
+        memcpy(&d, p, sizeof(d));
+        *val = makeDoubleIn(d, arena);
+        return p + sizeof(d);
+    }
+    if (type == VALUE_STRING && end - p >= sizeof(uint32_t)) {
+        uint32_t len = wireGetU32(p);
+        p += sizeof(uint32_t);
+        // A '\0' inside would cut the stored string short.
+        if (len > end - p || memchr(p, '\0', len) != NULL) {
+            return NULL;
+        }
+        *val = makeStringIn(p, len, arena);
+        return p + len;
+    }
+    return NULL;
+}
+
+/**
+    Returns the size of a whole request frame, header included.
+    @param keyLen length of the key
+    @param *val the value of a set, or NULL for other operations
+    @return number of bytes wirePutRequest() will write
+ */
+size_t wireRequestSize( size_t keyLen, Value const *val )
+{
+    return WIRE_HEADER + WIRE_REQUEST_HEADER + keyLen + ( val ? wireValueSize(val) : 0 );
+}
+
+/**
+    Encodes a request frame: the body length, then the operation byte, a 4-byte key
+    length, the key and, for a set, the value.
+    @param *p where to write, with room for wireRequestSize() bytes
+    @param op the operation
+    @param *key the key
+    @param keyLen length of the key
+    @param *val the value of a set, or NULL for other operations
+    @return pointer just past the frame
+ */
+char *wirePutRequest( char *p, WireOp op, char const *key, size_t keyLen, Value const *val )
+{
+    p = wirePutU32(p, wireRequestSize(keyLen, val) - WIRE_HEADER);
+    *p++ = op;
+    p = wirePutU32(p, keyLen);
+    memcpy(p, key, keyLen);
+    p += keyLen;
+    return val ? wirePutValue(p, val) : p;
+}
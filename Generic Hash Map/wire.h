@@ -0,0 +1,109 @@
+/**
+    @file wire.h
+    @author Sachi Vyas (smvyas)
+    A program that: Prototype for wire.c, the binary frames spoken by the driver's server mode
+ */
+#ifndef WIRE_H
+#define WIRE_H
+
+#include "value.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/** Bytes in the length in front of every frame. */
+#define WIRE_HEADER 4
+/** Bytes of a request body before the key: the operation and the key length. */
+#define WIRE_REQUEST_HEADER 5
+/** Longest frame body accepted; a client that sends a longer one is dropped. */
+#define WIRE_MAX_FRAME ( 1 << 20 )
+
+/** Operations a request can ask for, in the first byte of its body. */
+typedef enum {
+  /** Look a key up.  The reply carries its value. */
+  WIRE_GET = 1,
+
+  /** Store the value that follows the key. */
+  WIRE_SET,
+
+  /** Remove a key. */
+  WIRE_REMOVE,
+
+  /** Count the keys.  The reply carries the count as an int value; the key is empty. */
+  WIRE_SIZE
+} WireOp;
+
+/** Outcomes a reply can report, in the first byte of its body. */
+typedef enum {
+  /** The request was carried out. */
+  WIRE_OK,
+
+  /** The key of a get or remove isn't in the map. */
+  WIRE_MISSING,
+
+  /** The request couldn't be parsed. */
+  WIRE_BAD
+} WireStatus;
+
+/**
+    Reads a 4-byte number in the machine's byte order from any address.
+    @param *p where the number is
+    @return the number
+ */
+uint32_t wireGetU32( char const *p );
+
+/**
+    Writes a 4-byte number in the machine's byte order to any address.
+    @param *p where to write it
+    @param v the number
+    @return pointer just past it
+ */
+char *wirePutU32( char *p, uint32_t v );
+
+/**
+    Returns how many bytes a value takes in a frame.
+    @param *v the value, which must not be VALUE_CUSTOM
+    @return its encoded size
+ */
+size_t wireValueSize( Value const *v );
+
+/**
+    Encodes a value: a ValueType byte, then 4 bytes of int, 8 bytes of double, or a
+    4-byte length and the characters of a string.  Short strings are sent as
+    VALUE_STRING too.
+    @param *p where to write, with room for wireValueSize() bytes
+    @param *v the value, which must not be VALUE_CUSTOM
+    @return pointer just past the encoded value
+ */
+char *wirePutValue( char *p, Value const *v );
+
+/**
+    Decodes a value written by wirePutValue().
+    @param *p start of the encoded value
+    @param *end end of the frame it is in
+    @param *arena arena to allocate the value from, or NULL to use the heap
+    @param **val set to the value, or to NULL if it is cut off or has a bad type
+    @return pointer just past the value, or NULL if it couldn't be decoded
+ */
+char const *wireGetValue( char const *p, char const *end, Arena *arena, Value **val );
+
+/**
+    Returns the size of a whole request frame, header included.
+    @param keyLen length of the key
+    @param *val the value of a set, or NULL for other operations
+    @return number of bytes wirePutRequest() will write
+ */
+size_t wireRequestSize( size_t keyLen, Value const *val );
+
+/**
+    Encodes a request frame: the body length, then the operation byte, a 4-byte key
+    length, the key and, for a set, the value.
+    @param *p where to write, with room for wireRequestSize() bytes
+    @param op the operation
+    @param *key the key
+    @param keyLen length of the key
+    @param *val the value of a set, or NULL for other operations
+    @return pointer just past the frame
+ */
+char *wirePutRequest( char *p, WireOp op, char const *key, size_t keyLen, Value const *val );
+
+#endif